@@ -1424,7 +1424,9 @@ aas_routingcache_t *AAS_GetAreaRoutingCache(int clusternum, int areanum, int tra
 		cache->next = clustercache;
 		if (clustercache) clustercache->prev = cache;
 		aasworld.clusterareacache[clusternum][clusterareanum] = cache;
+		if (botimport.ProfileBegin) botimport.ProfileBegin("AAS_UpdateAreaRoutingCache");
 		AAS_UpdateAreaRoutingCache(cache);
+		if (botimport.ProfileEnd) botimport.ProfileEnd();
 	} //end if
 	else
 	{
@@ -794,8 +794,12 @@ CL_CGameRendering
 =====================
 */
 void CL_CGameRendering( stereoFrame_t stereo ) {
+	int		start;
+
+	start = CL_TimeDemoBegin();
 	VM_Call( cgvm, CG_DRAW_ACTIVE_FRAME, cl.serverTime, stereo, clc.demoplaying );
 	VM_Debug( 0 );
+	CL_TimeDemoEnd( TDP_CGAME, start );
 }
 
 
@@ -1008,7 +1012,7 @@ void CL_SetCGameTime( void ) {
 	// no matter what speed machine it is run on,
 	// while a normal demo may have different time samples
 	// each time it is played back
-	if ( cl_timedemo->integer ) {
+	if ( cl_timedemo->integer || clc.demoindexing ) {
 		if (!clc.timeDemoStart) {
 			clc.timeDemoStart = Sys_Milliseconds();
 		}
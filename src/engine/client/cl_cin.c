@@ -34,6 +34,13 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include "client.h"
 #include "snd_local.h"
 
+#if defined _M_X64 || defined _M_IX86
+#define	ROQ_SIMD	1
+#include <emmintrin.h>
+#else
+#define	ROQ_SIMD	0
+#endif
+
 #define MAXSIZE				8
 #define MINSIZE				4
 
@@ -52,8 +59,11 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 #define MAX_VIDEO_HANDLES	16
 
+#define ROQ_AUDIO_PACKETS	8			// sound chunks decoded before the next flush
+#define ROQ_AUDIO_SAMPLES	32768
+
 extern	int		s_paintedtime;
-extern	int		s_rawend;
+extern	volatile int	s_rawend;
 
 
 static void RoQ_init( void );
@@ -77,6 +87,13 @@ static	unsigned short		vq4[256*64*4];
 static	unsigned short		vq8[256*256*4];
 
 
+typedef struct {
+	int					samples;
+	int					channels;
+	qboolean			resync;				// first sound of the cinematic, start it now
+	short				data[ROQ_AUDIO_SAMPLES];
+} roqAudio_t;
+
 typedef struct {
 	byte				linbuf[DEFAULT_CIN_WIDTH*DEFAULT_CIN_HEIGHT*4*2];
 	byte				file[65536];
@@ -88,6 +105,16 @@ typedef struct {
 	long				oldXOff, oldYOff, oldysize, oldxsize;
 
 	int					currentHandle;
+
+	qboolean			simd;				// SSE2 blits and color conversion, from sys_cpuid
+
+	// RoQInterrupt leaves everything that has to happen on the calling
+	// thread here, so it can run on the decoder thread, see CIN_FinishInterrupt
+	roqAudio_t			audio[ROQ_AUDIO_PACKETS];
+	int					numAudio;
+	int					droppedAudio;
+	qboolean			reset;				// reached the end of a looping cinematic
+	qboolean			badFrame;
 } cinematics_t;
 
 typedef struct {
@@ -127,6 +154,8 @@ typedef struct {
 	long				roqFPS;
 	int					playonwalls;
 	byte*				buf;
+	byte*				decoded;			// newest frame, becomes buf once it is due
+	qboolean			newFrame;
 	long				drawX, drawY;
 } cin_cache;
 
@@ -135,6 +164,42 @@ static cin_cache		cinTable[MAX_VIDEO_HANDLES];
 static int				currentHandle = -1;
 static int				CL_handle = -1;
 
+/*
+===============================================================================
+
+DECODER THREAD
+
+With cl_cinThread 1 the next frame of the playing cinematic is decoded on
+a thread of its own while the current one is drawn.  cin.linbuf already
+holds two frames for the motion compensation, so the decoder writes one
+half while buf points at the other, and the new frame only becomes buf
+in CIN_RunCinematic once it is due.  Catching up after a hitch and the
+header and codebook at the start still decode on the calling thread.
+
+The decoder reads the cinematic's iFile through Sys_StreamedRead and
+FS_Read, everything else that uses the file waits for it first.  It never
+touches the sound system, the sound it decodes is handed over in
+cin.audio.
+
+With r_smp the renderer back end runs the cinematics on video maps while
+the main thread runs the one in the UI, and it may still be uploading
+the half of linbuf that the decoder would write next, so decoding ahead
+is off then.  The threads meet on semaphores rather than the job
+counters.
+
+===============================================================================
+*/
+
+typedef struct {
+	void				*thread;
+	void				*wakeup;
+	void				*done;
+	volatile int		shutdown;
+	qboolean			busy;				// a frame is being decoded ahead
+} cinDecoder_t;
+
+static cinDecoder_t		cin_decoder;
+
 extern int				s_soundtime;		// sample PAIRS
 extern int   			s_paintedtime; 		// sample PAIRS
 
@@ -335,6 +400,18 @@ static void move8_32( byte *src, byte *dst, int spl )
 	double *dsrc, *ddst;
 	int dspl;
 
+#if ROQ_SIMD
+	if ( cin.simd ) {
+		int i;
+
+		for ( i = 0 ; i < 8 ; i++, src += spl, dst += spl ) {
+			_mm_storeu_si128( (__m128i *)dst, _mm_loadu_si128( (const __m128i *)src ) );
+			_mm_storeu_si128( (__m128i *)(dst + 16), _mm_loadu_si128( (const __m128i *)(src + 16) ) );
+		}
+		return;
+	}
+#endif
+
 	dsrc = (double *)src;
 	ddst = (double *)dst;
 	dspl = spl>>3;
@@ -369,6 +446,16 @@ static void move4_32( byte *src, byte *dst, int spl  )
 	double *dsrc, *ddst;
 	int dspl;
 
+#if ROQ_SIMD
+	if ( cin.simd ) {
+		_mm_storeu_si128( (__m128i *)dst, _mm_loadu_si128( (const __m128i *)src ) );
+		_mm_storeu_si128( (__m128i *)(dst + spl), _mm_loadu_si128( (const __m128i *)(src + spl) ) );
+		_mm_storeu_si128( (__m128i *)(dst + spl*2), _mm_loadu_si128( (const __m128i *)(src + spl*2) ) );
+		_mm_storeu_si128( (__m128i *)(dst + spl*3), _mm_loadu_si128( (const __m128i *)(src + spl*3) ) );
+		return;
+	}
+#endif
+
 	dsrc = (double *)src;
 	ddst = (double *)dst;
 	dspl = spl>>3;
@@ -395,6 +482,18 @@ static void blit8_32( byte *src, byte *dst, int spl  )
 	double *dsrc, *ddst;
 	int dspl;
 
+#if ROQ_SIMD
+	if ( cin.simd ) {
+		int i;
+
+		for ( i = 0 ; i < 8 ; i++, src += 32, dst += spl ) {
+			_mm_storeu_si128( (__m128i *)dst, _mm_loadu_si128( (const __m128i *)src ) );
+			_mm_storeu_si128( (__m128i *)(dst + 16), _mm_loadu_si128( (const __m128i *)(src + 16) ) );
+		}
+		return;
+	}
+#endif
+
 	dsrc = (double *)src;
 	ddst = (double *)dst;
 	dspl = spl>>3;
@@ -429,6 +528,16 @@ static void blit4_32( byte *src, byte *dst, int spl  )
 	movs *dsrc, *ddst;
 	int dspl;
 
+#if ROQ_SIMD
+	if ( cin.simd ) {
+		_mm_storeu_si128( (__m128i *)dst, _mm_loadu_si128( (const __m128i *)src ) );
+		_mm_storeu_si128( (__m128i *)(dst + spl), _mm_loadu_si128( (const __m128i *)(src + 16) ) );
+		_mm_storeu_si128( (__m128i *)(dst + spl*2), _mm_loadu_si128( (const __m128i *)(src + 32) ) );
+		_mm_storeu_si128( (__m128i *)(dst + spl*3), _mm_loadu_si128( (const __m128i *)(src + 48) ) );
+		return;
+	}
+#endif
+
 	dsrc = (movs *)src;
 	ddst = (movs *)dst;
 	dspl = spl>>3;
@@ -676,6 +785,67 @@ static unsigned int yuv_to_rgb24( long y, long u, long v )
 }
 #endif
 
+#if ROQ_SIMD
+/******************************************************************************
+*
+* Function:		yuv4_to_rgb24
+*
+* Description:	yuv_to_rgb24 for the four pixels of a codebook entry, from
+*				y0 y1 y2 y3 cr cb.  The packs clamp to 0..255 the same way.
+*
+******************************************************************************/
+
+static void yuv4_to_rgb24( const byte *input, unsigned int *out )
+{
+	__m128i	yy, r, g, b, rgba, rg, ba;
+	long	cr, cb;
+
+	cr = input[4];
+	cb = input[5];
+	yy = _mm_setr_epi32( ROQ_YY_tab[input[0]], ROQ_YY_tab[input[1]], ROQ_YY_tab[input[2]], ROQ_YY_tab[input[3]] );
+
+	r = _mm_srai_epi32( _mm_add_epi32( yy, _mm_set1_epi32( ROQ_VR_tab[cb] ) ), 6 );
+	g = _mm_srai_epi32( _mm_add_epi32( yy, _mm_set1_epi32( ROQ_UG_tab[cr] + ROQ_VG_tab[cb] ) ), 6 );
+	b = _mm_srai_epi32( _mm_add_epi32( yy, _mm_set1_epi32( ROQ_UB_tab[cr] ) ), 6 );
+
+	// r0 r1 r2 r3 g0 g1 g2 g3 b0 b1 b2 b3 255 255 255 255
+	rgba = _mm_packus_epi16( _mm_packs_epi32( r, g ), _mm_packs_epi32( b, _mm_set1_epi32( 255 ) ) );
+
+	rg = _mm_unpacklo_epi8( rgba, _mm_srli_si128( rgba, 4 ) );
+	ba = _mm_unpacklo_epi8( _mm_srli_si128( rgba, 8 ), _mm_srli_si128( rgba, 12 ) );
+	_mm_storeu_si128( (__m128i *)out, _mm_unpacklo_epi16( rg, ba ) );
+}
+
+/******************************************************************************
+*
+* Function:		vq2to4_32
+*
+* Description:	both VQ2TO4 steps of a 32 bit 4x4 entry, from two 2x2 ones
+*
+******************************************************************************/
+
+static void vq2to4_32( const unsigned int *a, const unsigned int *b, unsigned int *c, unsigned int *d )
+{
+	__m128i	va, vb, row, lo, hi;
+	int		j;
+
+	va = _mm_loadu_si128( (const __m128i *)a );
+	vb = _mm_loadu_si128( (const __m128i *)b );
+
+	for ( j = 0 ; j < 2 ; j++, c += 4, d += 16 ) {
+		row = j ? _mm_unpackhi_epi64( va, vb ) : _mm_unpacklo_epi64( va, vb );
+		lo = _mm_unpacklo_epi32( row, row );
+		hi = _mm_unpackhi_epi32( row, row );
+
+		_mm_storeu_si128( (__m128i *)c, row );
+		_mm_storeu_si128( (__m128i *)d, lo );
+		_mm_storeu_si128( (__m128i *)(d + 4), hi );
+		_mm_storeu_si128( (__m128i *)(d + 8), lo );
+		_mm_storeu_si128( (__m128i *)(d + 12), hi );
+	}
+}
+#endif
+
 /******************************************************************************
 *
 * Function:		
@@ -734,6 +904,27 @@ static void decodeCodeBook( byte *input, unsigned short roq_flags )
 				}
 			} else if (cinTable[currentHandle].samplesPerPixel==4) {
 				ibptr = (unsigned int *)bptr;
+#if ROQ_SIMD
+				if ( cin.simd ) {
+					for(i=0;i<two;i++) {
+						yuv4_to_rgb24( input, ibptr );
+						input += 6;
+						ibptr += 4;
+					}
+
+					icptr = (unsigned int *)vq4;
+					idptr = (unsigned int *)vq8;
+
+					for(i=0;i<four;i++) {
+						iaptr = (unsigned int *)vq2 + (*input++)*4;
+						ibptr = (unsigned int *)vq2 + (*input++)*4;
+						vq2to4_32( iaptr, ibptr, icptr, idptr );
+						icptr += 8;
+						idptr += 32;
+					}
+					return;
+				}
+#endif
 				for(i=0;i<two;i++) {
 					y0 = (long)*input++;
 					y1 = (long)*input++;
@@ -1095,6 +1286,9 @@ static void initRoQ()
 	cinTable[currentHandle].VQNormal = (void (*)(byte *, void *))blitVQQuad32fs;
 	cinTable[currentHandle].VQBuffer = (void (*)(byte *, void *))blitVQQuad32fs;
 	cinTable[currentHandle].samplesPerPixel = 4;
+#if ROQ_SIMD
+	cin.simd = (qboolean)( Cvar_VariableIntegerValue( "sys_cpuid" ) >= CPUID_SSE2 );
+#endif
 	ROQ_GenYUVTables();
 	RllSetupTable();
 }
@@ -1138,17 +1332,18 @@ static void RoQReset() {
 
 /******************************************************************************
 *
-* Function:		
+* Function:		RoQInterrupt
 *
-* Description:	
+* Description:	reads and decodes the next chunk, on the decoder thread too,
+*				so the sound and the loop restart are left for
+*				CIN_FinishInterrupt
 *
 ******************************************************************************/
 
 static void RoQInterrupt(void)
 {
 	byte				*framedata;
-        short		sbuf[32768];
-        int		ssize;
+	roqAudio_t			*audio;
         
 	if (currentHandle < 0) return;
 
@@ -1156,7 +1351,7 @@ static void RoQInterrupt(void)
 	if ( cinTable[currentHandle].RoQPlayed >= cinTable[currentHandle].ROQSize ) { 
 		if (cinTable[currentHandle].holdAtEnd==qfalse) {
 			if (cinTable[currentHandle].looping) {
-				RoQReset();
+				cin.reset = qtrue;
 			} else {
 				cinTable[currentHandle].status = FMV_EOF;
 			}
@@ -1178,36 +1373,44 @@ redump:
 				cinTable[currentHandle].normalBuffer0 = cinTable[currentHandle].t[1];
 				RoQPrepMcomp( cinTable[currentHandle].roqF0, cinTable[currentHandle].roqF1 );
 				cinTable[currentHandle].VQ1( (byte *)cin.qStatus[1], framedata);
-				cinTable[currentHandle].buf = 	cin.linbuf + cinTable[currentHandle].screenDelta;
+				cinTable[currentHandle].decoded = cin.linbuf + cinTable[currentHandle].screenDelta;
 			} else {
 				cinTable[currentHandle].normalBuffer0 = cinTable[currentHandle].t[0];
 				RoQPrepMcomp( cinTable[currentHandle].roqF0, cinTable[currentHandle].roqF1 );
 				cinTable[currentHandle].VQ0( (byte *)cin.qStatus[0], framedata );
-				cinTable[currentHandle].buf = 	cin.linbuf;
+				cinTable[currentHandle].decoded = cin.linbuf;
 			}
 			if (cinTable[currentHandle].numQuads == 0) {		// first frame
 				Com_Memcpy(cin.linbuf+cinTable[currentHandle].screenDelta, cin.linbuf, cinTable[currentHandle].samplesPerLine*cinTable[currentHandle].ysize);
 			}
 			cinTable[currentHandle].numQuads++;
-			cinTable[currentHandle].dirty = qtrue;
+			cinTable[currentHandle].newFrame = qtrue;
 			break;
 		case	ROQ_CODEBOOK:
 			decodeCodeBook( framedata, (unsigned short)cinTable[currentHandle].roq_flags );
 			break;
 		case	ZA_SOUND_MONO:
 			if (!cinTable[currentHandle].silent) {
-				ssize = RllDecodeMonoToStereo( framedata, sbuf, cinTable[currentHandle].RoQFrameSize, 0, (unsigned short)cinTable[currentHandle].roq_flags);
-                                S_RawSamples( ssize, 22050, 2, 1, (byte *)sbuf, 1.0f );
+				if (cin.numAudio == ROQ_AUDIO_PACKETS) {
+					cin.droppedAudio++;
+					break;
+				}
+				audio = &cin.audio[cin.numAudio++];
+				audio->samples = RllDecodeMonoToStereo( framedata, audio->data, cinTable[currentHandle].RoQFrameSize, 0, (unsigned short)cinTable[currentHandle].roq_flags);
+				audio->channels = 1;
+				audio->resync = qfalse;
 			}
 			break;
 		case	ZA_SOUND_STEREO:
 			if (!cinTable[currentHandle].silent) {
-				if (cinTable[currentHandle].numQuads == -1) {
-					S_Update();
-					s_rawend = s_soundtime;
+				if (cin.numAudio == ROQ_AUDIO_PACKETS) {
+					cin.droppedAudio++;
+					break;
 				}
-				ssize = RllDecodeStereoToStereo( framedata, sbuf, cinTable[currentHandle].RoQFrameSize, 0, (unsigned short)cinTable[currentHandle].roq_flags);
-                                S_RawSamples( ssize, 22050, 2, 2, (byte *)sbuf, 1.0f );
+				audio = &cin.audio[cin.numAudio++];
+				audio->samples = RllDecodeStereoToStereo( framedata, audio->data, cinTable[currentHandle].RoQFrameSize, 0, (unsigned short)cinTable[currentHandle].roq_flags);
+				audio->channels = 2;
+				audio->resync = (qboolean)(cinTable[currentHandle].numQuads == -1);
 			}
 			break;
 		case	ROQ_QUAD_INFO:
@@ -1238,7 +1441,7 @@ redump:
 	if ( cinTable[currentHandle].RoQPlayed >= cinTable[currentHandle].ROQSize ) { 
 		if (cinTable[currentHandle].holdAtEnd==qfalse) {
 			if (cinTable[currentHandle].looping) {
-				RoQReset();
+				cin.reset = qtrue;
 			} else {
 				cinTable[currentHandle].status = FMV_EOF;
 			}
@@ -1256,10 +1459,10 @@ redump:
 	cinTable[currentHandle].roqF1		 = (char)framedata[6];
 
 	if (cinTable[currentHandle].RoQFrameSize>65536||cinTable[currentHandle].roq_id==0x1084) {
-		Com_DPrintf("roq_size>65536||roq_id==0x1084\n");
+		cin.badFrame = qtrue;
 		cinTable[currentHandle].status = FMV_EOF;
 		if (cinTable[currentHandle].looping) {
-			RoQReset();
+			cin.reset = qtrue;
 		}
 		return;
 	}
@@ -1348,6 +1551,155 @@ static void RoQShutdown( void ) {
 	currentHandle = -1;
 }
 
+/*
+==================
+CIN_FinishInterrupt
+
+What RoQInterrupt left behind that has to be done on the calling thread
+==================
+*/
+static void CIN_FinishInterrupt( void ) {
+	roqAudio_t	*audio;
+	int			i;
+
+	if ( cin.badFrame ) {
+		Com_DPrintf("roq_size>65536||roq_id==0x1084\n");
+		cin.badFrame = qfalse;
+	}
+
+	for ( i = 0, audio = cin.audio ; i < cin.numAudio ; i++, audio++ ) {
+		if ( audio->resync ) {
+			S_Update();
+			s_rawend = s_soundtime;
+		}
+		S_RawSamples( audio->samples, 22050, 2, audio->channels, (byte *)audio->data, 1.0f );
+	}
+	cin.numAudio = 0;
+
+	if ( cin.droppedAudio ) {
+		Com_DPrintf( "dropped %i cinematic sound chunks\n", cin.droppedAudio );
+		cin.droppedAudio = 0;
+	}
+
+	if ( cin.reset ) {
+		cin.reset = qfalse;
+		RoQReset();
+	}
+}
+
+/*
+==================
+CIN_DecoderThread
+==================
+*/
+static void CIN_DecoderThread( void *arg ) {
+	Com_ProfileThreadName( "cinematic decoder" );
+
+	while ( 1 ) {
+		Sys_WaitSemaphore( cin_decoder.wakeup );
+		if ( cin_decoder.shutdown ) {
+			break;
+		}
+
+		PROFILE_BEGIN( "RoQInterrupt" );
+		// up to and including the next frame, leaving room for the sound
+		// of a whole packet
+		while ( !cinTable[currentHandle].newFrame && cinTable[currentHandle].status == FMV_PLAY
+			&& !cin.reset && cin.numAudio <= ROQ_AUDIO_PACKETS / 2 ) {
+			RoQInterrupt();
+		}
+		PROFILE_END();
+
+		Sys_PostSemaphore( cin_decoder.done, 1 );
+	}
+}
+
+/*
+==================
+CIN_StartDecoder
+==================
+*/
+static void CIN_StartDecoder( void ) {
+	if ( cin_decoder.thread || !cl_cinThread->integer ) {
+		return;
+	}
+
+	cin_decoder.shutdown = 0;
+	cin_decoder.busy = qfalse;
+	cin_decoder.wakeup = Sys_CreateSemaphore( 0 );
+	cin_decoder.done = Sys_CreateSemaphore( 0 );
+
+	cin_decoder.thread = Sys_CreateThread( CIN_DecoderThread, NULL );
+	if ( !cin_decoder.thread ) {
+		Com_Printf( "WARNING: couldn't start the cinematic decoder thread\n" );
+		Sys_DestroySemaphore( cin_decoder.wakeup );
+		Sys_DestroySemaphore( cin_decoder.done );
+		Com_Memset( &cin_decoder, 0, sizeof( cin_decoder ) );
+	}
+}
+
+/*
+==================
+CIN_DecodeAhead
+
+Starts the frame after the one just shown on the decoder thread
+==================
+*/
+static void CIN_DecodeAhead( void ) {
+	// looked at every time, a vid_restart can turn r_smp on under a
+	// cinematic that is still playing
+	if ( !cin_decoder.thread || !cl_cinThread->integer || cls.glconfig.smpActive ) {
+		return;
+	}
+
+	if ( cinTable[currentHandle].status != FMV_PLAY || !cinTable[currentHandle].buf
+		|| cinTable[currentHandle].newFrame || cinTable[currentHandle].numQuads < 1 ) {
+		return;
+	}
+
+	cin_decoder.busy = qtrue;
+	Sys_PostSemaphore( cin_decoder.wakeup, 1 );
+}
+
+/*
+==================
+CIN_FinishDecode
+
+Everything that looks at cin or changes currentHandle waits for the
+decoder first
+==================
+*/
+static void CIN_FinishDecode( void ) {
+	if ( !cin_decoder.busy ) {
+		return;
+	}
+
+	Sys_WaitSemaphore( cin_decoder.done );
+	cin_decoder.busy = qfalse;
+
+	CIN_FinishInterrupt();
+}
+
+/*
+==================
+CIN_Shutdown
+==================
+*/
+void CIN_Shutdown( void ) {
+	CIN_FinishDecode();
+
+	if ( !cin_decoder.thread ) {
+		return;
+	}
+
+	cin_decoder.shutdown = 1;
+	Sys_PostSemaphore( cin_decoder.wakeup, 1 );
+	Sys_JoinThread( cin_decoder.thread );
+	Sys_DestroySemaphore( cin_decoder.wakeup );
+	Sys_DestroySemaphore( cin_decoder.done );
+	Com_Memset( &cin_decoder, 0, sizeof( cin_decoder ) );
+}
+
 /*
 ==================
 SCR_StopCinematic
@@ -1355,6 +1707,8 @@ SCR_StopCinematic
 */
 e_status CIN_StopCinematic(int handle) {
 	
+	CIN_FinishDecode();
+
 	if (handle < 0 || handle>= MAX_VIDEO_HANDLES || cinTable[handle].status == FMV_EOF) return FMV_EOF;
 	currentHandle = handle;
 
@@ -1390,9 +1744,13 @@ e_status CIN_RunCinematic (int handle)
 	int	start = 0;
 	int     thisTime = 0;
 
+	CIN_FinishDecode();
+
 	if (handle < 0 || handle>= MAX_VIDEO_HANDLES || cinTable[handle].status == FMV_EOF) return FMV_EOF;
 
 	if (cin.currentHandle != handle) {
+		// the other cinematic's frame in linbuf is about to go
+		cinTable[cin.currentHandle].newFrame = qfalse;
 		currentHandle = handle;
 		cin.currentHandle = currentHandle;
 		cinTable[currentHandle].status = FMV_EOF;
@@ -1425,10 +1783,13 @@ e_status CIN_RunCinematic (int handle)
 	cinTable[currentHandle].tfps = ((((CL_ScaledMilliseconds()*com_timescale->value) - cinTable[currentHandle].startTime)*3)/100);
 
 	start = cinTable[currentHandle].startTime;
+	// a frame decoded ahead only needs more when it is already late
 	while(  (cinTable[currentHandle].tfps != cinTable[currentHandle].numQuads)
-		&& (cinTable[currentHandle].status == FMV_PLAY) ) 
+		&& (cinTable[currentHandle].status == FMV_PLAY)
+		&& (!cinTable[currentHandle].newFrame || cinTable[currentHandle].tfps > cinTable[currentHandle].numQuads) ) 
 	{
 		RoQInterrupt();
+		CIN_FinishInterrupt();
 		if (start != (int)cinTable[currentHandle].startTime) {
 			// we need to use CL_ScaledMilliseconds because of the smp mode calls from the renderer
 		  cinTable[currentHandle].tfps = ((((CL_ScaledMilliseconds()*com_timescale->value)
@@ -1439,6 +1800,12 @@ e_status CIN_RunCinematic (int handle)
 
 	cinTable[currentHandle].lastTime = thisTime;
 
+	if (cinTable[currentHandle].newFrame && cinTable[currentHandle].tfps >= cinTable[currentHandle].numQuads) {
+		cinTable[currentHandle].buf = cinTable[currentHandle].decoded;
+		cinTable[currentHandle].dirty = qtrue;
+		cinTable[currentHandle].newFrame = qfalse;
+	}
+
 	if (cinTable[currentHandle].status == FMV_LOOPED) {
 		cinTable[currentHandle].status = FMV_PLAY;
 	}
@@ -1451,7 +1818,11 @@ e_status CIN_RunCinematic (int handle)
 	  }
 	}
 
-	return cinTable[currentHandle].status;
+	if (currentHandle >= 0) {
+		CIN_DecodeAhead();
+		return cinTable[currentHandle].status;
+	}
+	return cinTable[handle].status;
 }
 
 /*
@@ -1474,6 +1845,8 @@ int CIN_PlayCinematic( const char *arg, int x, int y, int w, int h, int systemBi
 	if (!(systemBits & CIN_system)) {
 		for ( i = 0 ; i < MAX_VIDEO_HANDLES ; i++ ) {
 			if (!strcmp(cinTable[i].fileName, name) ) {
+				// registered again after a vid_restart, which stopped the decoder
+				CIN_StartDecoder();
 				return i;
 			}
 		}
@@ -1481,12 +1854,16 @@ int CIN_PlayCinematic( const char *arg, int x, int y, int w, int h, int systemBi
 
 	Com_DPrintf("SCR_PlayCinematic( %s )\n", arg);
 
+	CIN_FinishDecode();
+	CIN_StartDecoder();
+
 	Com_Memset(&cin, 0, sizeof(cinematics_t) );
 	currentHandle = CIN_HandleForVideo();
 
 	cin.currentHandle = currentHandle;
 
 	strcpy(cinTable[currentHandle].fileName, name);
+	cinTable[currentHandle].newFrame = qfalse;
 
 	cinTable[currentHandle].ROQSize = 0;
 	cinTable[currentHandle].ROQSize = FS_FOpenFileRead (cinTable[currentHandle].fileName, &cinTable[currentHandle].iFile, qtrue);
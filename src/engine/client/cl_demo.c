@@ -0,0 +1,748 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// cl_demo.c -- demo keyframes and seeking
+
+#include "client.h"
+
+/*
+=======================================================================
+
+A demo is a gamestate message followed by the net messages as they were
+received, ended by a -1 length.  Nothing reads past the end marker, so
+keyframes are appended after it without breaking older clients:
+
+<demo messages>
+-1 -1
+<keyframes>		each one a gamestate message and the snapshots that later
+				messages can still delta from, as ordinary demo messages
+<index>			numKeyframes demoKeyframe_t
+<trailer>		demoTrailer_t, the last bytes of the file
+
+Seeking parses the messages of the nearest earlier keyframe, which
+loads the level again just like starting the demo, then carries on
+reading the demo messages that followed it.  The cgame doesn't execute
+the commands that are read through, so their configstring changes are
+made to the gamestate before the cgame is started on it.
+
+While recording, the keyframes go to a temporary file until the demo
+is stopped and the end marker has been written.
+
+=======================================================================
+*/
+
+#define	DEMO_INDEX_MAGIC	(('X'<<24)+('D'<<16)+('K'<<8)+'D')
+#define	MAX_DEMO_KEYFRAMES	4096
+
+// the server never deltas from further back than this
+#define	KEYFRAME_SNAPSHOTS	( PACKET_BACKUP - 3 )
+
+#define	KEYFRAME_TEMP_FILE	"demokeys.tmp"
+
+typedef struct {
+	int			serverTime;
+	int			keyframeOffset;		// the keyframe gamestate message
+	int			numMessages;
+	int			resumeOffset;		// the demo message after the keyframe
+	int			serverCommandSequence;	// commands executed by then
+} demoKeyframe_t;
+
+typedef struct {
+	int			numKeyframes;
+	int			indexOffset;
+	int			magic;
+} demoTrailer_t;
+
+typedef struct {
+	fileHandle_t	file;			// the demo being written
+	fileHandle_t	keyFile;		// keyframes until the demo is finished
+	int				nextKeyframeTime;
+	int				numKeyframes;
+	demoKeyframe_t	keyframes[MAX_DEMO_KEYFRAMES];
+} demoWriter_t;
+
+typedef struct {
+	int				numKeyframes;
+	demoKeyframe_t	keyframes[MAX_DEMO_KEYFRAMES];
+} demoIndex_t;
+
+static demoWriter_t	demoWriter;
+static demoIndex_t	demoIndex;
+
+/*
+=======================================================================
+
+KEYFRAME WRITING
+
+=======================================================================
+*/
+
+/*
+====================
+CL_DemoWriteMessage
+====================
+*/
+static void CL_DemoWriteMessage( fileHandle_t f, int sequence, msg_t *msg ) {
+	int		swlen;
+
+	swlen = LittleLong( sequence );
+	FS_Write( &swlen, 4, f );
+	swlen = LittleLong( msg->cursize );
+	FS_Write( &swlen, 4, f );
+	FS_Write( msg->data, msg->cursize, f );
+}
+
+/*
+====================
+CL_EmitPacketEntities
+
+The client side of SV_EmitPacketEntities, for snapshots that are
+still in cl.parseEntities
+====================
+*/
+static void CL_EmitPacketEntities( clSnapshot_t *from, clSnapshot_t *to, msg_t *msg ) {
+	entityState_t	*oldent, *newent;
+	int		oldindex, newindex;
+	int		oldnum, newnum;
+	int		from_num_entities;
+
+	if ( !from ) {
+		from_num_entities = 0;
+	} else {
+		from_num_entities = from->numEntities;
+	}
+
+	newent = NULL;
+	oldent = NULL;
+	newindex = 0;
+	oldindex = 0;
+	while ( newindex < to->numEntities || oldindex < from_num_entities ) {
+		if ( newindex >= to->numEntities ) {
+			newnum = 9999;
+		} else {
+			newent = &cl.parseEntities[(to->parseEntitiesNum+newindex) & (MAX_PARSE_ENTITIES-1)];
+			newnum = newent->number;
+		}
+
+		if ( oldindex >= from_num_entities ) {
+			oldnum = 9999;
+		} else {
+			oldent = &cl.parseEntities[(from->parseEntitiesNum+oldindex) & (MAX_PARSE_ENTITIES-1)];
+			oldnum = oldent->number;
+		}
+
+		if ( newnum == oldnum ) {
+			MSG_WriteDeltaEntity( msg, oldent, newent, qfalse );
+			oldindex++;
+			newindex++;
+			continue;
+		}
+
+		if ( newnum < oldnum ) {
+			MSG_WriteDeltaEntity( msg, &cl.entityBaselines[newnum], newent, qtrue );
+			newindex++;
+			continue;
+		}
+
+		if ( newnum > oldnum ) {
+			MSG_WriteDeltaEntity( msg, oldent, NULL, qtrue );
+			oldindex++;
+			continue;
+		}
+	}
+
+	MSG_WriteBits( msg, (MAX_GENTITIES-1), GENTITYNUM_BITS );	// end of packetentities
+}
+
+/*
+====================
+CL_WriteKeyframeSnapshot
+
+Writes a snapshot back out as a server message, with any commands
+the cgame hasn't executed yet ahead of it
+====================
+*/
+static void CL_WriteKeyframeSnapshot( msg_t *msg, clSnapshot_t *from, clSnapshot_t *to, qboolean commands ) {
+	int		i;
+
+	MSG_WriteLong( msg, clc.reliableSequence );
+
+	if ( commands ) {
+		for ( i = clc.lastExecutedServerCommand + 1 ; i <= clc.serverCommandSequence ; i++ ) {
+			MSG_WriteByte( msg, svc_serverCommand );
+			MSG_WriteLong( msg, i );
+			MSG_WriteString( msg, clc.serverCommands[ i & ( MAX_RELIABLE_COMMANDS - 1 ) ] );
+		}
+	}
+
+	MSG_WriteByte( msg, svc_snapshot );
+	MSG_WriteLong( msg, to->serverTime );
+	MSG_WriteByte( msg, from ? to->messageNum - from->messageNum : 0 );
+	MSG_WriteByte( msg, to->snapFlags );
+	MSG_WriteByte( msg, sizeof( to->areamask ) );
+	MSG_WriteData( msg, to->areamask, sizeof( to->areamask ) );
+	if ( from ) {
+		MSG_WriteDeltaPlayerstate( msg, &from->ps, &to->ps );
+	} else {
+		MSG_WriteDeltaPlayerstate( msg, NULL, &to->ps );
+	}
+	CL_EmitPacketEntities( from, to, msg );
+
+	MSG_WriteByte( msg, svc_EOF );
+}
+
+/*
+====================
+CL_WriteKeyframe
+
+Writes the gamestate and every snapshot the next demo messages could
+delta from, the first one uncompressed and each following one from
+the one before
+====================
+*/
+static void CL_WriteKeyframe( void ) {
+	demoKeyframe_t	*key;
+	clSnapshot_t	*snap, *from;
+	msg_t			buf;
+	byte			bufData[MAX_MSGLEN];
+	int				messageNum, first;
+
+	// oldest snapshot that is still complete
+	first = cl.snap.messageNum;
+	for ( messageNum = cl.snap.messageNum - KEYFRAME_SNAPSHOTS ; messageNum < cl.snap.messageNum ; messageNum++ ) {
+		snap = &cl.snapshots[messageNum & PACKET_MASK];
+		if ( snap->valid && snap->messageNum == messageNum
+			&& cl.parseEntitiesNum - snap->parseEntitiesNum <= MAX_PARSE_ENTITIES-128 ) {
+			first = messageNum;
+			break;
+		}
+	}
+
+	key = &demoWriter.keyframes[demoWriter.numKeyframes];
+	key->serverTime = cl.snap.serverTime;
+	key->keyframeOffset = FS_FTell( demoWriter.keyFile );
+	key->numMessages = 0;
+	key->resumeOffset = FS_FTell( demoWriter.file );
+	key->serverCommandSequence = clc.lastExecutedServerCommand;
+
+	// the gamestate as the cgame has it now
+	MSG_Init( &buf, bufData, sizeof( bufData ) );
+	MSG_Bitstream( &buf );
+	CL_WriteGamestate( &buf, clc.lastExecutedServerCommand );
+	MSG_WriteByte( &buf, svc_EOF );
+	if ( buf.overflowed ) {
+		return;
+	}
+	CL_DemoWriteMessage( demoWriter.keyFile, first - 1, &buf );
+	key->numMessages++;
+
+	from = NULL;
+	for ( messageNum = first ; messageNum <= cl.snap.messageNum ; messageNum++ ) {
+		snap = &cl.snapshots[messageNum & PACKET_MASK];
+		if ( !snap->valid || snap->messageNum != messageNum ) {
+			continue;
+		}
+		if ( from && cl.parseEntitiesNum - snap->parseEntitiesNum > MAX_PARSE_ENTITIES-128 ) {
+			continue;
+		}
+
+		MSG_Init( &buf, bufData, sizeof( bufData ) );
+		MSG_Bitstream( &buf );
+		CL_WriteKeyframeSnapshot( &buf, from, snap, from ? qfalse : qtrue );
+		if ( buf.overflowed ) {
+			return;		// leaves unreferenced bytes in the keyframe file
+		}
+		CL_DemoWriteMessage( demoWriter.keyFile, messageNum, &buf );
+		key->numMessages++;
+
+		from = snap;
+	}
+
+	demoWriter.numKeyframes++;
+}
+
+/*
+====================
+CL_DemoStartKeyframes
+
+Called after the gamestate message has been written to a new demo
+====================
+*/
+void CL_DemoStartKeyframes( fileHandle_t demofile ) {
+	demoWriter.file = 0;
+	demoWriter.keyFile = 0;
+	demoWriter.nextKeyframeTime = 0;
+	demoWriter.numKeyframes = 0;
+
+	if ( cl_demoKeyframes->integer <= 0 ) {
+		return;
+	}
+
+	demoWriter.keyFile = FS_SV_FOpenFileWrite( KEYFRAME_TEMP_FILE );
+	if ( !demoWriter.keyFile ) {
+		Com_Printf( "WARNING: couldn't open %s, the demo won't be seekable.\n", KEYFRAME_TEMP_FILE );
+		return;
+	}
+	demoWriter.file = demofile;
+}
+
+/*
+====================
+CL_DemoKeyframe
+
+Called after each message has been written to the demo
+====================
+*/
+void CL_DemoKeyframe( void ) {
+	if ( !demoWriter.keyFile ) {
+		return;
+	}
+
+	// only right after a snapshot, so that the next demo message
+	// continues from it
+	if ( !cl.snap.valid || cl.snap.messageNum != clc.serverMessageSequence ) {
+		return;
+	}
+	if ( cl.snap.serverTime < demoWriter.nextKeyframeTime ) {
+		return;
+	}
+	if ( demoWriter.numKeyframes == MAX_DEMO_KEYFRAMES ) {
+		return;
+	}
+
+	demoWriter.nextKeyframeTime = cl.snap.serverTime + cl_demoKeyframes->integer * 1000;
+
+	CL_WriteKeyframe();
+}
+
+/*
+====================
+CL_DemoFinishKeyframes
+
+Called after the end marker has been written, appends the keyframes,
+the index and the trailer
+====================
+*/
+void CL_DemoFinishKeyframes( void ) {
+	fileHandle_t	f;
+	demoKeyframe_t	key;
+	demoTrailer_t	trailer;
+	byte			data[16384];
+	int				base, len, i;
+
+	if ( !demoWriter.keyFile ) {
+		return;
+	}
+	FS_FCloseFile( demoWriter.keyFile );
+	demoWriter.keyFile = 0;
+
+	if ( demoWriter.numKeyframes ) {
+		base = FS_FTell( demoWriter.file );
+
+		len = FS_SV_FOpenFileRead( KEYFRAME_TEMP_FILE, &f );
+		if ( !f ) {
+			Com_Printf( "WARNING: lost %s, the demo won't be seekable.\n", KEYFRAME_TEMP_FILE );
+			demoWriter.numKeyframes = 0;
+			return;
+		}
+		while ( len > 0 ) {
+			i = FS_Read( data, len < (int)sizeof( data ) ? len : (int)sizeof( data ), f );
+			if ( i <= 0 ) {
+				break;
+			}
+			FS_Write( data, i, demoWriter.file );
+			len -= i;
+		}
+		FS_FCloseFile( f );
+
+		trailer.indexOffset = LittleLong( FS_FTell( demoWriter.file ) );
+		trailer.numKeyframes = LittleLong( demoWriter.numKeyframes );
+		trailer.magic = LittleLong( DEMO_INDEX_MAGIC );
+
+		for ( i = 0 ; i < demoWriter.numKeyframes ; i++ ) {
+			key.serverTime = LittleLong( demoWriter.keyframes[i].serverTime );
+			key.keyframeOffset = LittleLong( base + demoWriter.keyframes[i].keyframeOffset );
+			key.numMessages = LittleLong( demoWriter.keyframes[i].numMessages );
+			key.resumeOffset = LittleLong( demoWriter.keyframes[i].resumeOffset );
+			key.serverCommandSequence = LittleLong( demoWriter.keyframes[i].serverCommandSequence );
+			FS_Write( &key, sizeof( key ), demoWriter.file );
+		}
+		FS_Write( &trailer, sizeof( trailer ), demoWriter.file );
+	}
+
+	FS_SV_Remove( KEYFRAME_TEMP_FILE );
+	demoWriter.file = 0;
+}
+
+/*
+=======================================================================
+
+SEEKING
+
+=======================================================================
+*/
+
+/*
+====================
+CL_DemoReadIndex
+
+Called when a demo is opened for playback
+====================
+*/
+void CL_DemoReadIndex( const char *name ) {
+	demoTrailer_t	trailer;
+	demoKeyframe_t	*key;
+	int				len, i;
+
+	demoIndex.numKeyframes = 0;
+
+	// can't seek around inside a pk3
+	if ( FS_FileIsInPAK( name, NULL ) == 1 ) {
+		return;
+	}
+
+	len = FS_filelength( clc.demofile );
+	if ( len < (int)sizeof( trailer ) ) {
+		return;
+	}
+
+	FS_Seek( clc.demofile, len - sizeof( trailer ), FS_SEEK_SET );
+	FS_Read( &trailer, sizeof( trailer ), clc.demofile );
+	trailer.magic = LittleLong( trailer.magic );
+	trailer.numKeyframes = LittleLong( trailer.numKeyframes );
+	trailer.indexOffset = LittleLong( trailer.indexOffset );
+
+	if ( trailer.magic != DEMO_INDEX_MAGIC || trailer.numKeyframes <= 0
+		|| trailer.numKeyframes > MAX_DEMO_KEYFRAMES
+		|| trailer.indexOffset + trailer.numKeyframes * (int)sizeof( demoKeyframe_t ) + (int)sizeof( trailer ) != len ) {
+		FS_Seek( clc.demofile, 0, FS_SEEK_SET );
+		return;
+	}
+
+	FS_Seek( clc.demofile, trailer.indexOffset, FS_SEEK_SET );
+	FS_Read( demoIndex.keyframes, trailer.numKeyframes * sizeof( demoKeyframe_t ), clc.demofile );
+	for ( i = 0, key = demoIndex.keyframes ; i < trailer.numKeyframes ; i++, key++ ) {
+		key->serverTime = LittleLong( key->serverTime );
+		key->keyframeOffset = LittleLong( key->keyframeOffset );
+		key->numMessages = LittleLong( key->numMessages );
+		key->resumeOffset = LittleLong( key->resumeOffset );
+		key->serverCommandSequence = LittleLong( key->serverCommandSequence );
+	}
+	demoIndex.numKeyframes = trailer.numKeyframes;
+
+	FS_Seek( clc.demofile, 0, FS_SEEK_SET );
+}
+
+/*
+====================
+CL_DemoApplyCommands
+
+The cgame doesn't get to execute the commands that are read through, so
+their configstring changes are made to the gamestate here
+====================
+*/
+static void CL_DemoApplyCommands( int first ) {
+	static char	bigConfigString[BIG_INFO_STRING];
+	char		*s, *cmd;
+	int			i;
+
+	if ( first <= clc.serverCommandSequence - MAX_RELIABLE_COMMANDS ) {
+		first = clc.serverCommandSequence - MAX_RELIABLE_COMMANDS + 1;
+	}
+
+	for ( i = first ; i <= clc.serverCommandSequence ; i++ ) {
+		s = clc.serverCommands[ i & ( MAX_RELIABLE_COMMANDS - 1 ) ];
+		Cmd_TokenizeString( s );
+		cmd = Cmd_Argv( 0 );
+
+		if ( !strcmp( cmd, "bcs0" ) ) {
+			Com_sprintf( bigConfigString, sizeof( bigConfigString ), "cs %s \"%s", Cmd_Argv( 1 ), Cmd_Argv( 2 ) );
+			continue;
+		}
+		if ( !strcmp( cmd, "bcs1" ) || !strcmp( cmd, "bcs2" ) ) {
+			Q_strcat( bigConfigString, sizeof( bigConfigString ), Cmd_Argv( 2 ) );
+			if ( cmd[3] == '1' ) {
+				continue;
+			}
+			Q_strcat( bigConfigString, sizeof( bigConfigString ), "\"" );
+			Cmd_TokenizeString( bigConfigString );
+			cmd = Cmd_Argv( 0 );
+		}
+
+		if ( !strcmp( cmd, "cs" ) ) {
+			CL_ConfigstringModified();
+		}
+	}
+}
+
+/*
+====================
+CL_DemoFastForward
+
+Reads ahead without the cgame seeing the snapshots in between.  If the
+cgame is running and more commands go by than it can catch up on, it
+stops and returns qfalse, the cgame has to be started again from a
+keyframe then.
+====================
+*/
+static qboolean CL_DemoFastForward( int serverTime ) {
+	int		start, sequence;
+
+	start = cl.snap.serverTime;
+	while ( cl.snap.serverTime < serverTime ) {
+		sequence = clc.serverCommandSequence;
+		CL_ReadDemoMessage();
+		if ( !clc.demoplaying ) {
+			return qtrue;		// ran off the end
+		}
+		CL_DemoApplyCommands( sequence + 1 );
+
+		if ( cls.state == CA_ACTIVE
+			&& clc.serverCommandSequence - clc.lastExecutedServerCommand >= MAX_RELIABLE_COMMANDS ) {
+			return qfalse;
+		}
+	}
+
+	// skip the playback clock over the time that was read through
+	if ( cls.state == CA_ACTIVE ) {
+		cl.serverTimeDelta += cl.snap.serverTime - start;
+	}
+	return qtrue;
+}
+
+/*
+====================
+CL_DemoRestoreKeyframe
+====================
+*/
+static void CL_DemoRestoreKeyframe( demoKeyframe_t *key ) {
+	int		i;
+
+	cls.state = CA_CONNECTED;
+
+	// the cgame is started from the keyframe gamestate
+	clc.serverCommandSequence = key->serverCommandSequence;
+	clc.lastExecutedServerCommand = key->serverCommandSequence;
+
+	FS_Seek( clc.demofile, key->keyframeOffset, FS_SEEK_SET );
+	for ( i = 0 ; i < key->numMessages ; i++ ) {
+		CL_ReadDemoMessage();
+		if ( !clc.demoplaying ) {
+			return;
+		}
+	}
+
+	FS_Seek( clc.demofile, key->resumeOffset, FS_SEEK_SET );
+
+	// don't get the first snapshot this frame, same as starting the demo
+	clc.firstDemoFrameSkipped = qfalse;
+}
+
+/*
+====================
+CL_DemoSeekKeyframe
+
+Loads the level from the keyframe and reads on to the time, the cgame is
+only started once it is there so that it sees the configstrings of then
+====================
+*/
+static void CL_DemoSeekKeyframe( demoKeyframe_t *key, int serverTime ) {
+	clc.demoseeking = qtrue;
+	CL_DemoRestoreKeyframe( key );
+	if ( clc.demoplaying ) {
+		CL_DemoFastForward( serverTime );
+	}
+	clc.demoseeking = qfalse;
+
+	if ( clc.demoplaying && cls.state == CA_CONNECTED ) {
+		// the commands in between have been applied to the gamestate
+		clc.lastExecutedServerCommand = clc.serverCommandSequence;
+		CL_InitDownloads();
+	}
+}
+
+/*
+====================
+CL_DemoSeek_f
+
+demoseek <seconds>
+demoseek +<seconds> / -<seconds>
+
+Seconds are from the start of the demo, or from the current position
+with a sign
+====================
+*/
+void CL_DemoSeek_f( void ) {
+	demoKeyframe_t	*key;
+	char			*s;
+	int				serverTime;
+	int				i;
+
+	if ( Cmd_Argc() != 2 ) {
+		Com_Printf( "demoseek <seconds|+seconds|-seconds>\n" );
+		return;
+	}
+
+	if ( !clc.demoplaying || cls.state != CA_ACTIVE ) {
+		Com_Printf( "Not playing a demo.\n" );
+		return;
+	}
+	if ( clc.demoindexing ) {
+		Com_Printf( "Can't seek while indexing a demo.\n" );
+		return;
+	}
+	if ( !demoIndex.numKeyframes ) {
+		Com_Printf( "%s has no keyframes, use demoindex to add them.\n", clc.demoName );
+		return;
+	}
+
+	s = Cmd_Argv( 1 );
+	if ( s[0] == '+' || s[0] == '-' ) {
+		serverTime = cl.snap.serverTime + (int)( atof( s ) * 1000 );
+	} else {
+		serverTime = demoIndex.keyframes[0].serverTime + (int)( atof( s ) * 1000 );
+	}
+
+	// latest keyframe at or before the time
+	key = &demoIndex.keyframes[0];
+	for ( i = 1 ; i < demoIndex.numKeyframes ; i++ ) {
+		if ( demoIndex.keyframes[i].serverTime > serverTime ) {
+			break;
+		}
+		key = &demoIndex.keyframes[i];
+	}
+
+	i = ( serverTime - demoIndex.keyframes[0].serverTime ) / 1000;
+	if ( i < 0 ) {
+		i = 0;
+	}
+	Com_Printf( "Seeking to %i:%02i\n", i / 60, i % 60 );
+
+	// without a keyframe in between, reading on is much quicker
+	// than loading the level again
+	if ( serverTime >= cl.snap.serverTime && key->serverTime <= cl.snap.serverTime ) {
+		if ( CL_DemoFastForward( serverTime ) ) {
+			return;
+		}
+	}
+
+	CL_DemoSeekKeyframe( key, serverTime );
+}
+
+/*
+=======================================================================
+
+INDEXING OLD DEMOS
+
+=======================================================================
+*/
+
+/*
+====================
+CL_DemoIndexMessage
+
+Called with each message read while indexing
+====================
+*/
+void CL_DemoIndexMessage( msg_t *msg ) {
+	CL_DemoWriteMessage( demoWriter.file, clc.serverMessageSequence, msg );
+	CL_DemoKeyframe();
+}
+
+/*
+====================
+CL_DemoIndexStop
+
+Called when the demo being indexed ends
+====================
+*/
+void CL_DemoIndexStop( void ) {
+	int		len;
+
+	len = -1;
+	FS_Write( &len, 4, demoWriter.file );
+	FS_Write( &len, 4, demoWriter.file );
+
+	Com_Printf( "Wrote %i keyframes.\n", demoWriter.numKeyframes );
+
+	CL_DemoFinishKeyframes();
+	FS_FCloseFile( demoWriter.file );
+	demoWriter.file = 0;
+	clc.demoindexing = qfalse;
+}
+
+/*
+====================
+CL_DemoIndex_f
+
+demoindex <demoname>
+
+Plays a demo through as a timedemo and copies it to <demoname>_indexed
+with keyframes
+====================
+*/
+void CL_DemoIndex_f( void ) {
+	char			name[MAX_OSPATH];
+	char			base[MAX_OSPATH];
+	byte			bufData[MAX_MSGLEN];
+	msg_t			buf;
+	fileHandle_t	f;
+
+	if ( Cmd_Argc() != 2 ) {
+		Com_Printf( "demoindex <demoname>\n" );
+		return;
+	}
+	if ( cl_demoKeyframes->integer <= 0 ) {
+		Com_Printf( "cl_demoKeyframes is 0, there would be no keyframes.\n" );
+		return;
+	}
+
+	CL_PlayDemo_f();
+	if ( !clc.demoplaying || cls.state != CA_PRIMED ) {
+		return;
+	}
+	if ( clc.svdemo ) {
+		Com_Printf( "Server demos can't be indexed.\n" );
+		return;
+	}
+
+	COM_StripExtension( Cmd_Argv( 1 ), base );
+	Com_sprintf( name, sizeof( name ), "demos/%s_indexed.dm_%d", base, PROTOCOL_VERSION );
+
+	f = FS_FOpenFileWrite( name );
+	if ( !f ) {
+		Com_Printf( "ERROR: couldn't open %s.\n", name );
+		return;
+	}
+	FS_WriteAsync( f );
+	Com_Printf( "indexing to %s.\n", name );
+
+	// the gamestate has been read already, write it back out
+	MSG_Init( &buf, bufData, sizeof( bufData ) );
+	MSG_Bitstream( &buf );
+	CL_WriteGamestate( &buf, clc.serverCommandSequence );
+	MSG_WriteByte( &buf, svc_EOF );
+	CL_DemoWriteMessage( f, clc.serverMessageSequence, &buf );
+
+	CL_DemoStartKeyframes( f );
+	demoWriter.file = f;
+	clc.demoindexing = qtrue;
+}
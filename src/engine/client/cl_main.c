@@ -43,6 +43,7 @@ cvar_t	*cl_freezeDemo;
 cvar_t	*cl_shownet;
 cvar_t	*cl_showSend;
 cvar_t	*cl_timedemo;
+cvar_t	*cl_demoKeyframes;
 cvar_t	*cl_avidemo;
 cvar_t	*cl_forceavidemo;
 
@@ -65,6 +66,7 @@ cvar_t	*cl_motdString;
 cvar_t	*cl_allowDownload;
 cvar_t	*cl_conXOffset;
 cvar_t	*cl_inGameVideo;
+cvar_t	*cl_cinThread;
 
 cvar_t	*cl_serverStatusResendTime;
 cvar_t	*cl_trn;
@@ -177,18 +179,17 @@ Dumps the current net message, prefixed by the length
 ====================
 */
 void CL_WriteDemoMessage ( msg_t *msg, int headerBytes ) {
-	int		len, swlen;
-
-	// write the packet sequence
-	len = clc.serverMessageSequence;
-	swlen = LittleLong( len );
-	FS_Write (&swlen, 4, clc.demofile);
+	int		len;
+	int		header[2];
 
-	// skip the packet sequencing information
+	// the packet sequence, then the length without the sequencing information
 	len = msg->cursize - headerBytes;
-	swlen = LittleLong(len);
-	FS_Write (&swlen, 4, clc.demofile);
-	FS_Write ( msg->data + headerBytes, len, clc.demofile );
+	header[0] = LittleLong( clc.serverMessageSequence );
+	header[1] = LittleLong( len );
+	FS_Write( header, sizeof( header ), clc.demofile );
+	FS_Write( msg->data + headerBytes, len, clc.demofile );
+
+	CL_DemoKeyframe();
 }
 
 
@@ -211,10 +212,12 @@ void CL_StopRecord_f( void ) {
 	len = -1;
 	FS_Write (&len, 4, clc.demofile);
 	FS_Write (&len, 4, clc.demofile);
+	CL_DemoFinishKeyframes();
 	FS_FCloseFile (clc.demofile);
 	clc.demofile = 0;
 	clc.demorecording = qfalse;
 	clc.spDemoRecording = qfalse;
+	NET_WantLocalSnapshots( qtrue );
 	Com_Printf ("Stopped demo.\n");
 }
 
@@ -243,6 +246,58 @@ void CL_DemoFilename( int number, char *fileName ) {
 		, a, b, c, d );
 }
 
+/*
+====================
+CL_WriteGamestate
+
+Writes the current gamestate the way the server sent it, up to
+the end of the client packet
+====================
+*/
+void CL_WriteGamestate( msg_t *msg, int serverCommandSequence ) {
+	int			i;
+	entityState_t	*ent;
+	entityState_t	nullstate;
+	char		*s;
+
+	// NOTE, MRE: all server->client messages now acknowledge
+	MSG_WriteLong( msg, clc.reliableSequence );
+
+	MSG_WriteByte (msg, svc_gamestate);
+	MSG_WriteLong (msg, serverCommandSequence );
+
+	// configstrings
+	for ( i = 0 ; i < MAX_CONFIGSTRINGS ; i++ ) {
+		if ( !cl.gameState.stringOffsets[i] ) {
+			continue;
+		}
+		s = cl.gameState.stringData + cl.gameState.stringOffsets[i];
+		MSG_WriteByte (msg, svc_configstring);
+		MSG_WriteShort (msg, i);
+		MSG_WriteBigString (msg, s);
+	}
+
+	// baselines
+	Com_Memset (&nullstate, 0, sizeof(nullstate));
+	for ( i = 0; i < MAX_GENTITIES ; i++ ) {
+		ent = &cl.entityBaselines[i];
+		if ( !ent->number ) {
+			continue;
+		}
+		MSG_WriteByte (msg, svc_baseline);		
+		MSG_WriteDeltaEntity (msg, &nullstate, ent, qtrue );
+	}
+
+	MSG_WriteByte( msg, svc_EOF );
+	
+	// finished writing the gamestate stuff
+
+	// write the client num
+	MSG_WriteLong(msg, clc.clientNum);
+	// write the checksum feed
+	MSG_WriteLong(msg, clc.checksumFeed);
+}
+
 /*
 ====================
 CL_Record_f
@@ -257,10 +312,7 @@ void CL_Record_f( void ) {
 	char		name[MAX_OSPATH];
 	byte		bufData[MAX_MSGLEN];
 	msg_t	buf;
-	int			i;
 	int			len;
-	entityState_t	*ent;
-	entityState_t	nullstate;
 	char		*s;
 
 	if ( Cmd_Argc() > 2 ) {
@@ -312,6 +364,7 @@ void CL_Record_f( void ) {
 		Com_Printf ("ERROR: couldn't open.\n");
 		return;
 	}
+	FS_WriteAsync( clc.demofile );
 	clc.demorecording = qtrue;
 	if (Cvar_VariableValue("ui_recordSPDemo")) {
 	  clc.spDemoRecording = qtrue;
@@ -325,46 +378,14 @@ void CL_Record_f( void ) {
 	// don't start saving messages until a non-delta compressed message is received
 	clc.demowaiting = qtrue;
 
+	// a listen server has to send real snapshots to have them recorded
+	NET_WantLocalSnapshots( qfalse );
+
 	// write out the gamestate message
 	MSG_Init (&buf, bufData, sizeof(bufData));
 	MSG_Bitstream(&buf);
 
-	// NOTE, MRE: all server->client messages now acknowledge
-	MSG_WriteLong( &buf, clc.reliableSequence );
-
-	MSG_WriteByte (&buf, svc_gamestate);
-	MSG_WriteLong (&buf, clc.serverCommandSequence );
-
-	// configstrings
-	for ( i = 0 ; i < MAX_CONFIGSTRINGS ; i++ ) {
-		if ( !cl.gameState.stringOffsets[i] ) {
-			continue;
-		}
-		s = cl.gameState.stringData + cl.gameState.stringOffsets[i];
-		MSG_WriteByte (&buf, svc_configstring);
-		MSG_WriteShort (&buf, i);
-		MSG_WriteBigString (&buf, s);
-	}
-
-	// baselines
-	Com_Memset (&nullstate, 0, sizeof(nullstate));
-	for ( i = 0; i < MAX_GENTITIES ; i++ ) {
-		ent = &cl.entityBaselines[i];
-		if ( !ent->number ) {
-			continue;
-		}
-		MSG_WriteByte (&buf, svc_baseline);		
-		MSG_WriteDeltaEntity (&buf, &nullstate, ent, qtrue );
-	}
-
-	MSG_WriteByte( &buf, svc_EOF );
-	
-	// finished writing the gamestate stuff
-
-	// write the client num
-	MSG_WriteLong(&buf, clc.clientNum);
-	// write the checksum feed
-	MSG_WriteLong(&buf, clc.checksumFeed);
+	CL_WriteGamestate( &buf, clc.serverCommandSequence );
 
 	// finished writing the client packet
 	MSG_WriteByte( &buf, svc_EOF );
@@ -377,6 +398,8 @@ void CL_Record_f( void ) {
 	FS_Write (&len, 4, clc.demofile);
 	FS_Write (buf.data, buf.cursize, clc.demofile);
 
+	CL_DemoStartKeyframes( clc.demofile );
+
 	// the rest of the demo file will be copied from net messages
 }
 
@@ -402,6 +425,7 @@ void CL_DemoCompleted( void ) {
 			Com_Printf ("%i frames, %3.1f seconds: %3.1f fps\n", clc.timeDemoFrames,
 			time/1000.0, clc.timeDemoFrames*1000.0 / time);
 		}
+		CL_TimeDemoReport();
 	}
 
 	CL_Disconnect( qtrue );
@@ -424,6 +448,11 @@ void CL_ReadDemoMessage( void ) {
 		return;
 	}
 
+	if ( clc.svdemo ) {
+		CL_ReadServerDemoMessage();
+		return;
+	}
+
 	// get the sequence number
 	r = FS_Read( &s, 4, clc.demofile);
 	if ( r != 4 ) {
@@ -459,6 +488,10 @@ void CL_ReadDemoMessage( void ) {
 	clc.lastPacketTime = cls.realtime;
 	buf.readcount = 0;
 	CL_ParseServerMessage( &buf );
+
+	if ( clc.demoindexing ) {
+		CL_DemoIndexMessage( &buf );
+	}
 }
 
 /*
@@ -512,9 +545,19 @@ void CL_PlayDemo_f( void ) {
 	// open the demo file
 	arg = Cmd_Argv(1);
 	
+	// server demos are played from a client's point of view
+	if ( strstr( arg, "." SVDEMO_EXTENSION ) ) {
+		Com_sprintf( name, sizeof( name ), "demos/%s", arg );
+		FS_FOpenFileRead( name, &clc.demofile, qtrue );
+		clc.svdemo = qtrue;
+		CL_ServerDemoReset();
+	}
+
 	// check for an extension .dm_?? (?? is protocol)
 	ext_test = arg + (int)strlen(arg) - 6;
-	if ((strlen(arg) > 6) && (ext_test[0] == '.') && ((ext_test[1] == 'd') || (ext_test[1] == 'D')) && ((ext_test[2] == 'm') || (ext_test[2] == 'M')) && (ext_test[3] == '_'))
+	if ( clc.svdemo ) {
+		// already opened
+	} else if ((strlen(arg) > 6) && (ext_test[0] == '.') && ((ext_test[1] == 'd') || (ext_test[1] == 'D')) && ((ext_test[2] == 'm') || (ext_test[2] == 'M')) && (ext_test[3] == '_'))
 	{
 		protocol = atoi(ext_test+4);
 		i=0;
@@ -542,6 +585,10 @@ void CL_PlayDemo_f( void ) {
 		Com_Error( ERR_DROP, "couldn't open %s", name);
 		return;
 	}
+	if ( !clc.svdemo ) {
+		CL_DemoReadIndex( name );
+	}
+	CL_TimeDemoReset();
 	Q_strncpyz( clc.demoName, Cmd_Argv(1), sizeof( clc.demoName ) );
 
 	Con_Close();
@@ -732,6 +779,10 @@ void CL_Disconnect( qboolean showMainMenu ) {
 		CL_StopRecord_f ();
 	}
 
+	if ( clc.demoindexing ) {
+		CL_DemoIndexStop();
+	}
+
 	if (clc.download) {
 		FS_FCloseFile( clc.download );
 		clc.download = 0;
@@ -1195,6 +1246,8 @@ void CL_Vid_Restart_f( void ) {
 	CL_ShutdownCGame();
 	// shutdown the renderer and clear the renderer interface
 	CL_ShutdownRef();
+	// finish a frame decoding ahead while the back end is gone, r_smp may change
+	CIN_Shutdown();
 	// client is no longer pure untill new checksums are sent
 	CL_ResetPureClientAtServer();
 	// clear pak references
@@ -1995,11 +2048,14 @@ CL_Frame
 ==================
 */
 void CL_Frame ( int msec ) {
+	int		frameStart, soundStart;
 
 	if ( !com_cl_running->integer ) {
 		return;
 	}
 
+	frameStart = CL_TimeDemoBegin();
+
 	if ( cls.cddialog ) {
 		// bring up the cd error dialog if needed
 		cls.cddialog = qfalse;
@@ -2056,7 +2112,9 @@ void CL_Frame ( int msec ) {
 	SCR_UpdateScreen();
 
 	// update audio
+	soundStart = CL_TimeDemoBegin();
 	S_Update();
+	CL_TimeDemoEnd( TDP_SOUND, soundStart );
 
 	// advance local effects for next frame
 	SCR_RunCinematic();
@@ -2064,6 +2122,9 @@ void CL_Frame ( int msec ) {
 	Con_RunConsole();
 
 	cls.framecount++;
+
+	CL_TimeDemoEnd( TDP_FRAME, frameStart );
+	CL_TimeDemoEndFrame();
 }
 
 
@@ -2195,6 +2256,7 @@ void CL_InitRef( void ) {
 	ri.Printf = CL_RefPrintf;
 	ri.Error = Com_Error;
 	ri.Milliseconds = CL_ScaledMilliseconds;
+	ri.Microseconds = Sys_Microseconds;
 	ri.Malloc = CL_RefMalloc;
 	ri.Free = Z_Free;
 #ifdef HUNK_DEBUG
@@ -2292,6 +2354,8 @@ void CL_Init( void ) {
 	cl_activeAction = Cvar_Get( "activeAction", "", CVAR_TEMP );
 
 	cl_timedemo = Cvar_Get ("timedemo", "0", 0);
+	cl_timedemoLog = Cvar_Get ("cl_timedemoLog", "timedemo.csv", CVAR_ARCHIVE);
+	cl_demoKeyframes = Cvar_Get ("cl_demoKeyframes", "10", CVAR_ARCHIVE);
 	cl_avidemo = Cvar_Get ("cl_avidemo", "0", 0);
 	cl_forceavidemo = Cvar_Get ("cl_forceavidemo", "0", 0);
 
@@ -2321,6 +2385,8 @@ void CL_Init( void ) {
 	cl_inGameVideo = Cvar_Get ("r_inGameVideo", "1", CVAR_ARCHIVE);
 #endif
 
+	cl_cinThread = Cvar_Get ("cl_cinThread", "1", CVAR_ARCHIVE);
+
 	cl_serverStatusResendTime = Cvar_Get ("cl_serverStatusResendTime", "750", 0);
 
 	// init autoswitch so the ui will have it correctly even
@@ -2378,6 +2444,9 @@ void CL_Init( void ) {
 	Cmd_AddCommand ("disconnect", CL_Disconnect_f);
 	Cmd_AddCommand ("record", CL_Record_f);
 	Cmd_AddCommand ("demo", CL_PlayDemo_f);
+	Cmd_AddCommand ("demoseek", CL_DemoSeek_f);
+	Cmd_AddCommand ("demoindex", CL_DemoIndex_f);
+	Cmd_AddCommand ("svdemofollow", CL_ServerDemoFollow_f);
 	Cmd_AddCommand ("cinematic", CL_PlayCinematic_f);
 	Cmd_AddCommand ("stoprecord", CL_StopRecord_f);
 	Cmd_AddCommand ("connect", CL_Connect_f);
@@ -2423,6 +2492,7 @@ void CL_Shutdown( void ) {
 
 	CL_Disconnect( qtrue );
 
+	CIN_Shutdown();
 	S_Shutdown();
 	CL_ShutdownRef();
 	
@@ -2436,6 +2506,9 @@ void CL_Shutdown( void ) {
 	Cmd_RemoveCommand ("disconnect");
 	Cmd_RemoveCommand ("record");
 	Cmd_RemoveCommand ("demo");
+	Cmd_RemoveCommand ("demoseek");
+	Cmd_RemoveCommand ("demoindex");
+	Cmd_RemoveCommand ("svdemofollow");
 	Cmd_RemoveCommand ("cinematic");
 	Cmd_RemoveCommand ("stoprecord");
 	Cmd_RemoveCommand ("connect");
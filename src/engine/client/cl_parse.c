@@ -32,7 +32,9 @@ char *svc_strings[256] = {
 	"svc_baseline",	
 	"svc_serverCommand",
 	"svc_download",
-	"svc_snapshot"
+	"svc_snapshot",
+	"svc_EOF",
+	"svc_localSnapshot"
 };
 
 void SHOWNET( msg_t *msg, char *s) {
@@ -188,6 +190,8 @@ void CL_ParsePacketEntities( msg_t *msg, clSnapshot_t *oldframe, clSnapshot_t *n
 }
 
 
+static void CL_AcceptSnapshot( clSnapshot_t *newSnap );
+
 /*
 ================
 CL_ParseSnapshot
@@ -202,8 +206,6 @@ void CL_ParseSnapshot( msg_t *msg ) {
 	clSnapshot_t	*old;
 	clSnapshot_t	newSnap;
 	int			deltaNum;
-	int			oldMessageNum;
-	int			i, packetNum;
 
 	// get the reliable sequence acknowledge number
 	// NOTE: now sent with all server to client messages
@@ -275,21 +277,89 @@ void CL_ParseSnapshot( msg_t *msg ) {
 		return;
 	}
 
+	CL_AcceptSnapshot( &newSnap );
+}
+
+/*
+================
+CL_ParseLocalSnapshot
+
+A listen server copied the snapshot for us instead of encoding it
+================
+*/
+void CL_ParseLocalSnapshot( msg_t *msg ) {
+	const localSnapshot_t	*snap;
+	const entityState_t		*entities;
+	clSnapshot_t	newSnap;
+	int			sequence;
+	int			i;
+
+	if ( clc.netchan.remoteAddress.type != NA_LOOPBACK ) {
+		Com_Error( ERR_DROP, "CL_ParseLocalSnapshot: not a local server" );
+	}
+
+	sequence = MSG_ReadLong( msg );
+
+	snap = NET_GetLocalSnapshot( sequence );
+	entities = snap ? NET_LocalSnapshotEntities( snap ) : NULL;
+	if ( !entities ) {
+		// same as a dropped packet, the next one will be complete again
+		Com_DPrintf( "Local snapshot %i overwritten.\n", sequence );
+		return;
+	}
+
+	if ( snap->numEntities > MAX_PARSE_ENTITIES ) {
+		Com_Error( ERR_DROP, "CL_ParseLocalSnapshot: %i entities", snap->numEntities );
+	}
+
+	Com_Memset (&newSnap, 0, sizeof(newSnap));
+
+	newSnap.serverCommandNum = clc.serverCommandSequence;
+	newSnap.serverTime = snap->serverTime;
+	newSnap.messageNum = clc.serverMessageSequence;
+	newSnap.deltaNum = -1;
+	newSnap.snapFlags = snap->snapFlags;
+	newSnap.valid = qtrue;		// but not one to start a demo with, so demowaiting stays
+
+	Com_Memcpy( newSnap.areamask, snap->areabits, snap->areabytes );
+	newSnap.ps = snap->ps;
+
+	newSnap.parseEntitiesNum = cl.parseEntitiesNum;
+	newSnap.numEntities = snap->numEntities;
+	for ( i = 0 ; i < snap->numEntities ; i++ ) {
+		cl.parseEntities[cl.parseEntitiesNum & (MAX_PARSE_ENTITIES-1)] = entities[i];
+		cl.parseEntitiesNum++;
+	}
+
+	CL_AcceptSnapshot( &newSnap );
+}
+
+/*
+================
+CL_AcceptSnapshot
+
+Makes a valid new snapshot current
+================
+*/
+static void CL_AcceptSnapshot( clSnapshot_t *newSnap ) {
+	int			oldMessageNum;
+	int			i, packetNum;
+
 	// clear the valid flags of any snapshots between the last
 	// received and this one, so if there was a dropped packet
 	// it won't look like something valid to delta from next
 	// time we wrap around in the buffer
 	oldMessageNum = cl.snap.messageNum + 1;
 
-	if ( newSnap.messageNum - oldMessageNum >= PACKET_BACKUP ) {
-		oldMessageNum = newSnap.messageNum - ( PACKET_BACKUP - 1 );
+	if ( newSnap->messageNum - oldMessageNum >= PACKET_BACKUP ) {
+		oldMessageNum = newSnap->messageNum - ( PACKET_BACKUP - 1 );
 	}
-	for ( ; oldMessageNum < newSnap.messageNum ; oldMessageNum++ ) {
+	for ( ; oldMessageNum < newSnap->messageNum ; oldMessageNum++ ) {
 		cl.snapshots[oldMessageNum & PACKET_MASK].valid = qfalse;
 	}
 
 	// copy to the current good spot
-	cl.snap = newSnap;
+	cl.snap = *newSnap;
 	cl.snap.ping = 999;
 	// calculate ping time
 	for ( i = 0 ; i < PACKET_BACKUP ; i++ ) {
@@ -453,8 +523,10 @@ void CL_ParseGamestate( msg_t *msg ) {
   FS_ConditionalRestart( clc.checksumFeed );
 
 	// This used to call CL_StartHunkUsers, but now we enter the download state before loading the
-	// cgame
-	CL_InitDownloads();
+	// cgame.  A demo seek starts the cgame once it has read through to the time.
+	if ( !clc.demoseeking ) {
+		CL_InitDownloads();
+	}
 
 	// make sure the game starts
 	Cvar_Set( "cl_paused", "0" );
@@ -645,6 +717,9 @@ void CL_ParseServerMessage( msg_t *msg ) {
 		case svc_snapshot:
 			CL_ParseSnapshot( msg );
 			break;
+		case svc_localSnapshot:
+			CL_ParseLocalSnapshot( msg );
+			break;
 		case svc_download:
 			CL_ParseDownload( msg );
 			break;
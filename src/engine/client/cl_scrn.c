@@ -518,6 +518,7 @@ text to the screen.
 */
 void SCR_UpdateScreen( void ) {
 	static int	recursive;
+	int			frontEndUsec, backEndUsec;
 
 	if ( !scr_initialized ) {
 		return;				// not initialized yet
@@ -536,11 +537,14 @@ void SCR_UpdateScreen( void ) {
 		SCR_DrawScreenField( STEREO_CENTER );
 	}
 
+	frontEndUsec = backEndUsec = 0;
+	re.EndFrame( &frontEndUsec, &backEndUsec );
 	if ( com_speeds->integer ) {
-		re.EndFrame( &time_frontend, &time_backend );
-	} else {
-		re.EndFrame( NULL, NULL );
+		time_frontend = frontEndUsec / 1000;
+		time_backend = backEndUsec / 1000;
 	}
+	CL_TimeDemoAdd( TDP_FRONTEND, frontEndUsec );
+	CL_TimeDemoAdd( TDP_BACKEND, backEndUsec );
 
 	recursive = 0;
 }
@@ -0,0 +1,548 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// cl_svdemo.c -- playing back server demos from any client's point of view
+
+#include "client.h"
+
+/*
+===============================================================================
+
+A server demo, written by sv_demo.c, holds every client at once.  Each
+message of it is turned into the server message the followed client
+would have been sent, and handed to CL_ParseServerMessage, so the cgame
+can't tell it from a normal demo.
+
+The gamestate is given a free client slot as its client number and the
+followed client's playerstate is marked PMF_FOLLOW, the same as a
+spectator following someone on the server.  svdemofollow switches to
+another client; the next snapshot is then sent without delta.
+
+The server only sends what is in the PVS, which isn't known here, so
+everything in the frame that the client may see goes into the snapshot.
+When that is more than the cgame takes, the furthest entities that
+aren't brush models are left out.
+
+===============================================================================
+*/
+
+typedef struct {
+	int				checksumFeed;
+	int				pov;				// the client being followed
+	int				nextPov;			// -1 unless svdemofollow asked for one
+
+	entityState_t	baselines[MAX_GENTITIES];
+	entityState_t	entities[2][MAX_GENTITIES];	// this frame and the last, sorted by number
+	int				numEntities[2];
+	int				current;
+	byte			visMode[MAX_GENTITIES];		// SVDEMO_VIS_ or 0 for everyone
+	int				visClients[MAX_GENTITIES];
+
+	playerState_t	ps[MAX_CLIENTS];
+	qboolean		active[MAX_CLIENTS];
+
+	// the last snapshot given to the client, to delta from
+	entityState_t	sent[MAX_ENTITIES_IN_SNAPSHOT];
+	int				numSent;
+	playerState_t	sentPs;
+	int				sentSequence;		// 0 for none since the gamestate or a new pov
+
+	int				messageSequence;
+	int				commandSequence;
+} clServerDemo_t;
+
+static clServerDemo_t	csd;
+
+/*
+==================
+CL_ServerDemoReset
+
+Called when a server demo is opened
+==================
+*/
+void CL_ServerDemoReset( void ) {
+	Com_Memset( &csd, 0, sizeof( csd ) );
+	csd.pov = 0;
+	csd.nextPov = -1;
+}
+
+/*
+==================
+CL_ServerDemoCommand
+==================
+*/
+static void CL_ServerDemoCommand( msg_t *out, const char *cmd ) {
+	MSG_WriteByte( out, svc_serverCommand );
+	MSG_WriteLong( out, ++csd.commandSequence );
+	MSG_WriteString( out, cmd );
+}
+
+/*
+==================
+CL_ServerDemoConfigstring
+
+Sent as cs commands, split up the way SV_SetConfigstring does
+==================
+*/
+static void CL_ServerDemoConfigstring( msg_t *out, int index, const char *val ) {
+	int		maxChunkSize = MAX_STRING_CHARS - 24;
+	int		len, sent, remaining;
+	char	*cmd;
+	char	buf[MAX_STRING_CHARS];
+
+	len = (int)strlen( val );
+	if ( len < maxChunkSize ) {
+		CL_ServerDemoCommand( out, va( "cs %i \"%s\"\n", index, val ) );
+		return;
+	}
+
+	sent = 0;
+	remaining = len;
+	while ( remaining > 0 ) {
+		if ( sent == 0 ) {
+			cmd = "bcs0";
+		} else if ( remaining < maxChunkSize ) {
+			cmd = "bcs2";
+		} else {
+			cmd = "bcs1";
+		}
+		Q_strncpyz( buf, &val[sent], maxChunkSize );
+		CL_ServerDemoCommand( out, va( "%s %i \"%s\"\n", cmd, index, buf ) );
+
+		sent += maxChunkSize - 1;
+		remaining -= maxChunkSize - 1;
+	}
+}
+
+/*
+==================
+CL_ServerDemoGamestate
+==================
+*/
+static void CL_ServerDemoGamestate( msg_t *in, msg_t *out ) {
+	entityState_t	nullstate;
+	entityState_t	*es;
+	qboolean		used[MAX_CLIENTS];
+	int				cmd, index, newnum, maxclients, viewer;
+	char			*s;
+
+	maxclients = MSG_ReadLong( in );
+	csd.checksumFeed = MSG_ReadLong( in );
+	csd.sentSequence = 0;
+
+	Com_Memset( &nullstate, 0, sizeof( nullstate ) );
+	Com_Memset( used, 0, sizeof( used ) );
+
+	MSG_WriteByte( out, svc_gamestate );
+	MSG_WriteLong( out, csd.commandSequence );
+
+	while ( 1 ) {
+		cmd = MSG_ReadByte( in );
+		if ( cmd == svd_EOF ) {
+			break;
+		}
+
+		if ( cmd == svd_configstring ) {
+			index = MSG_ReadShort( in );
+			if ( index < 0 || index >= MAX_CONFIGSTRINGS ) {
+				Com_Error( ERR_DROP, "CL_ServerDemoGamestate: configstring > MAX_CONFIGSTRINGS" );
+			}
+			s = MSG_ReadBigString( in );
+			if ( index >= CS_PLAYERS && index < CS_PLAYERS + MAX_CLIENTS ) {
+				used[index - CS_PLAYERS] = (qboolean)( s[0] != 0 );
+			}
+			MSG_WriteByte( out, svc_configstring );
+			MSG_WriteShort( out, index );
+			MSG_WriteBigString( out, s );
+		} else if ( cmd == svd_baseline ) {
+			newnum = MSG_ReadBits( in, GENTITYNUM_BITS );
+			if ( newnum < 0 || newnum >= MAX_GENTITIES ) {
+				Com_Error( ERR_DROP, "CL_ServerDemoGamestate: baseline number out of range: %i", newnum );
+			}
+			es = &csd.baselines[newnum];
+			MSG_ReadDeltaEntity( in, &nullstate, es, newnum );
+			MSG_WriteByte( out, svc_baseline );
+			MSG_WriteDeltaEntity( out, &nullstate, es, qtrue );
+		} else {
+			Com_Error( ERR_DROP, "CL_ServerDemoGamestate: bad command byte" );
+		}
+	}
+
+	// the viewer takes a slot nobody can be in, above maxclients if there
+	// is one, or else the last one without a player
+	viewer = MAX_CLIENTS - 1;
+	if ( maxclients >= MAX_CLIENTS ) {
+		while ( viewer > 0 && used[viewer] ) {
+			viewer--;
+		}
+	}
+
+	MSG_WriteByte( out, svc_EOF );
+	MSG_WriteLong( out, viewer );
+	MSG_WriteLong( out, csd.checksumFeed );
+}
+
+/*
+==================
+CL_ServerDemoReadFrame
+==================
+*/
+static int CL_ServerDemoReadFrame( msg_t *in, int *snapFlags ) {
+	playerState_t	ps;
+	qboolean		wasActive[MAX_CLIENTS];
+	entityState_t	*to;
+	int				serverTime;
+	int				i, num;
+
+	serverTime = MSG_ReadLong( in );
+	*snapFlags = MSG_ReadByte( in );
+
+	for ( i = 0 ; i < MAX_CLIENTS ; i++ ) {
+		wasActive[i] = csd.active[i];
+		csd.active[i] = qfalse;
+	}
+	while ( 1 ) {
+		i = MSG_ReadByte( in );
+		if ( i == MAX_CLIENTS ) {
+			break;
+		}
+		if ( i < 0 || i >= MAX_CLIENTS ) {
+			Com_Error( ERR_DROP, "CL_ServerDemoReadFrame: bad client number %i", i );
+		}
+		MSG_ReadDeltaPlayerstate( in, wasActive[i] ? &csd.ps[i] : NULL, &ps );
+		csd.ps[i] = ps;
+		csd.active[i] = qtrue;
+	}
+
+	to = csd.entities[csd.current ^ 1];
+	num = MSG_ReadEntityList( in, csd.entities[csd.current], csd.numEntities[csd.current],
+		to, MAX_GENTITIES, csd.baselines );
+	csd.current ^= 1;
+	csd.numEntities[csd.current] = num;
+
+	Com_Memset( csd.visMode, 0, sizeof( csd.visMode ) );
+	while ( 1 ) {
+		num = MSG_ReadBits( in, GENTITYNUM_BITS );
+		if ( num == MAX_GENTITIES-1 ) {
+			break;
+		}
+		csd.visMode[num] = MSG_ReadBits( in, 2 );
+		csd.visClients[num] = MSG_ReadLong( in );
+	}
+
+	return serverTime;
+}
+
+/*
+==================
+CL_ServerDemoPickPov
+
+Keeps the followed client, unless it left or svdemofollow asked for
+another.  Returns qfalse if nobody is playing.
+==================
+*/
+static qboolean CL_ServerDemoPickPov( void ) {
+	int		i, n;
+
+	if ( csd.nextPov >= 0 ) {
+		if ( csd.active[csd.nextPov] && csd.nextPov != csd.pov ) {
+			csd.pov = csd.nextPov;
+			csd.sentSequence = 0;
+		}
+		csd.nextPov = -1;
+	}
+
+	if ( csd.active[csd.pov] ) {
+		return qtrue;
+	}
+
+	for ( i = 1 ; i <= MAX_CLIENTS ; i++ ) {
+		n = ( csd.pov + i ) % MAX_CLIENTS;
+		if ( csd.active[n] ) {
+			csd.pov = n;
+			csd.sentSequence = 0;
+			return qtrue;
+		}
+	}
+	return qfalse;
+}
+
+/*
+==================
+CL_ServerDemoVisible
+
+The same test SV_AddEntitiesVisibleFromPoint makes
+==================
+*/
+static qboolean CL_ServerDemoVisible( int num, int clientNum ) {
+	switch ( csd.visMode[num] ) {
+	case SVDEMO_VIS_SINGLE:
+		return (qboolean)( csd.visClients[num] == clientNum );
+	case SVDEMO_VIS_NOTSINGLE:
+		return (qboolean)( csd.visClients[num] != clientNum );
+	case SVDEMO_VIS_MASK:
+		return (qboolean)( clientNum < 32 && ( csd.visClients[num] & ( 1 << clientNum ) ) );
+	default:
+		return qtrue;
+	}
+}
+
+/*
+==================
+CL_ServerDemoDistanceCompare
+==================
+*/
+static float	csd_distance[MAX_GENTITIES];
+
+static int QDECL CL_ServerDemoDistanceCompare( const void *a, const void *b ) {
+	float	da, db;
+
+	da = csd_distance[*(const int *)a];
+	db = csd_distance[*(const int *)b];
+	if ( da < db ) {
+		return -1;
+	}
+	if ( da > db ) {
+		return 1;
+	}
+	return *(const int *)a - *(const int *)b;
+}
+
+/*
+==================
+CL_ServerDemoSnapshot
+
+Writes what the followed client would have been sent this frame
+==================
+*/
+static void CL_ServerDemoSnapshot( msg_t *out, int serverTime, int snapFlags ) {
+	static int		candidates[MAX_GENTITIES];
+	static byte		keep[MAX_GENTITIES];
+	static entityState_t	view[MAX_ENTITIES_IN_SNAPSHOT];
+	entityState_t	*es;
+	playerState_t	ps;
+	vec3_t			delta;
+	int				numCandidates, numView;
+	int				deltaNum, i;
+
+	ps = csd.ps[csd.pov];
+	ps.pm_flags |= PMF_FOLLOW;
+
+	numCandidates = 0;
+	for ( i = 0, es = csd.entities[csd.current] ; i < csd.numEntities[csd.current] ; i++, es++ ) {
+		// the followed client is the playerstate, the server leaves it out too
+		if ( es->number == ps.clientNum ) {
+			continue;
+		}
+		if ( CL_ServerDemoVisible( es->number, ps.clientNum ) ) {
+			candidates[numCandidates++] = i;
+		}
+	}
+
+	// too many for the cgame, keep the brush models and the closest of the rest
+	if ( numCandidates > MAX_ENTITIES_IN_SNAPSHOT ) {
+		for ( i = 0 ; i < numCandidates ; i++ ) {
+			es = &csd.entities[csd.current][candidates[i]];
+			if ( es->solid == SOLID_BMODEL ) {
+				csd_distance[candidates[i]] = -1;
+			} else {
+				VectorSubtract( es->pos.trBase, ps.origin, delta );
+				csd_distance[candidates[i]] = VectorLengthSquared( delta );
+			}
+		}
+		qsort( candidates, numCandidates, sizeof( candidates[0] ), CL_ServerDemoDistanceCompare );
+		Com_DPrintf( "CL_ServerDemoSnapshot: dropped %i entities\n", numCandidates - MAX_ENTITIES_IN_SNAPSHOT );
+
+		Com_Memset( keep, 0, csd.numEntities[csd.current] );
+		for ( i = 0 ; i < MAX_ENTITIES_IN_SNAPSHOT ; i++ ) {
+			keep[candidates[i]] = 1;
+		}
+		numCandidates = 0;
+		for ( i = 0 ; i < csd.numEntities[csd.current] ; i++ ) {
+			if ( keep[i] ) {
+				candidates[numCandidates++] = i;
+			}
+		}
+	}
+
+	numView = 0;
+	for ( i = 0 ; i < numCandidates ; i++ ) {
+		view[numView++] = csd.entities[csd.current][candidates[i]];
+	}
+
+	// delta from the last snapshot if the client still has it
+	deltaNum = 0;
+	if ( csd.sentSequence && csd.messageSequence - csd.sentSequence < PACKET_BACKUP - 3 ) {
+		deltaNum = csd.messageSequence - csd.sentSequence;
+	}
+
+	MSG_WriteByte( out, svc_snapshot );
+	MSG_WriteLong( out, serverTime );
+	MSG_WriteByte( out, deltaNum );
+	MSG_WriteByte( out, snapFlags );
+	MSG_WriteByte( out, 0 );		// no areamask, everything is drawn
+
+	if ( deltaNum ) {
+		MSG_WriteDeltaPlayerstate( out, &csd.sentPs, &ps );
+		MSG_WriteEntityList( out, csd.sent, csd.numSent, view, numView, csd.baselines );
+	} else {
+		MSG_WriteDeltaPlayerstate( out, NULL, &ps );
+		MSG_WriteEntityList( out, NULL, 0, view, numView, csd.baselines );
+	}
+
+	Com_Memcpy( csd.sent, view, numView * sizeof( view[0] ) );
+	csd.numSent = numView;
+	csd.sentPs = ps;
+	csd.sentSequence = csd.messageSequence;
+}
+
+/*
+==================
+CL_ReadServerDemoMessage
+
+Called by CL_ReadDemoMessage for server demos
+==================
+*/
+void CL_ReadServerDemoMessage( void ) {
+	static byte	inData[SVDEMO_MSGLEN];
+	static byte	outData[SVDEMO_MSGLEN * 2];
+	msg_t		in, out;
+	int			header[2];
+	int			cmd, index, target;
+	int			serverTime, snapFlags;
+	char		*s;
+
+	if ( FS_Read( header, sizeof( header ), clc.demofile ) != sizeof( header ) ) {
+		CL_DemoCompleted();
+		return;
+	}
+	MSG_Init( &in, inData, sizeof( inData ) );
+	in.cursize = LittleLong( header[1] );
+	if ( in.cursize == -1 ) {
+		CL_DemoCompleted();
+		return;
+	}
+	if ( in.cursize < 0 || in.cursize > in.maxsize ) {
+		Com_Error( ERR_DROP, "CL_ReadServerDemoMessage: demoMsglen > SVDEMO_MSGLEN" );
+	}
+	if ( FS_Read( in.data, in.cursize, clc.demofile ) != in.cursize ) {
+		Com_Printf( "Demo file was truncated.\n" );
+		CL_DemoCompleted();
+		return;
+	}
+
+	csd.messageSequence++;
+
+	MSG_Init( &out, outData, sizeof( outData ) );
+	MSG_Bitstream( &out );
+	MSG_WriteLong( &out, clc.reliableSequence );
+
+	while ( 1 ) {
+		if ( in.readcount > in.cursize ) {
+			Com_Error( ERR_DROP, "CL_ReadServerDemoMessage: read past end of demo message" );
+		}
+
+		cmd = MSG_ReadByte( &in );
+		if ( cmd == svd_EOF ) {
+			break;
+		}
+
+		switch ( cmd ) {
+		case svd_gamestate:
+			CL_ServerDemoGamestate( &in, &out );
+			break;
+		case svd_configstring:
+			index = MSG_ReadShort( &in );
+			s = MSG_ReadBigString( &in );
+			if ( cls.state >= CA_PRIMED ) {
+				CL_ServerDemoConfigstring( &out, index, s );
+			}
+			break;
+		case svd_serverCommand:
+			target = MSG_ReadByte( &in );
+			s = MSG_ReadString( &in );
+			if ( cls.state >= CA_PRIMED && ( target == 255 || target == csd.pov ) ) {
+				CL_ServerDemoCommand( &out, s );
+			}
+			break;
+		case svd_frame:
+			serverTime = CL_ServerDemoReadFrame( &in, &snapFlags );
+			if ( cls.state >= CA_PRIMED && CL_ServerDemoPickPov() ) {
+				CL_ServerDemoSnapshot( &out, serverTime, snapFlags );
+			}
+			break;
+		default:
+			Com_Error( ERR_DROP, "CL_ReadServerDemoMessage: illegible server demo message" );
+			break;
+		}
+	}
+
+	MSG_WriteByte( &out, svc_EOF );
+	if ( out.overflowed ) {
+		Com_Error( ERR_DROP, "CL_ReadServerDemoMessage: message overflowed" );
+	}
+
+	clc.serverMessageSequence = csd.messageSequence;
+	clc.lastPacketTime = cls.realtime;
+	CL_ParseServerMessage( &out );
+}
+
+/*
+==================
+CL_ServerDemoFollow_f
+
+svdemofollow [clientNum]
+
+Without a client number, goes on to the next one playing
+==================
+*/
+void CL_ServerDemoFollow_f( void ) {
+	const char	*info;
+	int			i, n;
+
+	if ( !clc.demoplaying || !clc.svdemo ) {
+		Com_Printf( "Not playing a server demo.\n" );
+		return;
+	}
+
+	if ( Cmd_Argc() > 1 ) {
+		n = atoi( Cmd_Argv( 1 ) );
+		if ( n < 0 || n >= MAX_CLIENTS || !csd.active[n] ) {
+			Com_Printf( "Client %s isn't playing.\n", Cmd_Argv( 1 ) );
+			return;
+		}
+	} else {
+		for ( i = 1 ; i <= MAX_CLIENTS ; i++ ) {
+			n = ( csd.pov + i ) % MAX_CLIENTS;
+			if ( csd.active[n] ) {
+				break;
+			}
+		}
+		if ( i > MAX_CLIENTS ) {
+			Com_Printf( "Nobody is playing.\n" );
+			return;
+		}
+	}
+
+	csd.nextPov = n;
+	info = cl.gameState.stringData + cl.gameState.stringOffsets[CS_PLAYERS + n];
+	Com_Printf( "following %i: %s\n", n, Info_ValueForKey( info, "n" ) );
+}
@@ -0,0 +1,288 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// cl_timedemo.c -- per frame timings of a timedemo
+
+#include "client.h"
+
+/*
+===============================================================================
+
+While a timedemo runs, every client frame is timed with Sys_Microseconds
+and split into the cgame, the renderer front and back end and sound.
+The frames are all kept, so the percentiles at the end are exact, and
+written out to cl_timedemoLog with the demo time they were drawn at.
+
+The front end runs inside the RE_RenderScene calls the cgame makes, so
+it is taken out of the cgame time.  With r_smp the back end time is
+from the frame before.
+
+===============================================================================
+*/
+
+#define	MAX_TIMEDEMO_FRAMES		32768	// 27 minutes of demo at 50 msec a frame
+#define	TIMEDEMO_WORST_FRAMES	10
+
+typedef struct {
+	int		demoTime;			// msec since the first snapshot
+	int		usec[TDP_NUM_PHASES];
+} timeDemoFrame_t;
+
+typedef struct {
+	int				frameTime[TDP_NUM_PHASES];
+	int				numFrames;
+	int				droppedFrames;
+	timeDemoFrame_t	frames[MAX_TIMEDEMO_FRAMES];
+} timeDemo_t;
+
+static timeDemo_t	td;
+
+static const char *td_phaseNames[TDP_NUM_PHASES] = {
+	"frame",
+	"cgame",
+	"frontend",
+	"backend",
+	"sound"
+};
+
+cvar_t	*cl_timedemoLog;
+
+/*
+==================
+CL_TimeDemoReset
+
+Called when a demo starts playing
+==================
+*/
+void CL_TimeDemoReset( void ) {
+	Com_Memset( td.frameTime, 0, sizeof( td.frameTime ) );
+	td.numFrames = 0;
+	td.droppedFrames = 0;
+}
+
+/*
+==================
+CL_TimeDemoBegin
+==================
+*/
+int CL_TimeDemoBegin( void ) {
+	if ( !cl_timedemo->integer || !clc.demoplaying ) {
+		return 0;
+	}
+	return Sys_Microseconds();
+}
+
+/*
+==================
+CL_TimeDemoEnd
+
+Adds the time since start, as returned by CL_TimeDemoBegin, to the phase
+==================
+*/
+void CL_TimeDemoEnd( timeDemoPhase_t phase, int start ) {
+	if ( !start ) {
+		return;
+	}
+	td.frameTime[phase] += Sys_Microseconds() - start;
+}
+
+/*
+==================
+CL_TimeDemoAdd
+
+For times measured somewhere else, like the renderer
+==================
+*/
+void CL_TimeDemoAdd( timeDemoPhase_t phase, int usec ) {
+	if ( !cl_timedemo->integer || !clc.demoplaying ) {
+		return;
+	}
+	td.frameTime[phase] += usec;
+}
+
+/*
+==================
+CL_TimeDemoEndFrame
+
+Called at the end of CL_Frame
+==================
+*/
+void CL_TimeDemoEndFrame( void ) {
+	timeDemoFrame_t	*frame;
+	int				i;
+
+	// only the frames the timedemo counts, not the level load
+	if ( cl_timedemo->integer && clc.demoplaying && cls.state == CA_ACTIVE && clc.timeDemoStart ) {
+		if ( td.numFrames < MAX_TIMEDEMO_FRAMES ) {
+			frame = &td.frames[td.numFrames++];
+			frame->demoTime = cl.serverTime - clc.timeDemoBaseTime;
+			for ( i = 0 ; i < TDP_NUM_PHASES ; i++ ) {
+				frame->usec[i] = td.frameTime[i];
+			}
+			frame->usec[TDP_CGAME] -= frame->usec[TDP_FRONTEND];
+			if ( frame->usec[TDP_CGAME] < 0 ) {
+				frame->usec[TDP_CGAME] = 0;
+			}
+		} else {
+			td.droppedFrames++;
+		}
+	}
+
+	Com_Memset( td.frameTime, 0, sizeof( td.frameTime ) );
+}
+
+/*
+==================
+CL_TimeDemoCompare
+==================
+*/
+static int QDECL CL_TimeDemoCompare( const void *a, const void *b ) {
+	return *(const int *)a - *(const int *)b;
+}
+
+/*
+==================
+CL_TimeDemoPercentile
+
+Nearest rank, so it is always a frame that really happened
+==================
+*/
+static int CL_TimeDemoPercentile( const int *sorted, int count, float fraction ) {
+	int		rank;
+
+	rank = (int)ceil( count * fraction );
+	if ( rank < 1 ) {
+		rank = 1;
+	}
+	if ( rank > count ) {
+		rank = count;
+	}
+	return sorted[rank - 1];
+}
+
+/*
+==================
+CL_TimeDemoWriteLog
+==================
+*/
+static void CL_TimeDemoWriteLog( void ) {
+	timeDemoFrame_t	*frame;
+	fileHandle_t	f;
+	int				i;
+
+	if ( !cl_timedemoLog->string[0] ) {
+		return;
+	}
+
+	f = FS_FOpenFileWrite( cl_timedemoLog->string );
+	if ( !f ) {
+		Com_Printf( "WARNING: couldn't open %s\n", cl_timedemoLog->string );
+		return;
+	}
+
+	FS_Printf( f, "frame,demo_msec,frame_us,cgame_us,frontend_us,backend_us,sound_us\n" );
+	for ( i = 0, frame = td.frames ; i < td.numFrames ; i++, frame++ ) {
+		FS_Printf( f, "%i,%i,%i,%i,%i,%i,%i\n", i, frame->demoTime,
+			frame->usec[TDP_FRAME], frame->usec[TDP_CGAME], frame->usec[TDP_FRONTEND],
+			frame->usec[TDP_BACKEND], frame->usec[TDP_SOUND] );
+	}
+
+	FS_FCloseFile( f );
+	Com_Printf( "frame times written to %s\n", cl_timedemoLog->string );
+}
+
+/*
+==================
+CL_TimeDemoReport
+
+Called from CL_DemoCompleted after a timedemo
+==================
+*/
+void CL_TimeDemoReport( void ) {
+	timeDemoFrame_t	*frame;
+	int				worst[TIMEDEMO_WORST_FRAMES];
+	int				numWorst;
+	int				*sorted;
+	double			total;
+	int				i, j, phase;
+
+	if ( !td.numFrames ) {
+		return;
+	}
+
+	sorted = (int *)Z_Malloc( td.numFrames * sizeof( *sorted ) );
+
+	Com_Printf( "phase        mean      p50      p90      p99    p99.9      max (msec)\n" );
+	for ( phase = 0 ; phase < TDP_NUM_PHASES ; phase++ ) {
+		total = 0;
+		for ( i = 0 ; i < td.numFrames ; i++ ) {
+			sorted[i] = td.frames[i].usec[phase];
+			total += sorted[i];
+		}
+		qsort( sorted, td.numFrames, sizeof( *sorted ), CL_TimeDemoCompare );
+
+		Com_Printf( "%-9s %7.3f  %7.3f  %7.3f  %7.3f  %7.3f  %7.3f\n", td_phaseNames[phase],
+			total / td.numFrames * 0.001,
+			CL_TimeDemoPercentile( sorted, td.numFrames, 0.5f ) * 0.001,
+			CL_TimeDemoPercentile( sorted, td.numFrames, 0.9f ) * 0.001,
+			CL_TimeDemoPercentile( sorted, td.numFrames, 0.99f ) * 0.001,
+			CL_TimeDemoPercentile( sorted, td.numFrames, 0.999f ) * 0.001,
+			sorted[td.numFrames - 1] * 0.001 );
+	}
+
+	Z_Free( sorted );
+
+	// keep the slowest frames in order, slowest first
+	numWorst = 0;
+	for ( i = 0 ; i < td.numFrames ; i++ ) {
+		for ( j = numWorst ; j > 0 ; j-- ) {
+			if ( td.frames[worst[j - 1]].usec[TDP_FRAME] >= td.frames[i].usec[TDP_FRAME] ) {
+				break;
+			}
+			if ( j < TIMEDEMO_WORST_FRAMES ) {
+				worst[j] = worst[j - 1];
+			}
+		}
+		if ( j < TIMEDEMO_WORST_FRAMES ) {
+			worst[j] = i;
+			if ( numWorst < TIMEDEMO_WORST_FRAMES ) {
+				numWorst++;
+			}
+		}
+	}
+
+	Com_Printf( "\nslowest frames:\n" );
+	Com_Printf( " frame  demo time    frame    cgame frontend  backend    sound (msec)\n" );
+	for ( i = 0 ; i < numWorst ; i++ ) {
+		frame = &td.frames[worst[i]];
+		Com_Printf( "%6i  %3i:%02i.%03i  %7.3f  %7.3f  %7.3f  %7.3f  %7.3f\n", worst[i],
+			frame->demoTime / 60000, ( frame->demoTime / 1000 ) % 60, frame->demoTime % 1000,
+			frame->usec[TDP_FRAME] * 0.001, frame->usec[TDP_CGAME] * 0.001,
+			frame->usec[TDP_FRONTEND] * 0.001, frame->usec[TDP_BACKEND] * 0.001,
+			frame->usec[TDP_SOUND] * 0.001 );
+	}
+
+	if ( td.droppedFrames ) {
+		Com_Printf( "%i frames past the first %i were not kept\n", td.droppedFrames, MAX_TIMEDEMO_FRAMES );
+	}
+
+	CL_TimeDemoWriteLog();
+}
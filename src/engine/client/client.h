@@ -196,6 +196,9 @@ typedef struct {
 	qboolean	demorecording;
 	qboolean	demoplaying;
 	qboolean	demowaiting;	// don't record until a non-delta message is received
+	qboolean	demoindexing;	// copying the demo being played with new keyframes
+	qboolean	demoseeking;	// the cgame isn't started until the seek is done
+	qboolean	svdemo;			// playing a server demo through cl_svdemo.c
 	qboolean	firstDemoFrameSkipped;
 	fileHandle_t	demofile;
 
@@ -342,12 +345,14 @@ extern	cvar_t	*m_side;
 extern	cvar_t	*m_filter;
 
 extern	cvar_t	*cl_timedemo;
+extern	cvar_t	*cl_demoKeyframes;
 
 extern	cvar_t	*cl_activeAction;
 
 extern	cvar_t	*cl_allowDownload;
 extern	cvar_t	*cl_conXOffset;
 extern	cvar_t	*cl_inGameVideo;
+extern	cvar_t	*cl_cinThread;
 
 //=================================================
 
@@ -368,6 +373,9 @@ void CL_Snd_Restart_f (void);
 void CL_StartDemoLoop( void );
 void CL_NextDemo( void );
 void CL_ReadDemoMessage( void );
+void CL_DemoCompleted( void );
+void CL_PlayDemo_f( void );
+void CL_WriteGamestate( msg_t *msg, int serverCommandSequence );
 
 void CL_InitDownloads(void);
 void CL_NextDownload(void);
@@ -383,6 +391,50 @@ qboolean CL_CDKeyValidate( const char *key, const char *checksum );
 int CL_ServerStatus( char *serverAddress, char *serverStatusString, int maxLen );
 
 
+//
+// cl_demo
+//
+void CL_DemoStartKeyframes( fileHandle_t demofile );
+void CL_DemoKeyframe( void );
+void CL_DemoFinishKeyframes( void );
+void CL_DemoReadIndex( const char *name );
+void CL_DemoIndexMessage( msg_t *msg );
+void CL_DemoIndexStop( void );
+void CL_DemoSeek_f( void );
+void CL_DemoIndex_f( void );
+
+
+//
+// cl_svdemo
+//
+void CL_ServerDemoReset( void );
+void CL_ReadServerDemoMessage( void );
+void CL_ServerDemoFollow_f( void );
+
+
+//
+// cl_timedemo
+//
+typedef enum {
+	TDP_FRAME,			// all of CL_Frame
+	TDP_CGAME,			// CG_DRAW_ACTIVE_FRAME less the front end it calls
+	TDP_FRONTEND,
+	TDP_BACKEND,
+	TDP_SOUND,
+
+	TDP_NUM_PHASES
+} timeDemoPhase_t;
+
+extern	cvar_t	*cl_timedemoLog;
+
+void CL_TimeDemoReset( void );
+int CL_TimeDemoBegin( void );
+void CL_TimeDemoEnd( timeDemoPhase_t phase, int start );
+void CL_TimeDemoAdd( timeDemoPhase_t phase, int usec );
+void CL_TimeDemoEndFrame( void );
+void CL_TimeDemoReport( void );
+
+
 //
 // cl_input
 //
@@ -487,6 +539,7 @@ void CIN_SetExtents (int handle, int x, int y, int w, int h);
 void CIN_SetLooping (int handle, qboolean loop);
 void CIN_UploadCinematic(int handle);
 void CIN_CloseAllVideos(void);
+void CIN_Shutdown( void );
 
 //
 // cl_cgame.c
@@ -498,6 +551,7 @@ void CL_CGameRendering( stereoFrame_t stereo );
 void CL_SetCGameTime( void );
 void CL_FirstSnapshot( void );
 void CL_ShaderStateChanged(void);
+void CL_ConfigstringModified( void );
 
 //
 // cl_ui.c
@@ -39,11 +39,50 @@ void S_Music_f(void);
 void S_Update_();
 void S_StopAllSounds(void);
 void S_UpdateBackgroundTrack( void );
-
-static fileHandle_t s_backgroundFile;
-static wavinfo_t	s_backgroundInfo;
+static void S_MixerClearSoundBuffer( void );
+static void S_StartMixer( void );
+static void S_StopMixer( void );
+static void S_RunCommands( void );
+static void S_StartMusicStream( void );
+static void S_StopMusicStream( void );
+
+#define	MUSIC_BUFFER_SAMPLES	0x20000		// stereo samples at dma.speed, must be a power of two
+#define	MUSIC_READ_BYTES		0x4000		// read from the file at a time
+#define	MUSIC_STREAM_MSEC		20
+
+typedef struct {
+	fileHandle_t	file;
+	wavinfo_t		info;
+	int				samples;		// left to read
+} musicFile_t;
+
+// see S_UpdateBackgroundTrack
+typedef struct {
+	qboolean		active;			// a track is playing or draining
+	qboolean		threaded;
+	void			*thread;
+	void			*lock;			// held while decoding and to change tracks
+	volatile int	shutdown;
+
+	musicFile_t		current;		// only touched under the lock
+	volatile int	playing;		// current has a file
+	musicFile_t		next;			// the main thread opens it while nextReady is 0
+	volatile int	nextReady;
+	volatile int	finished;		// a file the decoder is done with, the main thread closes it
+	volatile int	failed;			// a read came up short
+
+	int				position;		// 16.16, into the raw samples not resampled yet
+	byte			raw[MUSIC_READ_BYTES];
+
+	short			buffer[MUSIC_BUFFER_SAMPLES*2];
+	volatile int	head;			// samples decoded, only the decoder moves it
+	volatile int	tail;			// samples taken, only the main thread moves it
+
+	int				underruns;
+} sndMusic_t;
+
+static sndMusic_t	s_music;
 //int			s_nextWavChunk;
-static int			s_backgroundSamples;
 static char		s_backgroundLoop[MAX_QPATH];
 //static char		s_backgroundMusic[MAX_QPATH]; //TTimo: unused
 
@@ -91,14 +130,159 @@ cvar_t		*s_mixPreStep;
 cvar_t		*s_musicVolume;
 cvar_t		*s_separation;
 cvar_t		*s_doppler;
+cvar_t		*s_mixThread;
+cvar_t		*s_nullDevice;
+cvar_t		*s_asyncLoad;
+cvar_t		*s_musicThread;
 
 static loopSound_t		loopSounds[MAX_GENTITIES];
 static	channel_t		*freelist = NULL;
 
-int						s_rawend;
+volatile int			s_rawend;
 portable_samplepair_t	s_rawsamples[MAX_RAW_SAMPLES];
 
 
+/*
+===============================================================================
+
+MIXER THREAD
+
+The channels, the looping sounds and the listener belong to the mixer,
+which has a thread of its own with s_mixThread 1.  The calls the client
+makes into them only queue a command, in a ring that the main thread
+alone writes and the mixer alone reads, so neither waits for the other.
+Every SND_MIXER_MSEC the mixer runs the commands in order, then tracks
+the DMA position and paints, so a long client frame no longer starves
+the DMA buffer.
+
+Sound data is still loaded and freed on the main thread, under
+s_mixer.lock, which the mixer holds while it runs.  Music and cinematic
+samples go through s_rawsamples as before, with s_rawend only moved
+after the samples are in.
+
+With s_mixThread 0, S_Update runs the commands and mixes on the main
+thread, the way it always did.
+
+===============================================================================
+*/
+
+#define	SND_COMMANDS		4096		// must be a power of two
+#define	SND_MIXER_MSEC		5
+
+typedef enum {
+	SND_CMD_START_SOUND,
+	SND_CMD_STOP_LOOP,
+	SND_CMD_CLEAR_LOOPS,
+	SND_CMD_ADD_LOOP,
+	SND_CMD_ADD_REAL_LOOP,
+	SND_CMD_UPDATE_ENTITY,
+	SND_CMD_RESPATIALIZE,
+	SND_CMD_CLEAR_BUFFER
+} sndCommandType_t;
+
+typedef struct {
+	sndCommandType_t	type;
+	int					time;			// Com_Milliseconds when queued, for starts and respatializes
+	int					entityNum;
+	int					value;			// entchannel, killall or cls.framecount
+	sfxHandle_t			sfx;
+	qboolean			fixedOrigin;
+	vec3_t				origin;
+	vec3_t				velocity;
+	vec3_t				axis[3];
+} sndCommand_t;
+
+typedef struct {
+	qboolean		threaded;
+	void			*thread;
+	void			*lock;
+	volatile int	shutdown;
+	volatile int	failed;			// the device failed on the mixer thread, S_Update shuts down
+	volatile int	timeWrapped;	// s_paintedtime was chopped, S_Update resets s_rawend
+
+	sndCommand_t	commands[SND_COMMANDS];
+	volatile int	head;			// commands queued, only the main thread moves it
+	volatile int	tail;			// commands run, only the mixer moves it
+	int				time;			// of the command being run
+
+	int				stalls;			// times the main thread waited for a full ring
+	volatile int	dropped;		// sounds that found no channel
+	int				listener;		// the main thread's copy of listener_number
+} sndMixer_t;
+
+static sndMixer_t	s_mixer;
+static __declspec( thread ) qboolean	s_onMixer;
+
+// the null device paints into memory at the speed a real one would play
+typedef struct {
+	qboolean		active;
+	int				startTime;
+} sndNullDevice_t;
+
+static sndNullDevice_t	s_null;
+
+/*
+================
+S_LockMixer
+
+Keeps the mixer out while sound data is loaded or freed
+================
+*/
+void S_LockMixer( void ) {
+	if ( s_mixer.lock ) {
+		Sys_LockMutex( s_mixer.lock );
+	}
+}
+
+/*
+================
+S_UnlockMixer
+================
+*/
+void S_UnlockMixer( void ) {
+	if ( s_mixer.lock ) {
+		Sys_UnlockMutex( s_mixer.lock );
+	}
+}
+
+/*
+================
+S_NewCommand
+
+Returns the next free slot in the ring, which S_QueueCommand hands to the mixer
+================
+*/
+static sndCommand_t *S_NewCommand( sndCommandType_t type ) {
+	sndCommand_t	*cmd;
+
+	while ( s_mixer.head - s_mixer.tail >= SND_COMMANDS ) {
+		if ( !s_mixer.threaded ) {
+			S_LockMixer();
+			S_RunCommands();
+			S_UnlockMixer();
+			break;
+		}
+		s_mixer.stalls++;
+		Sys_Sleep( 1 );
+	}
+
+	cmd = &s_mixer.commands[ s_mixer.head & ( SND_COMMANDS - 1 ) ];
+	Com_Memset( cmd, 0, sizeof( *cmd ) );
+	cmd->type = type;
+	return cmd;
+}
+
+/*
+================
+S_QueueCommand
+================
+*/
+static void S_QueueCommand( void ) {
+	// the command is all written before the mixer can see it
+	Sys_AtomicAdd( &s_mixer.head, 1 );
+}
+
+
 // ====================================================================
 // User-setable variables
 // ====================================================================
@@ -119,8 +303,15 @@ void S_SoundInfo_f(void) {
 		Com_Printf("%5d submission_chunk\n", dma.submission_chunk);
 		Com_Printf("%5d speed\n", dma.speed);
 		Com_Printf("0x%x dma buffer\n", dma.buffer);
-		if ( s_backgroundFile ) {
+		Com_Printf("%s device, mixing on the %s thread\n", s_null.active ? "null" : "sound",
+			s_mixer.threaded ? "mixer" : "main" );
+		if ( s_mixer.stalls ) {
+			Com_Printf("%5d waits for a full command ring\n", s_mixer.stalls);
+		}
+		if ( s_music.active ) {
 			Com_Printf("Background file: %s\n", s_backgroundLoop );
+			Com_Printf("%5d music underruns, streaming on the %s thread\n", s_music.underruns,
+				s_music.threaded ? "music" : "main" );
 		} else {
 			Com_Printf("No background file.\n" );
 		}
@@ -131,6 +322,110 @@ void S_SoundInfo_f(void) {
 
 
 
+/*
+===============================================================================
+
+DEVICE
+
+===============================================================================
+*/
+
+/*
+================
+S_NullDeviceInit
+
+s_nullDevice 1 plays into memory, so the mixer runs without sound hardware
+================
+*/
+static qboolean S_NullDeviceInit( void ) {
+	Com_Memset( &dma, 0, sizeof( dma ) );
+
+	if ( s_khz->integer == 44 ) {
+		dma.speed = 44100;
+	} else if ( s_khz->integer == 11 ) {
+		dma.speed = 11025;
+	} else {
+		dma.speed = 22050;
+	}
+	dma.channels = 2;
+	dma.samplebits = 16;
+	dma.samples = dma.speed >= 44100 ? 0x10000 : 0x8000;
+	dma.submission_chunk = 1;
+	dma.buffer = (byte *)Z_Malloc( dma.samples * dma.samplebits / 8 );
+
+	s_null.active = qtrue;
+	s_null.startTime = Sys_Milliseconds();
+
+	Com_Printf( "using the null sound device\n" );
+	return qtrue;
+}
+
+/*
+================
+S_DeviceInit
+================
+*/
+static qboolean S_DeviceInit( void ) {
+	if ( s_nullDevice->integer ) {
+		return S_NullDeviceInit();
+	}
+	return SNDDMA_Init();
+}
+
+/*
+================
+S_DeviceShutdown
+================
+*/
+static void S_DeviceShutdown( void ) {
+	if ( !s_null.active ) {
+		SNDDMA_Shutdown();
+		return;
+	}
+
+	Z_Free( dma.buffer );
+	Com_Memset( &dma, 0, sizeof( dma ) );
+	s_null.active = qfalse;
+}
+
+/*
+================
+S_DeviceGetDMAPos
+================
+*/
+static int S_DeviceGetDMAPos( void ) {
+	double	played;
+
+	if ( !s_null.active ) {
+		return SNDDMA_GetDMAPos();
+	}
+
+	played = (double)( Sys_Milliseconds() - s_null.startTime ) * dma.speed / 1000;
+	return ( (int)fmod( played, dma.samples / dma.channels ) * dma.channels ) & ( dma.samples - 1 );
+}
+
+/*
+================
+S_DeviceBeginPainting
+================
+*/
+static void S_DeviceBeginPainting( void ) {
+	if ( !s_null.active ) {
+		SNDDMA_BeginPainting();
+	}
+}
+
+/*
+================
+S_DeviceSubmit
+================
+*/
+static void S_DeviceSubmit( void ) {
+	if ( !s_null.active ) {
+		SNDDMA_Submit();
+	}
+}
+
 /*
 ================
 S_Init
@@ -152,6 +447,12 @@ void S_Init( void ) {
 	s_mixPreStep = Cvar_Get ("s_mixPreStep", "0.05", CVAR_ARCHIVE);
 	s_show = Cvar_Get ("s_show", "0", CVAR_CHEAT);
 	s_testsound = Cvar_Get ("s_testsound", "0", CVAR_CHEAT);
+	s_mixThread = Cvar_Get ("s_mixThread", "1", CVAR_ARCHIVE);
+	s_nullDevice = Cvar_Get ("s_nullDevice", "0", 0);
+	s_asyncLoad = Cvar_Get ("s_asyncLoad", "1", CVAR_ARCHIVE);
+	s_musicThread = Cvar_Get ("s_musicThread", "1", CVAR_ARCHIVE);
+	s_mixSimd = Cvar_Get ("s_mixSimd", "1", CVAR_ARCHIVE);
+	S_InitMixPath();
 
 	cv = Cvar_Get ("s_initsound", "1", 0);
 	if ( !cv->integer ) {
@@ -165,8 +466,9 @@ void S_Init( void ) {
 	Cmd_AddCommand("s_list", S_SoundList_f);
 	Cmd_AddCommand("s_info", S_SoundInfo_f);
 	Cmd_AddCommand("s_stop", S_StopAllSounds);
+	Cmd_AddCommand("s_mixbench", S_MixBench_f);
 
-	r = SNDDMA_Init();
+	r = S_DeviceInit();
 	Com_Printf("------------------------------------\n");
 
 	if ( r ) {
@@ -179,6 +481,9 @@ void S_Init( void ) {
 		s_soundtime = 0;
 		s_paintedtime = 0;
 
+		S_StartMixer();
+		S_StartMusicStream();
+
 		S_StopAllSounds ();
 
 		S_SoundInfo_f();
@@ -200,7 +505,7 @@ channel_t*	S_ChannelMalloc() {
 	}
 	v = freelist;
 	freelist = *(channel_t **)freelist;
-	v->allocTime = Com_Milliseconds();
+	v->allocTime = s_mixer.time;
 	return v;
 }
 
@@ -218,7 +523,9 @@ void S_ChannelSetup() {
 	
 	*(channel_t **)q = NULL;
 	freelist = p + MAX_CHANNELS - 1;
-	Com_DPrintf("Channel memory manager started\n");
+	if ( !s_onMixer ) {
+		Com_DPrintf("Channel memory manager started\n");
+	}
 }
 
 // =======================================================================
@@ -230,7 +537,20 @@ void S_Shutdown( void ) {
 		return;
 	}
 
-	SNDDMA_Shutdown();
+	// SNDDMA_BeginPainting shuts down when the device fails, S_Update finishes it
+	if ( s_onMixer ) {
+		s_mixer.failed = qtrue;
+		return;
+	}
+
+	// the jobs resample at dma.speed
+	S_FinishSoundLoads( qtrue );
+
+	S_StopMusicStream();
+
+	S_StopMixer();
+
+	S_DeviceShutdown();
 
 	s_soundStarted = 0;
 
@@ -239,6 +559,7 @@ void S_Shutdown( void ) {
 	Cmd_RemoveCommand("stopsound");
 	Cmd_RemoveCommand("soundlist");
 	Cmd_RemoveCommand("soundinfo");
+	Cmd_RemoveCommand("s_mixbench");
 }
 
 
@@ -371,7 +692,9 @@ void S_BeginRegistration( void ) {
 	s_soundMuted = qfalse;		// we can play again
 
 	if (s_numSfx == 0) {
+		S_LockMixer();
 		SND_setup();
+		S_UnlockMixer();
 
 		s_numSfx = 0;
 		Com_Memset( s_knownSfx, 0, sizeof( s_knownSfx ) );
@@ -403,7 +726,7 @@ sfxHandle_t	S_RegisterSound( const char *name, qboolean compressed ) {
 	}
 
 	sfx = S_FindName( name );
-	if ( sfx->soundData ) {
+	if ( sfx->soundData || sfx->load ) {
 		if ( sfx->defaultSound ) {
 			Com_Printf( S_COLOR_YELLOW "WARNING: could not find %s - using default\n", sfx->soundName );
 			return 0;
@@ -414,7 +737,16 @@ sfxHandle_t	S_RegisterSound( const char *name, qboolean compressed ) {
 	sfx->inMemory = qfalse;
 	sfx->soundCompressed = compressed;
 
-  S_memoryLoad(sfx);
+	// resample on a job thread while the level loads, without workers
+	// the job wouldn't run until someone waited for it
+	if ( s_asyncLoad->integer && !compressed && Com_JobThreadCount() > 1 ) {
+		if ( !S_LoadSoundAsync( sfx ) ) {
+			sfx->defaultSound = qtrue;
+		}
+		sfx->inMemory = qtrue;
+	} else {
+		S_memoryLoad(sfx);
+	}
 
 	if ( sfx->defaultSound ) {
 		Com_Printf( S_COLOR_YELLOW "WARNING: could not find %s - using default\n", sfx->soundName );
@@ -425,12 +757,17 @@ sfxHandle_t	S_RegisterSound( const char *name, qboolean compressed ) {
 }
 
 void S_memoryLoad(sfx_t	*sfx) {
+	// loading can free the oldest sound, which the mixer may be playing
+	S_LockMixer();
+
 	// load the sound file
 	if ( !S_LoadSound ( sfx ) ) {
 //		Com_Printf( S_COLOR_YELLOW "WARNING: couldn't load sound: %s\n", sfx->soundName );
 		sfx->defaultSound = qtrue;
 	}
 	sfx->inMemory = qtrue;
+
+	S_UnlockMixer();
 }
 
 //=============================================================================
@@ -502,43 +839,21 @@ void S_SpatializeOrigin (vec3_t origin, int master_vol, int *left_vol, int *righ
 
 /*
 ====================
-S_StartSound
+S_MixerStartSound
 
-Validates the parms and ques the sound up
-if pos is NULL, the sound will be dynamically sourced from the entity
-Entchannel 0 will never override a playing sound
+Picks a channel for a SND_CMD_START_SOUND
 ====================
 */
-void S_StartSound(vec3_t origin, int entityNum, int entchannel, sfxHandle_t sfxHandle ) {
+static void S_MixerStartSound( const sndCommand_t *cmd ) {
 	channel_t	*ch;
 	sfx_t		*sfx;
+	int			entityNum;
   int i, oldest, chosen, time;
   int	inplay, allowed;
 
-	if ( !s_soundStarted || s_soundMuted ) {
-		return;
-	}
-
-	if ( !origin && ( entityNum < 0 || entityNum > MAX_GENTITIES ) ) {
-		Com_Error( ERR_DROP, "S_StartSound: bad entitynum %i", entityNum );
-	}
-
-	if ( sfxHandle < 0 || sfxHandle >= s_numSfx ) {
-		Com_Printf( S_COLOR_YELLOW, "S_StartSound: handle %i out of range\n", sfxHandle );
-		return;
-	}
-
-	sfx = &s_knownSfx[ sfxHandle ];
-
-	if (sfx->inMemory == qfalse) {
-		S_memoryLoad(sfx);
-	}
-
-	if ( s_show->integer == 1 ) {
-		Com_Printf( "%i : %s\n", s_paintedtime, sfx->soundName );
-	}
-
-	time = Com_Milliseconds();
+	sfx = &s_knownSfx[ cmd->sfx ];
+	entityNum = cmd->entityNum;
+	time = cmd->time;
 
 //	Com_Printf("playing %s\n", sfx->soundName);
 	// pick a channel to play on
@@ -598,7 +913,8 @@ void S_StartSound(vec3_t origin, int entityNum, int entchannel, sfxHandle_t sfxH
 					}
 				}
 				if (chosen == -1) {
-					Com_Printf("dropping sound\n");
+					// printed by S_Update, the console isn't for this thread
+					Sys_AtomicAdd( &s_mixer.dropped, 1 );
 					return;
 				}
 			}
@@ -607,8 +923,8 @@ void S_StartSound(vec3_t origin, int entityNum, int entchannel, sfxHandle_t sfxH
 		ch->allocTime = sfx->lastTimeUsed;
 	}
 
-	if (origin) {
-		VectorCopy (origin, ch->origin);
+	if (cmd->fixedOrigin) {
+		VectorCopy (cmd->origin, ch->origin);
 		ch->fixed_origin = qtrue;
 	} else {
 		ch->fixed_origin = qfalse;
@@ -618,12 +934,65 @@ void S_StartSound(vec3_t origin, int entityNum, int entchannel, sfxHandle_t sfxH
 	ch->entnum = entityNum;
 	ch->thesfx = sfx;
 	ch->startSample = START_SAMPLE_IMMEDIATE;
-	ch->entchannel = entchannel;
+	ch->entchannel = cmd->value;
 	ch->leftvol = ch->master_vol;		// these will get calced at next spatialize
 	ch->rightvol = ch->master_vol;		// unless the game isn't running
 	ch->doppler = qfalse;
 }
 
+/*
+====================
+S_StartSound
+
+Validates the parms and ques the sound up
+if pos is NULL, the sound will be dynamically sourced from the entity
+Entchannel 0 will never override a playing sound
+====================
+*/
+void S_StartSound(vec3_t origin, int entityNum, int entchannel, sfxHandle_t sfxHandle ) {
+	sndCommand_t	*cmd;
+	sfx_t			*sfx;
+
+	if ( !s_soundStarted || s_soundMuted ) {
+		return;
+	}
+
+	if ( !origin && ( entityNum < 0 || entityNum > MAX_GENTITIES ) ) {
+		Com_Error( ERR_DROP, "S_StartSound: bad entitynum %i", entityNum );
+	}
+
+	if ( sfxHandle < 0 || sfxHandle >= s_numSfx ) {
+		Com_Printf( S_COLOR_YELLOW, "S_StartSound: handle %i out of range\n", sfxHandle );
+		return;
+	}
+
+	sfx = &s_knownSfx[ sfxHandle ];
+
+	if (sfx->inMemory == qfalse) {
+		S_memoryLoad(sfx);
+	}
+
+	// still resampling, a sound that starts late is worse than none
+	if ( !S_FinishSoundLoad( sfx ) ) {
+		return;
+	}
+
+	if ( s_show->integer == 1 ) {
+		Com_Printf( "%i : %s\n", s_paintedtime, sfx->soundName );
+	}
+
+	cmd = S_NewCommand( SND_CMD_START_SOUND );
+	cmd->time = Com_Milliseconds();
+	cmd->entityNum = entityNum;
+	cmd->value = entchannel;
+	cmd->sfx = sfxHandle;
+	cmd->fixedOrigin = origin ? qtrue : qfalse;
+	if ( origin ) {
+		VectorCopy( origin, cmd->origin );
+	}
+	S_QueueCommand();
+}
+
 
 /*
 ==================
@@ -640,23 +1009,17 @@ void S_StartLocalSound( sfxHandle_t sfxHandle, int channelNum ) {
 		return;
 	}
 
-	S_StartSound (NULL, listener_number, channelNum, sfxHandle );
+	S_StartSound (NULL, s_mixer.listener, channelNum, sfxHandle );
 }
 
 
 /*
 ==================
-S_ClearSoundBuffer
-
-If we are about to perform file access, clear the buffer
-so sound doesn't stutter.
+S_MixerClearSoundBuffer
 ==================
 */
-void S_ClearSoundBuffer( void ) {
+static void S_MixerClearSoundBuffer( void ) {
 	int		clear;
-		
-	if (!s_soundStarted)
-		return;
 
 	// stop looping sounds
 	Com_Memset(loopSounds, 0, MAX_GENTITIES*sizeof(loopSound_t));
@@ -665,21 +1028,39 @@ void S_ClearSoundBuffer( void ) {
 
 	S_ChannelSetup();
 
-	s_rawend = 0;
+	// s_rawend is moved on the main thread only, S_ClearSoundBuffer resets it
 
 	if (dma.samplebits == 8)
 		clear = 0x80;
 	else
 		clear = 0;
 
-	SNDDMA_BeginPainting ();
+	S_DeviceBeginPainting ();
 	if (dma.buffer)
     // TTimo: due to a particular bug workaround in linux sound code,
     //   have to optionally use a custom C implementation of Com_Memset
     //   not affecting win32, we have #define Snd_Memset Com_Memset
     // https://zerowing.idsoftware.com/bugzilla/show_bug.cgi?id=371
 		Snd_Memset(dma.buffer, clear, dma.samples * dma.samplebits/8);
-	SNDDMA_Submit ();
+	S_DeviceSubmit ();
+}
+
+/*
+==================
+S_ClearSoundBuffer
+
+If we are about to perform file access, clear the buffer
+so sound doesn't stutter.
+==================
+*/
+void S_ClearSoundBuffer( void ) {
+	if (!s_soundStarted)
+		return;
+
+	s_rawend = 0;
+
+	S_NewCommand( SND_CMD_CLEAR_BUFFER );
+	S_QueueCommand();
 }
 
 /*
@@ -706,24 +1087,35 @@ continuous looping sounds are added each frame
 ==============================================================
 */
 
-void S_StopLoopingSound(int entityNum) {
+static void S_MixerStopLoopingSound( int entityNum ) {
 	loopSounds[entityNum].active = qfalse;
 //	loopSounds[entityNum].sfx = 0;
 	loopSounds[entityNum].kill = qfalse;
 }
 
+void S_StopLoopingSound(int entityNum) {
+	sndCommand_t	*cmd;
+
+	if ( !s_soundStarted ) {
+		return;
+	}
+
+	cmd = S_NewCommand( SND_CMD_STOP_LOOP );
+	cmd->entityNum = entityNum;
+	S_QueueCommand();
+}
+
 /*
 ==================
-S_ClearLoopingSounds
-
+S_MixerClearLoopingSounds
 ==================
 */
-void S_ClearLoopingSounds( qboolean killall ) {
+static void S_MixerClearLoopingSounds( qboolean killall ) {
 	int i;
 	for ( i = 0 ; i < MAX_GENTITIES ; i++) {
 		if (killall || loopSounds[i].kill == qtrue || (loopSounds[i].sfx && loopSounds[i].sfx->soundLength == 0)) {
 			loopSounds[i].kill = qfalse;
-			S_StopLoopingSound(i);
+			S_MixerStopLoopingSound(i);
 		}
 	}
 	numLoopChannels = 0;
@@ -731,44 +1123,50 @@ void S_ClearLoopingSounds( qboolean killall ) {
 
 /*
 ==================
-S_AddLoopingSound
+S_ClearLoopingSounds
 
-Called during entity generation for a frame
-Include velocity in case I get around to doing doppler...
 ==================
 */
-void S_AddLoopingSound( int entityNum, const vec3_t origin, const vec3_t velocity, sfxHandle_t sfxHandle ) {
-	sfx_t *sfx;
+void S_ClearLoopingSounds( qboolean killall ) {
+	sndCommand_t	*cmd;
 
-	if ( !s_soundStarted || s_soundMuted ) {
+	if ( !s_soundStarted ) {
 		return;
 	}
 
-	if ( sfxHandle < 0 || sfxHandle >= s_numSfx ) {
-		Com_Printf( S_COLOR_YELLOW, "S_AddLoopingSound: handle %i out of range\n", sfxHandle );
-		return;
-	}
+	cmd = S_NewCommand( SND_CMD_CLEAR_LOOPS );
+	cmd->value = killall;
+	S_QueueCommand();
+}
 
-	sfx = &s_knownSfx[ sfxHandle ];
+/*
+==================
+S_MixerAddLoopingSound
 
-	if (sfx->inMemory == qfalse) {
-		S_memoryLoad(sfx);
-	}
+SND_CMD_ADD_LOOP and SND_CMD_ADD_REAL_LOOP
+==================
+*/
+static void S_MixerAddLoopingSound( const sndCommand_t *cmd, qboolean real ) {
+	int		entityNum;
 
-	if ( !sfx->soundLength ) {
-		Com_Error( ERR_DROP, "%s has length 0", sfx->soundName );
-	}
+	entityNum = cmd->entityNum;
 
-	VectorCopy( origin, loopSounds[entityNum].origin );
-	VectorCopy( velocity, loopSounds[entityNum].velocity );
+	VectorCopy( cmd->origin, loopSounds[entityNum].origin );
+	VectorCopy( cmd->velocity, loopSounds[entityNum].velocity );
+	loopSounds[entityNum].sfx = &s_knownSfx[ cmd->sfx ];
 	loopSounds[entityNum].active = qtrue;
-	loopSounds[entityNum].kill = qtrue;
 	loopSounds[entityNum].doppler = qfalse;
+
+	if ( real ) {
+		loopSounds[entityNum].kill = qfalse;
+		return;
+	}
+
+	loopSounds[entityNum].kill = qtrue;
 	loopSounds[entityNum].oldDopplerScale = 1.0;
 	loopSounds[entityNum].dopplerScale = 1.0;
-	loopSounds[entityNum].sfx = sfx;
 
-	if (s_doppler->integer && VectorLengthSquared(velocity)>0.0) {
+	if (s_doppler->integer && VectorLengthSquared(cmd->velocity)>0.0) {
 		vec3_t	out;
 		float	lena, lenb;
 
@@ -776,7 +1174,7 @@ void S_AddLoopingSound( int entityNum, const vec3_t origin, const vec3_t velocit
 		lena = DistanceSquared(loopSounds[listener_number].origin, loopSounds[entityNum].origin);
 		VectorAdd(loopSounds[entityNum].origin, loopSounds[entityNum].velocity, out);
 		lenb = DistanceSquared(loopSounds[listener_number].origin, out);
-		if ((loopSounds[entityNum].framenum+1) != cls.framecount) {
+		if ((loopSounds[entityNum].framenum+1) != cmd->value) {
 			loopSounds[entityNum].oldDopplerScale = 1.0;
 		} else {
 			loopSounds[entityNum].oldDopplerScale = loopSounds[entityNum].dopplerScale;
@@ -787,44 +1185,82 @@ void S_AddLoopingSound( int entityNum, const vec3_t origin, const vec3_t velocit
 		}
 	}
 
-	loopSounds[entityNum].framenum = cls.framecount;
+	loopSounds[entityNum].framenum = cmd->value;
 }
 
 /*
 ==================
-S_AddLoopingSound
+S_QueueLoopingSound
+==================
+*/
+static void S_QueueLoopingSound( sndCommandType_t type, int entityNum, const vec3_t origin, const vec3_t velocity, sfxHandle_t sfxHandle ) {
+	sndCommand_t	*cmd;
+	sfx_t			*sfx;
+
+	sfx = &s_knownSfx[ sfxHandle ];
+
+	if (sfx->inMemory == qfalse) {
+		S_memoryLoad(sfx);
+	}
+
+	// the loop is added again next frame
+	if ( !S_FinishSoundLoad( sfx ) ) {
+		return;
+	}
+
+	if ( !sfx->soundLength ) {
+		Com_Error( ERR_DROP, "%s has length 0", sfx->soundName );
+	}
+
+	cmd = S_NewCommand( type );
+	cmd->entityNum = entityNum;
+	cmd->value = cls.framecount;
+	cmd->sfx = sfxHandle;
+	VectorCopy( origin, cmd->origin );
+	VectorCopy( velocity, cmd->velocity );
+	S_QueueCommand();
+}
+
+/*
+==================
+S_AddLoopingSound
 
 Called during entity generation for a frame
 Include velocity in case I get around to doing doppler...
 ==================
 */
-void S_AddRealLoopingSound( int entityNum, const vec3_t origin, const vec3_t velocity, sfxHandle_t sfxHandle ) {
-	sfx_t *sfx;
-
+void S_AddLoopingSound( int entityNum, const vec3_t origin, const vec3_t velocity, sfxHandle_t sfxHandle ) {
 	if ( !s_soundStarted || s_soundMuted ) {
 		return;
 	}
 
 	if ( sfxHandle < 0 || sfxHandle >= s_numSfx ) {
-		Com_Printf( S_COLOR_YELLOW, "S_AddRealLoopingSound: handle %i out of range\n", sfxHandle );
+		Com_Printf( S_COLOR_YELLOW, "S_AddLoopingSound: handle %i out of range\n", sfxHandle );
 		return;
 	}
 
-	sfx = &s_knownSfx[ sfxHandle ];
+	S_QueueLoopingSound( SND_CMD_ADD_LOOP, entityNum, origin, velocity, sfxHandle );
+}
 
-	if (sfx->inMemory == qfalse) {
-		S_memoryLoad(sfx);
+/*
+==================
+S_AddLoopingSound
+
+Called during entity generation for a frame
+Include velocity in case I get around to doing doppler...
+==================
+*/
+void S_AddRealLoopingSound( int entityNum, const vec3_t origin, const vec3_t velocity, sfxHandle_t sfxHandle ) {
+	if ( !s_soundStarted || s_soundMuted ) {
+		return;
 	}
 
-	if ( !sfx->soundLength ) {
-		Com_Error( ERR_DROP, "%s has length 0", sfx->soundName );
+	if ( sfxHandle < 0 || sfxHandle >= s_numSfx ) {
+		Com_Printf( S_COLOR_YELLOW, "S_AddRealLoopingSound: handle %i out of range\n", sfxHandle );
+		return;
 	}
-	VectorCopy( origin, loopSounds[entityNum].origin );
-	VectorCopy( velocity, loopSounds[entityNum].velocity );
-	loopSounds[entityNum].sfx = sfx;
-	loopSounds[entityNum].active = qtrue;
-	loopSounds[entityNum].kill = qfalse;
-	loopSounds[entityNum].doppler = qfalse;
+
+	S_QueueLoopingSound( SND_CMD_ADD_REAL_LOOP, entityNum, origin, velocity, sfxHandle );
 }
 
 
@@ -848,7 +1284,7 @@ void S_AddLoopSounds (void) {
 
 	numLoopChannels = 0;
 
-	time = Com_Milliseconds();
+	time = s_mixer.time;
 
 	loopFrame++;
 	for ( i = 0 ; i < MAX_GENTITIES ; i++) {
@@ -954,6 +1390,7 @@ void S_RawSamples( int samples, int rate, int width, int s_channels, const byte
 	int		src, dst;
 	float	scale;
 	int		intVolume;
+	int		rawend;
 
 	if ( !s_soundStarted || s_soundMuted ) {
 		return;
@@ -966,6 +1403,9 @@ void S_RawSamples( int samples, int rate, int width, int s_channels, const byte
 		s_rawend = s_soundtime;
 	}
 
+	// the mixer only sees the new samples once they are all in
+	rawend = s_rawend;
+
 	scale = (float)rate / dma.speed;
 
 //Com_Printf ("%i < %i < %i\n", s_soundtime, s_paintedtime, s_rawend);
@@ -975,8 +1415,8 @@ void S_RawSamples( int samples, int rate, int width, int s_channels, const byte
 		{	// optimized case
 			for (i=0 ; i<samples ; i++)
 			{
-				dst = s_rawend&(MAX_RAW_SAMPLES-1);
-				s_rawend++;
+				dst = rawend&(MAX_RAW_SAMPLES-1);
+				rawend++;
 				s_rawsamples[dst].left = ((short *)data)[i*2] * intVolume;
 				s_rawsamples[dst].right = ((short *)data)[i*2+1] * intVolume;
 			}
@@ -988,8 +1428,8 @@ void S_RawSamples( int samples, int rate, int width, int s_channels, const byte
 				src = i*scale;
 				if (src >= samples)
 					break;
-				dst = s_rawend&(MAX_RAW_SAMPLES-1);
-				s_rawend++;
+				dst = rawend&(MAX_RAW_SAMPLES-1);
+				rawend++;
 				s_rawsamples[dst].left = ((short *)data)[src*2] * intVolume;
 				s_rawsamples[dst].right = ((short *)data)[src*2+1] * intVolume;
 			}
@@ -1002,8 +1442,8 @@ void S_RawSamples( int samples, int rate, int width, int s_channels, const byte
 			src = i*scale;
 			if (src >= samples)
 				break;
-			dst = s_rawend&(MAX_RAW_SAMPLES-1);
-			s_rawend++;
+			dst = rawend&(MAX_RAW_SAMPLES-1);
+			rawend++;
 			s_rawsamples[dst].left = ((short *)data)[src] * intVolume;
 			s_rawsamples[dst].right = ((short *)data)[src] * intVolume;
 		}
@@ -1017,8 +1457,8 @@ void S_RawSamples( int samples, int rate, int width, int s_channels, const byte
 			src = i*scale;
 			if (src >= samples)
 				break;
-			dst = s_rawend&(MAX_RAW_SAMPLES-1);
-			s_rawend++;
+			dst = rawend&(MAX_RAW_SAMPLES-1);
+			rawend++;
 			s_rawsamples[dst].left = ((char *)data)[src*2] * intVolume;
 			s_rawsamples[dst].right = ((char *)data)[src*2+1] * intVolume;
 		}
@@ -1032,13 +1472,15 @@ void S_RawSamples( int samples, int rate, int width, int s_channels, const byte
 			src = i*scale;
 			if (src >= samples)
 				break;
-			dst = s_rawend&(MAX_RAW_SAMPLES-1);
-			s_rawend++;
+			dst = rawend&(MAX_RAW_SAMPLES-1);
+			rawend++;
 			s_rawsamples[dst].left = (((byte *)data)[src]-128) * intVolume;
 			s_rawsamples[dst].right = (((byte *)data)[src]-128) * intVolume;
 		}
 	}
 
+	s_rawend = rawend;
+
 	if ( s_rawend > s_soundtime + MAX_RAW_SAMPLES ) {
 		Com_DPrintf( "S_RawSamples: overflowed %i > %i\n", s_rawend, s_soundtime );
 	}
@@ -1054,34 +1496,40 @@ let the sound system know where an entity currently is
 ======================
 */
 void S_UpdateEntityPosition( int entityNum, const vec3_t origin ) {
+	sndCommand_t	*cmd;
+
 	if ( entityNum < 0 || entityNum > MAX_GENTITIES ) {
 		Com_Error( ERR_DROP, "S_UpdateEntityPosition: bad entitynum %i", entityNum );
 	}
-	VectorCopy( origin, loopSounds[entityNum].origin );
+
+	if ( !s_soundStarted ) {
+		return;
+	}
+
+	cmd = S_NewCommand( SND_CMD_UPDATE_ENTITY );
+	cmd->entityNum = entityNum;
+	VectorCopy( origin, cmd->origin );
+	S_QueueCommand();
 }
 
 
 /*
 ============
-S_Respatialize
+S_MixerRespatialize
 
 Change the volumes of all the playing sounds for changes in their positions
 ============
 */
-void S_Respatialize( int entityNum, const vec3_t head, vec3_t axis[3], int inwater ) {
+static void S_MixerRespatialize( const sndCommand_t *cmd ) {
 	int			i;
 	channel_t	*ch;
 	vec3_t		origin;
 
-	if ( !s_soundStarted || s_soundMuted ) {
-		return;
-	}
-
-	listener_number = entityNum;
-	VectorCopy(head, listener_origin);
-	VectorCopy(axis[0], listener_axis[0]);
-	VectorCopy(axis[1], listener_axis[1]);
-	VectorCopy(axis[2], listener_axis[2]);
+	listener_number = cmd->entityNum;
+	VectorCopy(cmd->origin, listener_origin);
+	VectorCopy(cmd->axis[0], listener_axis[0]);
+	VectorCopy(cmd->axis[1], listener_axis[1]);
+	VectorCopy(cmd->axis[2], listener_axis[2]);
 
 	// update spatialization for dynamic sounds	
 	ch = s_channels;
@@ -1108,6 +1556,149 @@ void S_Respatialize( int entityNum, const vec3_t head, vec3_t axis[3], int inwat
 	S_AddLoopSounds ();
 }
 
+/*
+============
+S_Respatialize
+============
+*/
+void S_Respatialize( int entityNum, const vec3_t head, vec3_t axis[3], int inwater ) {
+	sndCommand_t	*cmd;
+
+	if ( !s_soundStarted || s_soundMuted ) {
+		return;
+	}
+
+	s_mixer.listener = entityNum;
+
+	cmd = S_NewCommand( SND_CMD_RESPATIALIZE );
+	cmd->time = Com_Milliseconds();
+	cmd->entityNum = entityNum;
+	VectorCopy( head, cmd->origin );
+	VectorCopy( axis[0], cmd->axis[0] );
+	VectorCopy( axis[1], cmd->axis[1] );
+	VectorCopy( axis[2], cmd->axis[2] );
+	S_QueueCommand();
+}
+
+/*
+============
+S_RunCommands
+
+Runs everything the main thread has queued, with s_mixer.lock held
+============
+*/
+static void S_RunCommands( void ) {
+	sndCommand_t	*cmd;
+
+	while ( s_mixer.tail != s_mixer.head ) {
+		cmd = &s_mixer.commands[ s_mixer.tail & ( SND_COMMANDS - 1 ) ];
+
+		switch ( cmd->type ) {
+		case SND_CMD_START_SOUND:
+			s_mixer.time = cmd->time;
+			S_MixerStartSound( cmd );
+			break;
+		case SND_CMD_STOP_LOOP:
+			S_MixerStopLoopingSound( cmd->entityNum );
+			break;
+		case SND_CMD_CLEAR_LOOPS:
+			S_MixerClearLoopingSounds( (qboolean)cmd->value );
+			break;
+		case SND_CMD_ADD_LOOP:
+			S_MixerAddLoopingSound( cmd, qfalse );
+			break;
+		case SND_CMD_ADD_REAL_LOOP:
+			S_MixerAddLoopingSound( cmd, qtrue );
+			break;
+		case SND_CMD_UPDATE_ENTITY:
+			VectorCopy( cmd->origin, loopSounds[ cmd->entityNum ].origin );
+			break;
+		case SND_CMD_RESPATIALIZE:
+			s_mixer.time = cmd->time;
+			S_MixerRespatialize( cmd );
+			break;
+		case SND_CMD_CLEAR_BUFFER:
+			S_MixerClearSoundBuffer();
+			break;
+		}
+
+		// the slot can be reused once tail passes it
+		Sys_AtomicAdd( &s_mixer.tail, 1 );
+	}
+}
+
+/*
+============
+S_MixerThread
+============
+*/
+static void S_MixerThread( void *arg ) {
+	Com_ProfileThreadName( "sound mixer" );
+	s_onMixer = qtrue;
+
+	while ( !s_mixer.shutdown ) {
+		Sys_LockMutex( s_mixer.lock );
+		S_RunCommands();
+		if ( !s_mixer.failed ) {
+			S_Update_();
+		}
+		Sys_UnlockMutex( s_mixer.lock );
+
+		Sys_Sleep( SND_MIXER_MSEC );
+	}
+}
+
+/*
+============
+S_StartMixer
+============
+*/
+static void S_StartMixer( void ) {
+	s_mixer.head = 0;
+	s_mixer.tail = 0;
+	s_mixer.shutdown = 0;
+	s_mixer.failed = 0;
+	s_mixer.timeWrapped = 0;
+	s_mixer.stalls = 0;
+	s_mixer.dropped = 0;
+	s_mixer.lock = Sys_CreateMutex();
+
+	s_mixer.threaded = qfalse;
+	if ( !s_mixThread->integer ) {
+		return;
+	}
+
+	s_mixer.thread = Sys_CreateThread( S_MixerThread, NULL );
+	if ( !s_mixer.thread ) {
+		Com_Printf( "WARNING: couldn't start the sound mixer thread\n" );
+		return;
+	}
+	s_mixer.threaded = qtrue;
+}
+
+/*
+============
+S_StopMixer
+============
+*/
+static void S_StopMixer( void ) {
+	if ( s_mixer.threaded ) {
+		s_mixer.shutdown = 1;
+		Sys_JoinThread( s_mixer.thread );
+		s_mixer.thread = NULL;
+		s_mixer.threaded = qfalse;
+	}
+
+	if ( s_mixer.lock ) {
+		Sys_DestroyMutex( s_mixer.lock );
+		s_mixer.lock = NULL;
+	}
+
+	// anything still queued is dropped with the channels
+	s_mixer.head = 0;
+	s_mixer.tail = 0;
+}
+
 
 /*
 ========================
@@ -1156,17 +1747,38 @@ Called once each time through the main loop
 void S_Update( void ) {
 	int			i;
 	int			total;
+	int			dropped;
 	channel_t	*ch;
 
+	// the device failed on the mixer thread
+	SNDDMA_ReportErrors();
+	if ( s_mixer.failed ) {
+		S_Shutdown();
+	}
+
 	if ( !s_soundStarted || s_soundMuted ) {
 		Com_DPrintf ("not started or muted\n");
 		return;
 	}
 
+	S_FinishSoundLoads( qfalse );
+	S_UpdateMixPath();
+
+	if ( !s_mixer.threaded ) {
+		S_RunCommands();
+	}
+
+	dropped = s_mixer.dropped;
+	if ( dropped ) {
+		Sys_AtomicAdd( &s_mixer.dropped, -dropped );
+		Com_DPrintf( "dropping %i sounds\n", dropped );
+	}
+
 	//
 	// debugging output
 	//
 	if ( s_show->integer == 2 ) {
+		S_LockMixer();
 		total = 0;
 		ch = s_channels;
 		for (i=0 ; i<MAX_CHANNELS; i++, ch++) {
@@ -1177,13 +1789,22 @@ void S_Update( void ) {
 		}
 		
 		Com_Printf ("----(%i)---- painted: %i\n", total, s_paintedtime);
+		S_UnlockMixer();
+	}
+
+	// the raw samples are timed against s_paintedtime, which the mixer chopped
+	if ( s_mixer.timeWrapped ) {
+		s_mixer.timeWrapped = qfalse;
+		s_rawend = 0;
 	}
 
 	// add raw data from streamed samples
 	S_UpdateBackgroundTrack();
 
 	// mix some sound
-	S_Update_();
+	if ( !s_mixer.threaded ) {
+		S_Update_();
+	}
 }
 
 void S_GetSoundtime(void)
@@ -1197,7 +1818,7 @@ void S_GetSoundtime(void)
 
 	// it is possible to miscount buffers if it has wrapped twice between
 	// calls to S_Update.  Oh well.
-	samplepos = SNDDMA_GetDMAPos();
+	samplepos = S_DeviceGetDMAPos();
 	if (samplepos < oldsamplepos)
 	{
 		buffers++;					// buffer wrapped
@@ -1206,7 +1827,8 @@ void S_GetSoundtime(void)
 		{	// time to chop things off to avoid 32 bit limits
 			buffers = 0;
 			s_paintedtime = fullsamples;
-			S_StopAllSounds ();
+			S_MixerClearSoundBuffer ();
+			s_mixer.timeWrapped = qtrue;
 		}
 	}
 	oldsamplepos = samplepos;
@@ -1242,7 +1864,7 @@ void S_Update_(void) {
 		return;
 	}
 
-	thisTime = Com_Milliseconds();
+	thisTime = Sys_Milliseconds();
 
 	// Updates s_soundtime
 	S_GetSoundtime();
@@ -1252,6 +1874,8 @@ void S_Update_(void) {
 	}
 	ot = s_soundtime;
 
+	PROFILE_BEGIN( "S_Update_" );
+
 	// clear any sound effects that end before the current time,
 	// and start any new sounds
 	S_ScanChannelStarts();
@@ -1282,13 +1906,21 @@ void S_Update_(void) {
 
 
 
-	SNDDMA_BeginPainting ();
+	S_DeviceBeginPainting ();
+
+	// the device failed and S_Update will shut it down
+	if ( s_mixer.failed ) {
+		PROFILE_END();
+		return;
+	}
 
 	S_PaintChannels (endtime);
 
-	SNDDMA_Submit ();
+	S_DeviceSubmit ();
 
 	lastTime = thisTime;
+
+	PROFILE_END();
 }
 
 /*
@@ -1411,18 +2043,120 @@ int S_FindWavChunk( fileHandle_t f, char *chunk ) {
 	return len;
 }
 
+/*
+======================
+S_OpenBackgroundFile
+
+Opens a wav and leaves it at the start of the samples
+======================
+*/
+static qboolean S_OpenBackgroundFile( const char *filename, musicFile_t *music ) {
+	char	dump[16];
+	char	name[MAX_QPATH];
+	int		len;
+
+	Q_strncpyz( name, filename, sizeof( name ) - 4 );
+	COM_DefaultExtension( name, sizeof( name ), ".wav" );
+
+	Com_Memset( music, 0, sizeof( *music ) );
+
+	//
+	// open up a wav file and get all the info
+	//
+	FS_FOpenFileRead( name, &music->file, qtrue );
+	if ( !music->file ) {
+		Com_Printf( S_COLOR_YELLOW "WARNING: couldn't open music file %s\n", name );
+		return qfalse;
+	}
+
+	// skip the riff wav header
+
+	FS_Read(dump, 12, music->file);
+
+	if ( !S_FindWavChunk( music->file, "fmt " ) ) {
+		Com_Printf( "No fmt chunk in %s\n", name );
+		FS_FCloseFile( music->file );
+		music->file = 0;
+		return qfalse;
+	}
+
+	// save name for soundinfo
+	music->info.format = FGetLittleShort( music->file );
+	music->info.channels = FGetLittleShort( music->file );
+	music->info.rate = FGetLittleLong( music->file );
+	FGetLittleLong(  music->file );
+	FGetLittleShort(  music->file );
+	music->info.width = FGetLittleShort( music->file ) / 8;
+
+	if ( music->info.format != WAV_FORMAT_PCM ) {
+		FS_FCloseFile( music->file );
+		music->file = 0;
+		Com_Printf("Not a microsoft PCM format wav: %s\n", name);
+		return qfalse;
+	}
+
+	if ( music->info.channels != 2 || music->info.rate != 22050 ) {
+		Com_Printf(S_COLOR_YELLOW "WARNING: music file %s is not 22k stereo\n", name );
+	}
+
+	if ( ( len = S_FindWavChunk( music->file, "data" ) ) == 0 ) {
+		FS_FCloseFile( music->file );
+		music->file = 0;
+		Com_Printf("No data chunk in %s\n", name);
+		return qfalse;
+	}
+
+	music->info.samples = len / (music->info.width * music->info.channels);
+	music->samples = music->info.samples;
+
+	return qtrue;
+}
+
+/*
+======================
+S_CloseBackgroundTrack
+======================
+*/
+static void S_CloseBackgroundTrack( void ) {
+	if ( s_music.lock ) {
+		Sys_LockMutex( s_music.lock );
+	}
+
+	if ( s_music.current.file ) {
+		FS_FCloseFile( s_music.current.file );
+	}
+	if ( s_music.nextReady ) {
+		FS_FCloseFile( s_music.next.file );
+	}
+	if ( s_music.finished ) {
+		FS_FCloseFile( s_music.finished );
+	}
+	Com_Memset( &s_music.current, 0, sizeof( s_music.current ) );
+	Com_Memset( &s_music.next, 0, sizeof( s_music.next ) );
+	s_music.playing = 0;
+	s_music.nextReady = 0;
+	s_music.finished = 0;
+	s_music.failed = 0;
+	s_music.position = 0;
+	s_music.head = 0;
+	s_music.tail = 0;
+	s_music.active = qfalse;
+
+	if ( s_music.lock ) {
+		Sys_UnlockMutex( s_music.lock );
+	}
+}
+
 /*
 ======================
 S_StopBackgroundTrack
 ======================
 */
 void S_StopBackgroundTrack( void ) {
-	if ( !s_backgroundFile ) {
+	if ( !s_music.active ) {
 		return;
 	}
-	Sys_EndStreamedFile( s_backgroundFile );
-	FS_FCloseFile( s_backgroundFile );
-	s_backgroundFile = 0;
+	S_CloseBackgroundTrack();
 	s_rawend = 0;
 }
 
@@ -1432,9 +2166,7 @@ S_StartBackgroundTrack
 ======================
 */
 void S_StartBackgroundTrack( const char *intro, const char *loop ){
-	int		len;
-	char	dump[16];
-	char	name[MAX_QPATH];
+	musicFile_t	music;
 
 	if ( !intro ) {
 		intro = "";
@@ -1444,9 +2176,6 @@ void S_StartBackgroundTrack( const char *intro, const char *loop ){
 	}
 	Com_DPrintf( "S_StartBackgroundTrack( %s, %s )\n", intro, loop );
 
-	Q_strncpyz( name, intro, sizeof( name ) - 4 );
-	COM_DefaultExtension( name, sizeof( name ), ".wav" );
-
 	if ( !intro[0] ) {
 		return;
 	}
@@ -1455,82 +2184,240 @@ void S_StartBackgroundTrack( const char *intro, const char *loop ){
 
 	// close the background track, but DON'T reset s_rawend
 	// if restarting the same back ground track
-	if ( s_backgroundFile ) {
-		Sys_EndStreamedFile( s_backgroundFile );
-		FS_FCloseFile( s_backgroundFile );
-		s_backgroundFile = 0;
-	}
+	S_CloseBackgroundTrack();
 
-	//
-	// open up a wav file and get all the info
-	//
-	FS_FOpenFileRead( name, &s_backgroundFile, qtrue );
-	if ( !s_backgroundFile ) {
-		Com_Printf( S_COLOR_YELLOW "WARNING: couldn't open music file %s\n", name );
+	if ( !S_OpenBackgroundFile( intro, &music ) ) {
 		return;
 	}
 
-	// skip the riff wav header
+	if ( s_music.lock ) {
+		Sys_LockMutex( s_music.lock );
+	}
+	s_music.current = music;
+	s_music.playing = 1;
+	s_music.active = qtrue;
+	if ( s_music.lock ) {
+		Sys_UnlockMutex( s_music.lock );
+	}
+}
 
-	FS_Read(dump, 12, s_backgroundFile);
+/*
+======================
+S_DecodeMusic
 
-	if ( !S_FindWavChunk( s_backgroundFile, "fmt " ) ) {
-		Com_Printf( "No fmt chunk in %s\n", name );
-		FS_FCloseFile( s_backgroundFile );
-		s_backgroundFile = 0;
-		return;
+Reads a block of the current file and resamples it into s_music.buffer,
+moving on to the next file at the end of this one.  Called with the lock
+held, on the music thread or from S_UpdateBackgroundTrack without one.
+Returns qfalse when there was nothing to do.
+======================
+*/
+static qboolean S_DecodeMusic( void ) {
+	musicFile_t	*music;
+	short		*out;
+	int			frameBytes, fileSamples, space;
+	int			step, produced, src, dst, r;
+	int			left, right;
+
+	music = &s_music.current;
+
+	// hand a finished file back to the main thread to close
+	if ( music->file && !music->samples ) {
+		if ( Sys_AtomicCompareExchange( &s_music.finished, music->file, 0 ) != 0 ) {
+			return qfalse;		// the last one isn't closed yet
+		}
+		music->file = 0;
 	}
 
-	// save name for soundinfo
-	s_backgroundInfo.format = FGetLittleShort( s_backgroundFile );
-	s_backgroundInfo.channels = FGetLittleShort( s_backgroundFile );
-	s_backgroundInfo.rate = FGetLittleLong( s_backgroundFile );
-	FGetLittleLong(  s_backgroundFile );
-	FGetLittleShort(  s_backgroundFile );
-	s_backgroundInfo.width = FGetLittleShort( s_backgroundFile ) / 8;
-
-	if ( s_backgroundInfo.format != WAV_FORMAT_PCM ) {
-		FS_FCloseFile( s_backgroundFile );
-		s_backgroundFile = 0;
-		Com_Printf("Not a microsoft PCM format wav: %s\n", name);
-		return;
+	// the loop, once the main thread has opened it
+	if ( !music->file ) {
+		if ( !s_music.nextReady ) {
+			s_music.playing = 0;
+			return qfalse;
+		}
+		*music = s_music.next;
+		s_music.position = 0;
+		s_music.playing = 1;
+		Sys_AtomicAdd( &s_music.nextReady, -1 );
 	}
 
-	if ( s_backgroundInfo.channels != 2 || s_backgroundInfo.rate != 22050 ) {
-		Com_Printf(S_COLOR_YELLOW "WARNING: music file %s is not 22k stereo\n", name );
+	// as many file samples as there is room for after resampling
+	space = MUSIC_BUFFER_SAMPLES - ( s_music.head - s_music.tail ) - 2;
+	frameBytes = music->info.width * music->info.channels;
+	fileSamples = (int)( (float)space * music->info.rate / dma.speed );
+	if ( fileSamples > MUSIC_READ_BYTES / frameBytes ) {
+		fileSamples = MUSIC_READ_BYTES / frameBytes;
+	}
+	if ( fileSamples > music->samples ) {
+		fileSamples = music->samples;
+	}
+	if ( fileSamples <= 0 ) {
+		return qfalse;
 	}
 
-	if ( ( len = S_FindWavChunk( s_backgroundFile, "data" ) ) == 0 ) {
-		FS_FCloseFile( s_backgroundFile );
-		s_backgroundFile = 0;
-		Com_Printf("No data chunk in %s\n", name);
+	r = FS_Read( s_music.raw, fileSamples * frameBytes, music->file );
+	if ( r != fileSamples * frameBytes ) {
+		Sys_AtomicAdd( &s_music.failed, 1 );
+		music->samples = 0;
+		return qfalse;
+	}
+	music->samples -= fileSamples;
+
+	// byte swap if needed
+	S_ByteSwapRawSamples( fileSamples, music->info.width, music->info.channels, s_music.raw );
+
+	// the position carries over between reads, so the blocks join up
+	step = (int)( (float)music->info.rate / dma.speed * 65536 );
+	produced = 0;
+	while ( ( src = s_music.position >> 16 ) < fileSamples ) {
+		if ( music->info.width == 2 ) {
+			if ( music->info.channels == 2 ) {
+				left = ((short *)s_music.raw)[src*2];
+				right = ((short *)s_music.raw)[src*2+1];
+			} else {
+				left = right = ((short *)s_music.raw)[src];
+			}
+		} else {
+			if ( music->info.channels == 2 ) {
+				left = ( s_music.raw[src*2] - 128 ) << 8;
+				right = ( s_music.raw[src*2+1] - 128 ) << 8;
+			} else {
+				left = right = ( s_music.raw[src] - 128 ) << 8;
+			}
+		}
+
+		dst = ( s_music.head + produced ) & ( MUSIC_BUFFER_SAMPLES - 1 );
+		out = &s_music.buffer[dst*2];
+		out[0] = (short)left;
+		out[1] = (short)right;
+
+		produced++;
+		s_music.position += step;
+	}
+	s_music.position -= fileSamples << 16;
+
+	// the samples are all in before the main thread can see them
+	Sys_AtomicAdd( &s_music.head, produced );
+
+	return qtrue;
+}
+
+/*
+======================
+S_MusicThread
+======================
+*/
+static void S_MusicThread( void *arg ) {
+	qboolean	decoded;
+
+	Com_ProfileThreadName( "music streamer" );
+
+	while ( !s_music.shutdown ) {
+		Sys_LockMutex( s_music.lock );
+		PROFILE_BEGIN( "S_DecodeMusic" );
+		decoded = S_DecodeMusic();
+		PROFILE_END();
+		Sys_UnlockMutex( s_music.lock );
+
+		if ( !decoded ) {
+			Sys_Sleep( MUSIC_STREAM_MSEC );
+		}
+	}
+}
+
+/*
+======================
+S_StartMusicStream
+======================
+*/
+static void S_StartMusicStream( void ) {
+	s_music.shutdown = 0;
+	s_music.underruns = 0;
+	s_music.lock = Sys_CreateMutex();
+
+	s_music.threaded = qfalse;
+	if ( !s_musicThread->integer ) {
 		return;
 	}
 
-	s_backgroundInfo.samples = len / (s_backgroundInfo.width * s_backgroundInfo.channels);
+	s_music.thread = Sys_CreateThread( S_MusicThread, NULL );
+	if ( !s_music.thread ) {
+		Com_Printf( "WARNING: couldn't start the music thread\n" );
+		return;
+	}
+	s_music.threaded = qtrue;
+}
 
-	s_backgroundSamples = s_backgroundInfo.samples;
+/*
+======================
+S_StopMusicStream
+======================
+*/
+static void S_StopMusicStream( void ) {
+	if ( s_music.threaded ) {
+		s_music.shutdown = 1;
+		Sys_JoinThread( s_music.thread );
+		s_music.thread = NULL;
+		s_music.threaded = qfalse;
+	}
 
-	//
-	// start the background streaming
-	//
-	Sys_BeginStreamedFile( s_backgroundFile, 0x10000 );
+	S_CloseBackgroundTrack();
+
+	if ( s_music.lock ) {
+		Sys_DestroyMutex( s_music.lock );
+		s_music.lock = NULL;
+	}
 }
 
 /*
 ======================
 S_UpdateBackgroundTrack
+
+The music is read and resampled to dma.speed ahead of time, on a thread
+of its own with s_musicThread 1, so the main thread never waits on the
+file.  Here it only closes and opens files for the loop and copies the
+samples into s_rawsamples at the music volume.
 ======================
 */
 void S_UpdateBackgroundTrack( void ) {
-	int		bufferSamples;
-	int		fileSamples;
-	byte	raw[30000];		// just enough to fit in a mac stack frame
-	int		fileBytes;
-	int		r;
+	int		available, wanted, count;
+	int		rawend, src, dst, n;
+	int		intVolume;
 	static	float	musicVolume = 0.5f;
 
-	if ( !s_backgroundFile ) {
+	if ( !s_music.active ) {
+		return;
+	}
+
+	if ( s_music.failed ) {
+		Com_Printf("StreamedRead failure on music track\n");
+		S_StopBackgroundTrack();
+		return;
+	}
+
+	if ( s_music.finished ) {
+		FS_FCloseFile( s_music.finished );
+		s_music.finished = 0;
+	}
+
+	// have the loop ready well before the decoder gets to the end
+	if ( !s_music.nextReady && s_backgroundLoop[0] ) {
+		if ( S_OpenBackgroundFile( s_backgroundLoop, &s_music.next ) ) {
+			Sys_AtomicAdd( &s_music.nextReady, 1 );
+		} else {
+			s_backgroundLoop[0] = 0;		// loop failed to restart
+		}
+	}
+
+	if ( !s_music.threaded ) {
+		while ( S_DecodeMusic() ) {
+		}
+	}
+
+	available = s_music.head - s_music.tail;
+
+	// the end of a track without a loop
+	if ( !available && !s_music.playing && !s_music.nextReady ) {
+		S_CloseBackgroundTrack();
 		return;
 	}
 
@@ -1546,56 +2433,37 @@ void S_UpdateBackgroundTrack( void ) {
 	if ( s_rawend < s_soundtime ) {
 		s_rawend = s_soundtime;
 	}
-
-	while ( s_rawend < s_soundtime + MAX_RAW_SAMPLES ) {
-		bufferSamples = MAX_RAW_SAMPLES - (s_rawend - s_soundtime);
-
-		// decide how much data needs to be read from the file
-		fileSamples = bufferSamples * s_backgroundInfo.rate / dma.speed;
-
-		// don't try and read past the end of the file
-		if ( fileSamples > s_backgroundSamples ) {
-			fileSamples = s_backgroundSamples;
+	wanted = s_soundtime + MAX_RAW_SAMPLES - s_rawend;
+	count = available < wanted ? available : wanted;
+	// nothing counts before the first samples are in
+	if ( available < wanted && s_music.playing && s_music.tail ) {
+		s_music.underruns++;
+	}
+
+	intVolume = 256 * musicVolume;
+	rawend = s_rawend;
+	src = s_music.tail;
+	while ( count > 0 ) {
+		// both rings wrap
+		n = count;
+		if ( n > MUSIC_BUFFER_SAMPLES - ( src & ( MUSIC_BUFFER_SAMPLES - 1 ) ) ) {
+			n = MUSIC_BUFFER_SAMPLES - ( src & ( MUSIC_BUFFER_SAMPLES - 1 ) );
 		}
-
-		// our max buffer size
-		fileBytes = fileSamples * (s_backgroundInfo.width * s_backgroundInfo.channels);
-		if ( fileBytes > sizeof(raw) ) {
-			fileBytes = sizeof(raw);
-			fileSamples = fileBytes / (s_backgroundInfo.width * s_backgroundInfo.channels);
+		dst = rawend & ( MAX_RAW_SAMPLES - 1 );
+		if ( n > MAX_RAW_SAMPLES - dst ) {
+			n = MAX_RAW_SAMPLES - dst;
 		}
 
-		r = Sys_StreamedRead( raw, 1, fileBytes, s_backgroundFile );
-		if ( r != fileBytes ) {
-			Com_Printf("StreamedRead failure on music track\n");
-			S_StopBackgroundTrack();
-			return;
-		}
+		S_ScaleRawSamples( &s_rawsamples[dst], &s_music.buffer[( src & ( MUSIC_BUFFER_SAMPLES - 1 ) )*2], n, intVolume );
 
-		// byte swap if needed
-		S_ByteSwapRawSamples( fileSamples, s_backgroundInfo.width, s_backgroundInfo.channels, raw );
-
-		// add to raw buffer
-		S_RawSamples( fileSamples, s_backgroundInfo.rate, 
-			s_backgroundInfo.width, s_backgroundInfo.channels, raw, musicVolume );
-
-		s_backgroundSamples -= fileSamples;
-		if ( !s_backgroundSamples ) {
-			// loop
-			if (s_backgroundLoop[0]) {
-				Sys_EndStreamedFile( s_backgroundFile );
-				FS_FCloseFile( s_backgroundFile );
-				s_backgroundFile = 0;
-				S_StartBackgroundTrack( s_backgroundLoop, s_backgroundLoop );
-				if ( !s_backgroundFile ) {
-					return;		// loop failed to restart
-				}
-			} else {
-				s_backgroundFile = 0;
-				return;
-			}
-		}
+		src += n;
+		rawend += n;
+		count -= n;
 	}
+
+	// the mixer only sees the new samples once they are all in
+	s_rawend = rawend;
+	Sys_AtomicAdd( &s_music.tail, src - s_music.tail );
 }
 
 
@@ -1615,7 +2483,7 @@ void S_FreeOldestSound() {
 
 	for (i=1 ; i < s_numSfx ; i++) {
 		sfx = &s_knownSfx[i];
-		if (sfx->inMemory && sfx->lastTimeUsed<oldest) {
+		if (sfx->inMemory && !sfx->load && sfx->lastTimeUsed<oldest) {
 			used = i;
 			oldest = sfx->lastTimeUsed;
 		}
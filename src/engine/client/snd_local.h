@@ -58,6 +58,7 @@ typedef struct sfx_s {
 	int 			soundLength;
 	char 			soundName[MAX_QPATH];
 	int				lastTimeUsed;
+	struct sndLoad_s	*load;				// still decoding on a job thread
 	struct sfx_s	*next;
 } sfx_t;
 
@@ -135,6 +136,9 @@ void	SNDDMA_Shutdown(void);
 
 void	SNDDMA_BeginPainting (void);
 
+// prints the errors SNDDMA_BeginPainting had on the mixer thread
+void	SNDDMA_ReportErrors(void);
+
 void	SNDDMA_Submit(void);
 
 //====================================================================
@@ -146,7 +150,7 @@ extern	channel_t   loop_channels[MAX_CHANNELS];
 extern	int		numLoopChannels;
 
 extern	int		s_paintedtime;
-extern	int		s_rawend;
+extern	volatile int	s_rawend;
 extern	vec3_t	listener_forward;
 extern	vec3_t	listener_right;
 extern	vec3_t	listener_up;
@@ -163,16 +167,28 @@ extern cvar_t	*s_mixahead;
 
 extern cvar_t	*s_testsound;
 extern cvar_t	*s_separation;
+extern cvar_t	*s_mixSimd;
+extern cvar_t	*s_asyncLoad;
 
 qboolean S_LoadSound( sfx_t *sfx );
+qboolean S_LoadSoundAsync( sfx_t *sfx );
+qboolean S_FinishSoundLoad( sfx_t *sfx );
+void S_FinishSoundLoads( qboolean wait );
 
 void		SND_free(sndBuffer *v);
 sndBuffer*	SND_malloc();
 void		SND_setup();
 
 void S_PaintChannels(int endtime);
+void S_ScaleRawSamples( portable_samplepair_t *out, const short *in, int count, int volume );
+void S_MixBench_f( void );
+void S_InitMixPath( void );
+void S_UpdateMixPath( void );
+void S_LockMixer( void );
+void S_UnlockMixer( void );
 
 void S_memoryLoad(sfx_t *sfx);
+void S_DefaultSound( sfx_t *sfx );
 portable_samplepair_t *S_GetRawSamplePointer();
 
 // adpcm functions
@@ -402,3 +402,233 @@ qboolean S_LoadSound( sfx_t *sfx )
 void S_DisplayFreeMemory() {
 	Com_Printf("%d bytes free sound buffer memory, %d total used\n", inUse, totalInUse);
 }
+
+
+/*
+===============================================================================
+
+ASYNC LOADING
+
+With s_asyncLoad 1, S_RegisterSound returns as soon as the wav has been
+read and its header checked, and a job resamples it while the level goes
+on loading.  The file is still read on the main thread, as the file
+system and the pk3 inflate allocate from the zone.
+
+The job writes into memory of its own and the main thread copies that
+into the sound chunks, under the mixer lock, the next time it looks:
+every S_Update, and whenever a sound that hasn't been copied yet is
+started, which skips the sound if the job isn't done.
+
+===============================================================================
+*/
+
+typedef struct sndLoad_s {
+	sfx_t			*sfx;
+	byte			*file;			// malloced copy, freed by the job
+	wavinfo_t		info;
+	short			*samples;		// at dma.speed, NULL if out of memory
+	int				length;
+	volatile int	done;
+	struct sndLoad_s	*next;
+} sndLoad_t;
+
+static jobCounter_t	s_loadCounter;
+static sndLoad_t	*s_loads;		// not copied yet, newest first
+
+/*
+==============
+S_DecodeSoundJob
+
+Runs on a job thread, so nothing here may touch the zone, hunk or console
+==============
+*/
+static void S_DecodeSoundJob( void *data, int index, int thread ) {
+	sndLoad_t	*load;
+	float		stepscale;
+	int			outcount;
+
+	load = (sndLoad_t *)data;
+
+	PROFILE_BEGIN( "S_DecodeSoundJob" );
+
+	// same count ResampleSfxRaw comes up with
+	stepscale = (float)load->info.rate / dma.speed;
+	outcount = load->info.samples / stepscale;
+
+	load->samples = (short *)malloc( ( outcount + 1 ) * sizeof( short ) );
+	if ( load->samples ) {
+		load->length = ResampleSfxRaw( load->samples, load->info.rate, load->info.width,
+			load->info.samples, load->file + load->info.dataofs );
+	}
+
+	free( load->file );
+	load->file = NULL;
+
+	PROFILE_END();
+
+	// everything above is written before the main thread sees it
+	Sys_AtomicAdd( &load->done, 1 );
+}
+
+/*
+==============
+S_LoadSoundAsync
+
+Checks the wav and queues the resample, returns qfalse like S_LoadSound
+if it can't be used
+==============
+*/
+qboolean S_LoadSoundAsync( sfx_t *sfx ) {
+	byte		*data;
+	wavinfo_t	info;
+	sndLoad_t	*load;
+	int			size;
+	qboolean	loaded;
+
+	// player specific sounds are never directly loaded
+	if ( sfx->soundName[0] == '*') {
+		return qfalse;
+	}
+
+	size = FS_ReadFile( sfx->soundName, (void **)&data );
+	if ( !data ) {
+		return qfalse;
+	}
+
+	info = GetWavinfo( sfx->soundName, data, size );
+	if ( info.channels != 1 ) {
+		Com_Printf ("%s is a stereo wav file\n", sfx->soundName);
+		FS_FreeFile (data);
+		return qfalse;
+	}
+
+	if ( info.width == 1 ) {
+		Com_DPrintf(S_COLOR_YELLOW "WARNING: %s is a 8 bit wav file\n", sfx->soundName);
+	}
+
+	if ( info.rate != 22050 ) {
+		Com_DPrintf(S_COLOR_YELLOW "WARNING: %s is not a 22kHz wav file\n", sfx->soundName);
+	}
+
+	load = (sndLoad_t *)malloc( sizeof( *load ) );
+	if ( load ) {
+		Com_Memset( load, 0, sizeof( *load ) );
+		load->file = (byte *)malloc( size );
+	}
+	if ( !load || !load->file ) {
+		// no memory to spare, do it the old way
+		free( load );
+		FS_FreeFile( data );
+
+		S_LockMixer();
+		loaded = S_LoadSound( sfx );
+		S_UnlockMixer();
+		return loaded;
+	}
+
+	// the temp hunk is freed in stack order, so the job gets a copy
+	Com_Memcpy( load->file, data, size );
+	FS_FreeFile( data );
+
+	load->sfx = sfx;
+	load->info = info;
+
+	sfx->soundCompressionMethod = 0;
+	sfx->soundLength = 0;
+	sfx->soundData = NULL;
+	sfx->lastTimeUsed = Com_Milliseconds()+1;
+	sfx->load = load;
+	load->next = s_loads;
+	s_loads = load;
+
+	Com_AddJob( S_DecodeSoundJob, load, 0, &s_loadCounter );
+
+	return qtrue;
+}
+
+/*
+==============
+S_FinishSoundLoad
+
+Copies the samples of a finished job into sound chunks.  Returns qfalse
+while the job is still running.
+==============
+*/
+qboolean S_FinishSoundLoad( sfx_t *sfx ) {
+	sndLoad_t	*load, **prev;
+	sndBuffer	*chunk, *newchunk;
+	int			i, n;
+
+	load = sfx->load;
+	if ( !load ) {
+		return qtrue;
+	}
+	if ( !load->done ) {
+		return qfalse;
+	}
+
+	S_LockMixer();
+
+	if ( !load->samples ) {
+		Com_Printf( S_COLOR_YELLOW "WARNING: out of memory decoding %s - using default\n", sfx->soundName );
+		S_DefaultSound( sfx );
+		sfx->defaultSound = qtrue;
+	} else {
+		sfx->soundLength = load->length;
+		chunk = NULL;
+		for ( i = 0 ; i < load->length ; i += SND_CHUNK_SIZE ) {
+			n = load->length - i;
+			if ( n > SND_CHUNK_SIZE ) {
+				n = SND_CHUNK_SIZE;
+			}
+
+			newchunk = SND_malloc();
+			if ( chunk == NULL ) {
+				sfx->soundData = newchunk;
+			} else {
+				chunk->next = newchunk;
+			}
+			chunk = newchunk;
+
+			Com_Memcpy( chunk->sndChunk, load->samples + i, n * sizeof( short ) );
+		}
+	}
+
+	sfx->load = NULL;
+	prev = &s_loads;
+	while ( *prev != load ) {
+		prev = &(*prev)->next;
+	}
+	*prev = load->next;
+
+	S_UnlockMixer();
+
+	free( load->samples );
+	free( load );
+
+	return qtrue;
+}
+
+/*
+==============
+S_FinishSoundLoads
+
+Called every S_Update, and with wait before the sound system goes away
+==============
+*/
+void S_FinishSoundLoads( qboolean wait ) {
+	sndLoad_t	*load, *next;
+
+	if ( !s_loads ) {
+		return;
+	}
+
+	if ( wait ) {
+		Com_WaitJobs( &s_loadCounter );
+	}
+
+	for ( load = s_loads ; load ; load = next ) {
+		next = load->next;
+		S_FinishSoundLoad( load->sfx );
+	}
+}
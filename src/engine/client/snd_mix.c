@@ -23,9 +23,36 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include "snd_local.h"
 
+#if defined _M_X64 || defined _M_IX86
+#define	SND_SIMD	1
+#include <immintrin.h>
+#else
+#define	SND_SIMD	0
+#endif
+
 static portable_samplepair_t paintbuffer[PAINTBUFFER_SIZE];
 static int snd_vol;
 
+cvar_t	*s_mixSimd;
+
+// the mixing path, picked on the main thread from sys_cpuid and s_mixSimd
+typedef enum {
+	SND_MIX_C,
+	SND_MIX_SSE2,
+	SND_MIX_AVX2,
+
+	SND_MIX_NUM_PATHS
+} sndMixPath_t;
+
+static const char *snd_mixPathNames[SND_MIX_NUM_PATHS] = {
+	"C",
+	"SSE2",
+	"AVX2"
+};
+
+static sndMixPath_t	snd_mixPath;
+static int			snd_cpuid;		// sys_cpuid, read once in S_Init
+
 // bk001119 - these not static, required by unix/snd_mixa.s
 int*     snd_p;  
 int      snd_linear_count;
@@ -110,6 +137,308 @@ LClampDone2:
 void S_WriteLinearBlastStereo16 (void);
 #endif
 
+
+/*
+===============================================================================
+
+SIMD MIXING
+
+Every path gives the same bits as the C one; s_mixbench checks that.
+The SSE2 multiply is split in two 8 bit halves of the volume, because
+there is no 32 bit multiply before SSE4.1:
+
+	( data * vol ) >> 8 == data * ( vol >> 8 ) + ( ( data * ( vol & 255 ) ) >> 8 )
+
+The paths are picked from sys_cpuid, s_mixSimd 0 keeps the C ones.  The
+mixer thread only ever reads snd_mixPath, cvars are looked at on the main
+thread.
+
+===============================================================================
+*/
+
+/*
+===================
+S_MixSamples_C
+===================
+*/
+static void S_MixSamples_C( portable_samplepair_t *samp, const short *samples, int count, int leftvol, int rightvol ) {
+	int		data;
+	int		i;
+
+	for ( i = 0 ; i < count ; i++ ) {
+		data = samples[i];
+		samp[i].left += (data * leftvol)>>8;
+		samp[i].right += (data * rightvol)>>8;
+	}
+}
+
+#if SND_SIMD
+/*
+===================
+S_MixSamples_SSE2
+===================
+*/
+static void S_MixSamples_SSE2( portable_samplepair_t *samp, const short *samples, int count, int leftvol, int rightvol ) {
+	__m128i		lvLo, lvHi, rvLo, rvHi;
+	__m128i		d, lo, hi, l0, l1, r0, r1;
+	__m128i		*out;
+	int			i;
+
+	// out of the range s_volume 0 to 1 gives, the C multiply can overflow, which this wouldn't copy
+	if ( leftvol < 0 || leftvol > 0x10000 || rightvol < 0 || rightvol > 0x10000 ) {
+		S_MixSamples_C( samp, samples, count, leftvol, rightvol );
+		return;
+	}
+
+	lvLo = _mm_set1_epi16( (short)( leftvol & 255 ) );
+	lvHi = _mm_set1_epi16( (short)( leftvol >> 8 ) );
+	rvLo = _mm_set1_epi16( (short)( rightvol & 255 ) );
+	rvHi = _mm_set1_epi16( (short)( rightvol >> 8 ) );
+
+	for ( i = 0 ; i + 8 <= count ; i += 8 ) {
+		d = _mm_loadu_si128( (const __m128i *)&samples[i] );
+
+		lo = _mm_mullo_epi16( d, lvLo );
+		hi = _mm_mulhi_epi16( d, lvLo );
+		l0 = _mm_srai_epi32( _mm_unpacklo_epi16( lo, hi ), 8 );
+		l1 = _mm_srai_epi32( _mm_unpackhi_epi16( lo, hi ), 8 );
+		lo = _mm_mullo_epi16( d, lvHi );
+		hi = _mm_mulhi_epi16( d, lvHi );
+		l0 = _mm_add_epi32( l0, _mm_unpacklo_epi16( lo, hi ) );
+		l1 = _mm_add_epi32( l1, _mm_unpackhi_epi16( lo, hi ) );
+
+		lo = _mm_mullo_epi16( d, rvLo );
+		hi = _mm_mulhi_epi16( d, rvLo );
+		r0 = _mm_srai_epi32( _mm_unpacklo_epi16( lo, hi ), 8 );
+		r1 = _mm_srai_epi32( _mm_unpackhi_epi16( lo, hi ), 8 );
+		lo = _mm_mullo_epi16( d, rvHi );
+		hi = _mm_mulhi_epi16( d, rvHi );
+		r0 = _mm_add_epi32( r0, _mm_unpacklo_epi16( lo, hi ) );
+		r1 = _mm_add_epi32( r1, _mm_unpackhi_epi16( lo, hi ) );
+
+		// back to left / right pairs
+		out = (__m128i *)&samp[i];
+		_mm_storeu_si128( out + 0, _mm_add_epi32( _mm_loadu_si128( out + 0 ), _mm_unpacklo_epi32( l0, r0 ) ) );
+		_mm_storeu_si128( out + 1, _mm_add_epi32( _mm_loadu_si128( out + 1 ), _mm_unpackhi_epi32( l0, r0 ) ) );
+		_mm_storeu_si128( out + 2, _mm_add_epi32( _mm_loadu_si128( out + 2 ), _mm_unpacklo_epi32( l1, r1 ) ) );
+		_mm_storeu_si128( out + 3, _mm_add_epi32( _mm_loadu_si128( out + 3 ), _mm_unpackhi_epi32( l1, r1 ) ) );
+	}
+
+	S_MixSamples_C( samp + i, samples + i, count - i, leftvol, rightvol );
+}
+
+/*
+===================
+S_MixSamples_AVX2
+===================
+*/
+static void S_MixSamples_AVX2( portable_samplepair_t *samp, const short *samples, int count, int leftvol, int rightvol ) {
+	__m256i		lv, rv;
+	__m256i		d, l, r, lo, hi;
+	__m256i		*out;
+	int			i;
+
+	lv = _mm256_set1_epi32( leftvol );
+	rv = _mm256_set1_epi32( rightvol );
+
+	for ( i = 0 ; i + 8 <= count ; i += 8 ) {
+		d = _mm256_cvtepi16_epi32( _mm_loadu_si128( (const __m128i *)&samples[i] ) );
+		l = _mm256_srai_epi32( _mm256_mullo_epi32( d, lv ), 8 );
+		r = _mm256_srai_epi32( _mm256_mullo_epi32( d, rv ), 8 );
+
+		// the unpacks stay inside the 128 bit lanes, so the halves are swapped back after
+		lo = _mm256_unpacklo_epi32( l, r );
+		hi = _mm256_unpackhi_epi32( l, r );
+
+		out = (__m256i *)&samp[i];
+		_mm256_storeu_si256( out + 0, _mm256_add_epi32( _mm256_loadu_si256( out + 0 ), _mm256_permute2x128_si256( lo, hi, 0x20 ) ) );
+		_mm256_storeu_si256( out + 1, _mm256_add_epi32( _mm256_loadu_si256( out + 1 ), _mm256_permute2x128_si256( lo, hi, 0x31 ) ) );
+	}
+	_mm256_zeroupper();
+
+	S_MixSamples_C( samp + i, samples + i, count - i, leftvol, rightvol );
+}
+#endif
+
+/*
+===================
+S_MixSamples
+
+Adds count samples at the volumes into samp
+===================
+*/
+static void S_MixSamples( portable_samplepair_t *samp, const short *samples, int count, int leftvol, int rightvol ) {
+#if SND_SIMD
+	if ( snd_mixPath == SND_MIX_AVX2 ) {
+		S_MixSamples_AVX2( samp, samples, count, leftvol, rightvol );
+		return;
+	}
+	if ( snd_mixPath == SND_MIX_SSE2 ) {
+		S_MixSamples_SSE2( samp, samples, count, leftvol, rightvol );
+		return;
+	}
+#endif
+	S_MixSamples_C( samp, samples, count, leftvol, rightvol );
+}
+
+#if SND_SIMD
+/*
+===================
+S_ClampSamples_SSE2
+
+packs saturates the same way the C version clamps
+===================
+*/
+static void S_ClampSamples_SSE2( const int *p, short *out, int count ) {
+	__m128i		a, b;
+	int			i;
+	int			val;
+
+	for ( i = 0 ; i + 8 <= count ; i += 8 ) {
+		a = _mm_srai_epi32( _mm_loadu_si128( (const __m128i *)&p[i] ), 8 );
+		b = _mm_srai_epi32( _mm_loadu_si128( (const __m128i *)&p[i + 4] ), 8 );
+		_mm_storeu_si128( (__m128i *)&out[i], _mm_packs_epi32( a, b ) );
+	}
+
+	for ( ; i < count ; i++ ) {
+		val = p[i]>>8;
+		if (val > 0x7fff)
+			out[i] = 0x7fff;
+		else if (val < -32768)
+			out[i] = -32768;
+		else
+			out[i] = val;
+	}
+}
+
+/*
+===================
+S_ClampSamples_AVX2
+===================
+*/
+static void S_ClampSamples_AVX2( const int *p, short *out, int count ) {
+	__m256i		a, b;
+	int			i;
+
+	for ( i = 0 ; i + 16 <= count ; i += 16 ) {
+		a = _mm256_srai_epi32( _mm256_loadu_si256( (const __m256i *)&p[i] ), 8 );
+		b = _mm256_srai_epi32( _mm256_loadu_si256( (const __m256i *)&p[i + 8] ), 8 );
+		// packs works inside the lanes, put the quarters back in order
+		_mm256_storeu_si256( (__m256i *)&out[i], _mm256_permute4x64_epi64( _mm256_packs_epi32( a, b ), 0xd8 ) );
+	}
+	_mm256_zeroupper();
+
+	S_ClampSamples_SSE2( p + i, out + i, count - i );
+}
+#endif
+
+/*
+===================
+S_ScaleRawSamples_C
+===================
+*/
+static void S_ScaleRawSamples_C( portable_samplepair_t *out, const short *in, int count, int volume ) {
+	int		i;
+
+	for ( i = 0 ; i < count ; i++ ) {
+		out[i].left = in[i*2] * volume;
+		out[i].right = in[i*2+1] * volume;
+	}
+}
+
+#if SND_SIMD
+/*
+===================
+S_ScaleRawSamples_SSE2
+
+The pairs are already interleaved, so the products only need widening
+===================
+*/
+static void S_ScaleRawSamples_SSE2( portable_samplepair_t *out, const short *in, int count, int volume ) {
+	__m128i		v, d, lo, hi;
+	__m128i		*o;
+	int			i;
+
+	if ( volume < 0 || volume > 0x7fff ) {
+		S_ScaleRawSamples_C( out, in, count, volume );
+		return;
+	}
+
+	v = _mm_set1_epi16( (short)volume );
+	for ( i = 0 ; i + 4 <= count ; i += 4 ) {
+		d = _mm_loadu_si128( (const __m128i *)&in[i*2] );
+		lo = _mm_mullo_epi16( d, v );
+		hi = _mm_mulhi_epi16( d, v );
+		o = (__m128i *)&out[i];
+		_mm_storeu_si128( o + 0, _mm_unpacklo_epi16( lo, hi ) );
+		_mm_storeu_si128( o + 1, _mm_unpackhi_epi16( lo, hi ) );
+	}
+
+	S_ScaleRawSamples_C( out + i, in + i*2, count - i, volume );
+}
+
+/*
+===================
+S_ScaleRawSamples_AVX2
+===================
+*/
+static void S_ScaleRawSamples_AVX2( portable_samplepair_t *out, const short *in, int count, int volume ) {
+	__m256i		v, d;
+	int			i;
+
+	v = _mm256_set1_epi32( volume );
+	for ( i = 0 ; i + 4 <= count ; i += 4 ) {
+		d = _mm256_cvtepi16_epi32( _mm_loadu_si128( (const __m128i *)&in[i*2] ) );
+		_mm256_storeu_si256( (__m256i *)&out[i], _mm256_mullo_epi32( d, v ) );
+	}
+	_mm256_zeroupper();
+
+	S_ScaleRawSamples_C( out + i, in + i*2, count - i, volume );
+}
+#endif
+
+/*
+===================
+S_ScaleRawSamples
+
+Stereo 16 bit samples at volume into the raw sample ring, for the music
+===================
+*/
+void S_ScaleRawSamples( portable_samplepair_t *out, const short *in, int count, int volume ) {
+#if SND_SIMD
+	switch ( snd_mixPath ) {
+	case SND_MIX_AVX2:
+		S_ScaleRawSamples_AVX2( out, in, count, volume );
+		return;
+	case SND_MIX_SSE2:
+		S_ScaleRawSamples_SSE2( out, in, count, volume );
+		return;
+	}
+#endif
+	S_ScaleRawSamples_C( out, in, count, volume );
+}
+
+/*
+===================
+S_WriteLinearBlast16
+
+Clamps snd_linear_count samples from snd_p to snd_out
+===================
+*/
+static void S_WriteLinearBlast16( void ) {
+#if SND_SIMD
+	if ( snd_mixPath == SND_MIX_AVX2 ) {
+		S_ClampSamples_AVX2( snd_p, snd_out, snd_linear_count );
+		return;
+	}
+	if ( snd_mixPath == SND_MIX_SSE2 ) {
+		S_ClampSamples_SSE2( snd_p, snd_out, snd_linear_count );
+		return;
+	}
+#endif
+	S_WriteLinearBlastStereo16();
+}
+
 void S_TransferStereo16 (unsigned long *pbuf, int endtime)
 {
 	int		lpos;
@@ -132,7 +461,7 @@ void S_TransferStereo16 (unsigned long *pbuf, int endtime)
 		snd_linear_count <<= 1;
 
 	// write a linear blast of samples
-		S_WriteLinearBlastStereo16 ();
+		S_WriteLinearBlast16 ();
 
 		snd_p += snd_linear_count;
 		ls_paintedtime += (snd_linear_count>>1);
@@ -224,9 +553,9 @@ CHANNEL MIXING
 */
 
 static void S_PaintChannelFrom16( channel_t *ch, const sfx_t *sc, int count, int sampleOffset, int bufferOffset ) {
-	int						data, aoff, boff;
+	int						aoff, boff;
 	int						leftvol, rightvol;
-	int						i, j;
+	int						i, j, run;
 	portable_samplepair_t	*samp;
 	sndBuffer				*chunk;
 	short					*samples;
@@ -249,6 +578,7 @@ static void S_PaintChannelFrom16( channel_t *ch, const sfx_t *sc, int count, int
 
 	if (!ch->doppler || ch->dopplerScale==1.0f) {
 #if idppc_altivec
+		int data;
 		vector signed short volume_vec;
 		vector unsigned int volume_shift;
 		int vectorCount, samplesLeft, chunkSamplesLeft;
@@ -364,17 +694,20 @@ static void S_PaintChannelFrom16( channel_t *ch, const sfx_t *sc, int count, int
 				}
 			}
 		}
-#else			
-		for ( i=0 ; i<count ; i++ ) {
-			data  = samples[sampleOffset++];
-			samp[i].left += (data * leftvol)>>8;
-			samp[i].right += (data * rightvol)>>8;
-
+#else
+		// a run at a time, up to the end of each chunk
+		for ( i=0 ; i<count ; i+=run ) {
 			if (sampleOffset == SND_CHUNK_SIZE) {
 				chunk = chunk->next;
 				samples = chunk->sndChunk;
 				sampleOffset = 0;
 			}
+			run = SND_CHUNK_SIZE - sampleOffset;
+			if (run > count - i) {
+				run = count - i;
+			}
+			S_MixSamples( samp + i, samples + sampleOffset, run, leftvol, rightvol );
+			sampleOffset += run;
 		}
 #endif
 	} else {
@@ -412,9 +745,8 @@ static void S_PaintChannelFrom16( channel_t *ch, const sfx_t *sc, int count, int
 }
 
 void S_PaintChannelFromWavelet( channel_t *ch, sfx_t *sc, int count, int sampleOffset, int bufferOffset ) {
-	int						data;
 	int						leftvol, rightvol;
-	int						i;
+	int						i, run;
 	portable_samplepair_t	*samp;
 	sndBuffer				*chunk;
 	short					*samples;
@@ -439,24 +771,25 @@ void S_PaintChannelFromWavelet( channel_t *ch, sfx_t *sc, int count, int sampleO
 
 	samples = sfxScratchBuffer;
 
-	for ( i=0 ; i<count ; i++ ) {
-		data  = samples[sampleOffset++];
-		samp[i].left += (data * leftvol)>>8;
-		samp[i].right += (data * rightvol)>>8;
-
+	for ( i=0 ; i<count ; i+=run ) {
 		if (sampleOffset == SND_CHUNK_SIZE*2) {
 			chunk = chunk->next;
 			decodeWavelet(chunk, sfxScratchBuffer);
 			sfxScratchIndex++;
 			sampleOffset = 0;
 		}
+		run = SND_CHUNK_SIZE*2 - sampleOffset;
+		if (run > count - i) {
+			run = count - i;
+		}
+		S_MixSamples( samp + i, samples + sampleOffset, run, leftvol, rightvol );
+		sampleOffset += run;
 	}
 }
 
 void S_PaintChannelFromADPCM( channel_t *ch, sfx_t *sc, int count, int sampleOffset, int bufferOffset ) {
-	int						data;
 	int						leftvol, rightvol;
-	int						i;
+	int						i, run;
 	portable_samplepair_t	*samp;
 	sndBuffer				*chunk;
 	short					*samples;
@@ -486,24 +819,27 @@ void S_PaintChannelFromADPCM( channel_t *ch, sfx_t *sc, int count, int sampleOff
 
 	samples = sfxScratchBuffer;
 
-	for ( i=0 ; i<count ; i++ ) {
-		data  = samples[sampleOffset++];
-		samp[i].left += (data * leftvol)>>8;
-		samp[i].right += (data * rightvol)>>8;
-
+	for ( i=0 ; i<count ; i+=run ) {
 		if (sampleOffset == SND_CHUNK_SIZE*4) {
 			chunk = chunk->next;
 			S_AdpcmGetSamples( chunk, sfxScratchBuffer);
 			sampleOffset = 0;
 			sfxScratchIndex++;
 		}
+		run = SND_CHUNK_SIZE*4 - sampleOffset;
+		if (run > count - i) {
+			run = count - i;
+		}
+		S_MixSamples( samp + i, samples + sampleOffset, run, leftvol, rightvol );
+		sampleOffset += run;
 	}
 }
 
 void S_PaintChannelFromMuLaw( channel_t *ch, sfx_t *sc, int count, int sampleOffset, int bufferOffset ) {
 	int						data;
 	int						leftvol, rightvol;
-	int						i;
+	int						i, j, run;
+	short					expanded[SND_CHUNK_SIZE*2];
 	portable_samplepair_t	*samp;
 	sndBuffer				*chunk;
 	byte					*samples;
@@ -523,16 +859,22 @@ void S_PaintChannelFromMuLaw( channel_t *ch, sfx_t *sc, int count, int sampleOff
 	}
 
 	if (!ch->doppler) {
+		// expand a run up to the end of the chunk, then mix it
 		samples = (byte *)chunk->sndChunk + sampleOffset;
-		for ( i=0 ; i<count ; i++ ) {
-			data  = mulawToShort[*samples];
-			samp[i].left += (data * leftvol)>>8;
-			samp[i].right += (data * rightvol)>>8;
-			samples++;
+		for ( i=0 ; i<count ; i+=run ) {
 			if (samples == (byte *)chunk->sndChunk+(SND_CHUNK_SIZE*2)) {
 				chunk = chunk->next;
 				samples = (byte *)chunk->sndChunk;
 			}
+			run = (int)( (byte *)chunk->sndChunk + (SND_CHUNK_SIZE*2) - samples );
+			if (run > count - i) {
+				run = count - i;
+			}
+			for ( j=0 ; j<run ; j++ ) {
+				expanded[j] = mulawToShort[samples[j]];
+			}
+			S_MixSamples( samp + i, expanded, run, leftvol, rightvol );
+			samples += run;
 		}
 	} else {
 		ooff = sampleOffset;
@@ -554,6 +896,148 @@ void S_PaintChannelFromMuLaw( channel_t *ch, sfx_t *sc, int count, int sampleOff
 	}
 }
 
+/*
+===================
+S_MixPath
+===================
+*/
+static sndMixPath_t S_MixPath( void ) {
+	if ( !s_mixSimd->integer ) {
+		return SND_MIX_C;
+	}
+	switch ( snd_cpuid ) {
+#if SND_SIMD
+	case CPUID_AVX2:
+		return SND_MIX_AVX2;
+	case CPUID_SSE2:
+		return SND_MIX_SSE2;
+#endif
+	default:
+		return SND_MIX_C;
+	}
+}
+
+/*
+===================
+S_InitMixPath
+===================
+*/
+void S_InitMixPath( void ) {
+	snd_cpuid = Cvar_VariableIntegerValue( "sys_cpuid" );
+	snd_mixPath = S_MixPath();
+	s_mixSimd->modified = qfalse;
+}
+
+/*
+===================
+S_UpdateMixPath
+
+Called from S_Update, a changed s_mixSimd takes effect from the next paint
+===================
+*/
+void S_UpdateMixPath( void ) {
+	if ( !s_mixSimd->modified ) {
+		return;
+	}
+	s_mixSimd->modified = qfalse;
+
+	S_LockMixer();
+	snd_mixPath = S_MixPath();
+	S_UnlockMixer();
+}
+
+/*
+===================
+S_MixBench_f
+
+s_mixbench [passes]
+
+Mixes and clamps a paintbuffer of random samples at random volumes with
+every path the cpu has, checks they give the same bits as the C path
+and prints how long each took
+===================
+*/
+void S_MixBench_f( void ) {
+	static portable_samplepair_t	mixed[SND_MIX_NUM_PATHS][PAINTBUFFER_SIZE];
+	static short					clamped[SND_MIX_NUM_PATHS][PAINTBUFFER_SIZE*2];
+	static short					samples[PAINTBUFFER_SIZE];
+	sndMixPath_t	best, path, saved;
+	int				leftvol[MAX_CHANNELS], rightvol[MAX_CHANNELS];
+	int				mixTime, clampTime;
+	int				passes, seed;
+	int				start, i, n;
+
+	passes = Cmd_Argc() > 1 ? atoi( Cmd_Argv( 1 ) ) : 100;
+	if ( passes < 1 ) {
+		passes = 1;
+	}
+
+	seed = 0x5eed;
+	for ( i = 0 ; i < PAINTBUFFER_SIZE ; i++ ) {
+		samples[i] = (short)Q_rand( &seed );
+	}
+	for ( i = 0 ; i < MAX_CHANNELS ; i++ ) {
+		leftvol[i] = ( Q_rand( &seed ) & 255 ) * 255;
+		rightvol[i] = ( Q_rand( &seed ) & 255 ) * 255;
+	}
+
+	// the mixer thread shares snd_mixPath and the blast pointers
+	S_LockMixer();
+
+	saved = snd_mixPath;
+	best = SND_MIX_C;
+#if SND_SIMD
+	switch ( snd_cpuid ) {
+	case CPUID_AVX2:
+		best = SND_MIX_AVX2;
+		break;
+	case CPUID_SSE2:
+		best = SND_MIX_SSE2;
+		break;
+	}
+#endif
+
+	Com_Printf( "%i passes of %i channels over %i samples\n", passes, MAX_CHANNELS, PAINTBUFFER_SIZE );
+	Com_Printf( "path     mix msec  clamp msec\n" );
+	for ( path = SND_MIX_C ; path <= best ; path = (sndMixPath_t)( path + 1 ) ) {
+		snd_mixPath = path;
+
+		// every channel starts at a different sample, so the loads aren't all aligned
+		Com_Memset( mixed[path], 0, sizeof( mixed[path] ) );
+		start = Sys_Microseconds();
+		for ( n = 0 ; n < passes ; n++ ) {
+			for ( i = 0 ; i < MAX_CHANNELS ; i++ ) {
+				S_MixSamples( mixed[path], samples + i, PAINTBUFFER_SIZE - i, leftvol[i], rightvol[i] );
+			}
+		}
+		mixTime = Sys_Microseconds() - start;
+
+		snd_p = (int *)mixed[path];
+		snd_out = clamped[path];
+		snd_linear_count = PAINTBUFFER_SIZE*2;
+		start = Sys_Microseconds();
+		for ( n = 0 ; n < passes ; n++ ) {
+			S_WriteLinearBlast16();
+		}
+		clampTime = Sys_Microseconds() - start;
+
+		Com_Printf( "%-6s %10.3f  %10.3f", snd_mixPathNames[path], mixTime * 0.001, clampTime * 0.001 );
+		if ( path != SND_MIX_C ) {
+			if ( memcmp( mixed[path], mixed[SND_MIX_C], sizeof( mixed[path] ) )
+				|| memcmp( clamped[path], clamped[SND_MIX_C], sizeof( clamped[path] ) ) ) {
+				Com_Printf( "  MISMATCH" );
+			} else {
+				Com_Printf( "  same as C" );
+			}
+		}
+		Com_Printf( "\n" );
+	}
+
+	snd_mixPath = saved;
+
+	S_UnlockMixer();
+}
+
 /*
 ===================
 S_PaintChannels
@@ -566,6 +1050,7 @@ void S_PaintChannels( int endtime ) {
 	sfx_t	*sc;
 	int		ltime, count;
 	int		sampleOffset;
+	int		rawend;
 
 
 	snd_vol = s_volume->value*255;
@@ -579,9 +1064,12 @@ void S_PaintChannels( int endtime ) {
 			end = s_paintedtime + PAINTBUFFER_SIZE;
 		}
 
+		// S_RawSamples moves s_rawend on the main thread once the samples are in
+		rawend = s_rawend;
+
 		// clear the paint buffer to either music or zeros
-		if ( s_rawend < s_paintedtime ) {
-			if ( s_rawend ) {
+		if ( rawend < s_paintedtime ) {
+			if ( rawend ) {
 				//Com_DPrintf ("background sound underrun\n");
 			}
 			Com_Memset(paintbuffer, 0, (end - s_paintedtime) * sizeof(portable_samplepair_t));
@@ -590,7 +1078,7 @@ void S_PaintChannels( int endtime ) {
 			int		s;
 			int		stop;
 
-			stop = (end < s_rawend) ? end : s_rawend;
+			stop = (end < rawend) ? end : rawend;
 
 			for ( i = s_paintedtime ; i < stop ; i++ ) {
 				s = i&(MAX_RAW_SAMPLES-1);
@@ -1106,6 +1106,12 @@ void Sys_Init( void ) {
 		case CPUID_GENERIC:
 			Cvar_Set( "sys_cpustring", "generic" );
 			break;
+		case CPUID_SSE2:
+			Cvar_Set( "sys_cpustring", "sse2" );
+			break;
+		case CPUID_AVX2:
+			Cvar_Set( "sys_cpustring", "avx2" );
+			break;
 		default:
 			Com_Error( ERR_FATAL, "Unknown cpu type %d\n", cpuid );
 			break;
@@ -1118,6 +1124,14 @@ void Sys_Init( void ) {
 		{
 			cpuid = CPUID_GENERIC;
 		}
+		else if ( !Q_stricmp( Cvar_VariableString( "sys_cpustring" ), "sse2" ) )
+		{
+			cpuid = CPUID_SSE2;
+		}
+		else if ( !Q_stricmp( Cvar_VariableString( "sys_cpustring" ), "avx2" ) )
+		{
+			cpuid = CPUID_AVX2;
+		}
 		else
 		{
 			Com_Printf( "WARNING: unknown sys_cpustring '%s'\n", Cvar_VariableString( "sys_cpustring" ) );
@@ -1163,6 +1177,7 @@ int WINAPI WinMain (HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLin
 
 	// get the initial time base
 	Sys_Milliseconds();
+	Sys_Microseconds();
 #if 0
 	// if we find the CD, add a +set cddir xxx command line
 	Sys_ScanForCD();
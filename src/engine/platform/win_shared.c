@@ -32,6 +32,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <direct.h>
 #include <io.h>
 #include <conio.h>
+#include <intrin.h>
 
 /*
 ================
@@ -53,6 +54,30 @@ int Sys_Milliseconds (void)
 	return sys_curtime;
 }
 
+/*
+================
+Sys_Microseconds
+
+High resolution timer for profiling.  Wraps around every 35 minutes,
+so only differences between two readings mean anything.
+================
+*/
+int Sys_Microseconds( void ) {
+	static LARGE_INTEGER	frequency, base;
+	LARGE_INTEGER			now;
+	LONGLONG				ticks;
+
+	if ( !frequency.QuadPart ) {
+		QueryPerformanceFrequency( &frequency );
+		QueryPerformanceCounter( &base );
+	}
+	QueryPerformanceCounter( &now );
+
+	ticks = now.QuadPart - base.QuadPart;
+	return (int)(unsigned int)( ( ticks / frequency.QuadPart ) * 1000000
+		+ ( ticks % frequency.QuadPart ) * 1000000 / frequency.QuadPart );
+}
+
 /*
 ================
 Sys_SnapVector
@@ -83,7 +108,30 @@ void Sys_SnapVector( float *v )
 
 int Sys_GetProcessorId( void )
 {
+#if defined _M_X64 || defined _M_IX86
+	int		regs[4];
+	int		maxLevel;
+
+	__cpuid( regs, 0 );
+	maxLevel = regs[0];
+
+	__cpuid( regs, 1 );
+	if ( !( regs[3] & ( 1 << 26 ) ) )
+		return CPUID_GENERIC;
+
+	// AVX2 also needs OSXSAVE and the OS saving the xmm and ymm state
+	if ( maxLevel >= 7 && ( regs[2] & ( 1 << 27 ) ) && ( regs[2] & ( 1 << 28 ) )
+		&& ( _xgetbv( 0 ) & 6 ) == 6 )
+	{
+		__cpuidex( regs, 7, 0 );
+		if ( regs[1] & ( 1 << 5 ) )
+			return CPUID_AVX2;
+	}
+
+	return CPUID_SSE2;
+#else
 	return CPUID_GENERIC;
+#endif
 }
 
 /*
@@ -121,3 +169,100 @@ char *Sys_DefaultInstallPath(void)
 	return Sys_Cwd();
 }
 
+
+//============================================
+
+/*
+================
+Sys_OpenSharedMemory
+
+Creates the named pagefile backed section, or opens it if another
+process got there first, in which case *created is set to qfalse.
+================
+*/
+void *Sys_OpenSharedMemory( const char *name, int size, qboolean *created ) {
+	HANDLE	handle;
+
+	handle = CreateFileMapping( INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, size, name );
+	if ( !handle ) {
+		return NULL;
+	}
+	*created = ( GetLastError() != ERROR_ALREADY_EXISTS ) ? qtrue : qfalse;
+	return handle;
+}
+
+void Sys_CloseSharedMemory( void *shm ) {
+	CloseHandle( (HANDLE)shm );
+}
+
+/*
+================
+Sys_FindSharedMemory
+
+Opens a segment that another process has created, NULL if there is none
+================
+*/
+void *Sys_FindSharedMemory( const char *name ) {
+	return OpenFileMapping( FILE_MAP_READ, FALSE, name );
+}
+
+/*
+================
+Sys_MapSharedMemory
+
+Maps the whole segment wherever there is room, read only unless writable
+================
+*/
+void *Sys_MapSharedMemory( void *shm, qboolean writable ) {
+	return MapViewOfFile( (HANDLE)shm, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0 );
+}
+
+void Sys_UnmapSharedMemory( void *view ) {
+	UnmapViewOfFile( view );
+}
+
+/*
+================
+Sys_MapFile
+
+The view keeps the file open, so the handles can go right away.  Writers
+are allowed in so a server can still replace a pk3 being downloaded.
+================
+*/
+const void *Sys_MapFile( const char *ospath, int *length ) {
+	HANDLE			file, mapping;
+	LARGE_INTEGER	size;
+	const void		*view;
+
+	*length = 0;
+
+	file = CreateFile( ospath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+	if ( file == INVALID_HANDLE_VALUE ) {
+		return NULL;
+	}
+
+	if ( !GetFileSizeEx( file, &size ) || size.QuadPart <= 0 || size.QuadPart > 0x7fffffff ) {
+		CloseHandle( file );
+		return NULL;
+	}
+
+	mapping = CreateFileMapping( file, NULL, PAGE_READONLY, 0, 0, NULL );
+	CloseHandle( file );
+	if ( !mapping ) {
+		return NULL;
+	}
+
+	view = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+	CloseHandle( mapping );
+	if ( !view ) {
+		return NULL;
+	}
+
+	*length = (int)size.QuadPart;
+	return view;
+}
+
+void Sys_UnmapFile( const void *data ) {
+	UnmapViewOfFile( data );
+}
@@ -39,6 +39,10 @@ static LPDIRECTSOUND pDS;
 static LPDIRECTSOUNDBUFFER pDSBuf, pDSPBuf;
 static HINSTANCE hInstDS;
 
+// SNDDMA_BeginPainting runs on the mixer thread, which can't print
+static volatile int	dsoundStatusErrors;
+static volatile int	dsoundLockError;
+
 
 static const char *DSoundError( int error ) {
 	switch ( error ) {
@@ -307,7 +311,7 @@ void SNDDMA_BeginPainting( void ) {
 
 	// if the buffer was lost or stopped, restore it and/or restart it
 	if ( pDSBuf->lpVtbl->GetStatus (pDSBuf, &dwStatus) != DS_OK ) {
-		Com_Printf ("Couldn't get sound buffer status\n");
+		Sys_AtomicAdd( &dsoundStatusErrors, 1 );
 	}
 	
 	if (dwStatus & DSBSTATUS_BUFFERLOST)
@@ -326,7 +330,7 @@ void SNDDMA_BeginPainting( void ) {
 	{
 		if (hresult != DSERR_BUFFERLOST)
 		{
-			Com_Printf( "SNDDMA_BeginPainting: Lock failed with error '%s'\n", DSoundError( hresult ) );
+			dsoundLockError = hresult;
 			S_Shutdown ();
 			return;
 		}
@@ -341,6 +345,28 @@ void SNDDMA_BeginPainting( void ) {
 	dma.buffer = (unsigned char *)pbuf;
 }
 
+/*
+==============
+SNDDMA_ReportErrors
+
+Prints what went wrong in SNDDMA_BeginPainting, on the main thread
+===============
+*/
+void SNDDMA_ReportErrors( void ) {
+	int		errors;
+
+	errors = dsoundStatusErrors;
+	if ( errors ) {
+		Sys_AtomicAdd( &dsoundStatusErrors, -errors );
+		Com_Printf( "Couldn't get sound buffer status %i times\n", errors );
+	}
+
+	if ( dsoundLockError ) {
+		Com_Printf( "SNDDMA_BeginPainting: Lock failed with error '%s'\n", DSoundError( dsoundLockError ) );
+		dsoundLockError = 0;
+	}
+}
+
 /*
 ==============
 SNDDMA_Submit
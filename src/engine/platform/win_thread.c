@@ -0,0 +1,184 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// win_thread.c -- Win32 threads and synchronization primitives
+
+#include "../../game/q_shared.h"
+#include "../qcommon/qcommon.h"
+#include "win_local.h"
+
+// worker threads can run collision and other generation code that keeps
+// large scratch structures on the stack
+#define	THREAD_STACK_SIZE	( 1024 * 1024 )
+
+typedef struct {
+	void	(*func)( void *arg );
+	void	*arg;
+} threadStart_t;
+
+/*
+==================
+Sys_ThreadProc
+==================
+*/
+static DWORD WINAPI Sys_ThreadProc( LPVOID param ) {
+	threadStart_t	start;
+
+	start = *(threadStart_t *)param;
+	HeapFree( GetProcessHeap(), 0, param );
+
+	start.func( start.arg );
+	return 0;
+}
+
+/*
+==================
+Sys_ProcessorCount
+==================
+*/
+unsigned int Sys_ProcessorCount() {
+	SYSTEM_INFO	info;
+
+	GetSystemInfo( &info );
+	if ( info.dwNumberOfProcessors < 1 ) {
+		return 1;
+	}
+	return info.dwNumberOfProcessors;
+}
+
+/*
+==================
+Sys_CreateThread
+==================
+*/
+void *Sys_CreateThread( void (*func)( void *arg ), void *arg ) {
+	threadStart_t	*start;
+	HANDLE			handle;
+
+	start = (threadStart_t *)HeapAlloc( GetProcessHeap(), 0, sizeof( *start ) );
+	if ( !start ) {
+		return NULL;
+	}
+	start->func = func;
+	start->arg = arg;
+
+	handle = CreateThread( NULL, THREAD_STACK_SIZE, Sys_ThreadProc, start,
+		STACK_SIZE_PARAM_IS_A_RESERVATION, NULL );
+	if ( !handle ) {
+		HeapFree( GetProcessHeap(), 0, start );
+		return NULL;
+	}
+	return handle;
+}
+
+/*
+==================
+Sys_JoinThread
+==================
+*/
+void Sys_JoinThread( void *thread ) {
+	WaitForSingleObject( (HANDLE)thread, INFINITE );
+	CloseHandle( (HANDLE)thread );
+}
+
+/*
+==================
+Sys_Yield
+==================
+*/
+void Sys_Yield( void ) {
+	SwitchToThread();
+}
+
+void Sys_Sleep( int msec ) {
+	Sleep( msec );
+}
+
+/*
+==================
+Sys_CreateMutex
+==================
+*/
+void *Sys_CreateMutex( void ) {
+	CRITICAL_SECTION	*crit;
+
+	crit = (CRITICAL_SECTION *)HeapAlloc( GetProcessHeap(), 0, sizeof( *crit ) );
+	InitializeCriticalSectionAndSpinCount( crit, 1000 );
+	return crit;
+}
+
+void Sys_DestroyMutex( void *mutex ) {
+	DeleteCriticalSection( (CRITICAL_SECTION *)mutex );
+	HeapFree( GetProcessHeap(), 0, mutex );
+}
+
+void Sys_LockMutex( void *mutex ) {
+	EnterCriticalSection( (CRITICAL_SECTION *)mutex );
+}
+
+void Sys_UnlockMutex( void *mutex ) {
+	LeaveCriticalSection( (CRITICAL_SECTION *)mutex );
+}
+
+/*
+==================
+Sys_CreateSemaphore
+==================
+*/
+void *Sys_CreateSemaphore( int initialCount ) {
+	return CreateSemaphore( NULL, initialCount, 0x7fffffff, NULL );
+}
+
+void Sys_DestroySemaphore( void *sem ) {
+	CloseHandle( (HANDLE)sem );
+}
+
+void Sys_PostSemaphore( void *sem, int count ) {
+	if ( count > 0 ) {
+		ReleaseSemaphore( (HANDLE)sem, count, NULL );
+	}
+}
+
+void Sys_WaitSemaphore( void *sem ) {
+	WaitForSingleObject( (HANDLE)sem, INFINITE );
+}
+
+/*
+==================
+Sys_AtomicAdd
+
+Returns the new value
+==================
+*/
+int Sys_AtomicAdd( volatile int *value, int add ) {
+	return InterlockedExchangeAdd( (volatile LONG *)value, add ) + add;
+}
+
+/*
+==================
+Sys_AtomicCompareExchange
+
+Returns the previous value
+==================
+*/
+int Sys_AtomicCompareExchange( volatile int *value, int exchange, int comparand ) {
+	return InterlockedCompareExchange( (volatile LONG *)value, exchange, comparand );
+}
@@ -22,6 +22,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 // cmodel.c -- model loading
 
 #include "cm_local.h"
+#include "cm_patch.h"
 
 #ifdef BSPC
 
@@ -62,6 +63,8 @@ byte		*cmod_base;
 cvar_t		*cm_noAreas;
 cvar_t		*cm_noCurves;
 cvar_t		*cm_playerCurveClip;
+cvar_t		*cm_mapCache;
+cvar_t		*cm_sharedMaps;
 #endif
 
 cmodel_t	box_model;
@@ -74,6 +77,812 @@ void	CM_InitBoxHull (void);
 void	CM_FloodAreaConnections (void);
 
 
+/*
+===============================================================================
+
+					MAP CACHE
+
+The collision data of recently used maps can be kept in memory of its own,
+outside of the hunk, so it survives the Hunk_Clear of a map change and
+rotating back to one of those maps skips all of the parsing and patch
+generation.  cm_mapCache is the number of maps to keep, 0 disables it.
+
+With cm_sharedMaps set, the first server process on the machine to load
+a map also writes it into a named shared memory segment sized to fit,
+and every process that loads the same map after that, the builder
+included, maps the segment read only wherever it lands.  Everything in
+the segment is addressed by offsets from its start.  The arrays that
+are written while the map is in use or that hold pointers, brushes,
+planes, nodes, patches, areas and portals, are rebuilt in private cache
+blocks, while the bulk of the data, patch facets and planes, visibility,
+leafs, submodels and the entity string, stays shared.
+
+===============================================================================
+*/
+
+#define	MAX_CM_CACHE		16
+#define	CM_CACHE_BLOCK		( 1024 * 1024 )
+
+#define	CM_SHARED_IDENT		(('S'<<24)+('M'<<16)+('C'<<8)+'Q')
+#define	CM_SHARED_VERSION	2
+#define	CM_SHARED_WAIT		20000	// msec to wait for another process to finish building
+
+#define	CM_SHARED_BUILDING	0		// a new segment is zero filled
+#define	CM_SHARED_READY		1
+
+#define	CM_SHARED_ALIGN( x )	( ( (x) + 31 ) & ~31 )
+
+typedef struct {
+	int				planeNum;
+	int				surfaceFlags;
+	int				shaderNum;
+} cmSharedSide_t;
+
+typedef struct {
+	int				planeNum;
+	int				children[2];
+} cmSharedNode_t;
+
+typedef struct {
+	int				shaderNum;
+	int				contents;
+	vec3_t			bounds[2];
+	int				numsides;
+	int				firstSide;
+} cmSharedBrush_t;
+
+typedef struct {
+	qboolean		isPatch;		// non-patch surfaces are left out
+	int				surfaceFlags;
+	int				contents;
+	vec3_t			bounds[2];
+	int				numPlanes;
+	int				planes;
+	int				numFacets;
+	int				facets;
+} cmSharedPatch_t;
+
+// lives at the start of a shared segment, the array members are
+// offsets from the start of the segment
+typedef struct {
+	int				ident;
+	volatile int	state;
+	int				size;
+
+	int				numShaders;
+	int				numBrushSides;
+	int				numPlanes;
+	int				numNodes;
+	int				numLeafs;
+	int				numLeafBrushes;
+	int				numLeafBrushIndexes;	// world, box and submodel leaf brushes
+	int				numLeafSurfaces;
+	int				numSubModels;
+	int				numBrushes;
+	int				numClusters;
+	int				clusterBytes;
+	int				visibilityBytes;
+	qboolean		vised;
+	int				numEntityChars;
+	int				numAreas;
+	int				numSurfaces;
+
+	int				shaders;
+	int				brushSides;
+	int				planes;
+	int				nodes;
+	int				leafs;
+	int				leafBrushes;
+	int				leafSurfaces;
+	int				cmodels;
+	int				brushes;
+	int				visibility;
+	int				entityString;
+	int				surfaces;
+} cmSharedHeader_t;
+
+typedef struct cmCacheBlock_s {
+	struct cmCacheBlock_s	*next;
+	int						size;
+	int						used;
+} cmCacheBlock_t;
+
+typedef struct {
+	char			name[MAX_QPATH];
+	unsigned		checksum;
+	int				length;			// of the bsp file
+	int				lastUsed;
+	qboolean		complete;		// false while loading or if the load failed
+	int				totalBytes;
+	cmCacheBlock_t	*blocks;
+	void			*shm;			// shared segment handle, next to the blocks
+	void			*view;
+	clipMap_t		cm;				// copied back when the map is unloaded
+} cmCacheEntry_t;
+
+static cmCacheEntry_t	cm_cache[MAX_CM_CACHE];
+static cmCacheEntry_t	*cm_cacheLoading;	// allocations go here when set
+static cmCacheEntry_t	*cm_cacheCurrent;	// the entry cm was restored from
+static int				cm_cacheSequence;
+
+/*
+==================
+CM_CacheFreeBlocks
+==================
+*/
+static void CM_CacheFreeBlocks( cmCacheEntry_t *entry ) {
+	cmCacheBlock_t	*block, *next;
+
+	for ( block = entry->blocks ; block ; block = next ) {
+		next = block->next;
+		entry->totalBytes -= block->size;
+		free( block );
+	}
+	entry->blocks = NULL;
+}
+
+/*
+==================
+CM_CacheFreeEntry
+==================
+*/
+static void CM_CacheFreeEntry( cmCacheEntry_t *entry ) {
+	CM_CacheFreeBlocks( entry );
+
+#ifndef BSPC
+	if ( entry->view ) {
+		Sys_UnmapSharedMemory( entry->view );
+	}
+	if ( entry->shm ) {
+		Sys_CloseSharedMemory( entry->shm );
+	}
+#endif
+
+	if ( cm_cacheLoading == entry ) {
+		cm_cacheLoading = NULL;
+	}
+	if ( cm_cacheCurrent == entry ) {
+		cm_cacheCurrent = NULL;
+	}
+	Com_Memset( entry, 0, sizeof( *entry ) );
+}
+
+/*
+==================
+CM_Alloc
+==================
+*/
+void *CM_Alloc( int size ) {
+	cmCacheEntry_t	*entry;
+	cmCacheBlock_t	*block;
+	void			*buf;
+
+	entry = cm_cacheLoading;
+	if ( !entry ) {
+		return Hunk_Alloc( size, h_high );
+	}
+
+	// round to cacheline like the hunk does
+	size = ( size + 31 ) & ~31;
+
+	block = entry->blocks;
+	if ( !block || block->used + size > block->size ) {
+		int		blockSize;
+
+		blockSize = size > CM_CACHE_BLOCK ? size : CM_CACHE_BLOCK;
+		block = (cmCacheBlock_t *) malloc( 32 + blockSize );
+		if ( !block ) {
+			Com_Error( ERR_DROP, "CM_Alloc: failed on %i", size );
+		}
+		block->size = blockSize;
+		block->used = 0;
+		block->next = entry->blocks;
+		entry->blocks = block;
+		entry->totalBytes += blockSize;
+	}
+
+	buf = (byte *)block + 32 + block->used;
+	block->used += size;
+
+	Com_Memset( buf, 0, size );
+	return buf;
+}
+
+/*
+==================
+CM_CacheRelease
+
+Called when cm is about to be thrown away.  Traces and area portal
+changes write into the map data, so copy the current state back into
+the cache entry to keep it consistent with the arrays.
+==================
+*/
+static void CM_CacheRelease( void ) {
+	if ( cm_cacheCurrent ) {
+		cm_cacheCurrent->cm = cm;
+		cm_cacheCurrent = NULL;
+	}
+
+	// a load that didn't finish, most likely because of a Com_Error
+	if ( cm_cacheLoading ) {
+		CM_CacheFreeEntry( cm_cacheLoading );
+	}
+}
+
+#ifndef BSPC
+/*
+==================
+CM_CacheLimit
+==================
+*/
+static int CM_CacheLimit( void ) {
+	if ( !cm_mapCache ) {
+		return 0;
+	}
+
+	// a shared map has to stay mapped for as long as it is in use
+	if ( cm_sharedMaps->integer && cm_mapCache->integer < 1 ) {
+		return 1;
+	}
+	return cm_mapCache->integer > 0 ? cm_mapCache->integer : 0;
+}
+
+/*
+==================
+CM_CacheTrim
+
+Evicts the least recently used maps until at most keep are left, the
+map in use is never evicted
+==================
+*/
+static void CM_CacheTrim( int keep ) {
+	cmCacheEntry_t	*entry, *oldest;
+	int				i, used;
+
+	while ( 1 ) {
+		used = 0;
+		oldest = NULL;
+		for ( i = 0, entry = cm_cache ; i < MAX_CM_CACHE ; i++, entry++ ) {
+			if ( !entry->complete ) {
+				continue;
+			}
+			used++;
+			if ( entry == cm_cacheCurrent ) {
+				continue;
+			}
+			if ( !oldest || entry->lastUsed < oldest->lastUsed ) {
+				oldest = entry;
+			}
+		}
+		if ( used <= keep || !oldest ) {
+			break;
+		}
+		CM_CacheFreeEntry( oldest );
+	}
+}
+
+/*
+==================
+CM_CacheRestore
+==================
+*/
+static void CM_CacheRestore( cmCacheEntry_t *entry ) {
+	cm = entry->cm;
+	entry->lastUsed = ++cm_cacheSequence;
+	cm_cacheCurrent = entry;
+
+	// area portals are opened by the game as it spawns the entities
+	Com_Memset( cm.areaPortals, 0, cm.numAreas * cm.numAreas * sizeof( *cm.areaPortals ) );
+}
+
+/*
+==================
+CM_CacheLookup
+
+Restores cm from the cache if the map is in there
+==================
+*/
+static qboolean CM_CacheLookup( const char *name, unsigned checksum ) {
+	cmCacheEntry_t	*entry;
+	int				i;
+
+	for ( i = 0, entry = cm_cache ; i < MAX_CM_CACHE ; i++, entry++ ) {
+		if ( !entry->complete || entry->checksum != checksum ) {
+			continue;
+		}
+		if ( Q_stricmp( entry->name, name ) ) {
+			continue;
+		}
+
+		CM_CacheRestore( entry );
+
+		Com_Printf( "CM_LoadMap: %s from the map cache\n", name );
+		return qtrue;
+	}
+
+	return qfalse;
+}
+
+/*
+==================
+CM_SharedName
+
+Segments are told apart by the map name as well as its contents
+==================
+*/
+static const char *CM_SharedName( cmCacheEntry_t *entry ) {
+	static char	name[MAX_OSPATH];
+	char		*s;
+
+	Com_sprintf( name, sizeof( name ), "Local\\q3cm_%i_%i_%08x_%i_%s", CM_SHARED_VERSION,
+		(int)sizeof( cmSharedHeader_t ), entry->checksum, entry->length, entry->name );
+
+	// backslashes separate kernel namespaces
+	for ( s = name + 6 ; *s ; s++ ) {
+		if ( *s == '\\' || *s == '/' ) {
+			*s = '_';
+		}
+	}
+	return name;
+}
+
+/*
+==================
+CM_SharedArray
+
+Reserves count elements in the segment being written, returns where
+they go or NULL while the size is only being measured
+==================
+*/
+static void *CM_SharedArray( byte *base, int *used, int *offset, int count, int size ) {
+	*offset = *used;
+	*used += CM_SHARED_ALIGN( count * size );
+	return base ? base + *offset : NULL;
+}
+
+/*
+==================
+CM_SharedWrite
+
+Lays cm out in a segment at base, with NULL only adds up the size
+==================
+*/
+static int CM_SharedWrite( byte *base ) {
+	cmSharedHeader_t	*h, measure;
+	cmSharedSide_t		*side;
+	cmSharedNode_t		*node;
+	cmSharedBrush_t		*brush;
+	cmSharedPatch_t		*patch;
+	cmodel_t			*cmodels;
+	patchPlane_t		*planes;
+	facet_t				*facets;
+	void				*data;
+	int					*leafBrushes, *leafSurfaces;
+	int					numLeafBrushes, numLeafSurfaces;
+	int					i, used, planesOffset, facetsOffset;
+
+	h = base ? (cmSharedHeader_t *)base : &measure;
+	Com_Memset( h, 0, sizeof( *h ) );
+	used = CM_SHARED_ALIGN( sizeof( *h ) );
+
+	h->numShaders = cm.numShaders;
+	h->numBrushSides = cm.numBrushSides;
+	h->numPlanes = cm.numPlanes;
+	h->numNodes = cm.numNodes;
+	h->numLeafs = cm.numLeafs;
+	h->numLeafBrushes = cm.numLeafBrushes;
+	h->numLeafSurfaces = cm.numLeafSurfaces;
+	h->numSubModels = cm.numSubModels;
+	h->numBrushes = cm.numBrushes;
+	h->numClusters = cm.numClusters;
+	h->clusterBytes = cm.clusterBytes;
+	h->vised = cm.vised;
+	h->visibilityBytes = cm.vised ? cm.numClusters * cm.clusterBytes : cm.clusterBytes;
+	h->numEntityChars = cm.numEntityChars;
+	h->numAreas = cm.numAreas;
+	h->numSurfaces = cm.numSurfaces;
+
+	// the submodels have their leaf brushes and surfaces in blocks of
+	// their own, they go after the world's and the box brush's ones
+	numLeafBrushes = cm.numLeafBrushes + BOX_BRUSHES;
+	numLeafSurfaces = cm.numLeafSurfaces;
+	for ( i = 1 ; i < cm.numSubModels ; i++ ) {
+		numLeafBrushes += cm.cmodels[i].leaf.numLeafBrushes;
+		numLeafSurfaces += cm.cmodels[i].leaf.numLeafSurfaces;
+	}
+	h->numLeafBrushIndexes = numLeafBrushes;
+
+	leafBrushes = (int *)CM_SharedArray( base, &used, &h->leafBrushes, numLeafBrushes, sizeof( int ) );
+	leafSurfaces = (int *)CM_SharedArray( base, &used, &h->leafSurfaces, numLeafSurfaces, sizeof( int ) );
+	cmodels = (cmodel_t *)CM_SharedArray( base, &used, &h->cmodels, cm.numSubModels, sizeof( cmodel_t ) );
+	if ( base ) {
+		Com_Memcpy( leafBrushes, cm.leafbrushes, ( cm.numLeafBrushes + BOX_BRUSHES ) * sizeof( int ) );
+		Com_Memcpy( leafSurfaces, cm.leafsurfaces, cm.numLeafSurfaces * sizeof( int ) );
+		Com_Memcpy( cmodels, cm.cmodels, cm.numSubModels * sizeof( cmodel_t ) );
+
+		numLeafBrushes = cm.numLeafBrushes + BOX_BRUSHES;
+		numLeafSurfaces = cm.numLeafSurfaces;
+		for ( i = 1 ; i < cm.numSubModels ; i++ ) {
+			cLeaf_t	*leaf = &cmodels[i].leaf;
+
+			Com_Memcpy( leafBrushes + numLeafBrushes, cm.leafbrushes + leaf->firstLeafBrush,
+				leaf->numLeafBrushes * sizeof( int ) );
+			leaf->firstLeafBrush = numLeafBrushes;
+			numLeafBrushes += leaf->numLeafBrushes;
+
+			Com_Memcpy( leafSurfaces + numLeafSurfaces, cm.leafsurfaces + leaf->firstLeafSurface,
+				leaf->numLeafSurfaces * sizeof( int ) );
+			leaf->firstLeafSurface = numLeafSurfaces;
+			numLeafSurfaces += leaf->numLeafSurfaces;
+		}
+	}
+
+	data = CM_SharedArray( base, &used, &h->shaders, cm.numShaders, sizeof( dshader_t ) );
+	if ( data ) {
+		Com_Memcpy( data, cm.shaders, cm.numShaders * sizeof( dshader_t ) );
+	}
+
+	data = CM_SharedArray( base, &used, &h->planes, cm.numPlanes, sizeof( cplane_t ) );
+	if ( data ) {
+		Com_Memcpy( data, cm.planes, cm.numPlanes * sizeof( cplane_t ) );
+	}
+
+	// the box leafs only have to be there
+	data = CM_SharedArray( base, &used, &h->leafs, cm.numLeafs + BOX_LEAFS, sizeof( cLeaf_t ) );
+	if ( data ) {
+		Com_Memcpy( data, cm.leafs, cm.numLeafs * sizeof( cLeaf_t ) );
+	}
+
+	data = CM_SharedArray( base, &used, &h->visibility, h->visibilityBytes, 1 );
+	if ( data ) {
+		Com_Memcpy( data, cm.visibility, h->visibilityBytes );
+	}
+
+	data = CM_SharedArray( base, &used, &h->entityString, cm.numEntityChars, 1 );
+	if ( data ) {
+		Com_Memcpy( data, cm.entityString, cm.numEntityChars );
+	}
+
+	// pointers become indexes
+	side = (cmSharedSide_t *)CM_SharedArray( base, &used, &h->brushSides, cm.numBrushSides, sizeof( *side ) );
+	for ( i = 0 ; side && i < cm.numBrushSides ; i++, side++ ) {
+		side->planeNum = (int)( cm.brushsides[i].plane - cm.planes );
+		side->surfaceFlags = cm.brushsides[i].surfaceFlags;
+		side->shaderNum = cm.brushsides[i].shaderNum;
+	}
+
+	node = (cmSharedNode_t *)CM_SharedArray( base, &used, &h->nodes, cm.numNodes, sizeof( *node ) );
+	for ( i = 0 ; node && i < cm.numNodes ; i++, node++ ) {
+		node->planeNum = (int)( cm.nodes[i].plane - cm.planes );
+		node->children[0] = cm.nodes[i].children[0];
+		node->children[1] = cm.nodes[i].children[1];
+	}
+
+	brush = (cmSharedBrush_t *)CM_SharedArray( base, &used, &h->brushes, cm.numBrushes, sizeof( *brush ) );
+	for ( i = 0 ; brush && i < cm.numBrushes ; i++, brush++ ) {
+		brush->shaderNum = cm.brushes[i].shaderNum;
+		brush->contents = cm.brushes[i].contents;
+		VectorCopy( cm.brushes[i].bounds[0], brush->bounds[0] );
+		VectorCopy( cm.brushes[i].bounds[1], brush->bounds[1] );
+		brush->numsides = cm.brushes[i].numsides;
+		brush->firstSide = (int)( cm.brushes[i].sides - cm.brushsides );
+	}
+
+	patch = (cmSharedPatch_t *)CM_SharedArray( base, &used, &h->surfaces, cm.numSurfaces, sizeof( *patch ) );
+	for ( i = 0 ; i < cm.numSurfaces ; i++ ) {
+		cPatch_t		*in = cm.surfaces[i];
+		patchCollide_t	*pc;
+
+		if ( !in ) {
+			continue;
+		}
+		pc = in->pc;
+
+		planes = (patchPlane_t *)CM_SharedArray( base, &used, &planesOffset, pc->numPlanes, sizeof( *planes ) );
+		facets = (facet_t *)CM_SharedArray( base, &used, &facetsOffset, pc->numFacets, sizeof( *facets ) );
+		if ( !base ) {
+			continue;
+		}
+		Com_Memcpy( planes, pc->planes, pc->numPlanes * sizeof( *planes ) );
+		Com_Memcpy( facets, pc->facets, pc->numFacets * sizeof( *facets ) );
+
+		patch[i].isPatch = qtrue;
+		patch[i].surfaceFlags = in->surfaceFlags;
+		patch[i].contents = in->contents;
+		VectorCopy( pc->bounds[0], patch[i].bounds[0] );
+		VectorCopy( pc->bounds[1], patch[i].bounds[1] );
+		patch[i].numPlanes = pc->numPlanes;
+		patch[i].planes = planesOffset;
+		patch[i].numFacets = pc->numFacets;
+		patch[i].facets = facetsOffset;
+	}
+
+	h->size = used;
+	return used;
+}
+
+/*
+==================
+CM_SharedAttach
+
+Waits for the process that builds the segment to finish and maps it read
+only.  The private parts of the clip map go to the entry's own blocks.
+==================
+*/
+static qboolean CM_SharedAttach( cmCacheEntry_t *entry, void *shm ) {
+	cmSharedHeader_t	*h;
+	cmSharedSide_t		*side;
+	cmSharedNode_t		*node;
+	cmSharedBrush_t		*brush;
+	cmSharedPatch_t		*patch;
+	clipMap_t			*c;
+	byte				*base;
+	int					i, state, start;
+
+	base = (byte *)Sys_MapSharedMemory( shm, qfalse );
+	if ( !base ) {
+		return qfalse;
+	}
+	h = (cmSharedHeader_t *)base;
+
+	start = Sys_Milliseconds();
+	while ( 1 ) {
+		state = h->state;
+		if ( state != CM_SHARED_BUILDING || Sys_Milliseconds() - start > CM_SHARED_WAIT ) {
+			break;
+		}
+		Sys_Sleep( 10 );
+	}
+
+	if ( state != CM_SHARED_READY || h->ident != CM_SHARED_IDENT ) {
+		Sys_UnmapSharedMemory( base );
+		return qfalse;
+	}
+
+	entry->shm = shm;
+	entry->view = base;
+	entry->totalBytes += h->size;
+
+	c = &entry->cm;
+	Com_Memset( c, 0, sizeof( *c ) );
+
+	// used in place
+	c->numShaders = h->numShaders;
+	c->shaders = (dshader_t *)( base + h->shaders );
+	c->numLeafs = h->numLeafs;
+	c->leafs = (cLeaf_t *)( base + h->leafs );
+	c->numLeafSurfaces = h->numLeafSurfaces;
+	c->leafsurfaces = (int *)( base + h->leafSurfaces );
+	c->numSubModels = h->numSubModels;
+	c->cmodels = (cmodel_t *)( base + h->cmodels );
+	c->numClusters = h->numClusters;
+	c->clusterBytes = h->clusterBytes;
+	c->vised = h->vised;
+	c->visibility = base + h->visibility;
+	c->numEntityChars = h->numEntityChars;
+	c->entityString = (char *)( base + h->entityString );
+
+	// the box hull is kept at the end of these
+	c->numPlanes = h->numPlanes;
+	c->planes = (cplane_t *)CM_Alloc( ( BOX_PLANES + h->numPlanes ) * sizeof( *c->planes ) );
+	Com_Memcpy( c->planes, base + h->planes, h->numPlanes * sizeof( *c->planes ) );
+
+	c->numLeafBrushes = h->numLeafBrushes;
+	c->leafbrushes = (int *)CM_Alloc( h->numLeafBrushIndexes * sizeof( *c->leafbrushes ) );
+	Com_Memcpy( c->leafbrushes, base + h->leafBrushes, h->numLeafBrushIndexes * sizeof( *c->leafbrushes ) );
+
+	c->numBrushSides = h->numBrushSides;
+	c->brushsides = (cbrushside_t *)CM_Alloc( ( BOX_SIDES + h->numBrushSides ) * sizeof( *c->brushsides ) );
+	side = (cmSharedSide_t *)( base + h->brushSides );
+	for ( i = 0 ; i < h->numBrushSides ; i++, side++ ) {
+		c->brushsides[i].plane = c->planes + side->planeNum;
+		c->brushsides[i].surfaceFlags = side->surfaceFlags;
+		c->brushsides[i].shaderNum = side->shaderNum;
+	}
+
+	c->numNodes = h->numNodes;
+	c->nodes = (cNode_t *)CM_Alloc( h->numNodes * sizeof( *c->nodes ) );
+	node = (cmSharedNode_t *)( base + h->nodes );
+	for ( i = 0 ; i < h->numNodes ; i++, node++ ) {
+		c->nodes[i].plane = c->planes + node->planeNum;
+		c->nodes[i].children[0] = node->children[0];
+		c->nodes[i].children[1] = node->children[1];
+	}
+
+	// the check counts are written by every trace
+	c->numBrushes = h->numBrushes;
+	c->brushes = (cbrush_t *)CM_Alloc( ( BOX_BRUSHES + h->numBrushes ) * sizeof( *c->brushes ) );
+	brush = (cmSharedBrush_t *)( base + h->brushes );
+	for ( i = 0 ; i < h->numBrushes ; i++, brush++ ) {
+		c->brushes[i].shaderNum = brush->shaderNum;
+		c->brushes[i].contents = brush->contents;
+		VectorCopy( brush->bounds[0], c->brushes[i].bounds[0] );
+		VectorCopy( brush->bounds[1], c->brushes[i].bounds[1] );
+		c->brushes[i].numsides = brush->numsides;
+		c->brushes[i].sides = c->brushsides + brush->firstSide;
+	}
+
+	c->numSurfaces = h->numSurfaces;
+	c->surfaces = (cPatch_t **)CM_Alloc( h->numSurfaces * sizeof( *c->surfaces ) );
+	patch = (cmSharedPatch_t *)( base + h->surfaces );
+	for ( i = 0 ; i < h->numSurfaces ; i++, patch++ ) {
+		cPatch_t		*out;
+		patchCollide_t	*pc;
+
+		if ( !patch->isPatch ) {
+			continue;
+		}
+		c->surfaces[i] = out = (cPatch_t *)CM_Alloc( sizeof( *out ) );
+		out->surfaceFlags = patch->surfaceFlags;
+		out->contents = patch->contents;
+		out->pc = pc = (patchCollide_t *)CM_Alloc( sizeof( *pc ) );
+		VectorCopy( patch->bounds[0], pc->bounds[0] );
+		VectorCopy( patch->bounds[1], pc->bounds[1] );
+		pc->numPlanes = patch->numPlanes;
+		pc->planes = (patchPlane_t *)( base + patch->planes );
+		pc->numFacets = patch->numFacets;
+		pc->facets = (facet_t *)( base + patch->facets );
+	}
+
+	c->numAreas = h->numAreas;
+	c->areas = (cArea_t *)CM_Alloc( h->numAreas * sizeof( *c->areas ) );
+	c->areaPortals = (int *)CM_Alloc( h->numAreas * h->numAreas * sizeof( *c->areaPortals ) );
+
+	return qtrue;
+}
+
+/*
+==================
+CM_SharedPublish
+
+Writes the map that was just loaded into a new segment and switches cm
+over to it, unless another process got there first
+==================
+*/
+static void CM_SharedPublish( cmCacheEntry_t *entry ) {
+	cmSharedHeader_t	*h;
+	const char			*name;
+	void				*shm;
+	qboolean			created;
+	int					size;
+
+	size = CM_SharedWrite( NULL );
+	name = CM_SharedName( entry );
+
+	shm = Sys_OpenSharedMemory( name, size, &created );
+	if ( !shm ) {
+		return;
+	}
+	if ( !created ) {
+		// keep the private copy rather than wait on the other one
+		Sys_CloseSharedMemory( shm );
+		return;
+	}
+
+	h = (cmSharedHeader_t *)Sys_MapSharedMemory( shm, qtrue );
+	if ( !h ) {
+		Sys_CloseSharedMemory( shm );
+		return;
+	}
+	CM_SharedWrite( (byte *)h );
+	h->ident = CM_SHARED_IDENT;
+	Sys_AtomicCompareExchange( &h->state, CM_SHARED_READY, CM_SHARED_BUILDING );
+	Sys_UnmapSharedMemory( h );
+
+	// the private copy goes, the segment is used like everybody else does
+	CM_CacheFreeBlocks( entry );
+	if ( !CM_SharedAttach( entry, shm ) ) {
+		Sys_CloseSharedMemory( shm );
+		Com_Error( ERR_DROP, "CM_LoadMap: couldn't map the shared clip map" );
+	}
+	cm = entry->cm;
+}
+
+/*
+==================
+CM_CacheBegin
+
+Makes the following CM_Alloc calls go to a cache entry.  Returns qtrue
+if another process already has the map in a shared segment, in which
+case cm has been restored from it and there is nothing left to load.
+==================
+*/
+static qboolean CM_CacheBegin( const char *name, unsigned checksum, int length ) {
+	cmCacheEntry_t	*entry;
+	int				i, limit;
+	void			*shm;
+
+	limit = CM_CacheLimit();
+	if ( limit <= 0 ) {
+		return qfalse;
+	}
+
+	// make room for this one
+	CM_CacheTrim( ( limit < MAX_CM_CACHE ? limit : MAX_CM_CACHE ) - 1 );
+
+	for ( i = 0, entry = cm_cache ; i < MAX_CM_CACHE ; i++, entry++ ) {
+		if ( !entry->complete ) {
+			break;
+		}
+	}
+
+	Q_strncpyz( entry->name, name, sizeof( entry->name ) );
+	entry->checksum = checksum;
+	entry->length = length;
+	cm_cacheLoading = entry;
+
+	if ( cm_sharedMaps->integer ) {
+		shm = Sys_FindSharedMemory( CM_SharedName( entry ) );
+		if ( shm ) {
+			if ( CM_SharedAttach( entry, shm ) ) {
+				entry->complete = qtrue;
+				cm_cacheLoading = NULL;
+				CM_CacheRestore( entry );
+				Com_Printf( "CM_LoadMap: %s from shared memory\n", name );
+				return qtrue;
+			}
+			Sys_CloseSharedMemory( shm );
+			CM_CacheFreeBlocks( entry );
+			Com_Printf( "CM_LoadMap: couldn't use the shared copy of %s\n", name );
+		}
+	}
+
+	return qfalse;
+}
+
+#endif
+
+/*
+==================
+CM_CacheEnd
+==================
+*/
+static void CM_CacheEnd( void ) {
+	cmCacheEntry_t	*entry;
+
+	entry = cm_cacheLoading;
+	if ( !entry ) {
+		return;
+	}
+
+#ifndef BSPC
+	if ( cm_sharedMaps->integer ) {
+		CM_SharedPublish( entry );
+	}
+#endif
+
+	entry->cm = cm;
+	entry->complete = qtrue;
+	entry->lastUsed = ++cm_cacheSequence;
+
+	cm_cacheLoading = NULL;
+	cm_cacheCurrent = entry;
+}
+
+#ifndef BSPC
+/*
+==================
+CM_MapCache_f
+==================
+*/
+void CM_MapCache_f( void ) {
+	cmCacheEntry_t	*entry;
+	int				i, total;
+
+	total = 0;
+	for ( i = 0, entry = cm_cache ; i < MAX_CM_CACHE ; i++, entry++ ) {
+		if ( !entry->complete ) {
+			continue;
+		}
+		Com_Printf( "%8i %s%s%s\n", entry->totalBytes, entry->name,
+			entry->shm ? " (shared)" : "", entry == cm_cacheCurrent ? " (current)" : "" );
+		total += entry->totalBytes;
+	}
+	Com_Printf( "%8i total bytes in the map cache\n", total );
+}
+#endif
+
+
 /*
 ===============================================================================
 
@@ -100,7 +909,7 @@ void CMod_LoadShaders( lump_t *l ) {
 	if (count < 1) {
 		Com_Error (ERR_DROP, "Map with no shaders");
 	}
-	cm.shaders = (dshader_t*) Hunk_Alloc( count * sizeof( *cm.shaders ), h_high );
+	cm.shaders = (dshader_t*) CM_Alloc( count * sizeof( *cm.shaders ) );
 	cm.numShaders = count;
 
 	Com_Memcpy( cm.shaders, in, count * sizeof( *cm.shaders ) );
@@ -131,7 +940,7 @@ void CMod_LoadSubmodels( lump_t *l ) {
 
 	if (count < 1)
 		Com_Error (ERR_DROP, "Map with no models");
-	cm.cmodels = (cmodel_t*) Hunk_Alloc( count * sizeof( *cm.cmodels ), h_high );
+	cm.cmodels = (cmodel_t*) CM_Alloc( count * sizeof( *cm.cmodels ) );
 	cm.numSubModels = count;
 
 	if ( count > MAX_SUBMODELS ) {
@@ -154,14 +963,14 @@ void CMod_LoadSubmodels( lump_t *l ) {
 
 		// make a "leaf" just to hold the model's brushes and surfaces
 		out->leaf.numLeafBrushes = LittleLong( in->numBrushes );
-		indexes = (int*) Hunk_Alloc( out->leaf.numLeafBrushes * 4, h_high );
+		indexes = (int*) CM_Alloc( out->leaf.numLeafBrushes * 4 );
 		out->leaf.firstLeafBrush = indexes - cm.leafbrushes;
 		for ( j = 0 ; j < out->leaf.numLeafBrushes ; j++ ) {
 			indexes[j] = LittleLong( in->firstBrush ) + j;
 		}
 
 		out->leaf.numLeafSurfaces = LittleLong( in->numSurfaces );
-		indexes = (int*) Hunk_Alloc( out->leaf.numLeafSurfaces * 4, h_high );
+		indexes = (int*) CM_Alloc( out->leaf.numLeafSurfaces * 4 );
 		out->leaf.firstLeafSurface = indexes - cm.leafsurfaces;
 		for ( j = 0 ; j < out->leaf.numLeafSurfaces ; j++ ) {
 			indexes[j] = LittleLong( in->firstSurface ) + j;
@@ -189,7 +998,7 @@ void CMod_LoadNodes( lump_t *l ) {
 
 	if (count < 1)
 		Com_Error (ERR_DROP, "Map has no nodes");
-	cm.nodes = (cNode_t*) Hunk_Alloc( count * sizeof( *cm.nodes ), h_high );
+	cm.nodes = (cNode_t*) CM_Alloc( count * sizeof( *cm.nodes ) );
 	cm.numNodes = count;
 
 	out = cm.nodes;
@@ -241,7 +1050,7 @@ void CMod_LoadBrushes( lump_t *l ) {
 	}
 	count = l->filelen / sizeof(*in);
 
-	cm.brushes = (cbrush_t*) Hunk_Alloc( ( BOX_BRUSHES + count ) * sizeof( *cm.brushes ), h_high );
+	cm.brushes = (cbrush_t*) CM_Alloc( ( BOX_BRUSHES + count ) * sizeof( *cm.brushes ) );
 	cm.numBrushes = count;
 
 	out = cm.brushes;
@@ -281,7 +1090,7 @@ void CMod_LoadLeafs (lump_t *l)
 	if (count < 1)
 		Com_Error (ERR_DROP, "Map with no leafs");
 
-	cm.leafs = (cLeaf_t*) Hunk_Alloc( ( BOX_LEAFS + count ) * sizeof( *cm.leafs ), h_high );
+	cm.leafs = (cLeaf_t*) CM_Alloc( ( BOX_LEAFS + count ) * sizeof( *cm.leafs ) );
 	cm.numLeafs = count;
 
 	out = cm.leafs;	
@@ -300,8 +1109,8 @@ void CMod_LoadLeafs (lump_t *l)
 			cm.numAreas = out->area + 1;
 	}
 
-	cm.areas = (cArea_t*) Hunk_Alloc( cm.numAreas * sizeof( *cm.areas ), h_high );
-	cm.areaPortals = (int*) Hunk_Alloc( cm.numAreas * cm.numAreas * sizeof( *cm.areaPortals ), h_high );
+	cm.areas = (cArea_t*) CM_Alloc( cm.numAreas * sizeof( *cm.areas ) );
+	cm.areaPortals = (int*) CM_Alloc( cm.numAreas * cm.numAreas * sizeof( *cm.areaPortals ) );
 }
 
 /*
@@ -324,7 +1133,7 @@ void CMod_LoadPlanes (lump_t *l)
 
 	if (count < 1)
 		Com_Error (ERR_DROP, "Map with no planes");
-	cm.planes = (cplane_t*) Hunk_Alloc( ( BOX_PLANES + count ) * sizeof( *cm.planes ), h_high );
+	cm.planes = (cplane_t*) CM_Alloc( ( BOX_PLANES + count ) * sizeof( *cm.planes ) );
 	cm.numPlanes = count;
 
 	out = cm.planes;	
@@ -362,7 +1171,7 @@ void CMod_LoadLeafBrushes (lump_t *l)
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
 	count = l->filelen / sizeof(*in);
 
-	cm.leafbrushes = (int*) Hunk_Alloc( (count + BOX_BRUSHES) * sizeof( *cm.leafbrushes ), h_high );
+	cm.leafbrushes = (int*) CM_Alloc( (count + BOX_BRUSHES) * sizeof( *cm.leafbrushes ) );
 	cm.numLeafBrushes = count;
 
 	out = cm.leafbrushes;
@@ -389,7 +1198,7 @@ void CMod_LoadLeafSurfaces( lump_t *l )
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
 	count = l->filelen / sizeof(*in);
 
-	cm.leafsurfaces = (int*) Hunk_Alloc( count * sizeof( *cm.leafsurfaces ), h_high );
+	cm.leafsurfaces = (int*) CM_Alloc( count * sizeof( *cm.leafsurfaces ) );
 	cm.numLeafSurfaces = count;
 
 	out = cm.leafsurfaces;
@@ -418,7 +1227,7 @@ void CMod_LoadBrushSides (lump_t *l)
 	}
 	count = l->filelen / sizeof(*in);
 
-	cm.brushsides = (cbrushside_t*) Hunk_Alloc( ( BOX_SIDES + count ) * sizeof( *cm.brushsides ), h_high );
+	cm.brushsides = (cbrushside_t*) CM_Alloc( ( BOX_SIDES + count ) * sizeof( *cm.brushsides ) );
 	cm.numBrushSides = count;
 
 	out = cm.brushsides;	
@@ -441,7 +1250,7 @@ CMod_LoadEntityString
 =================
 */
 void CMod_LoadEntityString( lump_t *l ) {
-	cm.entityString = (char*) Hunk_Alloc( l->filelen, h_high );
+	cm.entityString = (char*) CM_Alloc( l->filelen );
 	cm.numEntityChars = l->filelen;
 	Com_Memcpy (cm.entityString, cmod_base + l->fileofs, l->filelen);
 }
@@ -459,14 +1268,14 @@ void CMod_LoadVisibility( lump_t *l ) {
     len = l->filelen;
 	if ( !len ) {
 		cm.clusterBytes = ( cm.numClusters + 31 ) & ~31;
-		cm.visibility = (byte*) Hunk_Alloc( cm.clusterBytes, h_high );
+		cm.visibility = (byte*) CM_Alloc( cm.clusterBytes );
 		Com_Memset( cm.visibility, 255, cm.clusterBytes );
 		return;
 	}
 	buf = cmod_base + l->fileofs;
 
 	cm.vised = qtrue;
-	cm.visibility = (byte*) Hunk_Alloc( len, h_high );
+	cm.visibility = (byte*) CM_Alloc( len );
 	cm.numClusters = LittleLong( ((int *)buf)[0] );
 	cm.clusterBytes = LittleLong( ((int *)buf)[1] );
 	Com_Memcpy (cm.visibility, buf + VIS_HEADER, len - VIS_HEADER );
@@ -488,7 +1297,10 @@ void CMod_LoadPatches( lump_t *surfs, lump_t *verts ) {
 	int			i, j;
 	int			c;
 	cPatch_t	*patch;
-	vec3_t		points[MAX_PATCH_VERTS];
+	cPatchSurface_t	*patchSurfs, *ps;
+	int			numPatches;
+	vec3_t		*points;
+	int			numPoints;
 	int			width, height;
 	int			shaderNum;
 
@@ -496,44 +1308,73 @@ void CMod_LoadPatches( lump_t *surfs, lump_t *verts ) {
 	if (surfs->filelen % sizeof(*in))
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
 	cm.numSurfaces = count = surfs->filelen / sizeof(*in);
-	cm.surfaces = (cPatch_t**) Hunk_Alloc( cm.numSurfaces * sizeof( cm.surfaces[0] ), h_high );
+	cm.surfaces = (cPatch_t**) CM_Alloc( cm.numSurfaces * sizeof( cm.surfaces[0] ) );
 
 	dv = (drawVert_t*) (void *)(cmod_base + verts->fileofs);
 	if (verts->filelen % sizeof(*dv))
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
 
+	// count the patches first, so all of them can be generated at once
+	numPatches = 0;
+	numPoints = 0;
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( LittleLong( in[i].surfaceType ) != MST_PATCH ) {
+			continue;
+		}
+		c = LittleLong( in[i].patchWidth ) * LittleLong( in[i].patchHeight );
+		if ( c > MAX_PATCH_VERTS ) {
+			Com_Error( ERR_DROP, "ParseMesh: MAX_PATCH_VERTS" );
+		}
+		numPatches++;
+		numPoints += c;
+	}
+
+	if ( !numPatches ) {
+		return;
+	}
+
+	patchSurfs = (cPatchSurface_t*) Hunk_AllocateTempMemory( numPatches * sizeof( *patchSurfs ) );
+	points = (vec3_t*) Hunk_AllocateTempMemory( numPoints * sizeof( *points ) );
+
 	// scan through all the surfaces, but only load patches,
 	// not planar faces
+	ps = patchSurfs;
 	for ( i = 0 ; i < count ; i++, in++ ) {
 		if ( LittleLong( in->surfaceType ) != MST_PATCH ) {
 			continue;		// ignore other surfaces
 		}
 		// FIXME: check for non-colliding patches
 
-		cm.surfaces[ i ] = patch = (cPatch_t*) Hunk_Alloc( sizeof( *patch ), h_high );
+		cm.surfaces[ i ] = patch = (cPatch_t*) CM_Alloc( sizeof( *patch ) );
 
-		// load the full drawverts onto the stack
+		// load the full drawverts
 		width = LittleLong( in->patchWidth );
 		height = LittleLong( in->patchHeight );
 		c = width * height;
-		if ( c > MAX_PATCH_VERTS ) {
-			Com_Error( ERR_DROP, "ParseMesh: MAX_PATCH_VERTS" );
-		}
+
+		ps->width = width;
+		ps->height = height;
+		ps->points = points;
+		ps->patch = patch;
+		ps++;
 
 		dv_p = dv + LittleLong( in->firstVert );
-		for ( j = 0 ; j < c ; j++, dv_p++ ) {
-			points[j][0] = LittleFloat( dv_p->xyz[0] );
-			points[j][1] = LittleFloat( dv_p->xyz[1] );
-			points[j][2] = LittleFloat( dv_p->xyz[2] );
+		for ( j = 0 ; j < c ; j++, dv_p++, points++ ) {
+			(*points)[0] = LittleFloat( dv_p->xyz[0] );
+			(*points)[1] = LittleFloat( dv_p->xyz[1] );
+			(*points)[2] = LittleFloat( dv_p->xyz[2] );
 		}
 
 		shaderNum = LittleLong( in->shaderNum );
 		patch->contents = cm.shaders[shaderNum].contentFlags;
 		patch->surfaceFlags = cm.shaders[shaderNum].surfaceFlags;
-
-		// create the internal facet structure
-		patch->pc = CM_GeneratePatchCollide( width, height, points );
 	}
+
+	// create the internal facet structures
+	CM_GeneratePatchCollides( patchSurfs, numPatches );
+
+	Hunk_FreeTempMemory( patchSurfs[0].points );
+	Hunk_FreeTempMemory( patchSurfs );
 }
 
 //==================================================================
@@ -581,6 +1422,8 @@ void CM_LoadMap( const char *name, qboolean clientload, int *checksum ) {
 	cm_noAreas = Cvar_Get ("cm_noAreas", "0", CVAR_CHEAT);
 	cm_noCurves = Cvar_Get ("cm_noCurves", "0", CVAR_CHEAT);
 	cm_playerCurveClip = Cvar_Get ("cm_playerCurveClip", "1", CVAR_ARCHIVE|CVAR_CHEAT );
+	cm_mapCache = Cvar_Get ("cm_mapCache", "0", CVAR_ARCHIVE );
+	cm_sharedMaps = Cvar_Get ("cm_sharedMaps", "0", CVAR_ARCHIVE );
 #endif
 	Com_DPrintf( "CM_LoadMap( %s, %i )\n", name, clientload );
 
@@ -590,14 +1433,19 @@ void CM_LoadMap( const char *name, qboolean clientload, int *checksum ) {
 	}
 
 	// free old stuff
+	CM_CacheRelease();
 	Com_Memset( &cm, 0, sizeof( cm ) );
 	CM_ClearLevelPatches();
+#ifndef BSPC
+	// cm_mapCache may have been lowered or cleared since
+	CM_CacheTrim( CM_CacheLimit() );
+#endif
 
 	if ( !name[0] ) {
 		cm.numLeafs = 1;
 		cm.numClusters = 1;
 		cm.numAreas = 1;
-		cm.cmodels = (cmodel_t*) Hunk_Alloc( sizeof( *cm.cmodels ), h_high );
+		cm.cmodels = (cmodel_t*) CM_Alloc( sizeof( *cm.cmodels ) );
 		*checksum = 0;
 		return;
 	}
@@ -618,6 +1466,23 @@ void CM_LoadMap( const char *name, qboolean clientload, int *checksum ) {
 	last_checksum = LittleLong (Com_BlockChecksum (buf, length));
 	*checksum = last_checksum;
 
+#ifndef BSPC
+	if ( CM_CacheLookup( name, last_checksum ) || CM_CacheBegin( name, last_checksum, length ) ) {
+		FS_FreeFile (buf);
+
+		CM_InitBoxHull ();
+
+		CM_FloodAreaConnections ();
+
+		if ( !clientload ) {
+			Q_strncpyz( cm.name, name, sizeof( cm.name ) );
+		} else {
+			cm.name[0] = 0;
+		}
+		return;
+	}
+#endif
+
 	header = *(dheader_t *)buf;
 	for (i=0 ; i<sizeof(dheader_t)/4 ; i++) {
 		((int *)&header)[i] = LittleLong ( ((int *)&header)[i]);
@@ -647,6 +1512,11 @@ void CM_LoadMap( const char *name, qboolean clientload, int *checksum ) {
 	// we are NOT freeing the file, because it is cached for the ref
 	FS_FreeFile (buf);
 
+#ifndef BSPC
+	// before the box hull goes in, a shared copy leaves that to each process
+	CM_CacheEnd();
+#endif
+
 	CM_InitBoxHull ();
 
 	CM_FloodAreaConnections ();
@@ -663,8 +1533,12 @@ CM_ClearMap
 ==================
 */
 void CM_ClearMap( void ) {
+	CM_CacheRelease();
 	Com_Memset( &cm, 0, sizeof( cm ) );
 	CM_ClearLevelPatches();
+#ifndef BSPC
+	CM_CacheTrim( CM_CacheLimit() );
+#endif
 }
 
 /*
@@ -139,6 +139,14 @@ extern	int			c_traces, c_brush_traces, c_patch_traces;
 extern	cvar_t		*cm_noAreas;
 extern	cvar_t		*cm_noCurves;
 extern	cvar_t		*cm_playerCurveClip;
+extern	cvar_t		*cm_mapCache;
+extern	cvar_t		*cm_sharedMaps;
+
+// cm_load.c
+
+void *CM_Alloc( int size );
+// zero filled, comes from the map cache when it is enabled
+// and from the high hunk otherwise
 
 // cm_test.c
 
@@ -188,7 +196,15 @@ cmodel_t	*CM_ClipHandleToModel( clipHandle_t handle );
 
 // cm_patch.c
 
-struct patchCollide_s	*CM_GeneratePatchCollide( int width, int height, vec3_t *points );
+// input for the parallel patch collide generation
+typedef struct {
+	int			width;
+	int			height;
+	vec3_t		*points;		// packed as concatenated rows
+	cPatch_t	*patch;			// pc is filled in
+} cPatchSurface_t;
+
+void CM_GeneratePatchCollides( cPatchSurface_t *surfaces, int numSurfaces );
 void CM_TraceThroughPatchCollide( traceWork_t *tw, const struct patchCollide_s *pc );
 qboolean CM_PositionTestInPatchCollide( traceWork_t *tw, const struct patchCollide_s *pc );
 void CM_ClearLevelPatches( void );
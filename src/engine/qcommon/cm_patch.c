@@ -22,13 +22,18 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include "cm_local.h"
 #include "cm_patch.h"
+#include <setjmp.h>
 
 /*
 
-This file does not reference any globals, and has these entry points:
+Patches are generated on job threads, each with a patchWork_t of its own
+for the scratch state.  The only global the generation uses is the
+thread local cm_patchWork, which points the winding code in cm_polylib.c
+at the patch being built on that thread, so its errors and allocations
+stay with that patch.  The entry points are:
 
 void CM_ClearLevelPatches( void );
-struct patchCollide_s	*CM_GeneratePatchCollide( int width, int height, const vec3_t *points );
+void CM_GeneratePatchCollides( cPatchSurface_t *surfaces, int numSurfaces );
 void CM_TraceThroughPatchCollide( traceWork_t *tw, const struct patchCollide_s *pc );
 qboolean CM_PositionTestInPatchCollide( traceWork_t *tw, const struct patchCollide_s *pc );
 void CM_DrawDebugSurface( void (*drawPoly)(int color, int numPoints, flaot *points) );
@@ -411,18 +416,157 @@ static void CM_RemoveDegenerateColumns( cGrid_t *grid ) {
 
 PATCH COLLIDE GENERATION
 
+All the scratch state used while generating a single patch lives in a
+patchWork_t, so the patches of a map can be generated in parallel on the
+job threads.  Plane numbers are local to each patch, which keeps the
+output identical to a serial build no matter which thread gets which patch.
+
+Nothing in here may touch the zone, hunk or console, diagnostics are
+recorded in the patchJob_t and printed once the patch is finished on the
+main thread.
+
 ================================================================================
 */
 
-static	int				numPlanes;
-static	patchPlane_t	planes[MAX_PATCH_PLANES];
+#define	MAX_PATCH_WINDINGS	16		// alive at once while bevelling a facet
+
+typedef enum {
+	PW_GRIDPLANE_UNRESOLVABLE,
+	PW_MIXED_PLANE_SIDES,
+	PW_TOO_MANY_BEVELS,
+	PW_BEVEL_ALREADY_USED,
+	PW_INVALID_BEVEL,
+
+	PW_NUM_WARNINGS
+} patchWarning_t;
+
+typedef struct {
+	// input
+	int				width;
+	int				height;
+	const vec3_t	*points;
+
+	// output, the planes and facets are malloc'ed until copied to the hunk
+	patchCollide_t	pc;
+	int				numBlocks;
+	int				warnings[PW_NUM_WARNINGS];
+	qboolean		debugBlock;
+	vec3_t			debugBlockPoints[4];
+
+	qboolean		error;
+	errorParm_t		errorCode;
+	char			errorMessage[MAX_STRING_CHARS];
+} patchJob_t;
+
+typedef struct {
+	patchJob_t		*job;
+	jmp_buf			abort;
+
+	int				numPlanes;
+	patchPlane_t	planes[MAX_PATCH_PLANES];
+
+	int				numFacets;
+	facet_t			facets[MAX_PATCH_PLANES]; //maybe MAX_FACETS ??
+
+	cGrid_t			grid;
+	int				gridPlanes[MAX_GRID_SIZE][MAX_GRID_SIZE][2];
 
-static	int				numFacets;
-static	facet_t			facets[MAX_PATCH_PLANES]; //maybe MAX_FACETS ??
+	// freed when the patch is aborted
+	int				numWindings;
+	winding_t		*windings[MAX_PATCH_WINDINGS];
+} patchWork_t;
+
+typedef struct {
+	patchJob_t		*jobs;
+	patchWork_t		*work[MAX_JOB_THREADS];
+} patchBatch_t;
 
 #define	NORMAL_EPSILON	0.0001
 #define	DIST_EPSILON	0.02
 
+// the patch being generated on this thread, for the winding code
+static __declspec( thread ) patchWork_t	*cm_patchWork;
+
+/*
+==================
+CM_PatchError
+
+Stops generating the current patch, the error is raised with
+Com_Error when the patch is finished on the main thread
+==================
+*/
+static void QDECL CM_PatchError( patchWork_t *pw, errorParm_t code, const char *fmt, ... ) {
+	va_list		argptr;
+
+	pw->job->error = qtrue;
+	pw->job->errorCode = code;
+
+	va_start( argptr, fmt );
+	Q_vsnprintf( pw->job->errorMessage, sizeof( pw->job->errorMessage ), fmt, argptr );
+	va_end( argptr );
+
+	longjmp( pw->abort, 1 );
+}
+
+/*
+==================
+CM_WindingError
+
+Com_Error for cm_polylib.c, which also runs on the job threads
+==================
+*/
+void QDECL CM_WindingError( errorParm_t code, const char *fmt, ... ) {
+	va_list		argptr;
+	char		message[MAX_STRING_CHARS];
+
+	va_start( argptr, fmt );
+	Q_vsnprintf( message, sizeof( message ), fmt, argptr );
+	va_end( argptr );
+
+	if ( cm_patchWork ) {
+		CM_PatchError( cm_patchWork, code, "%s", message );
+	}
+	Com_Error( code, "%s", message );
+}
+
+/*
+==================
+CM_WindingAllocated
+==================
+*/
+void CM_WindingAllocated( winding_t *w ) {
+	patchWork_t	*pw = cm_patchWork;
+
+	if ( !pw ) {
+		return;
+	}
+	if ( pw->numWindings == MAX_PATCH_WINDINGS ) {
+		free( w );
+		CM_PatchError( pw, ERR_FATAL, "MAX_PATCH_WINDINGS" );
+	}
+	pw->windings[pw->numWindings++] = w;
+}
+
+/*
+==================
+CM_WindingFreed
+==================
+*/
+void CM_WindingFreed( winding_t *w ) {
+	patchWork_t	*pw = cm_patchWork;
+	int			i;
+
+	if ( !pw ) {
+		return;
+	}
+	for ( i = 0 ; i < pw->numWindings ; i++ ) {
+		if ( pw->windings[i] == w ) {
+			pw->windings[i] = pw->windings[--pw->numWindings];
+			return;
+		}
+	}
+}
+
 /*
 ==================
 CM_PlaneEqual
@@ -487,27 +631,27 @@ void CM_SnapVector(vec3_t normal) {
 CM_FindPlane2
 ==================
 */
-int CM_FindPlane2(float plane[4], int *flipped) {
+static int CM_FindPlane2( patchWork_t *pw, float plane[4], int *flipped ) {
 	int i;
 
 	// see if the points are close enough to an existing plane
-	for ( i = 0 ; i < numPlanes ; i++ ) {
-		if (CM_PlaneEqual(&planes[i], plane, flipped)) return i;
+	for ( i = 0 ; i < pw->numPlanes ; i++ ) {
+		if (CM_PlaneEqual(&pw->planes[i], plane, flipped)) return i;
 	}
 
 	// add a new plane
-	if ( numPlanes == MAX_PATCH_PLANES ) {
-		Com_Error( ERR_DROP, "MAX_PATCH_PLANES" );
+	if ( pw->numPlanes == MAX_PATCH_PLANES ) {
+		CM_PatchError( pw, ERR_DROP, "MAX_PATCH_PLANES" );
 	}
 
-	Vector4Copy( plane, planes[numPlanes].plane );
-	planes[numPlanes].signbits = CM_SignbitsForNormal( plane );
+	Vector4Copy( plane, pw->planes[pw->numPlanes].plane );
+	pw->planes[pw->numPlanes].signbits = CM_SignbitsForNormal( plane );
 
-	numPlanes++;
+	pw->numPlanes++;
 
 	*flipped = qfalse;
 
-	return numPlanes-1;
+	return pw->numPlanes-1;
 }
 
 /*
@@ -515,7 +659,8 @@ int CM_FindPlane2(float plane[4], int *flipped) {
 CM_FindPlane
 ==================
 */
-static int CM_FindPlane( float *p1, float *p2, float *p3 ) {
+static int CM_FindPlane( patchWork_t *pw, float *p1, float *p2, float *p3 ) {
+	patchPlane_t	*planes = pw->planes;
 	float	plane[4];
 	int		i;
 	float	d;
@@ -525,7 +670,7 @@ static int CM_FindPlane( float *p1, float *p2, float *p3 ) {
 	}
 
 	// see if the points are close enough to an existing plane
-	for ( i = 0 ; i < numPlanes ; i++ ) {
+	for ( i = 0 ; i < pw->numPlanes ; i++ ) {
 		if ( DotProduct( plane, planes[i].plane ) < 0 ) {
 			continue;	// allow backwards planes?
 		}
@@ -550,16 +695,16 @@ static int CM_FindPlane( float *p1, float *p2, float *p3 ) {
 	}
 
 	// add a new plane
-	if ( numPlanes == MAX_PATCH_PLANES ) {
-		Com_Error( ERR_DROP, "MAX_PATCH_PLANES" );
+	if ( pw->numPlanes == MAX_PATCH_PLANES ) {
+		CM_PatchError( pw, ERR_DROP, "MAX_PATCH_PLANES" );
 	}
 
-	Vector4Copy( plane, planes[numPlanes].plane );
-	planes[numPlanes].signbits = CM_SignbitsForNormal( plane );
+	Vector4Copy( plane, planes[pw->numPlanes].plane );
+	planes[pw->numPlanes].signbits = CM_SignbitsForNormal( plane );
 
-	numPlanes++;
+	pw->numPlanes++;
 
-	return numPlanes-1;
+	return pw->numPlanes-1;
 }
 
 /*
@@ -567,14 +712,14 @@ static int CM_FindPlane( float *p1, float *p2, float *p3 ) {
 CM_PointOnPlaneSide
 ==================
 */
-static int CM_PointOnPlaneSide( float *p, int planeNum ) {
+static int CM_PointOnPlaneSide( patchWork_t *pw, float *p, int planeNum ) {
 	float	*plane;
 	float	d;
 
 	if ( planeNum == -1 ) {
 		return SIDE_ON;
 	}
-	plane = planes[ planeNum ].plane;
+	plane = pw->planes[ planeNum ].plane;
 
 	d = DotProduct( p, plane ) - plane[3];
 
@@ -594,20 +739,20 @@ static int CM_PointOnPlaneSide( float *p, int planeNum ) {
 CM_GridPlane
 ==================
 */
-static int	CM_GridPlane( int gridPlanes[MAX_GRID_SIZE][MAX_GRID_SIZE][2], int i, int j, int tri ) {
+static int	CM_GridPlane( patchWork_t *pw, int i, int j, int tri ) {
 	int		p;
 
-	p = gridPlanes[i][j][tri];
+	p = pw->gridPlanes[i][j][tri];
 	if ( p != -1 ) {
 		return p;
 	}
-	p = gridPlanes[i][j][!tri];
+	p = pw->gridPlanes[i][j][!tri];
 	if ( p != -1 ) {
 		return p;
 	}
 
 	// should never happen
-	Com_Printf( "WARNING: CM_GridPlane unresolvable\n" );
+	pw->job->warnings[PW_GRIDPLANE_UNRESOLVABLE]++;
 	return -1;
 }
 
@@ -616,7 +761,9 @@ static int	CM_GridPlane( int gridPlanes[MAX_GRID_SIZE][MAX_GRID_SIZE][2], int i,
 CM_EdgePlaneNum
 ==================
 */
-static int CM_EdgePlaneNum( cGrid_t *grid, int gridPlanes[MAX_GRID_SIZE][MAX_GRID_SIZE][2], int i, int j, int k ) {
+static int CM_EdgePlaneNum( patchWork_t *pw, int i, int j, int k ) {
+	cGrid_t		*grid = &pw->grid;
+	patchPlane_t	*planes = pw->planes;
 	float	*p1, *p2;
 	vec3_t		up;
 	int			p;
@@ -625,48 +772,48 @@ static int CM_EdgePlaneNum( cGrid_t *grid, int gridPlanes[MAX_GRID_SIZE][MAX_GRI
 	case 0:	// top border
 		p1 = grid->points[i][j];
 		p2 = grid->points[i+1][j];
-		p = CM_GridPlane( gridPlanes, i, j, 0 );
+		p = CM_GridPlane( pw, i, j, 0 );
 		VectorMA( p1, 4, planes[ p ].plane, up );
-		return CM_FindPlane( p1, p2, up );
+		return CM_FindPlane( pw, p1, p2, up );
 
 	case 2:	// bottom border
 		p1 = grid->points[i][j+1];
 		p2 = grid->points[i+1][j+1];
-		p = CM_GridPlane( gridPlanes, i, j, 1 );
+		p = CM_GridPlane( pw, i, j, 1 );
 		VectorMA( p1, 4, planes[ p ].plane, up );
-		return CM_FindPlane( p2, p1, up );
+		return CM_FindPlane( pw, p2, p1, up );
 
 	case 3: // left border
 		p1 = grid->points[i][j];
 		p2 = grid->points[i][j+1];
-		p = CM_GridPlane( gridPlanes, i, j, 1 );
+		p = CM_GridPlane( pw, i, j, 1 );
 		VectorMA( p1, 4, planes[ p ].plane, up );
-		return CM_FindPlane( p2, p1, up );
+		return CM_FindPlane( pw, p2, p1, up );
 
 	case 1:	// right border
 		p1 = grid->points[i+1][j];
 		p2 = grid->points[i+1][j+1];
-		p = CM_GridPlane( gridPlanes, i, j, 0 );
+		p = CM_GridPlane( pw, i, j, 0 );
 		VectorMA( p1, 4, planes[ p ].plane, up );
-		return CM_FindPlane( p1, p2, up );
+		return CM_FindPlane( pw, p1, p2, up );
 
 	case 4:	// diagonal out of triangle 0
 		p1 = grid->points[i+1][j+1];
 		p2 = grid->points[i][j];
-		p = CM_GridPlane( gridPlanes, i, j, 0 );
+		p = CM_GridPlane( pw, i, j, 0 );
 		VectorMA( p1, 4, planes[ p ].plane, up );
-		return CM_FindPlane( p1, p2, up );
+		return CM_FindPlane( pw, p1, p2, up );
 
 	case 5:	// diagonal out of triangle 1
 		p1 = grid->points[i][j];
 		p2 = grid->points[i+1][j+1];
-		p = CM_GridPlane( gridPlanes, i, j, 1 );
+		p = CM_GridPlane( pw, i, j, 1 );
 		VectorMA( p1, 4, planes[ p ].plane, up );
-		return CM_FindPlane( p1, p2, up );
+		return CM_FindPlane( pw, p1, p2, up );
 
 	}
 
-	Com_Error( ERR_DROP, "CM_EdgePlaneNum: bad k" );
+	CM_PatchError( pw, ERR_DROP, "CM_EdgePlaneNum: bad k" );
 	return -1;
 }
 
@@ -675,8 +822,9 @@ static int CM_EdgePlaneNum( cGrid_t *grid, int gridPlanes[MAX_GRID_SIZE][MAX_GRI
 CM_SetBorderInward
 ===================
 */
-static void CM_SetBorderInward( facet_t *facet, cGrid_t *grid, int gridPlanes[MAX_GRID_SIZE][MAX_GRID_SIZE][2],
-						  int i, int j, int which ) {
+static void CM_SetBorderInward( patchWork_t *pw, facet_t *facet, int i, int j, int which ) {
+	cGrid_t	*grid = &pw->grid;
+	patchJob_t	*job = pw->job;
 	int		k, l;
 	float	*points[4];
 	int		numPoints;
@@ -702,7 +850,7 @@ static void CM_SetBorderInward( facet_t *facet, cGrid_t *grid, int gridPlanes[MA
 		numPoints = 3;
 		break;
 	default:
-		Com_Error( ERR_FATAL, "CM_SetBorderInward: bad parameter" );
+		CM_PatchError( pw, ERR_FATAL, "CM_SetBorderInward: bad parameter" );
 		numPoints = 0;
 		break;
 	}
@@ -716,7 +864,7 @@ static void CM_SetBorderInward( facet_t *facet, cGrid_t *grid, int gridPlanes[MA
 		for ( l = 0 ; l < numPoints ; l++ ) {
 			int		side;
 
-			side = CM_PointOnPlaneSide( points[l], facet->borderPlanes[k] );
+			side = CM_PointOnPlaneSide( pw, points[l], facet->borderPlanes[k] );
 			if ( side == SIDE_FRONT ) {
 				front++;
 			} if ( side == SIDE_BACK ) {
@@ -733,14 +881,14 @@ static void CM_SetBorderInward( facet_t *facet, cGrid_t *grid, int gridPlanes[MA
 			facet->borderPlanes[k] = -1;
 		} else {
 			// bisecting side border
-			Com_DPrintf( "WARNING: CM_SetBorderInward: mixed plane sides\n" );
+			job->warnings[PW_MIXED_PLANE_SIDES]++;
 			facet->borderInward[k] = qfalse;
-			if ( !debugBlock ) {
-				debugBlock = qtrue;
-				VectorCopy( grid->points[i][j], debugBlockPoints[0] );
-				VectorCopy( grid->points[i+1][j], debugBlockPoints[1] );
-				VectorCopy( grid->points[i+1][j+1], debugBlockPoints[2] );
-				VectorCopy( grid->points[i][j+1], debugBlockPoints[3] );
+			if ( !job->debugBlock ) {
+				job->debugBlock = qtrue;
+				VectorCopy( grid->points[i][j], job->debugBlockPoints[0] );
+				VectorCopy( grid->points[i+1][j], job->debugBlockPoints[1] );
+				VectorCopy( grid->points[i+1][j+1], job->debugBlockPoints[2] );
+				VectorCopy( grid->points[i][j+1], job->debugBlockPoints[3] );
 			}
 		}
 	}
@@ -753,7 +901,8 @@ CM_ValidateFacet
 If the facet isn't bounded by its borders, we screwed up.
 ==================
 */
-static qboolean CM_ValidateFacet( facet_t *facet ) {
+static qboolean CM_ValidateFacet( patchWork_t *pw, facet_t *facet ) {
+	patchPlane_t	*planes = pw->planes;
 	float		plane[4];
 	int			j;
 	winding_t	*w;
@@ -804,8 +953,8 @@ static qboolean CM_ValidateFacet( facet_t *facet ) {
 CM_AddFacetBevels
 ==================
 */
-void CM_AddFacetBevels( facet_t *facet ) {
-
+static void CM_AddFacetBevels( patchWork_t *pw, facet_t *facet ) {
+	patchPlane_t	*planes = pw->planes;
 	int i, j, k, l;
 	int axis, dir, order, flipped;
 	float plane[4], d, newplane[4];
@@ -857,8 +1006,8 @@ void CM_AddFacetBevels( facet_t *facet ) {
 			}
 
 			if ( i == facet->numBorders ) {
-				if (facet->numBorders > 4 + 6 + 16) Com_Printf("ERROR: too many bevels\n");
-				facet->borderPlanes[facet->numBorders] = CM_FindPlane2(plane, &flipped);
+				if (facet->numBorders > 4 + 6 + 16) pw->job->warnings[PW_TOO_MANY_BEVELS]++;
+				facet->borderPlanes[facet->numBorders] = CM_FindPlane2(pw, plane, &flipped);
 				facet->borderNoAdjust[facet->numBorders] = (qboolean) 0;
 				facet->borderInward[facet->numBorders] = flipped;
 				facet->numBorders++;
@@ -919,12 +1068,12 @@ void CM_AddFacetBevels( facet_t *facet ) {
 				}
 
 				if ( i == facet->numBorders ) {
-					if (facet->numBorders > 4 + 6 + 16) Com_Printf("ERROR: too many bevels\n");
-					facet->borderPlanes[facet->numBorders] = CM_FindPlane2(plane, &flipped);
+					if (facet->numBorders > 4 + 6 + 16) pw->job->warnings[PW_TOO_MANY_BEVELS]++;
+					facet->borderPlanes[facet->numBorders] = CM_FindPlane2(pw, plane, &flipped);
 
 					for ( k = 0 ; k < facet->numBorders ; k++ ) {
 						if (facet->borderPlanes[facet->numBorders] ==
-							facet->borderPlanes[k]) Com_Printf("WARNING: bevel plane already used\n");
+							facet->borderPlanes[k]) pw->job->warnings[PW_BEVEL_ALREADY_USED]++;
 					}
 
 					facet->borderNoAdjust[facet->numBorders] = (qboolean) 0;
@@ -939,7 +1088,7 @@ void CM_AddFacetBevels( facet_t *facet ) {
 					} //end if
 					ChopWindingInPlace( &w2, newplane, newplane[3], 0.1f );
 					if (!w2) {
-						Com_DPrintf("WARNING: CM_AddFacetBevels... invalid bevel\n");
+						pw->job->warnings[PW_INVALID_BEVEL]++;
 						continue;
 					}
 					else {
@@ -977,16 +1126,18 @@ typedef enum {
 CM_PatchCollideFromGrid
 ==================
 */
-static void CM_PatchCollideFromGrid( cGrid_t *grid, patchCollide_t *pf ) {
+static void CM_PatchCollideFromGrid( patchWork_t *pw ) {
+	cGrid_t			*grid = &pw->grid;
+	int				(*gridPlanes)[MAX_GRID_SIZE][2] = pw->gridPlanes;
+	patchCollide_t	*pf = &pw->job->pc;
 	int				i, j;
 	float			*p1, *p2, *p3;
-	MAC_STATIC int				gridPlanes[MAX_GRID_SIZE][MAX_GRID_SIZE][2];
 	facet_t			*facet;
 	int				borders[4];
 	int				noAdjust[4];
 
-	numPlanes = 0;
-	numFacets = 0;
+	pw->numPlanes = 0;
+	pw->numFacets = 0;
 
 	// find the planes for each triangle of the grid
 	for ( i = 0 ; i < grid->width - 1 ; i++ ) {
@@ -994,12 +1145,12 @@ static void CM_PatchCollideFromGrid( cGrid_t *grid, patchCollide_t *pf ) {
 			p1 = grid->points[i][j];
 			p2 = grid->points[i+1][j];
 			p3 = grid->points[i+1][j+1];
-			gridPlanes[i][j][0] = CM_FindPlane( p1, p2, p3 );
+			gridPlanes[i][j][0] = CM_FindPlane( pw, p1, p2, p3 );
 
 			p1 = grid->points[i+1][j+1];
 			p2 = grid->points[i][j+1];
 			p3 = grid->points[i][j];
-			gridPlanes[i][j][1] = CM_FindPlane( p1, p2, p3 );
+			gridPlanes[i][j][1] = CM_FindPlane( pw, p1, p2, p3 );
 		}
 	}
 
@@ -1015,7 +1166,7 @@ static void CM_PatchCollideFromGrid( cGrid_t *grid, patchCollide_t *pf ) {
 			} 
 			noAdjust[EN_TOP] = ( borders[EN_TOP] == gridPlanes[i][j][0] );
 			if ( borders[EN_TOP] == -1 || noAdjust[EN_TOP] ) {
-				borders[EN_TOP] = CM_EdgePlaneNum( grid, gridPlanes, i, j, 0 );
+				borders[EN_TOP] = CM_EdgePlaneNum( pw, i, j, 0 );
 			}
 
 			borders[EN_BOTTOM] = -1;
@@ -1026,7 +1177,7 @@ static void CM_PatchCollideFromGrid( cGrid_t *grid, patchCollide_t *pf ) {
 			}
 			noAdjust[EN_BOTTOM] = ( borders[EN_BOTTOM] == gridPlanes[i][j][1] );
 			if ( borders[EN_BOTTOM] == -1 || noAdjust[EN_BOTTOM] ) {
-				borders[EN_BOTTOM] = CM_EdgePlaneNum( grid, gridPlanes, i, j, 2 );
+				borders[EN_BOTTOM] = CM_EdgePlaneNum( pw, i, j, 2 );
 			}
 
 			borders[EN_LEFT] = -1;
@@ -1037,7 +1188,7 @@ static void CM_PatchCollideFromGrid( cGrid_t *grid, patchCollide_t *pf ) {
 			}
 			noAdjust[EN_LEFT] = ( borders[EN_LEFT] == gridPlanes[i][j][1] );
 			if ( borders[EN_LEFT] == -1 || noAdjust[EN_LEFT] ) {
-				borders[EN_LEFT] = CM_EdgePlaneNum( grid, gridPlanes, i, j, 3 );
+				borders[EN_LEFT] = CM_EdgePlaneNum( pw, i, j, 3 );
 			}
 
 			borders[EN_RIGHT] = -1;
@@ -1048,13 +1199,13 @@ static void CM_PatchCollideFromGrid( cGrid_t *grid, patchCollide_t *pf ) {
 			}
 			noAdjust[EN_RIGHT] = ( borders[EN_RIGHT] == gridPlanes[i][j][0] );
 			if ( borders[EN_RIGHT] == -1 || noAdjust[EN_RIGHT] ) {
-				borders[EN_RIGHT] = CM_EdgePlaneNum( grid, gridPlanes, i, j, 1 );
+				borders[EN_RIGHT] = CM_EdgePlaneNum( pw, i, j, 1 );
 			}
 
-			if ( numFacets == MAX_FACETS ) {
-				Com_Error( ERR_DROP, "MAX_FACETS" );
+			if ( pw->numFacets == MAX_FACETS ) {
+				CM_PatchError( pw, ERR_DROP, "MAX_FACETS" );
 			}
-			facet = &facets[numFacets];
+			facet = &pw->facets[pw->numFacets];
 			Com_Memset( facet, 0, sizeof( *facet ) );
 
 			if ( gridPlanes[i][j][0] == gridPlanes[i][j][1] ) {
@@ -1071,10 +1222,10 @@ static void CM_PatchCollideFromGrid( cGrid_t *grid, patchCollide_t *pf ) {
 				facet->borderNoAdjust[2] = (qboolean)noAdjust[EN_BOTTOM];
 				facet->borderPlanes[3] = borders[EN_LEFT];
 				facet->borderNoAdjust[3] = (qboolean) noAdjust[EN_LEFT];
-				CM_SetBorderInward( facet, grid, gridPlanes, i, j, -1 );
-				if ( CM_ValidateFacet( facet ) ) {
-					CM_AddFacetBevels( facet );
-					numFacets++;
+				CM_SetBorderInward( pw, facet, i, j, -1 );
+				if ( CM_ValidateFacet( pw, facet ) ) {
+					CM_AddFacetBevels( pw, facet );
+					pw->numFacets++;
 				}
 			} else {
 				// two seperate triangles
@@ -1088,19 +1239,19 @@ static void CM_PatchCollideFromGrid( cGrid_t *grid, patchCollide_t *pf ) {
 				if ( facet->borderPlanes[2] == -1 ) {
 					facet->borderPlanes[2] = borders[EN_BOTTOM];
 					if ( facet->borderPlanes[2] == -1 ) {
-						facet->borderPlanes[2] = CM_EdgePlaneNum( grid, gridPlanes, i, j, 4 );
+						facet->borderPlanes[2] = CM_EdgePlaneNum( pw, i, j, 4 );
 					}
 				}
- 				CM_SetBorderInward( facet, grid, gridPlanes, i, j, 0 );
-				if ( CM_ValidateFacet( facet ) ) {
-					CM_AddFacetBevels( facet );
-					numFacets++;
+ 				CM_SetBorderInward( pw, facet, i, j, 0 );
+				if ( CM_ValidateFacet( pw, facet ) ) {
+					CM_AddFacetBevels( pw, facet );
+					pw->numFacets++;
 				}
 
-				if ( numFacets == MAX_FACETS ) {
-					Com_Error( ERR_DROP, "MAX_FACETS" );
+				if ( pw->numFacets == MAX_FACETS ) {
+					CM_PatchError( pw, ERR_DROP, "MAX_FACETS" );
 				}
-				facet = &facets[numFacets];
+				facet = &pw->facets[pw->numFacets];
 				Com_Memset( facet, 0, sizeof( *facet ) );
 
 				facet->surfacePlane = gridPlanes[i][j][1];
@@ -1113,93 +1264,107 @@ static void CM_PatchCollideFromGrid( cGrid_t *grid, patchCollide_t *pf ) {
 				if ( facet->borderPlanes[2] == -1 ) {
 					facet->borderPlanes[2] = borders[EN_TOP];
 					if ( facet->borderPlanes[2] == -1 ) {
-						facet->borderPlanes[2] = CM_EdgePlaneNum( grid, gridPlanes, i, j, 5 );
+						facet->borderPlanes[2] = CM_EdgePlaneNum( pw, i, j, 5 );
 					}
 				}
-				CM_SetBorderInward( facet, grid, gridPlanes, i, j, 1 );
-				if ( CM_ValidateFacet( facet ) ) {
-					CM_AddFacetBevels( facet );
-					numFacets++;
+				CM_SetBorderInward( pw, facet, i, j, 1 );
+				if ( CM_ValidateFacet( pw, facet ) ) {
+					CM_AddFacetBevels( pw, facet );
+					pw->numFacets++;
 				}
 			}
 		}
 	}
 
-	// copy the results out
-	pf->numPlanes = numPlanes;
-	pf->numFacets = numFacets;
-	pf->facets = (facet_t*) Hunk_Alloc( numFacets * sizeof( *pf->facets ), h_high );
-	Com_Memcpy( pf->facets, facets, numFacets * sizeof( *pf->facets ) );
-	pf->planes = (patchPlane_t*) Hunk_Alloc( numPlanes * sizeof( *pf->planes ), h_high );
-	Com_Memcpy( pf->planes, planes, numPlanes * sizeof( *pf->planes ) );
+	// copy the results out, they are moved to the hunk by CM_FinishPatchCollide
+	pf->numPlanes = pw->numPlanes;
+	pf->numFacets = pw->numFacets;
+	pf->facets = (facet_t*) malloc( pw->numFacets * sizeof( *pf->facets ) + 1 );
+	pf->planes = (patchPlane_t*) malloc( pw->numPlanes * sizeof( *pf->planes ) + 1 );
+	if ( !pf->facets || !pf->planes ) {
+		CM_PatchError( pw, ERR_FATAL, "CM_PatchCollideFromGrid: out of memory" );
+	}
+	Com_Memcpy( pf->facets, pw->facets, pw->numFacets * sizeof( *pf->facets ) );
+	Com_Memcpy( pf->planes, pw->planes, pw->numPlanes * sizeof( *pf->planes ) );
 }
 
 
 /*
 ===================
-CM_GeneratePatchCollide
-
-Creates an internal structure that will be used to perform
-collision detection with a patch mesh.
+CM_GeneratePatchJob
 
 Points is packed as concatenated rows.
 ===================
 */
-struct patchCollide_s	*CM_GeneratePatchCollide( int width, int height, vec3_t *points ) {
-	patchCollide_t	*pf;
-	MAC_STATIC cGrid_t			grid;
+static void CM_GeneratePatchJob( patchWork_t *pw, patchJob_t *job ) {
+	cGrid_t			*grid = &pw->grid;
+	patchCollide_t	*pf = &job->pc;
+	int				width = job->width;
+	int				height = job->height;
+	const vec3_t	*points = job->points;
 	int				i, j;
 
+	pw->job = job;
+	pw->numWindings = 0;
+	cm_patchWork = pw;
+	if ( setjmp( pw->abort ) ) {
+		for ( i = 0 ; i < pw->numWindings ; i++ ) {
+			free( pw->windings[i] );
+		}
+		pw->numWindings = 0;
+		cm_patchWork = NULL;
+		return;
+	}
+
 	if ( width <= 2 || height <= 2 || !points ) {
-		Com_Error( ERR_DROP, "CM_GeneratePatchFacets: bad parameters: (%i, %i, %p)",
+		CM_PatchError( pw, ERR_DROP, "CM_GeneratePatchFacets: bad parameters: (%i, %i, %p)",
 			width, height, points );
 	}
 
 	if ( !(width & 1) || !(height & 1) ) {
-		Com_Error( ERR_DROP, "CM_GeneratePatchFacets: even sizes are invalid for quadratic meshes" );
+		CM_PatchError( pw, ERR_DROP, "CM_GeneratePatchFacets: even sizes are invalid for quadratic meshes" );
 	}
 
 	if ( width > MAX_GRID_SIZE || height > MAX_GRID_SIZE ) {
-		Com_Error( ERR_DROP, "CM_GeneratePatchFacets: source is > MAX_GRID_SIZE" );
+		CM_PatchError( pw, ERR_DROP, "CM_GeneratePatchFacets: source is > MAX_GRID_SIZE" );
 	}
 
 	// build a grid
-	grid.width = width;
-	grid.height = height;
-	grid.wrapWidth = qfalse;
-	grid.wrapHeight = qfalse;
+	grid->width = width;
+	grid->height = height;
+	grid->wrapWidth = qfalse;
+	grid->wrapHeight = qfalse;
 	for ( i = 0 ; i < width ; i++ ) {
 		for ( j = 0 ; j < height ; j++ ) {
-			VectorCopy( points[j*width + i], grid.points[i][j] );
+			VectorCopy( points[j*width + i], grid->points[i][j] );
 		}
 	}
 
 	// subdivide the grid
-	CM_SetGridWrapWidth( &grid );
-	CM_SubdivideGridColumns( &grid );
-	CM_RemoveDegenerateColumns( &grid );
+	CM_SetGridWrapWidth( grid );
+	CM_SubdivideGridColumns( grid );
+	CM_RemoveDegenerateColumns( grid );
 
-	CM_TransposeGrid( &grid );
+	CM_TransposeGrid( grid );
 
-	CM_SetGridWrapWidth( &grid );
-	CM_SubdivideGridColumns( &grid );
-	CM_RemoveDegenerateColumns( &grid );
+	CM_SetGridWrapWidth( grid );
+	CM_SubdivideGridColumns( grid );
+	CM_RemoveDegenerateColumns( grid );
 
 	// we now have a grid of points exactly on the curve
 	// the aproximate surface defined by these points will be
 	// collided against
-	pf = (patchCollide_t*) Hunk_Alloc( sizeof( *pf ), h_high );
 	ClearBounds( pf->bounds[0], pf->bounds[1] );
-	for ( i = 0 ; i < grid.width ; i++ ) {
-		for ( j = 0 ; j < grid.height ; j++ ) {
-			AddPointToBounds( grid.points[i][j], pf->bounds[0], pf->bounds[1] );
+	for ( i = 0 ; i < grid->width ; i++ ) {
+		for ( j = 0 ; j < grid->height ; j++ ) {
+			AddPointToBounds( grid->points[i][j], pf->bounds[0], pf->bounds[1] );
 		}
 	}
 
-	c_totalPatchBlocks += ( grid.width - 1 ) * ( grid.height - 1 );
+	job->numBlocks = ( grid->width - 1 ) * ( grid->height - 1 );
 
 	// generate a bsp tree for the surface
-	CM_PatchCollideFromGrid( &grid, pf );
+	CM_PatchCollideFromGrid( pw );
 
 	// expand by one unit for epsilon purposes
 	pf->bounds[0][0] -= 1;
@@ -1210,9 +1375,151 @@ struct patchCollide_s	*CM_GeneratePatchCollide( int width, int height, vec3_t *p
 	pf->bounds[1][1] += 1;
 	pf->bounds[1][2] += 1;
 
+	cm_patchWork = NULL;
+}
+
+/*
+===================
+CM_PatchCollideJob
+
+Runs on the job threads, every thread gets its own scratch patchWork_t
+===================
+*/
+static void CM_PatchCollideJob( void *data, int index, int thread ) {
+	patchBatch_t	*batch = (patchBatch_t *)data;
+	patchJob_t		*job = &batch->jobs[index];
+
+	if ( !batch->work[thread] ) {
+		batch->work[thread] = (patchWork_t *) malloc( sizeof( patchWork_t ) );
+		if ( !batch->work[thread] ) {
+			job->error = qtrue;
+			job->errorCode = ERR_FATAL;
+			Q_strncpyz( job->errorMessage, "CM_PatchCollideJob: out of memory", sizeof( job->errorMessage ) );
+			return;
+		}
+	}
+
+	CM_GeneratePatchJob( batch->work[thread], job );
+}
+
+/*
+===================
+CM_FreePatchJob
+===================
+*/
+static void CM_FreePatchJob( patchJob_t *job ) {
+	free( job->pc.facets );
+	free( job->pc.planes );
+	job->pc.facets = NULL;
+	job->pc.planes = NULL;
+}
+
+/*
+===================
+CM_FinishPatchCollide
+
+Prints the warnings recorded while generating the patch and moves it
+to the hunk.  Must be called on the main thread in patch order, so the
+output and hunk layout match the serial build.
+===================
+*/
+static const char *patchWarnings[PW_NUM_WARNINGS] = {
+	"WARNING: CM_GridPlane unresolvable\n",
+	"WARNING: CM_SetBorderInward: mixed plane sides\n",
+	"ERROR: too many bevels\n",
+	"WARNING: bevel plane already used\n",
+	"WARNING: CM_AddFacetBevels... invalid bevel\n"
+};
+
+static struct patchCollide_s *CM_FinishPatchCollide( patchJob_t *job ) {
+	patchCollide_t	*pf;
+	int				i, j;
+
+	for ( i = 0 ; i < PW_NUM_WARNINGS ; i++ ) {
+		for ( j = 0 ; j < job->warnings[i] ; j++ ) {
+			if ( i == PW_MIXED_PLANE_SIDES || i == PW_INVALID_BEVEL ) {
+				Com_DPrintf( "%s", patchWarnings[i] );
+			} else {
+				Com_Printf( "%s", patchWarnings[i] );
+			}
+		}
+	}
+
+	if ( job->debugBlock && !debugBlock ) {
+		debugBlock = qtrue;
+		for ( i = 0 ; i < 4 ; i++ ) {
+			VectorCopy( job->debugBlockPoints[i], debugBlockPoints[i] );
+		}
+	}
+
+	c_totalPatchBlocks += job->numBlocks;
+
+	pf = (patchCollide_t*) CM_Alloc( sizeof( *pf ) );
+	*pf = job->pc;
+	pf->facets = (facet_t*) CM_Alloc( pf->numFacets * sizeof( *pf->facets ) );
+	Com_Memcpy( pf->facets, job->pc.facets, pf->numFacets * sizeof( *pf->facets ) );
+	pf->planes = (patchPlane_t*) CM_Alloc( pf->numPlanes * sizeof( *pf->planes ) );
+	Com_Memcpy( pf->planes, job->pc.planes, pf->numPlanes * sizeof( *pf->planes ) );
+
+	CM_FreePatchJob( job );
+
 	return pf;
 }
 
+/*
+===================
+CM_GeneratePatchCollides
+
+Creates the internal structures that will be used to perform
+collision detection with the patch meshes of a map, spreading
+the work over the job threads.
+===================
+*/
+void CM_GeneratePatchCollides( cPatchSurface_t *surfaces, int numSurfaces ) {
+	patchBatch_t	batch;
+	patchJob_t		*job;
+	int				i, j;
+
+	if ( numSurfaces <= 0 ) {
+		return;
+	}
+
+	Com_Memset( &batch, 0, sizeof( batch ) );
+	batch.jobs = (patchJob_t *) Z_Malloc( numSurfaces * sizeof( *batch.jobs ) );
+	for ( i = 0 ; i < numSurfaces ; i++ ) {
+		batch.jobs[i].width = surfaces[i].width;
+		batch.jobs[i].height = surfaces[i].height;
+		batch.jobs[i].points = surfaces[i].points;
+	}
+
+	Com_ParallelFor( CM_PatchCollideJob, &batch, numSurfaces );
+
+	for ( i = 0 ; i < MAX_JOB_THREADS ; i++ ) {
+		free( batch.work[i] );
+	}
+
+	// report the first failed patch, the same one a serial build would
+	for ( i = 0, job = batch.jobs ; i < numSurfaces ; i++, job++ ) {
+		if ( job->error ) {
+			errorParm_t	code = job->errorCode;
+			char		message[MAX_STRING_CHARS];
+
+			Q_strncpyz( message, job->errorMessage, sizeof( message ) );
+			for ( j = 0 ; j < numSurfaces ; j++ ) {
+				CM_FreePatchJob( &batch.jobs[j] );
+			}
+			Z_Free( batch.jobs );
+			Com_Error( code, "%s", message );
+		}
+	}
+
+	for ( i = 0 ; i < numSurfaces ; i++ ) {
+		surfaces[i].patch->pc = CM_FinishPatchCollide( &batch.jobs[i] );
+	}
+
+	Z_Free( batch.jobs );
+}
+
 /*
 ================================================================================
 
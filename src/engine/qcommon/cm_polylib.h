@@ -66,3 +66,9 @@ void	ChopWindingInPlace (winding_t **w, vec3_t normal, vec_t dist, vec_t epsilon
 // frees the original if clipped
 
 void pw(winding_t *w);
+
+// in cm_patch.c, a patch generated on a job thread keeps track of its
+// windings and stops on errors instead of calling Com_Error
+void	QDECL CM_WindingError( errorParm_t code, const char *fmt, ... );
+void	CM_WindingAllocated( winding_t *w );
+void	CM_WindingFreed( winding_t *w );
@@ -183,6 +183,9 @@ void QDECL Com_Printf( const char *fmt, ... ) {
 			newtime = localtime( &aclock );
 
 			logfile = FS_FOpenFileWrite( "qconsole.log" );
+			if ( com_logfile->integer == 1 ) {
+				FS_WriteAsync( logfile );
+			}
 			Com_Printf( "logfile opened on %s\n", asctime( newtime ) );
 			if ( com_logfile->integer > 1 ) {
 				// force it to not buffer so we get valid
@@ -2073,6 +2076,9 @@ int Com_EventLoop( void ) {
 
 		// if no more events are available
 		if ( ev.evType == SE_NONE ) {
+			// let out whatever the network emulator held back
+			NET_EmuFlush();
+
 			// manually send packet events for the loopback channel
 			while ( NET_GetLoopPacket( NS_CLIENT, &evFrom, &buf ) ) {
 				CL_PacketEvent( evFrom, &buf );
@@ -2454,12 +2460,15 @@ void Com_Init( char *commandLine ) {
 	}
 	Cmd_AddCommand ("quit", Com_Quit_f);
 	Cmd_AddCommand ("changeVectors", MSG_ReportChangeVectors_f );
+	Cmd_AddCommand ("mapcache", CM_MapCache_f );
 	Cmd_AddCommand ("writeconfig", Com_WriteConfig_f );
 
 	s = va("%s %s %s", Q3_VERSION, CPUSTRING, __DATE__ );
 	com_version = Cvar_Get ("version", s, CVAR_ROM | CVAR_SERVERINFO );
 
 	Sys_Init();
+	Com_InitProfile();
+	Com_InitJobs();
 	Netchan_Init( Com_Milliseconds() & 0xffff );	// pick a port value that should be nice and random
 	VM_Init();
 	SV_Init();
@@ -2647,9 +2656,12 @@ void Com_Frame( void ) {
 
 
 	if ( setjmp (abortframe) ) {
+		Com_ProfileUnwind();
 		return;			// an ERR_DROP was thrown
 	}
 
+	Com_ProfileFrame();
+
 	// bk001204 - init to zero.
 	//  also:  might be clobbered by `longjmp' or `vfork'
 	timeBeforeFirstEvents =0;
@@ -2693,6 +2705,7 @@ void Com_Frame( void ) {
 		}
 		msec = com_frameTime - lastTime;
 	} while ( msec < minMsec );
+	PROFILE_BEGIN( "Com_Frame" );
 	Cbuf_Execute ();
 
 	lastTime = com_frameTime;
@@ -2708,7 +2721,9 @@ void Com_Frame( void ) {
 		timeBeforeServer = Sys_Milliseconds ();
 	}
 
+	PROFILE_BEGIN( "SV_Frame" );
 	SV_Frame( msec );
+	PROFILE_END();
 
 	// if "dedicated" has been modified, start up
 	// or shut down the client system.
@@ -2793,6 +2808,8 @@ void Com_Frame( void ) {
 	key = lastTime * 0x87243987;
 
 	com_frameNumber++;
+
+	PROFILE_END();
 }
 
 /*
@@ -2801,6 +2818,8 @@ Com_Shutdown
 =================
 */
 void Com_Shutdown (void) {
+	Com_ShutdownJobs();
+
 	if (logfile) {
 		FS_FCloseFile (logfile);
 		logfile = 0;
@@ -2811,6 +2830,8 @@ void Com_Shutdown (void) {
 		com_journalFile = 0;
 	}
 
+	FS_ShutdownAsyncWrites();
+
 }
 
 #if !( defined __VECTORC )
@@ -255,8 +255,10 @@ static	cvar_t		*fs_cdpath;
 static	cvar_t		*fs_copyfiles;
 static	cvar_t		*fs_gamedirvar;
 static	cvar_t		*fs_restrict;
+static	cvar_t		*fs_asyncWrites;
+static	cvar_t		*fs_asyncBufferSize;
 static	searchpath_t	*fs_searchpaths;
-static	int			fs_readCount;			// total bytes read
+static	volatile int	fs_readCount;			// total bytes read, streams read it on their own threads
 static	int			fs_loadCount;			// total files read
 static	int			fs_loadStack;			// total files in memory
 static	int			fs_packFiles;			// total number of files in packs
@@ -282,6 +284,8 @@ typedef struct {
 	int			zipFilePos;
 	qboolean	zipFile;
 	qboolean	streamed;
+	qboolean	async;				// written by the writer thread, see FS_WriteAsync
+	int			asyncOffset;		// file position after everything queued
 	char		name[MAX_ZPATH];
 } fileHandleData_t;
 
@@ -410,10 +414,412 @@ static FILE	*FS_FileForHandle( fileHandle_t f ) {
 	return fsh[f].handleFiles.file.o;
 }
 
+/*
+=============================================================================
+
+ASYNC WRITES
+
+Demos and logs are written a message or a line at a time on the main
+thread, and a slow disk stalls the frame inside fwrite.  A file handed to
+FS_WriteAsync has its writes copied into a ring instead, and a writer
+thread does the fwrites in the same order, through a large stdio buffer
+so they reach the disk as big sequential writes.
+
+The writer is the only one that takes from the ring.  Anything that
+prints can queue a line for the log, and not only on the main thread,
+so queueing takes a lock, which the writer never needs.  A full
+ring is waited on rather than dropped, a demo with a hole in it can't be
+played back, but the wait is timed and reported, as is a ring that is
+more than half full, so a disk that can't keep up shows in the console.
+
+Closing, seeking and asking the length need the real file and wait for
+the ring to drain first.  FS_FTell doesn't, it counts what was queued.
+
+=============================================================================
+*/
+
+#define	ASYNC_RECORD_WRAP	-1			// the rest of the ring is unused
+#define	ASYNC_RECORD_FLUSH	-2			// fflush the file
+#define	ASYNC_FILE_BUFFER	0x10000
+#define	ASYNC_WARNING_MSEC	5000
+
+typedef struct {
+	int				handle;
+	int				length;			// bytes that follow, or ASYNC_RECORD_*
+} asyncRecord_t;
+
+typedef struct {
+	qboolean		started;
+	void			*thread;
+	void			*wakeup;
+	volatile int	sleeping;
+	volatile int	shutdown;
+	void			*lock;			// held while queueing
+	volatile int	reporting;		// FS_AsyncReport prints, which queues again
+
+	byte			*buffer;
+	int				size;			// power of two
+	volatile int	head;			// bytes queued, only moved under the lock
+	volatile int	tail;			// bytes written, only the writer moves it
+	volatile int	errors;			// failed fwrites, reported on the main thread
+
+	int				stalls;			// under the lock
+	int				stallMsec;
+	int				lastWarning;
+} asyncWriter_t;
+
+static asyncWriter_t	asyncWriter;
+
+#define	ASYNC_HEADER		( (int)sizeof( asyncRecord_t ) )
+#define	ASYNC_PAD( x )		( ( (x) + 7 ) & ~7 )
+
+/*
+=================
+FS_AsyncWriterThread
+=================
+*/
+static void FS_AsyncWriterThread( void *arg ) {
+	asyncRecord_t	*record;
+	fileHandleData_t	*fh;
+	const byte		*data;
+	int				offset, advance, written, remaining;
+
+	Com_ProfileThreadName( "file writer" );
+
+	while ( 1 ) {
+		if ( asyncWriter.tail == asyncWriter.head ) {
+			if ( asyncWriter.shutdown ) {
+				break;
+			}
+
+			// tell the main thread to wake us, then look once more
+			Sys_AtomicCompareExchange( &asyncWriter.sleeping, 1, 0 );
+			if ( asyncWriter.tail == asyncWriter.head && !asyncWriter.shutdown ) {
+				Sys_WaitSemaphore( asyncWriter.wakeup );
+			} else if ( Sys_AtomicCompareExchange( &asyncWriter.sleeping, 0, 1 ) == 0 ) {
+				// the main thread got there first, take its post
+				Sys_WaitSemaphore( asyncWriter.wakeup );
+			}
+			continue;
+		}
+
+		offset = asyncWriter.tail & ( asyncWriter.size - 1 );
+		record = (asyncRecord_t *)( asyncWriter.buffer + offset );
+		fh = &fsh[record->handle];
+
+		if ( record->length == ASYNC_RECORD_WRAP ) {
+			advance = asyncWriter.size - offset;
+		} else if ( record->length == ASYNC_RECORD_FLUSH ) {
+			fflush( fh->handleFiles.file.o );
+			advance = ASYNC_HEADER;
+		} else {
+			PROFILE_BEGIN( "async write" );
+			data = (const byte *)( record + 1 );
+			remaining = record->length;
+			while ( remaining ) {
+				written = (int)fwrite( data, 1, remaining, fh->handleFiles.file.o );
+				if ( written <= 0 ) {
+					Sys_AtomicAdd( &asyncWriter.errors, 1 );
+					break;
+				}
+				remaining -= written;
+				data += written;
+			}
+			if ( fh->handleSync ) {
+				fflush( fh->handleFiles.file.o );
+			}
+			PROFILE_END();
+			advance = ASYNC_HEADER + ASYNC_PAD( record->length );
+		}
+
+		Sys_AtomicAdd( &asyncWriter.tail, advance );
+	}
+}
+
+/*
+=================
+FS_AsyncWake
+=================
+*/
+static void FS_AsyncWake( void ) {
+	if ( asyncWriter.sleeping && Sys_AtomicCompareExchange( &asyncWriter.sleeping, 0, 1 ) == 1 ) {
+		Sys_PostSemaphore( asyncWriter.wakeup, 1 );
+	}
+}
+
+/*
+=================
+FS_AsyncReport
+
+Backpressure and errors from the writer thread
+=================
+*/
+static void FS_AsyncReport( void ) {
+	int		now, queued, errors, stalls, stallMsec;
+
+	// the warnings go to the log too, which comes back here
+	if ( Sys_AtomicCompareExchange( &asyncWriter.reporting, 1, 0 ) != 0 ) {
+		return;
+	}
+
+	now = Sys_Milliseconds();
+	if ( now - asyncWriter.lastWarning < ASYNC_WARNING_MSEC ) {
+		asyncWriter.reporting = 0;
+		return;
+	}
+
+	Sys_LockMutex( asyncWriter.lock );
+	queued = asyncWriter.head - asyncWriter.tail;
+	stalls = asyncWriter.stalls;
+	stallMsec = asyncWriter.stallMsec;
+	asyncWriter.stalls = 0;
+	asyncWriter.stallMsec = 0;
+	Sys_UnlockMutex( asyncWriter.lock );
+
+	errors = asyncWriter.errors;
+	if ( errors ) {
+		Sys_AtomicAdd( &asyncWriter.errors, -errors );
+	}
+
+	if ( !errors && !stalls && queued <= asyncWriter.size / 2 ) {
+		asyncWriter.reporting = 0;
+		return;
+	}
+	asyncWriter.lastWarning = now;
+
+	if ( errors ) {
+		Com_Printf( "WARNING: %i async file writes failed\n", errors );
+	}
+	if ( stalls ) {
+		Com_Printf( "WARNING: async writes waited %i times for %i msec, fs_asyncBufferSize is too small for this disk\n",
+			stalls, stallMsec );
+	} else if ( queued > asyncWriter.size / 2 ) {
+		Com_Printf( "WARNING: async writes are %ik behind\n", queued / 1024 );
+	}
+
+	asyncWriter.reporting = 0;
+}
+
+/*
+=================
+FS_AsyncWaitSpace
+
+Returns the free bytes in the ring, once there are at least need
+=================
+*/
+static int FS_AsyncWaitSpace( int need ) {
+	int		space, start;
+
+	space = asyncWriter.size - ( asyncWriter.head - asyncWriter.tail );
+	if ( space >= need ) {
+		return space;
+	}
+
+	start = Sys_Milliseconds();
+	do {
+		FS_AsyncWake();
+		Sys_Sleep( 1 );
+		space = asyncWriter.size - ( asyncWriter.head - asyncWriter.tail );
+	} while ( space < need );
+
+	asyncWriter.stalls++;
+	asyncWriter.stallMsec += Sys_Milliseconds() - start;
+
+	return space;
+}
+
+/*
+=================
+FS_AsyncQueue
+
+Copies a write, or a flush if data is NULL, into the ring
+=================
+*/
+static void FS_AsyncQueue( fileHandle_t h, const void *data, int length ) {
+	asyncRecord_t	*record;
+	const byte		*in;
+	int				offset, toEnd, space, chunk;
+
+	Sys_LockMutex( asyncWriter.lock );
+
+	fsh[h].asyncOffset += length;
+
+	in = (const byte *)data;
+	while ( 1 ) {
+		offset = asyncWriter.head & ( asyncWriter.size - 1 );
+		toEnd = asyncWriter.size - offset;
+		record = (asyncRecord_t *)( asyncWriter.buffer + offset );
+
+		// records don't wrap, skip the end if there's no room for data
+		if ( toEnd < 2 * ASYNC_HEADER ) {
+			FS_AsyncWaitSpace( toEnd );
+			record->handle = h;
+			record->length = ASYNC_RECORD_WRAP;
+			Sys_AtomicAdd( &asyncWriter.head, toEnd );
+			continue;
+		}
+
+		space = FS_AsyncWaitSpace( 2 * ASYNC_HEADER ) - ASYNC_HEADER;
+		record->handle = h;
+
+		if ( !in ) {
+			record->length = ASYNC_RECORD_FLUSH;
+			Sys_AtomicAdd( &asyncWriter.head, ASYNC_HEADER );
+			break;
+		}
+
+		// both positions stay 8 byte aligned, so the padding always fits
+		chunk = length;
+		if ( chunk > toEnd - ASYNC_HEADER ) {
+			chunk = toEnd - ASYNC_HEADER;
+		}
+		if ( chunk > space ) {
+			chunk = space;
+		}
+
+		record->length = chunk;
+		Com_Memcpy( record + 1, in, chunk );
+		Sys_AtomicAdd( &asyncWriter.head, ASYNC_HEADER + ASYNC_PAD( chunk ) );
+
+		in += chunk;
+		length -= chunk;
+		if ( !length ) {
+			break;
+		}
+	}
+
+	FS_AsyncWake();
+	Sys_UnlockMutex( asyncWriter.lock );
+
+	FS_AsyncReport();
+}
+
+/*
+=================
+FS_AsyncDrain
+
+Waits until the writer thread has written everything queued
+=================
+*/
+static void FS_AsyncDrain( void ) {
+	if ( !asyncWriter.started ) {
+		return;
+	}
+	while ( asyncWriter.tail != asyncWriter.head ) {
+		FS_AsyncWake();
+		Sys_Sleep( 1 );
+	}
+}
+
+/*
+=================
+FS_AsyncStart
+=================
+*/
+static qboolean FS_AsyncStart( void ) {
+	int		size;
+
+	if ( asyncWriter.started ) {
+		return qtrue;
+	}
+
+	// round down to a power of two
+	size = 64 * 1024;
+	while ( size * 2 <= fs_asyncBufferSize->integer * 1024 ) {
+		size *= 2;
+	}
+
+	asyncWriter.buffer = (byte *)malloc( size );
+	if ( !asyncWriter.buffer ) {
+		Com_Printf( "WARNING: couldn't allocate %ik for async writes\n", size / 1024 );
+		return qfalse;
+	}
+	asyncWriter.size = size;
+	asyncWriter.head = 0;
+	asyncWriter.tail = 0;
+	asyncWriter.sleeping = 0;
+	asyncWriter.shutdown = 0;
+	asyncWriter.errors = 0;
+	asyncWriter.reporting = 0;
+	asyncWriter.wakeup = Sys_CreateSemaphore( 0 );
+	asyncWriter.lock = Sys_CreateMutex();
+
+	asyncWriter.thread = Sys_CreateThread( FS_AsyncWriterThread, NULL );
+	if ( !asyncWriter.thread ) {
+		Com_Printf( "WARNING: couldn't start the async writer thread\n" );
+		Sys_DestroySemaphore( asyncWriter.wakeup );
+		Sys_DestroyMutex( asyncWriter.lock );
+		free( asyncWriter.buffer );
+		asyncWriter.buffer = NULL;
+		return qfalse;
+	}
+	asyncWriter.started = qtrue;
+	return qtrue;
+}
+
+/*
+=================
+FS_ShutdownAsyncWrites
+=================
+*/
+void FS_ShutdownAsyncWrites( void ) {
+	int		i;
+
+	if ( !asyncWriter.started ) {
+		return;
+	}
+
+	FS_AsyncDrain();
+
+	asyncWriter.shutdown = 1;
+	Sys_AtomicCompareExchange( &asyncWriter.sleeping, 0, 1 );
+	Sys_PostSemaphore( asyncWriter.wakeup, 1 );
+	Sys_JoinThread( asyncWriter.thread );
+	Sys_DestroySemaphore( asyncWriter.wakeup );
+	Sys_DestroyMutex( asyncWriter.lock );
+
+	free( asyncWriter.buffer );
+	Com_Memset( &asyncWriter, 0, sizeof( asyncWriter ) );
+
+	// anything still open goes back to plain writes
+	for ( i = 0 ; i < MAX_FILE_HANDLES ; i++ ) {
+		fsh[i].async = qfalse;
+	}
+}
+
+/*
+=================
+FS_WriteAsync
+=================
+*/
+void FS_WriteAsync( fileHandle_t f ) {
+	FILE	*file;
+
+	if ( !f || !fs_asyncWrites || !fs_asyncWrites->integer ) {
+		return;
+	}
+
+	file = FS_FileForHandle( f );
+	if ( !FS_AsyncStart() ) {
+		return;
+	}
+
+	// before anything is written, setvbuf can't come later
+	setvbuf( file, NULL, _IOFBF, ASYNC_FILE_BUFFER );
+
+	fsh[f].async = qtrue;
+	fsh[f].asyncOffset = ftell( file );
+}
+
 void	FS_ForceFlush( fileHandle_t f ) {
 	FILE *file;
 
 	file = FS_FileForHandle(f);
+	if ( fsh[f].async ) {
+		// asked for every write to be on disk, which the ring can't promise
+		FS_AsyncDrain();
+		fsh[f].async = qfalse;
+	}
 	setvbuf( file, NULL, _IONBF, 0 );
 }
 
@@ -432,6 +838,9 @@ int FS_filelength( fileHandle_t f ) {
 	FILE*	h;
 
 	h = FS_FileForHandle(f);
+	if ( fsh[f].async ) {
+		FS_AsyncDrain();
+	}
 	pos = ftell (h);
 	fseek (h, 0, SEEK_END);
 	end = ftell (h);
@@ -742,6 +1151,54 @@ int FS_SV_FOpenFileRead( const char *filename, fileHandle_t *fp ) {
 }
 
 
+/*
+===========
+FS_SV_MapFile
+
+Maps a file below the home path, base path or cd path read only, in the
+same order as FS_SV_FOpenFileRead.  Returns NULL if it can't be found or
+is empty, the mapping is released with Sys_UnmapFile.
+===========
+*/
+const byte *FS_SV_MapFile( const char *filename, int *length ) {
+	const char	*paths[3];
+	char		*ospath;
+	const byte	*data;
+	int			i;
+
+	if ( !fs_searchpaths ) {
+		Com_Error( ERR_FATAL, "Filesystem call made without initialization\n" );
+	}
+
+	paths[0] = fs_homepath->string;
+	paths[1] = fs_basepath->string;
+	paths[2] = fs_cdpath->string;
+
+	for ( i = 0 ; i < 3 ; i++ ) {
+		// fs_homepath == fs_basepath on non *nix systems
+		if ( i == 1 && !Q_stricmp( paths[0], paths[1] ) ) {
+			continue;
+		}
+
+		ospath = FS_BuildOSPath( paths[i], filename, "" );
+		// remove trailing slash
+		ospath[strlen(ospath)-1] = '\0';
+
+		if ( fs_debug->integer ) {
+			Com_Printf( "FS_SV_MapFile: %s\n", ospath );
+		}
+
+		data = (const byte *)Sys_MapFile( ospath, length );
+		if ( data ) {
+			return data;
+		}
+	}
+
+	*length = 0;
+	return NULL;
+}
+
+
 /*
 ===========
 FS_SV_Rename
@@ -774,6 +1231,29 @@ void FS_SV_Rename( const char *from, const char *to ) {
 	}
 }
 
+/*
+===========
+FS_SV_Remove
+
+===========
+*/
+void FS_SV_Remove( const char *filename ) {
+	char			*ospath;
+
+	if ( !fs_searchpaths ) {
+		Com_Error( ERR_FATAL, "Filesystem call made without initialization\n" );
+	}
+
+	ospath = FS_BuildOSPath( fs_homepath->string, filename, "" );
+	ospath[strlen(ospath)-1] = '\0';
+
+	if ( fs_debug->integer ) {
+		Com_Printf( "FS_SV_Remove: %s\n", ospath );
+	}
+
+	FS_Remove( ospath );
+}
+
 
 
 /*
@@ -833,6 +1313,10 @@ void FS_FCloseFile( fileHandle_t f ) {
 		return;
 	}
 
+	if ( fsh[f].async ) {
+		FS_AsyncDrain();
+	}
+
 	// we didn't find it as a pak, so close it as a unique file
 	if (fsh[f].handleFiles.file.o) {
 		fclose (fsh[f].handleFiles.file.o);
@@ -1266,7 +1750,7 @@ int FS_Read( void *buffer, int len, fileHandle_t f ) {
 	}
 
 	buf = (byte *)buffer;
-	fs_readCount += len;
+	Sys_AtomicAdd( &fs_readCount, len );
 
 	if (fsh[f].zipFile == qfalse) {
 		remaining = len;
@@ -1322,6 +1806,13 @@ int FS_Write( const void *buffer, int len, fileHandle_t h ) {
 	f = FS_FileForHandle(h);
 	buf = (byte *)buffer;
 
+	if ( fsh[h].async ) {
+		if ( len > 0 ) {
+			FS_AsyncQueue( h, buffer, len );
+		}
+		return len;
+	}
+
 	remaining = len;
 	tries = 0;
 	while (remaining) {
@@ -1415,6 +1906,15 @@ int FS_Seek( fileHandle_t f, long offset, int origin ) {
 			break;
 		}
 
+		if ( fsh[f].async ) {
+			int		r;
+
+			FS_AsyncDrain();
+			r = fseek( file, offset, _origin );
+			fsh[f].asyncOffset = ftell( file );
+			return r;
+		}
+
 		return fseek( file, offset, _origin );
 	}
 }
@@ -2653,6 +3153,9 @@ void FS_Shutdown( qboolean closemfp ) {
 	searchpath_t	*p, *next;
 	int	i;
 
+	// files left open still get everything written to them
+	FS_AsyncDrain();
+
 	for(i = 0; i < MAX_FILE_HANDLES; i++) {
 		if (fsh[i].fileSize) {
 			FS_FCloseFile(i);
@@ -2755,6 +3258,8 @@ static void FS_Startup( const char *gameName ) {
 	fs_homepath = Cvar_Get ("fs_homepath", homePath, CVAR_INIT );
 	fs_gamedirvar = Cvar_Get ("fs_game", "", CVAR_INIT|CVAR_SYSTEMINFO );
 	fs_restrict = Cvar_Get ("fs_restrict", "", CVAR_INIT );
+	fs_asyncWrites = Cvar_Get( "fs_asyncWrites", "1", CVAR_ARCHIVE );
+	fs_asyncBufferSize = Cvar_Get( "fs_asyncBufferSize", "4096", CVAR_ARCHIVE | CVAR_LATCH );
 
 	// add search path elements in reverse priority order
 	if (fs_cdpath->string[0]) {
@@ -3370,6 +3875,8 @@ int		FS_FOpenFileByMode( const char *qpath, fileHandle_t *f, fsMode_t mode ) {
 		sync = qtrue;
 	case FS_APPEND:
 		*f = FS_FOpenFileAppend( qpath );
+		// logs, like the game's
+		FS_WriteAsync( *f );
 		r = 0;
 		if (*f == 0) {
 			r = -1;
@@ -3405,6 +3912,9 @@ int		FS_FOpenFileByMode( const char *qpath, fileHandle_t *f, fsMode_t mode ) {
 
 int		FS_FTell( fileHandle_t f ) {
 	int pos;
+	if ( fsh[f].async ) {
+		return fsh[f].asyncOffset;
+	}
 	if (fsh[f].zipFile == qtrue) {
 		pos = unztell(fsh[f].handleFiles.file.z);
 	} else {
@@ -3414,6 +3924,10 @@ int		FS_FTell( fileHandle_t f ) {
 }
 
 void	FS_Flush( fileHandle_t f ) {
+	if ( fsh[f].async ) {
+		FS_AsyncQueue( f, NULL, 0 );
+		return;
+	}
 	fflush(fsh[f].handleFiles.file.o);
 }
 
@@ -27,7 +27,8 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include "../../game/q_shared.h"
 #include "qcommon.h"
 
-static int			bloc = 0;
+// per thread, so messages can be read on several threads at once
+static __declspec( thread ) int	bloc = 0;
 
 void	Huff_putBit( int bit, byte *fout, int *offset) {
 	bloc = *offset;
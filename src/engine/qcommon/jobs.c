@@ -0,0 +1,581 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// jobs.c -- work stealing job scheduler
+
+#include "../../game/q_shared.h"
+#include "qcommon.h"
+
+/*
+===============================================================================
+
+Every thread that runs jobs, the main thread and the workers, owns a queue.
+New jobs go to the bottom of the queue of the thread that adds them and
+the owner takes them back from the bottom, so related work stays on one
+cache.  A thread that runs out steals from the top of the other queues.
+
+A jobCounter_t counts the jobs added against it that haven't finished.
+Com_WaitJobs doesn't block, it keeps running queued jobs until the counter
+drops to zero, so a job can add more jobs and wait for them without
+tying up its thread, which is how dependencies between jobs are expressed.
+
+The queues are short and locked, a queue that is full makes Com_AddJob
+run the job right away on the calling thread.
+
+===============================================================================
+*/
+
+#define	MAX_QUEUED_JOBS		1024	// per thread, must be a power of two
+
+typedef struct {
+	jobFunc_t		func;
+	void			*data;
+	int				index;
+	jobCounter_t	*counter;
+} job_t;
+
+typedef struct {
+	void			*lock;
+	int				top;			// thieves take from here
+	int				bottom;			// the owner pushes and pops here
+	job_t			jobs[MAX_QUEUED_JOBS];
+} jobQueue_t;
+
+typedef struct {
+	qboolean		initialized;
+	int				numThreads;		// including the main thread
+	void			*threads[MAX_JOB_THREADS];
+	int				threadNums[MAX_JOB_THREADS];
+	jobQueue_t		*queues[MAX_JOB_THREADS];
+	void			*wakeup;
+	volatile int	queued;			// jobs sitting in any queue
+	volatile int	sleepers;		// workers waiting on wakeup
+	volatile int	shutdown;
+} jobState_t;
+
+static jobState_t	jobs;
+
+// -1 for threads that don't belong to the scheduler
+static __declspec( thread ) int	job_thread = -1;
+
+cvar_t	*com_jobThreads;
+
+static void Com_JobTest_f( void );
+static void Com_JobBench_f( void );
+
+/*
+==================
+Com_PushJob
+==================
+*/
+static qboolean Com_PushJob( jobQueue_t *queue, const job_t *job ) {
+	Sys_LockMutex( queue->lock );
+	if ( queue->bottom - queue->top >= MAX_QUEUED_JOBS ) {
+		Sys_UnlockMutex( queue->lock );
+		return qfalse;
+	}
+	queue->jobs[queue->bottom & ( MAX_QUEUED_JOBS - 1 )] = *job;
+	queue->bottom++;
+	Sys_UnlockMutex( queue->lock );
+	return qtrue;
+}
+
+/*
+==================
+Com_PopJob
+
+The owner takes the newest job, thieves the oldest
+==================
+*/
+static qboolean Com_PopJob( jobQueue_t *queue, job_t *job, qboolean steal ) {
+	Sys_LockMutex( queue->lock );
+	if ( queue->bottom == queue->top ) {
+		Sys_UnlockMutex( queue->lock );
+		return qfalse;
+	}
+	if ( steal ) {
+		*job = queue->jobs[queue->top & ( MAX_QUEUED_JOBS - 1 )];
+		queue->top++;
+	} else {
+		queue->bottom--;
+		*job = queue->jobs[queue->bottom & ( MAX_QUEUED_JOBS - 1 )];
+	}
+	Sys_UnlockMutex( queue->lock );
+	return qtrue;
+}
+
+/*
+==================
+Com_ExecuteJob
+==================
+*/
+static void Com_ExecuteJob( const job_t *job, int thread ) {
+	job->func( job->data, job->index, thread );
+	if ( job->counter ) {
+		Sys_AtomicAdd( &job->counter->count, -1 );
+	}
+}
+
+/*
+==================
+Com_RunOneJob
+
+Runs a job from the thread's own queue, or failing that one stolen
+from another thread.  Returns qfalse if there was nothing to run.
+==================
+*/
+static qboolean Com_RunOneJob( int thread ) {
+	job_t	job;
+	int		i, victim;
+
+	if ( !jobs.queued ) {
+		return qfalse;
+	}
+
+	if ( !Com_PopJob( jobs.queues[thread], &job, qfalse ) ) {
+		for ( i = 1 ; i < jobs.numThreads ; i++ ) {
+			victim = ( thread + i ) % jobs.numThreads;
+			if ( Com_PopJob( jobs.queues[victim], &job, qtrue ) ) {
+				break;
+			}
+		}
+		if ( i == jobs.numThreads ) {
+			return qfalse;
+		}
+	}
+
+	Sys_AtomicAdd( &jobs.queued, -1 );
+	Com_ExecuteJob( &job, thread );
+	return qtrue;
+}
+
+/*
+==================
+Com_JobWorker
+==================
+*/
+static void Com_JobWorker( void *arg ) {
+	int		thread;
+
+	thread = *(int *)arg;
+	job_thread = thread;
+	Com_ProfileThreadName( va( "job %i", thread ) );
+
+	while ( !jobs.shutdown ) {
+		if ( Com_RunOneJob( thread ) ) {
+			continue;
+		}
+
+		// announce the sleep before the last look at the queues, so a
+		// job added in between either gets seen here or posts a wakeup
+		Sys_AtomicAdd( &jobs.sleepers, 1 );
+		if ( !jobs.queued && !jobs.shutdown ) {
+			Sys_WaitSemaphore( jobs.wakeup );
+		}
+		Sys_AtomicAdd( &jobs.sleepers, -1 );
+	}
+}
+
+/*
+==================
+Com_InitJobs
+==================
+*/
+void Com_InitJobs( void ) {
+	int		i;
+	int		numThreads;
+
+	com_jobThreads = Cvar_Get( "com_jobThreads", "-1", CVAR_ARCHIVE | CVAR_LATCH );
+
+	numThreads = com_jobThreads->integer;
+	if ( numThreads < 0 ) {
+		numThreads = (int)Sys_ProcessorCount();
+	}
+	numThreads = Com_Clamp( 1, MAX_JOB_THREADS, numThreads );
+
+	// every queue exists up front, so thieves never see a missing one
+	for ( i = 0 ; i < numThreads ; i++ ) {
+		jobs.queues[i] = (jobQueue_t *)calloc( 1, sizeof( jobQueue_t ) );
+		if ( !jobs.queues[i] ) {
+			Com_Error( ERR_FATAL, "Com_InitJobs: couldn't allocate the job queues" );
+		}
+		jobs.queues[i]->lock = Sys_CreateMutex();
+	}
+
+	jobs.wakeup = Sys_CreateSemaphore( 0 );
+	jobs.shutdown = 0;
+	jobs.queued = 0;
+	jobs.sleepers = 0;
+	jobs.numThreads = numThreads;
+	job_thread = 0;
+
+	for ( i = 1 ; i < numThreads ; i++ ) {
+		jobs.threadNums[i] = i;
+		jobs.threads[i] = Sys_CreateThread( Com_JobWorker, &jobs.threadNums[i] );
+		if ( !jobs.threads[i] ) {
+			Com_Printf( "WARNING: couldn't create job thread %i\n", i );
+			break;
+		}
+	}
+
+	// workers that did start only steal from queues below this
+	jobs.numThreads = i;
+	jobs.initialized = qtrue;
+
+	Cmd_AddCommand( "jobtest", Com_JobTest_f );
+	Cmd_AddCommand( "jobbench", Com_JobBench_f );
+
+	Com_Printf( "%i job threads\n", jobs.numThreads );
+}
+
+/*
+==================
+Com_ShutdownJobs
+==================
+*/
+void Com_ShutdownJobs( void ) {
+	int		i;
+
+	if ( !jobs.initialized ) {
+		return;
+	}
+
+	jobs.shutdown = 1;
+	Sys_PostSemaphore( jobs.wakeup, jobs.numThreads - 1 );
+	for ( i = 1 ; i < jobs.numThreads ; i++ ) {
+		Sys_JoinThread( jobs.threads[i] );
+	}
+	Sys_DestroySemaphore( jobs.wakeup );
+
+	for ( i = 0 ; i < MAX_JOB_THREADS ; i++ ) {
+		if ( jobs.queues[i] ) {
+			Sys_DestroyMutex( jobs.queues[i]->lock );
+			free( jobs.queues[i] );
+		}
+	}
+
+	Cmd_RemoveCommand( "jobtest" );
+	Cmd_RemoveCommand( "jobbench" );
+
+	Com_Memset( &jobs, 0, sizeof( jobs ) );
+	job_thread = -1;
+}
+
+/*
+==================
+Com_JobThreadCount
+==================
+*/
+int Com_JobThreadCount( void ) {
+	return jobs.initialized ? jobs.numThreads : 1;
+}
+
+/*
+==================
+Com_AddJob
+==================
+*/
+void Com_AddJob( jobFunc_t func, void *data, int index, jobCounter_t *counter ) {
+	job_t	job;
+	int		thread;
+
+	job.func = func;
+	job.data = data;
+	job.index = index;
+	job.counter = counter;
+
+	if ( counter ) {
+		Sys_AtomicAdd( &counter->count, 1 );
+	}
+
+	// threads outside the scheduler go through the main thread's queue
+	thread = job_thread < 0 ? 0 : job_thread;
+
+	if ( !jobs.initialized || jobs.numThreads == 1
+		|| !Com_PushJob( jobs.queues[thread], &job ) ) {
+		Com_ExecuteJob( &job, thread );
+		return;
+	}
+
+	Sys_AtomicAdd( &jobs.queued, 1 );
+	if ( jobs.sleepers > 0 ) {
+		Sys_PostSemaphore( jobs.wakeup, 1 );
+	}
+}
+
+/*
+==================
+Com_WaitJobs
+
+Helps out with queued jobs until every job added against the counter
+has finished
+==================
+*/
+void Com_WaitJobs( jobCounter_t *counter ) {
+	while ( counter->count > 0 ) {
+		if ( job_thread < 0 || !Com_RunOneJob( job_thread ) ) {
+			Sys_Yield();
+		}
+	}
+}
+
+/*
+==================
+Com_ParallelForBatch
+==================
+*/
+typedef struct {
+	jobFunc_t	func;
+	void		*data;
+	int			count;
+	int			batchSize;
+} parallelFor_t;
+
+static void Com_ParallelForBatch( void *data, int index, int thread ) {
+	parallelFor_t	*pf;
+	int				i, end;
+
+	pf = (parallelFor_t *)data;
+
+	end = ( index + 1 ) * pf->batchSize;
+	if ( end > pf->count ) {
+		end = pf->count;
+	}
+	for ( i = index * pf->batchSize ; i < end ; i++ ) {
+		pf->func( pf->data, i, thread );
+	}
+}
+
+/*
+==================
+Com_ParallelFor
+==================
+*/
+void Com_ParallelFor( jobFunc_t func, void *data, int count ) {
+	parallelFor_t	pf;
+	jobCounter_t	counter;
+	int				i, numBatches;
+
+	if ( count <= 0 ) {
+		return;
+	}
+
+	// not worth waking anyone up
+	if ( Com_JobThreadCount() == 1 || count == 1 || job_thread < 0 ) {
+		for ( i = 0 ; i < count ; i++ ) {
+			func( data, i, job_thread < 0 ? 0 : job_thread );
+		}
+		return;
+	}
+
+	// a few batches per thread, so the stealing can even out uneven indexes
+	pf.func = func;
+	pf.data = data;
+	pf.count = count;
+	pf.batchSize = count / ( Com_JobThreadCount() * 4 );
+	if ( pf.batchSize < 1 ) {
+		pf.batchSize = 1;
+	}
+	numBatches = ( count + pf.batchSize - 1 ) / pf.batchSize;
+
+	counter.count = 0;
+	for ( i = 0 ; i < numBatches ; i++ ) {
+		Com_AddJob( Com_ParallelForBatch, &pf, i, &counter );
+	}
+	Com_WaitJobs( &counter );
+}
+
+/*
+===============================================================================
+
+STRESS TEST AND BENCHMARK
+
+===============================================================================
+*/
+
+typedef struct {
+	int				*marks;			// every index must be hit exactly once
+	volatile int	total;
+	int				fanout;
+} jobTest_t;
+
+static void Com_JobTestMark( void *data, int index, int thread ) {
+	jobTest_t	*test;
+
+	test = (jobTest_t *)data;
+	test->marks[index]++;
+	Sys_AtomicAdd( &test->total, 1 );
+}
+
+// adds children and waits for them from inside a job
+static void Com_JobTestTree( void *data, int index, int thread ) {
+	jobTest_t		*test;
+	jobCounter_t	counter;
+	int				i;
+
+	test = (jobTest_t *)data;
+	Sys_AtomicAdd( &test->total, 1 );
+
+	if ( index <= 0 ) {
+		return;
+	}
+
+	counter.count = 0;
+	for ( i = 0 ; i < test->fanout ; i++ ) {
+		Com_AddJob( Com_JobTestTree, data, index - 1, &counter );
+	}
+	Com_WaitJobs( &counter );
+}
+
+/*
+==================
+Com_JobTest_f
+
+jobtest [iterations]
+==================
+*/
+static void Com_JobTest_f( void ) {
+	jobTest_t		test;
+	jobCounter_t	counter;
+	int				iterations, iter;
+	int				count, expected, depth, i, j;
+	int				seed;
+
+	iterations = Cmd_Argc() > 1 ? atoi( Cmd_Argv( 1 ) ) : 100;
+	seed = Sys_Milliseconds();
+
+	test.marks = (int *)Z_Malloc( 100000 * sizeof( int ) );
+
+	for ( iter = 0 ; iter < iterations ; iter++ ) {
+		// parallel for over a random range
+		count = 1 + (int)( Q_random( &seed ) * 99999 );
+		Com_Memset( test.marks, 0, count * sizeof( int ) );
+		test.total = 0;
+		Com_ParallelFor( Com_JobTestMark, &test, count );
+		for ( i = 0 ; i < count ; i++ ) {
+			if ( test.marks[i] != 1 ) {
+				break;
+			}
+		}
+		if ( i < count || test.total != count ) {
+			Com_Printf( "jobtest: parallel for of %i missed index %i on iteration %i\n", count, i, iter );
+			Z_Free( test.marks );
+			return;
+		}
+
+		// more single jobs than the queues hold, so some of them run inline
+		count = MAX_QUEUED_JOBS * 4;
+		Com_Memset( test.marks, 0, count * sizeof( int ) );
+		test.total = 0;
+		counter.count = 0;
+		for ( i = 0 ; i < count ; i++ ) {
+			Com_AddJob( Com_JobTestMark, &test, i, &counter );
+		}
+		Com_WaitJobs( &counter );
+		if ( counter.count != 0 || test.total != count ) {
+			Com_Printf( "jobtest: %i of %i single jobs ran on iteration %i\n", test.total, count, iter );
+			Z_Free( test.marks );
+			return;
+		}
+
+		// nested jobs waiting on their children
+		test.fanout = 2 + iter % 3;
+		depth = 3 + iter % 3;
+		test.total = 0;
+		counter.count = 0;
+		Com_AddJob( Com_JobTestTree, &test, depth, &counter );
+		Com_WaitJobs( &counter );
+		for ( expected = 0, i = 0, j = 1 ; i <= depth ; i++, j *= test.fanout ) {
+			expected += j;
+		}
+		if ( test.total != expected ) {
+			Com_Printf( "jobtest: job tree ran %i of %i jobs on iteration %i\n", test.total, expected, iter );
+			Z_Free( test.marks );
+			return;
+		}
+	}
+
+	Z_Free( test.marks );
+	Com_Printf( "jobtest: %i iterations passed on %i threads\n", iterations, Com_JobThreadCount() );
+}
+
+static void Com_JobBenchEmpty( void *data, int index, int thread ) {
+}
+
+static void Com_JobBenchWork( void *data, int index, int thread ) {
+	float	*out;
+	float	f;
+	int		i;
+
+	out = (float *)data;
+	f = index;
+	for ( i = 0 ; i < 2000 ; i++ ) {
+		f = f * 0.999f + 1.0f;
+	}
+	out[index] = f;
+}
+
+/*
+==================
+Com_JobBench_f
+==================
+*/
+static void Com_JobBench_f( void ) {
+	jobCounter_t	counter;
+	volatile jobFunc_t	work;
+	float			*out;
+	int				start, serial, parallel, single, empty;
+	int				i;
+
+	out = (float *)Z_Malloc( 65536 * sizeof( float ) );
+
+	// through a pointer like the jobs, or the compiler vectorizes the loop
+	work = Com_JobBenchWork;
+	start = Sys_Microseconds();
+	for ( i = 0 ; i < 65536 ; i++ ) {
+		work( out, i, 0 );
+	}
+	serial = Sys_Microseconds() - start;
+
+	start = Sys_Microseconds();
+	Com_ParallelFor( Com_JobBenchWork, out, 65536 );
+	parallel = Sys_Microseconds() - start;
+
+	start = Sys_Microseconds();
+	Com_ParallelFor( Com_JobBenchEmpty, NULL, 1000000 );
+	empty = Sys_Microseconds() - start;
+
+	start = Sys_Microseconds();
+	counter.count = 0;
+	for ( i = 0 ; i < 100000 ; i++ ) {
+		Com_AddJob( Com_JobBenchEmpty, NULL, i, &counter );
+	}
+	Com_WaitJobs( &counter );
+	single = Sys_Microseconds() - start;
+
+	Z_Free( out );
+
+	Com_Printf( "%i job threads\n", Com_JobThreadCount() );
+	Com_Printf( "work: %i usec serial, %i usec parallel, %.2fx\n", serial, parallel,
+		parallel > 0 ? (float)serial / parallel : 0.0f );
+	Com_Printf( "parallel for: %.1f million empty indexes/sec\n", empty > 0 ? 1000000.0f / empty : 0.0f );
+	Com_Printf( "single jobs: %.1f million empty jobs/sec\n", single > 0 ? 100000.0f / single : 0.0f );
+}
@@ -28,6 +28,8 @@ static qboolean			msgInit = qfalse;
 
 int pcount[256];
 
+static netTraffic_t		*msg_traffic;		// see MSG_SetTraffic
+
 /*
 ==============================================================================
 
@@ -427,7 +429,7 @@ float MSG_ReadFloat( msg_t *msg ) {
 }
 
 char *MSG_ReadString( msg_t *msg ) {
-	static char	string[MAX_STRING_CHARS];
+	static __declspec( thread ) char	string[MAX_STRING_CHARS];
 	int		l,c;
 	
 	l = 0;
@@ -455,7 +457,7 @@ char *MSG_ReadString( msg_t *msg ) {
 }
 
 char *MSG_ReadBigString( msg_t *msg ) {
-	static char	string[BIG_INFO_STRING];
+	static __declspec( thread ) char	string[BIG_INFO_STRING];
 	int		l,c;
 	
 	l = 0;
@@ -479,7 +481,7 @@ char *MSG_ReadBigString( msg_t *msg ) {
 }
 
 char *MSG_ReadStringLine( msg_t *msg ) {
-	static char	string[MAX_STRING_CHARS];
+	static __declspec( thread ) char	string[MAX_STRING_CHARS];
 	int		l,c;
 
 	l = 0;
@@ -863,6 +865,8 @@ void MSG_WriteDeltaEntity( msg_t *msg, struct entityState_s *from, struct entity
 	int			trunc;
 	float		fullFloat;
 	int			*fromF, *toF;
+	netTraffic_t	*traffic;
+	int			start, fieldStart;
 
 	numFields = sizeof(entityStateFields)/sizeof(entityStateFields[0]);
 
@@ -872,6 +876,9 @@ void MSG_WriteDeltaEntity( msg_t *msg, struct entityState_s *from, struct entity
 	// struct without updating the message fields
 	assert( numFields + 1 == sizeof( *from )/4 );
 
+	traffic = msg_traffic;
+	start = msg->bit;
+
 	// a NULL to is a delta remove message
 	if ( to == NULL ) {
 		if ( from == NULL ) {
@@ -879,6 +886,10 @@ void MSG_WriteDeltaEntity( msg_t *msg, struct entityState_s *from, struct entity
 		}
 		MSG_WriteBits( msg, from->number, GENTITYNUM_BITS );
 		MSG_WriteBits( msg, 1, 1 );
+		if ( traffic ) {
+			traffic->entityRemoves++;
+			traffic->entityRemoveBits += msg->bit - start;
+		}
 		return;
 	}
 
@@ -905,6 +916,10 @@ void MSG_WriteDeltaEntity( msg_t *msg, struct entityState_s *from, struct entity
 		MSG_WriteBits( msg, to->number, GENTITYNUM_BITS );
 		MSG_WriteBits( msg, 0, 1 );		// not removed
 		MSG_WriteBits( msg, 0, 1 );		// no delta
+		if ( traffic ) {
+			traffic->entityTypeUpdates[to->eType & ( MAX_TRAFFIC_TYPES - 1 )]++;
+			traffic->entityTypeBits[to->eType & ( MAX_TRAFFIC_TYPES - 1 )] += msg->bit - start;
+		}
 		return;
 	}
 
@@ -919,9 +934,13 @@ void MSG_WriteDeltaEntity( msg_t *msg, struct entityState_s *from, struct entity
 	for ( i = 0, field = entityStateFields ; i < lc ; i++, field++ ) {
 		fromF = (int *)( (byte *)from + field->offset );
 		toF = (int *)( (byte *)to + field->offset );
+		fieldStart = msg->bit;
 
 		if ( *fromF == *toF ) {
 			MSG_WriteBits( msg, 0, 1 );	// no change
+			if ( traffic ) {
+				traffic->entityFieldBits[i] += msg->bit - fieldStart;
+			}
 			continue;
 		}
 
@@ -957,6 +976,16 @@ void MSG_WriteDeltaEntity( msg_t *msg, struct entityState_s *from, struct entity
 				MSG_WriteBits( msg, *toF, field->bits );
 			}
 		}
+
+		if ( traffic ) {
+			traffic->entityFieldChanges[i]++;
+			traffic->entityFieldBits[i] += msg->bit - fieldStart;
+		}
+	}
+
+	if ( traffic ) {
+		traffic->entityTypeUpdates[to->eType & ( MAX_TRAFFIC_TYPES - 1 )]++;
+		traffic->entityTypeBits[to->eType & ( MAX_TRAFFIC_TYPES - 1 )] += msg->bit - start;
 	}
 }
 
@@ -1086,6 +1115,108 @@ void MSG_ReadDeltaEntity( msg_t *msg, entityState_t *from, entityState_t *to,
 	}
 }
 
+/*
+==================
+MSG_WriteEntityList
+
+Delta encodes a list of entities sorted by number against an older one,
+the way snapshots do.  Entities that weren't in the old list go from
+their baseline.
+==================
+*/
+void MSG_WriteEntityList( msg_t *msg, entityState_t *from, int numFrom, entityState_t *to, int numTo,
+						 entityState_t *baselines ) {
+	int		oldindex, newindex;
+	int		oldnum, newnum;
+
+	oldindex = 0;
+	newindex = 0;
+	while ( newindex < numTo || oldindex < numFrom ) {
+		newnum = newindex < numTo ? to[newindex].number : 9999;
+		oldnum = oldindex < numFrom ? from[oldindex].number : 9999;
+
+		if ( newnum == oldnum ) {
+			// nothing is written if it hasn't changed
+			MSG_WriteDeltaEntity( msg, &from[oldindex], &to[newindex], qfalse );
+			oldindex++;
+			newindex++;
+		} else if ( newnum < oldnum ) {
+			MSG_WriteDeltaEntity( msg, &baselines[newnum], &to[newindex], qtrue );
+			newindex++;
+		} else {
+			MSG_WriteDeltaEntity( msg, &from[oldindex], NULL, qtrue );
+			oldindex++;
+		}
+	}
+
+	MSG_WriteBits( msg, (MAX_GENTITIES-1), GENTITYNUM_BITS );
+}
+
+/*
+==================
+MSG_ReadEntityList
+
+Reads what MSG_WriteEntityList wrote, returns the number of entities
+==================
+*/
+int MSG_ReadEntityList( msg_t *msg, entityState_t *from, int numFrom, entityState_t *to, int maxTo,
+					   entityState_t *baselines ) {
+	int		oldindex, oldnum, newnum;
+	int		numTo;
+
+	numTo = 0;
+	oldindex = 0;
+	oldnum = numFrom ? from[0].number : 99999;
+
+	while ( 1 ) {
+		newnum = MSG_ReadBits( msg, GENTITYNUM_BITS );
+		if ( newnum == (MAX_GENTITIES-1) ) {
+			break;
+		}
+		if ( msg->readcount > msg->cursize ) {
+			Com_Error( ERR_DROP, "MSG_ReadEntityList: end of message" );
+		}
+
+		// everything before it is unchanged
+		while ( oldnum <= newnum ) {
+			if ( numTo == maxTo ) {
+				Com_Error( ERR_DROP, "MSG_ReadEntityList: more than %i entities", maxTo );
+			}
+			if ( oldnum < newnum ) {
+				to[numTo] = from[oldindex];
+			} else {
+				MSG_ReadDeltaEntity( msg, &from[oldindex], &to[numTo], newnum );
+				newnum = -1;
+			}
+			if ( to[numTo].number != (MAX_GENTITIES-1) ) {
+				numTo++;
+			}
+
+			oldindex++;
+			oldnum = oldindex < numFrom ? from[oldindex].number : 99999;
+		}
+
+		if ( newnum >= 0 ) {
+			if ( numTo == maxTo ) {
+				Com_Error( ERR_DROP, "MSG_ReadEntityList: more than %i entities", maxTo );
+			}
+			MSG_ReadDeltaEntity( msg, &baselines[newnum], &to[numTo], newnum );
+			if ( to[numTo].number != (MAX_GENTITIES-1) ) {
+				numTo++;
+			}
+		}
+	}
+
+	for ( ; oldindex < numFrom ; oldindex++ ) {
+		if ( numTo == maxTo ) {
+			Com_Error( ERR_DROP, "MSG_ReadEntityList: more than %i entities", maxTo );
+		}
+		to[numTo++] = from[oldindex];
+	}
+
+	return numTo;
+}
+
 
 /*
 ============================================================================
@@ -1169,12 +1300,16 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct p
 	int				*fromF, *toF;
 	float			fullFloat;
 	int				trunc, lc;
+	netTraffic_t	*traffic;
+	int				start, fieldStart;
 
 	if (!from) {
 		from = &dummy;
 		Com_Memset (&dummy, 0, sizeof(dummy));
 	}
 
+	traffic = msg_traffic;
+	start = msg->bit;
 	c = msg->cursize;
 
 	numFields = sizeof( playerStateFields ) / sizeof( playerStateFields[0] );
@@ -1195,9 +1330,13 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct p
 	for ( i = 0, field = playerStateFields ; i < lc ; i++, field++ ) {
 		fromF = (int *)( (byte *)from + field->offset );
 		toF = (int *)( (byte *)to + field->offset );
+		fieldStart = msg->bit;
 
 		if ( *fromF == *toF ) {
 			MSG_WriteBits( msg, 0, 1 );	// no change
+			if ( traffic ) {
+				traffic->playerFieldBits[i] += msg->bit - fieldStart;
+			}
 			continue;
 		}
 
@@ -1223,6 +1362,11 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct p
 			// integer
 			MSG_WriteBits( msg, *toF, field->bits );
 		}
+
+		if ( traffic ) {
+			traffic->playerFieldChanges[i]++;
+			traffic->playerFieldBits[i] += msg->bit - fieldStart;
+		}
 	}
 	c = msg->cursize - c;
 
@@ -1258,10 +1402,16 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct p
 	if (!statsbits && !persistantbits && !ammobits && !powerupbits) {
 		MSG_WriteBits( msg, 0, 1 );	// no change
 		oldsize += 4;
+		if ( traffic ) {
+			traffic->playerstates++;
+			traffic->playerstateBits += msg->bit - start;
+		}
 		return;
 	}
 	MSG_WriteBits( msg, 1, 1 );	// changed
 
+	// the arrays are counted as the fields after the list
+	fieldStart = msg->bit;
 	if ( statsbits ) {
 		MSG_WriteBits( msg, 1, 1 );	// changed
 		MSG_WriteShort( msg, statsbits );
@@ -1271,8 +1421,13 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct p
 	} else {
 		MSG_WriteBits( msg, 0, 1 );	// no change
 	}
+	if ( traffic ) {
+		traffic->playerFieldChanges[numFields] += statsbits ? 1 : 0;
+		traffic->playerFieldBits[numFields] += msg->bit - fieldStart;
+	}
 
 
+	fieldStart = msg->bit;
 	if ( persistantbits ) {
 		MSG_WriteBits( msg, 1, 1 );	// changed
 		MSG_WriteShort( msg, persistantbits );
@@ -1282,8 +1437,13 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct p
 	} else {
 		MSG_WriteBits( msg, 0, 1 );	// no change
 	}
+	if ( traffic ) {
+		traffic->playerFieldChanges[numFields+1] += persistantbits ? 1 : 0;
+		traffic->playerFieldBits[numFields+1] += msg->bit - fieldStart;
+	}
 
 
+	fieldStart = msg->bit;
 	if ( ammobits ) {
 		MSG_WriteBits( msg, 1, 1 );	// changed
 		MSG_WriteShort( msg, ammobits );
@@ -1293,8 +1453,13 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct p
 	} else {
 		MSG_WriteBits( msg, 0, 1 );	// no change
 	}
+	if ( traffic ) {
+		traffic->playerFieldChanges[numFields+2] += ammobits ? 1 : 0;
+		traffic->playerFieldBits[numFields+2] += msg->bit - fieldStart;
+	}
 
 
+	fieldStart = msg->bit;
 	if ( powerupbits ) {
 		MSG_WriteBits( msg, 1, 1 );	// changed
 		MSG_WriteShort( msg, powerupbits );
@@ -1304,6 +1469,13 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct p
 	} else {
 		MSG_WriteBits( msg, 0, 1 );	// no change
 	}
+	if ( traffic ) {
+		traffic->playerFieldChanges[numFields+3] += powerupbits ? 1 : 0;
+		traffic->playerFieldBits[numFields+3] += msg->bit - fieldStart;
+
+		traffic->playerstates++;
+		traffic->playerstateBits += msg->bit - start;
+	}
 }
 
 
@@ -1447,6 +1619,174 @@ void MSG_ReadDeltaPlayerstate (msg_t *msg, playerState_t *from, playerState_t *t
 	}
 }
 
+/*
+============================================================================
+
+traffic accounting
+
+While a target is set, the delta writers add the bits they put into the
+message to it, per field of the entity and player states, per entity
+type, and for removes.  The bits are counted after huffman compression,
+so they are what actually goes out, less the netchan and packet headers.
+
+============================================================================
+*/
+
+static const char *msg_playerArrayNames[4] = { "stats", "persistant", "ammo", "powerups" };
+
+/*
+==================
+MSG_SetTraffic
+
+Starts adding to traffic, or stops with NULL, and returns the previous target
+==================
+*/
+netTraffic_t *MSG_SetTraffic( netTraffic_t *traffic ) {
+	netTraffic_t	*old;
+
+	old = msg_traffic;
+	msg_traffic = traffic;
+	return old;
+}
+
+/*
+==================
+MSG_AddTraffic
+==================
+*/
+void MSG_AddTraffic( netTraffic_t *to, const netTraffic_t *from ) {
+	int		i;
+
+	to->messages += from->messages;
+	to->messageBytes += from->messageBytes;
+	to->commands += from->commands;
+	to->commandBits += from->commandBits;
+	to->downloadBytes += from->downloadBytes;
+	to->playerstates += from->playerstates;
+	to->playerstateBits += from->playerstateBits;
+	to->entityRemoves += from->entityRemoves;
+	to->entityRemoveBits += from->entityRemoveBits;
+
+	for ( i = 0 ; i < MAX_TRAFFIC_FIELDS ; i++ ) {
+		to->playerFieldChanges[i] += from->playerFieldChanges[i];
+		to->playerFieldBits[i] += from->playerFieldBits[i];
+		to->entityFieldChanges[i] += from->entityFieldChanges[i];
+		to->entityFieldBits[i] += from->entityFieldBits[i];
+	}
+	for ( i = 0 ; i < MAX_TRAFFIC_TYPES ; i++ ) {
+		to->entityTypeUpdates[i] += from->entityTypeUpdates[i];
+		to->entityTypeBits[i] += from->entityTypeBits[i];
+	}
+}
+
+/*
+==================
+MSG_SortTraffic
+
+Fills order with the indexes of bits from the largest down, leaving out
+the ones that are empty, and returns how many there are
+==================
+*/
+static int MSG_SortTraffic( const double *bits, int num, int *order ) {
+	int		i, j, count, swap;
+
+	count = 0;
+	for ( i = 0 ; i < num ; i++ ) {
+		if ( bits[i] > 0 ) {
+			order[count++] = i;
+		}
+	}
+
+	// short lists, insertion sort is fine
+	for ( i = 1 ; i < count ; i++ ) {
+		swap = order[i];
+		for ( j = i ; j > 0 && bits[order[j-1]] < bits[swap] ; j-- ) {
+			order[j] = order[j-1];
+		}
+		order[j] = swap;
+	}
+
+	return count;
+}
+
+/*
+==================
+MSG_ReportTraffic
+
+Prints the largest consumers to the console, or writes everything to f
+as csv rows starting with who
+==================
+*/
+#define	TRAFFIC_REPORT_LINES	10
+void MSG_ReportTraffic( const netTraffic_t *t, const char *who, fileHandle_t f ) {
+	int			order[MAX_TRAFFIC_TYPES];
+	int			numEntityFields, numPlayerFields;
+	int			i, count;
+	double		total;
+	const char	*name;
+
+	numEntityFields = sizeof( entityStateFields ) / sizeof( entityStateFields[0] );
+	numPlayerFields = sizeof( playerStateFields ) / sizeof( playerStateFields[0] );
+
+	if ( f ) {
+		FS_Printf( f, "%s,message,all,%i,%i\n", who, t->messages, t->messageBytes );
+		FS_Printf( f, "%s,message,commands,%i,%i\n", who, t->commands, (int)( t->commandBits / 8 ) );
+		FS_Printf( f, "%s,message,download,0,%i\n", who, t->downloadBytes );
+		FS_Printf( f, "%s,message,playerstate,%i,%i\n", who, t->playerstates, (int)( t->playerstateBits / 8 ) );
+		FS_Printf( f, "%s,message,remove,%i,%i\n", who, t->entityRemoves, (int)( t->entityRemoveBits / 8 ) );
+		for ( i = 0 ; i < MAX_TRAFFIC_TYPES ; i++ ) {
+			if ( t->entityTypeUpdates[i] ) {
+				FS_Printf( f, "%s,eType,%i,%i,%i\n", who, i, t->entityTypeUpdates[i], (int)( t->entityTypeBits[i] / 8 ) );
+			}
+		}
+		for ( i = 0 ; i < numEntityFields ; i++ ) {
+			FS_Printf( f, "%s,entityState,%s,%i,%i\n", who, entityStateFields[i].name,
+				t->entityFieldChanges[i], (int)( t->entityFieldBits[i] / 8 ) );
+		}
+		for ( i = 0 ; i < numPlayerFields + 4 ; i++ ) {
+			name = i < numPlayerFields ? playerStateFields[i].name : msg_playerArrayNames[i - numPlayerFields];
+			FS_Printf( f, "%s,playerState,%s,%i,%i\n", who, name,
+				t->playerFieldChanges[i], (int)( t->playerFieldBits[i] / 8 ) );
+		}
+		return;
+	}
+
+	total = t->messageBytes > 0 ? t->messageBytes : 1;
+
+	Com_Printf( "%s: %i messages, %i bytes, %i per message\n", who, t->messages, t->messageBytes,
+		t->messages ? t->messageBytes / t->messages : 0 );
+	Com_Printf( "  commands     %8i bytes %5.1f%%\n", (int)( t->commandBits / 8 ), t->commandBits / 8 * 100 / total );
+	Com_Printf( "  download     %8i bytes %5.1f%%\n", t->downloadBytes, t->downloadBytes * 100 / total );
+	Com_Printf( "  playerstate  %8i bytes %5.1f%%\n", (int)( t->playerstateBits / 8 ), t->playerstateBits / 8 * 100 / total );
+	Com_Printf( "  removes      %8i bytes %5.1f%%\n", (int)( t->entityRemoveBits / 8 ), t->entityRemoveBits / 8 * 100 / total );
+
+	Com_Printf( "entity types:\n" );
+	count = MSG_SortTraffic( t->entityTypeBits, MAX_TRAFFIC_TYPES, order );
+	for ( i = 0 ; i < count && i < TRAFFIC_REPORT_LINES ; i++ ) {
+		Com_Printf( "  eType %-6i %8i bytes %5.1f%% %7i updates\n", order[i], (int)( t->entityTypeBits[order[i]] / 8 ),
+			t->entityTypeBits[order[i]] / 8 * 100 / total, t->entityTypeUpdates[order[i]] );
+	}
+
+	Com_Printf( "entityState fields:\n" );
+	count = MSG_SortTraffic( t->entityFieldBits, numEntityFields, order );
+	for ( i = 0 ; i < count && i < TRAFFIC_REPORT_LINES ; i++ ) {
+		Com_Printf( "  %-18s %8i bytes %5.1f%% %7i changes\n", entityStateFields[order[i]].name,
+			(int)( t->entityFieldBits[order[i]] / 8 ), t->entityFieldBits[order[i]] / 8 * 100 / total,
+			t->entityFieldChanges[order[i]] );
+	}
+
+	Com_Printf( "playerState fields:\n" );
+	count = MSG_SortTraffic( t->playerFieldBits, numPlayerFields + 4, order );
+	for ( i = 0 ; i < count && i < TRAFFIC_REPORT_LINES ; i++ ) {
+		name = order[i] < numPlayerFields ? playerStateFields[order[i]].name : msg_playerArrayNames[order[i] - numPlayerFields];
+		Com_Printf( "  %-18s %8i bytes %5.1f%% %7i changes\n", name,
+			(int)( t->playerFieldBits[order[i]] / 8 ), t->playerFieldBits[order[i]] / 8 * 100 / total,
+			t->playerFieldChanges[order[i]] );
+	}
+}
+
+//===========================================================================
+
 int msg_hData[256] = {
 250315,			// 0
 41193,			// 1
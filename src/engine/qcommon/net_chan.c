@@ -47,8 +47,6 @@ to the new value before sending out any replies.
 */
 
 
-#define	MAX_PACKETLEN			1400		// max size of a network packet
-
 #define	FRAGMENT_SIZE			(MAX_PACKETLEN - 100)
 #define	PACKET_HEADER			10			// two ints and a short
 
@@ -74,6 +72,8 @@ void Netchan_Init( int port ) {
 	showpackets = Cvar_Get ("showpackets", "0", CVAR_TEMP );
 	showdrop = Cvar_Get ("showdrop", "0", CVAR_TEMP );
 	qport = Cvar_Get ("net_qport", va("%i", port), CVAR_INIT );
+
+	NET_EmuInit();
 }
 
 /*
@@ -213,6 +213,8 @@ void Netchan_TransmitNextFragment( netchan_t *chan ) {
 
 	// send the datagram
 	NET_SendPacket( chan->sock, send.cursize, send.data, chan->remoteAddress );
+	chan->sentBytes += send.cursize;
+	chan->sentPackets++;
 
 	if ( showpackets->integer ) {
 		Com_Printf ("%s send %4i : s=%i fragment=%i,%i\n"
@@ -279,6 +281,8 @@ void Netchan_Transmit( netchan_t *chan, int length, const byte *data ) {
 
 	// send the datagram
 	NET_SendPacket( chan->sock, send.cursize, send.data, chan->remoteAddress );
+	chan->sentBytes += send.cursize;
+	chan->sentPackets++;
 
 	if ( showpackets->integer ) {
 		Com_Printf( "%s send %4i : s=%i ack=%i\n"
@@ -613,6 +617,112 @@ void NET_SendLoopPacket (netsrc_t sock, int length, const void *data, netadr_t t
 	loop->msgs[i].datalen = length;
 }
 
+/*
+=============================================================================
+
+LOCAL SNAPSHOTS
+
+The server copies the snapshots of a loopback client here instead of
+delta encoding them, and the client copies them back out when it parses
+the svc_localSnapshot in the message.  There are as many slots as there
+are loopback messages, so a snapshot can't be overwritten while the
+message pointing to it is still queued.  The entities of all the slots
+share one pool, which is large enough for that as well unless snapshots
+are unusually full, and the sequence checks catch it if they are.
+
+=============================================================================
+*/
+
+#define	MAX_LOCAL_SNAPSHOTS		MAX_LOOPBACK
+#define	MAX_LOCAL_ENTITIES		4096
+
+typedef struct {
+	localSnapshot_t	snapshots[MAX_LOCAL_SNAPSHOTS];
+	int				sequence;		// of the last allocated snapshot
+	entityState_t	entities[MAX_LOCAL_ENTITIES];
+	int				entityHead;		// ever increasing
+	qboolean		unwanted;		// the client is recording a demo
+} localSnapshots_t;
+
+static localSnapshots_t	localSnapshots;
+
+/*
+===================
+NET_AllocLocalSnapshot
+
+The entities of a snapshot are kept contiguous, skipping the end of the
+pool if they don't fit there
+===================
+*/
+localSnapshot_t *NET_AllocLocalSnapshot( int numEntities ) {
+	localSnapshots_t	*ls;
+	localSnapshot_t		*snap;
+	int					offset;
+
+	ls = &localSnapshots;
+
+	if ( numEntities < 0 || numEntities > MAX_LOCAL_ENTITIES ) {
+		Com_Error( ERR_DROP, "NET_AllocLocalSnapshot: bad numEntities %i", numEntities );
+	}
+
+	offset = ls->entityHead & ( MAX_LOCAL_ENTITIES - 1 );
+	if ( offset + numEntities > MAX_LOCAL_ENTITIES ) {
+		ls->entityHead += MAX_LOCAL_ENTITIES - offset;
+	}
+
+	ls->sequence++;
+	snap = &ls->snapshots[ls->sequence & ( MAX_LOCAL_SNAPSHOTS - 1 )];
+	snap->sequence = ls->sequence;
+	snap->numEntities = numEntities;
+	snap->firstEntity = ls->entityHead;
+	ls->entityHead += numEntities;
+
+	return snap;
+}
+
+/*
+===================
+NET_GetLocalSnapshot
+===================
+*/
+const localSnapshot_t *NET_GetLocalSnapshot( int sequence ) {
+	localSnapshot_t	*snap;
+
+	snap = &localSnapshots.snapshots[sequence & ( MAX_LOCAL_SNAPSHOTS - 1 )];
+	if ( sequence <= 0 || snap->sequence != sequence || localSnapshots.sequence - sequence >= MAX_LOCAL_SNAPSHOTS ) {
+		return NULL;
+	}
+	return snap;
+}
+
+/*
+===================
+NET_LocalSnapshotEntities
+===================
+*/
+entityState_t *NET_LocalSnapshotEntities( const localSnapshot_t *snap ) {
+	if ( localSnapshots.entityHead - snap->firstEntity > MAX_LOCAL_ENTITIES ) {
+		return NULL;
+	}
+	return &localSnapshots.entities[snap->firstEntity & ( MAX_LOCAL_ENTITIES - 1 )];
+}
+
+/*
+===================
+NET_WantLocalSnapshots
+
+A demo records the messages as they arrive, so the client asks for real
+snapshots while it is recording one
+===================
+*/
+void NET_WantLocalSnapshots( qboolean want ) {
+	localSnapshots.unwanted = want ? qfalse : qtrue;
+}
+
+qboolean NET_LocalSnapshotsWanted( void ) {
+	return localSnapshots.unwanted ? qfalse : qtrue;
+}
+
 //=============================================================================
 
 
@@ -623,6 +733,21 @@ void NET_SendPacket( netsrc_t sock, int length, const void *data, netadr_t to )
 		Com_Printf ("send packet %4i\n", length);
 	}
 
+	if ( NET_EmuSendPacket( sock, length, data, to ) ) {
+		return;		// the emulator sends it later, or loses it
+	}
+
+	NET_SendPacketNow( sock, length, data, to );
+}
+
+/*
+===============
+NET_SendPacketNow
+
+Sends without going through the network emulator
+================
+*/
+void NET_SendPacketNow( netsrc_t sock, int length, const void *data, netadr_t to ) {
 	if ( to.type == NA_LOOPBACK ) {
 		NET_SendLoopPacket (sock, length, data, to);
 		return;
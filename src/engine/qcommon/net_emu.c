@@ -0,0 +1,527 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// net_emu.c -- network condition emulation
+
+#include "../../game/q_shared.h"
+#include "qcommon.h"
+
+/*
+===============================================================================
+
+While net_emu is set every packet that goes through NET_SendPacket, to the
+loopback channel or out of a socket, passes through here first.  Packets
+the client sends use the net_emuClient profile, packets the server sends
+net_emuServer.  A profile is a list of key=value settings:
+
+latency=<msec>		one way delay
+jitter=<msec>		spread of the delay
+dist=<name>			uniform, normal or exponential delay distribution
+loss=<percent>		packets dropped
+dup=<percent>		packets sent twice
+reorder=<percent>	packets allowed to fall behind later ones
+rate=<bytes/sec>	bandwidth cap, 0 for none
+queue=<msec>		how long a packet can wait for the capped link
+
+All the decisions come from a generator seeded with net_emuSeed whenever
+the emulator is (re)configured, so the same traffic gets the same fate
+every run.  Queued packets go out from Com_EventLoop, so on a dedicated
+server the delays are only as fine as its frames.  net_emuLog names a
+file that gets a line for every packet.
+
+===============================================================================
+*/
+
+#define	MAX_EMU_PACKETS		1024
+
+typedef enum {
+	EMU_UNIFORM,
+	EMU_NORMAL,
+	EMU_EXPONENTIAL
+} emuDist_t;
+
+typedef struct {
+	int				latency;
+	int				jitter;
+	emuDist_t		dist;
+	float			loss;
+	float			dup;
+	float			reorder;
+	int				rate;
+	int				queue;
+} emuProfile_t;
+
+typedef struct {
+	emuProfile_t	profile;
+	unsigned int	seed;
+	int				linkFree;		// when the capped link has sent everything queued on it
+	int				lastDue;		// packets that aren't reordered don't overtake this
+	int				sent, dropped, duplicated, reordered, queueDropped;
+} emuDirection_t;
+
+typedef struct emuPacket_s {
+	struct emuPacket_s	*next;
+	netsrc_t			sock;
+	netadr_t			to;
+	int					sent;
+	int					due;
+	const char			*event;
+	int					length;
+	byte				data[1];
+} emuPacket_t;
+
+typedef struct {
+	qboolean		active;
+	int				startTime;
+	emuDirection_t	dirs[2];		// indexed by the sending netsrc_t
+	emuPacket_t		*queue;			// sorted by due time
+	int				numQueued;
+	fileHandle_t	log;
+} netEmu_t;
+
+static netEmu_t		emu;
+
+static cvar_t		*net_emu;
+static cvar_t		*net_emuClient;
+static cvar_t		*net_emuServer;
+static cvar_t		*net_emuSeed;
+static cvar_t		*net_emuLog;
+
+static const char	*emuDirNames[2] = { "client", "server" };
+
+/*
+==================
+NET_EmuRandom
+
+xorshift, returns [0,1)
+==================
+*/
+static float NET_EmuRandom( emuDirection_t *dir ) {
+	unsigned int	x;
+
+	x = dir->seed;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	dir->seed = x;
+
+	return ( x >> 8 ) * ( 1.0f / 16777216.0f );
+}
+
+/*
+==================
+NET_EmuChance
+==================
+*/
+static qboolean NET_EmuChance( emuDirection_t *dir, float percent ) {
+	// always draw so a setting doesn't shift the sequence of the others
+	return ( NET_EmuRandom( dir ) * 100.0f < percent ) ? qtrue : qfalse;
+}
+
+/*
+==================
+NET_EmuDelay
+
+One draw from the latency distribution
+==================
+*/
+static int NET_EmuDelay( emuDirection_t *dir ) {
+	emuProfile_t	*p;
+	float			u1, u2, delay;
+
+	p = &dir->profile;
+	u1 = NET_EmuRandom( dir );
+	u2 = NET_EmuRandom( dir );
+
+	switch ( p->dist ) {
+	case EMU_NORMAL:
+		// Box-Muller, jitter is the standard deviation
+		delay = p->latency + p->jitter * sqrt( -2.0f * log( 1.0f - u1 ) ) * cos( 2.0f * M_PI * u2 );
+		break;
+	case EMU_EXPONENTIAL:
+		// a long tail above the base latency, jitter is the mean of the tail
+		delay = p->latency - p->jitter * log( 1.0f - u1 );
+		break;
+	default:
+		delay = p->latency + p->jitter * ( 2.0f * u1 - 1.0f );
+		break;
+	}
+
+	return delay < 0 ? 0 : (int)delay;
+}
+
+/*
+==================
+NET_EmuParseProfile
+==================
+*/
+static void NET_EmuParseProfile( const char *name, const char *s, emuProfile_t *p ) {
+	char		key[32], value[32];
+	int			i;
+
+	Com_Memset( p, 0, sizeof( *p ) );
+	p->queue = 500;
+
+	while ( *s ) {
+		while ( *s == ' ' || *s == '\t' ) {
+			s++;
+		}
+		if ( !*s ) {
+			break;
+		}
+
+		for ( i = 0 ; *s && *s != '=' && *s != ' ' ; s++ ) {
+			if ( i < sizeof( key ) - 1 ) {
+				key[i++] = *s;
+			}
+		}
+		key[i] = 0;
+
+		value[0] = 0;
+		if ( *s == '=' ) {
+			s++;
+			for ( i = 0 ; *s && *s != ' ' ; s++ ) {
+				if ( i < sizeof( value ) - 1 ) {
+					value[i++] = *s;
+				}
+			}
+			value[i] = 0;
+		}
+
+		if ( !Q_stricmp( key, "latency" ) ) {
+			p->latency = atoi( value );
+		} else if ( !Q_stricmp( key, "jitter" ) ) {
+			p->jitter = atoi( value );
+		} else if ( !Q_stricmp( key, "dist" ) ) {
+			if ( !Q_stricmp( value, "normal" ) ) {
+				p->dist = EMU_NORMAL;
+			} else if ( !Q_stricmp( value, "exponential" ) ) {
+				p->dist = EMU_EXPONENTIAL;
+			} else if ( !Q_stricmp( value, "uniform" ) ) {
+				p->dist = EMU_UNIFORM;
+			} else {
+				Com_Printf( "%s: unknown distribution \"%s\"\n", name, value );
+			}
+		} else if ( !Q_stricmp( key, "loss" ) ) {
+			p->loss = atof( value );
+		} else if ( !Q_stricmp( key, "dup" ) ) {
+			p->dup = atof( value );
+		} else if ( !Q_stricmp( key, "reorder" ) ) {
+			p->reorder = atof( value );
+		} else if ( !Q_stricmp( key, "rate" ) ) {
+			p->rate = atoi( value );
+		} else if ( !Q_stricmp( key, "queue" ) ) {
+			p->queue = atoi( value );
+		} else {
+			Com_Printf( "%s: unknown setting \"%s\"\n", name, key );
+		}
+	}
+}
+
+/*
+==================
+NET_EmuSend
+
+Straight out, past the emulator
+==================
+*/
+static void NET_EmuSend( emuPacket_t *packet ) {
+	NET_SendPacketNow( packet->sock, packet->length, packet->data, packet->to );
+}
+
+/*
+==================
+NET_EmuLog
+==================
+*/
+static void NET_EmuLog( netsrc_t sock, int sent, int delivered, int length, const char *event ) {
+	if ( !emu.log ) {
+		return;
+	}
+	FS_Printf( emu.log, "%i,%i,%s,%i,%s\n", sent - emu.startTime,
+		delivered < 0 ? -1 : delivered - emu.startTime, emuDirNames[sock], length, event );
+}
+
+/*
+==================
+NET_EmuDrain
+
+Sends everything still queued right away
+==================
+*/
+static void NET_EmuDrain( void ) {
+	emuPacket_t	*packet;
+
+	while ( emu.queue ) {
+		packet = emu.queue;
+		emu.queue = packet->next;
+		NET_EmuSend( packet );
+		Z_Free( packet );
+	}
+	emu.numQueued = 0;
+}
+
+/*
+==================
+NET_EmuConfigure
+
+Called whenever one of the cvars changes
+==================
+*/
+static void NET_EmuConfigure( void ) {
+	int		i;
+
+	net_emu->modified = qfalse;
+	net_emuClient->modified = qfalse;
+	net_emuServer->modified = qfalse;
+	net_emuSeed->modified = qfalse;
+	net_emuLog->modified = qfalse;
+
+	NET_EmuDrain();
+	if ( emu.log ) {
+		FS_FCloseFile( emu.log );
+		emu.log = 0;
+	}
+
+	emu.active = net_emu->integer ? qtrue : qfalse;
+	if ( !emu.active ) {
+		return;
+	}
+
+	emu.startTime = Sys_Milliseconds();
+
+	NET_EmuParseProfile( "net_emuClient", net_emuClient->string, &emu.dirs[NS_CLIENT].profile );
+	NET_EmuParseProfile( "net_emuServer", net_emuServer->string, &emu.dirs[NS_SERVER].profile );
+
+	for ( i = 0 ; i < 2 ; i++ ) {
+		emu.dirs[i].seed = (unsigned int)net_emuSeed->integer * 2654435761u + i * 40503u + 1;
+		if ( !emu.dirs[i].seed ) {
+			emu.dirs[i].seed = 1;
+		}
+		emu.dirs[i].linkFree = emu.startTime;
+		emu.dirs[i].lastDue = emu.startTime;
+		emu.dirs[i].sent = emu.dirs[i].dropped = emu.dirs[i].duplicated = 0;
+		emu.dirs[i].reordered = emu.dirs[i].queueDropped = 0;
+	}
+
+	if ( net_emuLog->string[0] && FS_Initialized() ) {
+		emu.log = FS_FOpenFileWrite( net_emuLog->string );
+		if ( !emu.log ) {
+			Com_Printf( "WARNING: couldn't open %s\n", net_emuLog->string );
+		} else {
+			FS_Printf( emu.log, "sent_ms,delivered_ms,from,bytes,event\n" );
+		}
+	}
+}
+
+/*
+==================
+NET_EmuQueue
+==================
+*/
+static void NET_EmuQueue( netsrc_t sock, int length, const void *data, netadr_t to,
+						 int now, int due, const char *event ) {
+	emuPacket_t	*packet, **link;
+
+	if ( emu.numQueued >= MAX_EMU_PACKETS ) {
+		emu.dirs[sock].queueDropped++;
+		NET_EmuLog( sock, now, -1, length, "overflow" );
+		return;
+	}
+
+	packet = (emuPacket_t *)Z_Malloc( sizeof( *packet ) + length );
+	packet->sock = sock;
+	packet->to = to;
+	packet->sent = now;
+	packet->due = due;
+	packet->event = event;
+	packet->length = length;
+	Com_Memcpy( packet->data, data, length );
+
+	// after everything due at the same time, so equal delays keep their order
+	for ( link = &emu.queue ; *link && (*link)->due - due <= 0 ; link = &(*link)->next ) {
+	}
+	packet->next = *link;
+	*link = packet;
+	emu.numQueued++;
+}
+
+/*
+==================
+NET_EmuSendPacket
+
+Returns qfalse if the emulator is off and the packet should go out as usual
+==================
+*/
+qboolean NET_EmuSendPacket( netsrc_t sock, int length, const void *data, netadr_t to ) {
+	emuDirection_t	*dir;
+	emuProfile_t	*p;
+	int				now, due, copies, i, wait;
+	qboolean		reorder;
+	const char		*event;
+
+	if ( !net_emu ) {
+		return qfalse;
+	}
+	if ( net_emu->modified || net_emuClient->modified || net_emuServer->modified
+		|| net_emuSeed->modified || net_emuLog->modified ) {
+		NET_EmuConfigure();
+	}
+	if ( !emu.active ) {
+		return qfalse;
+	}
+	if ( to.type != NA_LOOPBACK && to.type != NA_IP && to.type != NA_IPX ) {
+		return qfalse;
+	}
+
+	dir = &emu.dirs[sock];
+	p = &dir->profile;
+	now = Sys_Milliseconds();
+	dir->sent++;
+
+	copies = NET_EmuChance( dir, p->dup ) ? 2 : 1;
+	reorder = NET_EmuChance( dir, p->reorder );
+
+	if ( NET_EmuChance( dir, p->loss ) ) {
+		dir->dropped++;
+		NET_EmuLog( sock, now, -1, length, "loss" );
+		return qtrue;
+	}
+
+	for ( i = 0 ; i < copies ; i++ ) {
+		due = now;
+
+		// wait for the link to be free and take the time the bytes need on it
+		if ( p->rate > 0 ) {
+			if ( dir->linkFree - now > 0 ) {
+				wait = dir->linkFree - now;
+				if ( wait > p->queue ) {
+					dir->queueDropped++;
+					NET_EmuLog( sock, now, -1, length, "queue" );
+					continue;
+				}
+				due = dir->linkFree;
+			}
+			due += ( length + 28 ) * 1000 / p->rate;
+			dir->linkFree = due;
+		}
+
+		due += NET_EmuDelay( dir );
+
+		// a reordered packet is held back a little further, so the ones
+		// sent after it can get by
+		if ( reorder && !i ) {
+			due += 1 + (int)( NET_EmuRandom( dir ) * ( p->jitter + 20 ) );
+		}
+
+		if ( i ) {
+			dir->duplicated++;
+			event = "dup";
+		} else if ( reorder ) {
+			dir->reordered++;
+			event = "reorder";
+		} else {
+			event = "ok";
+		}
+
+		// only a reordered packet can arrive before the ones sent earlier
+		if ( !reorder || i ) {
+			if ( dir->lastDue - due > 0 ) {
+				due = dir->lastDue;
+			}
+			dir->lastDue = due;
+		}
+
+		NET_EmuQueue( sock, length, data, to, now, due, event );
+	}
+
+	return qtrue;
+}
+
+/*
+==================
+NET_EmuFlush
+
+Sends the packets that are due
+==================
+*/
+void NET_EmuFlush( void ) {
+	emuPacket_t	*packet;
+	int			now;
+
+	if ( !emu.queue ) {
+		return;
+	}
+
+	now = Sys_Milliseconds();
+	while ( emu.queue && emu.queue->due - now <= 0 ) {
+		packet = emu.queue;
+		emu.queue = packet->next;
+		emu.numQueued--;
+
+		NET_EmuLog( packet->sock, packet->sent, now, packet->length, packet->event );
+		NET_EmuSend( packet );
+		Z_Free( packet );
+	}
+
+	if ( emu.log ) {
+		FS_Flush( emu.log );
+	}
+}
+
+/*
+==================
+NET_EmuStats_f
+==================
+*/
+static void NET_EmuStats_f( void ) {
+	emuDirection_t	*dir;
+	int				i;
+
+	if ( !emu.active ) {
+		Com_Printf( "net_emu is off\n" );
+		return;
+	}
+
+	for ( i = 0 ; i < 2 ; i++ ) {
+		dir = &emu.dirs[i];
+		Com_Printf( "%s: %i sent, %i lost, %i duplicated, %i reordered, %i dropped by the queue\n",
+			emuDirNames[i], dir->sent, dir->dropped, dir->duplicated, dir->reordered, dir->queueDropped );
+	}
+	Com_Printf( "%i packets in flight\n", emu.numQueued );
+}
+
+/*
+==================
+NET_EmuInit
+==================
+*/
+void NET_EmuInit( void ) {
+	net_emu = Cvar_Get( "net_emu", "0", CVAR_TEMP );
+	net_emuClient = Cvar_Get( "net_emuClient", "", CVAR_TEMP );
+	net_emuServer = Cvar_Get( "net_emuServer", "", CVAR_TEMP );
+	net_emuSeed = Cvar_Get( "net_emuSeed", "1", CVAR_TEMP );
+	net_emuLog = Cvar_Get( "net_emuLog", "", CVAR_TEMP );
+
+	NET_EmuConfigure();
+
+	Cmd_AddCommand( "netemu", NET_EmuStats_f );
+}
@@ -0,0 +1,346 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// profile.c -- instrumentation zones
+
+#include "../../game/q_shared.h"
+#include "qcommon.h"
+
+/*
+===============================================================================
+
+While com_profile is set, PROFILE_BEGIN and PROFILE_END record timestamped
+events into a ring buffer owned by the calling thread, so recording never
+takes a lock.  A thread gets its buffer the first time it records.  Old
+events are overwritten, so "profiledump" can only write out as far back
+as the rings reach, which com_profileEvents controls.
+
+The names are not copied, they have to be string literals or otherwise
+stay around for good.
+
+===============================================================================
+*/
+
+#define	MAX_PROFILE_THREADS		32
+
+typedef struct {
+	const char		*name;			// NULL for the end of a zone
+	int				time;			// Sys_Microseconds
+} profileEvent_t;
+
+typedef struct {
+	char				name[32];
+	int					mask;
+	int					depth;			// open zones, for unwinding after a Com_Error
+	volatile int		head;			// next event, kept below twice the ring size
+	profileEvent_t		*volatile events;
+} profileThread_t;
+
+static profileThread_t	prof_threads[MAX_PROFILE_THREADS];
+static volatile int		prof_numThreads;
+static profileThread_t	prof_noThread;	// used by everyone past MAX_PROFILE_THREADS
+
+static __declspec( thread ) profileThread_t	*prof_thread;
+
+int		com_profiling;
+
+cvar_t	*com_profile;
+cvar_t	*com_profileEvents;
+
+/*
+==================
+Com_ProfileThread
+
+Hands out the slot of the calling thread
+==================
+*/
+static profileThread_t *Com_ProfileThread( void ) {
+	profileThread_t	*t;
+	int				slot;
+
+	if ( prof_thread ) {
+		return prof_thread;
+	}
+
+	slot = Sys_AtomicAdd( &prof_numThreads, 1 ) - 1;
+	if ( slot >= MAX_PROFILE_THREADS ) {
+		prof_thread = &prof_noThread;
+		return prof_thread;
+	}
+
+	t = &prof_threads[slot];
+	Com_sprintf( t->name, sizeof( t->name ), "thread %i", slot );
+	prof_thread = t;
+	return t;
+}
+
+/*
+==================
+Com_ProfileAllocEvents
+
+The ring is only allocated once the thread records something
+==================
+*/
+static void Com_ProfileAllocEvents( profileThread_t *t ) {
+	int		count;
+
+	if ( t == &prof_noThread ) {
+		return;
+	}
+
+	// round down to a power of two for the mask
+	count = (int)Com_Clamp( 1024, 1 << 24, com_profileEvents->integer );
+	while ( count & ( count - 1 ) ) {
+		count &= count - 1;
+	}
+
+	t->mask = count - 1;
+	t->depth = 0;
+	t->head = 0;
+
+	// the dump skips threads until this is set
+	t->events = (profileEvent_t *)malloc( count * sizeof( profileEvent_t ) );
+}
+
+/*
+==================
+Com_ProfileAdvance
+
+Once the ring has been filled head stays between one and two ring sizes,
+so it never overflows and the dump can still tell a full ring from one
+that hasn't wrapped yet
+==================
+*/
+static void Com_ProfileAdvance( profileThread_t *t ) {
+	int		head;
+
+	head = t->head + 1;
+	if ( head == 2 * ( t->mask + 1 ) ) {
+		head = t->mask + 1;
+	}
+	t->head = head;
+}
+
+/*
+==================
+Com_ProfileThreadName
+
+Names the calling thread in the dumps
+==================
+*/
+void Com_ProfileThreadName( const char *name ) {
+	profileThread_t	*t;
+
+	t = Com_ProfileThread();
+	if ( t != &prof_noThread ) {
+		Q_strncpyz( t->name, name, sizeof( t->name ) );
+	}
+}
+
+/*
+==================
+Com_ProfileBegin
+==================
+*/
+void Com_ProfileBegin( const char *name ) {
+	profileThread_t	*t;
+	profileEvent_t	*ev;
+
+	if ( !com_profiling ) {
+		return;
+	}
+
+	t = Com_ProfileThread();
+	if ( !t->events ) {
+		Com_ProfileAllocEvents( t );
+		if ( !t->events ) {
+			return;
+		}
+	}
+
+	ev = &t->events[t->head & t->mask];
+	ev->name = name;
+	ev->time = Sys_Microseconds();
+	t->depth++;
+	Com_ProfileAdvance( t );
+}
+
+/*
+==================
+Com_ProfileEnd
+==================
+*/
+void Com_ProfileEnd( void ) {
+	profileThread_t	*t;
+	profileEvent_t	*ev;
+
+	if ( !com_profiling ) {
+		return;
+	}
+
+	t = Com_ProfileThread();
+	if ( !t->events || !t->depth ) {
+		return;		// recording started inside the zone
+	}
+
+	ev = &t->events[t->head & t->mask];
+	ev->name = NULL;
+	ev->time = Sys_Microseconds();
+	t->depth--;
+	Com_ProfileAdvance( t );
+}
+
+/*
+==================
+Com_ProfileUnwind
+
+Closes the zones a longjmp skipped the ends of
+==================
+*/
+void Com_ProfileUnwind( void ) {
+	profileThread_t	*t;
+
+	t = prof_thread;
+	if ( !t ) {
+		return;
+	}
+	while ( t->depth > 0 && com_profiling ) {
+		Com_ProfileEnd();
+	}
+	t->depth = 0;
+}
+
+/*
+==================
+Com_ProfileFrame
+
+Called at the start of every Com_Frame
+==================
+*/
+void Com_ProfileFrame( void ) {
+	com_profiling = com_profile->integer;
+}
+
+/*
+==================
+Com_ProfileDump_f
+
+profiledump [seconds] [file]
+==================
+*/
+void Com_ProfileDump_f( void ) {
+	profileThread_t	*t;
+	profileEvent_t	*ev;
+	fileHandle_t	f;
+	char			filename[MAX_QPATH];
+	int				window, now, age;
+	int				i, numThreads, head, first, e;
+	int				wasProfiling;
+	qboolean		comma;
+
+	if ( Cmd_Argc() > 3 ) {
+		Com_Printf( "usage: profiledump [seconds] [file]\n" );
+		return;
+	}
+
+	window = Cmd_Argc() > 1 ? atoi( Cmd_Argv( 1 ) ) : 5;
+	window = (int)Com_Clamp( 1, 600, window ) * 1000000;
+
+	if ( Cmd_Argc() > 2 ) {
+		Q_strncpyz( filename, Cmd_Argv( 2 ), sizeof( filename ) );
+	} else {
+		Q_strncpyz( filename, "profile.json", sizeof( filename ) );
+	}
+	COM_DefaultExtension( filename, sizeof( filename ), ".json" );
+
+	f = FS_FOpenFileWrite( filename );
+	if ( !f ) {
+		Com_Printf( "couldn't open %s\n", filename );
+		return;
+	}
+
+	// other threads only check the flag when they start an event, so a
+	// ring can still move a little while it is written out, which at
+	// worst loses a few events at the oldest end
+	wasProfiling = com_profiling;
+	com_profiling = 0;
+
+	now = Sys_Microseconds();
+	numThreads = prof_numThreads;
+	if ( numThreads > MAX_PROFILE_THREADS ) {
+		numThreads = MAX_PROFILE_THREADS;
+	}
+
+	FS_Printf( f, "{\"traceEvents\":[\n" );
+	comma = qfalse;
+
+	for ( i = 0, t = prof_threads ; i < numThreads ; i++, t++ ) {
+		if ( !t->events ) {
+			continue;
+		}
+
+		FS_Printf( f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%i,\"args\":{\"name\":\"%s\"}}",
+			comma ? ",\n" : "", i, t->name );
+		comma = qtrue;
+
+		head = t->head;
+		first = head > t->mask ? head - ( t->mask + 1 ) : 0;
+
+		for ( e = first ; e < head ; e++ ) {
+			ev = &t->events[e & t->mask];
+
+			// the subtraction keeps working across a Sys_Microseconds wrap
+			age = now - ev->time;
+			if ( age < 0 || age > window ) {
+				continue;
+			}
+
+			if ( ev->name ) {
+				FS_Printf( f, ",\n{\"name\":\"%s\",\"ph\":\"B\",\"pid\":1,\"tid\":%i,\"ts\":%i}",
+					ev->name, i, window - age );
+			} else {
+				FS_Printf( f, ",\n{\"ph\":\"E\",\"pid\":1,\"tid\":%i,\"ts\":%i}",
+					i, window - age );
+			}
+		}
+	}
+
+	FS_Printf( f, "\n]}\n" );
+	FS_FCloseFile( f );
+
+	com_profiling = wasProfiling;
+
+	Com_Printf( "wrote %s\n", filename );
+}
+
+/*
+==================
+Com_InitProfile
+==================
+*/
+void Com_InitProfile( void ) {
+	com_profile = Cvar_Get( "com_profile", "0", 0 );
+	com_profileEvents = Cvar_Get( "com_profileEvents", "262144", CVAR_ARCHIVE | CVAR_LATCH );
+
+	Com_ProfileThreadName( "main" );
+
+	Cmd_AddCommand( "profiledump", Com_ProfileDump_f );
+}
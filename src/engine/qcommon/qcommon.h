@@ -98,12 +98,43 @@ void MSG_WriteDeltaEntity( msg_t *msg, struct entityState_s *from, struct entity
 void MSG_ReadDeltaEntity( msg_t *msg, entityState_t *from, entityState_t *to, 
 						 int number );
 
+void MSG_WriteEntityList( msg_t *msg, entityState_t *from, int numFrom, entityState_t *to, int numTo,
+						 entityState_t *baselines );
+int MSG_ReadEntityList( msg_t *msg, entityState_t *from, int numFrom, entityState_t *to, int maxTo,
+					   entityState_t *baselines );
+
 void MSG_WriteDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct playerState_s *to );
 void MSG_ReadDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct playerState_s *to );
 
 
 void MSG_ReportChangeVectors_f( void );
 
+// traffic accounting, the delta writers add to the target while one is set
+#define	MAX_TRAFFIC_FIELDS	64
+#define	MAX_TRAFFIC_TYPES	256		// entityState_t->eType, masked
+
+typedef struct {
+	int		messages;
+	int		messageBytes;
+	int		commands;
+	double	commandBits;
+	int		downloadBytes;
+	int		playerstates;
+	double	playerstateBits;
+	int		playerFieldChanges[MAX_TRAFFIC_FIELDS];	// the arrays follow the field list
+	double	playerFieldBits[MAX_TRAFFIC_FIELDS];
+	int		entityRemoves;
+	double	entityRemoveBits;
+	int		entityTypeUpdates[MAX_TRAFFIC_TYPES];
+	double	entityTypeBits[MAX_TRAFFIC_TYPES];
+	int		entityFieldChanges[MAX_TRAFFIC_FIELDS];
+	double	entityFieldBits[MAX_TRAFFIC_FIELDS];
+} netTraffic_t;
+
+netTraffic_t *MSG_SetTraffic( netTraffic_t *traffic );
+void MSG_AddTraffic( netTraffic_t *to, const netTraffic_t *from );
+void MSG_ReportTraffic( const netTraffic_t *traffic, const char *who, fileHandle_t f );
+
 //============================================================================
 
 /*
@@ -154,6 +185,7 @@ void		NET_Restart( void );
 void		NET_Config( qboolean enableNetworking );
 
 void		NET_SendPacket (netsrc_t sock, int length, const void *data, netadr_t to);
+void		NET_SendPacketNow( netsrc_t sock, int length, const void *data, netadr_t to );	// skips the emulator
 void		QDECL NET_OutOfBandPrint( netsrc_t net_socket, netadr_t adr, const char *format, ...);
 void		QDECL NET_OutOfBandData( netsrc_t sock, netadr_t adr, byte *format, int len );
 
@@ -163,13 +195,40 @@ qboolean	NET_IsLocalAddress (netadr_t adr);
 const char	*NET_AdrToString (netadr_t a);
 qboolean	NET_StringToAdr ( const char *s, netadr_t *a);
 qboolean	NET_GetLoopPacket (netsrc_t sock, netadr_t *net_from, msg_t *net_message);
+
+// network condition emulation, see net_emu.c
+void		NET_EmuInit( void );
+qboolean	NET_EmuSendPacket( netsrc_t sock, int length, const void *data, netadr_t to );
+void		NET_EmuFlush( void );
+
+// snapshots for a listen server's own client skip the bitstream, the
+// message only carries svc_localSnapshot and the sequence to find them by
+typedef struct {
+	int				sequence;
+	int				serverTime;
+	int				snapFlags;
+	int				areabytes;
+	byte			areabits[MAX_MAP_AREA_BYTES];
+	playerState_t	ps;
+	int				numEntities;
+	int				firstEntity;		// ever increasing, into the entity pool
+} localSnapshot_t;
+
+localSnapshot_t	*NET_AllocLocalSnapshot( int numEntities );
+const localSnapshot_t	*NET_GetLocalSnapshot( int sequence );	// NULL once overwritten
+entityState_t	*NET_LocalSnapshotEntities( const localSnapshot_t *snap );	// NULL once overwritten
+void		NET_WantLocalSnapshots( qboolean want );
+qboolean	NET_LocalSnapshotsWanted( void );
 void		NET_Sleep(int msec);
 
 
 #define	MAX_MSGLEN				16384		// max length of a message, which may
 											// be fragmented into multiple packets
 
-#define MAX_DOWNLOAD_WINDOW			8		// max of eight download frames
+#define	MAX_PACKETLEN			1400		// max size of a network packet
+
+#define MAX_DOWNLOAD_WINDOW			48		// max blocks in flight, every one costs the client
+											// a reliable command to acknowledge
 #define MAX_DOWNLOAD_BLKSIZE		2048	// 2048 byte block chunks
  
 
@@ -200,6 +259,10 @@ typedef struct {
 	int			unsentFragmentStart;
 	int			unsentLength;
 	byte		unsentBuffer[MAX_MSGLEN];
+
+	// ever increasing totals for rate control
+	int			sentBytes;
+	int			sentPackets;
 } netchan_t;
 
 void Netchan_Init( int qport );
@@ -259,9 +322,33 @@ enum svc_ops_e {
 	svc_serverCommand,			// [string] to be executed by client game module
 	svc_download,				// [short] size [size bytes]
 	svc_snapshot,
-	svc_EOF
+	svc_EOF,
+
+	// only sent through loopback, never recorded in demos
+	svc_localSnapshot			// [long] sequence for NET_GetLocalSnapshot
 };
 
+//
+// server demos, see sv_demo.c
+//
+#define	SVDEMO_EXTENSION	"svdm_"
+#define	SVDEMO_MSGLEN		0x20000		// the first frame of a full server fits easily
+
+enum svd_ops_e {
+	svd_bad,
+	svd_EOF,
+	svd_gamestate,				// [long] maxclients [long] checksumFeed, then configstrings and baselines up to svd_EOF
+	svd_configstring,			// [short] [string]
+	svd_baseline,				// only in the gamestate
+	svd_serverCommand,			// [byte] client or 255 for everyone [string]
+	svd_frame					// [long] time [byte] snapFlags, playerstates, entities, visibility
+};
+
+// who sees the entities of an svd_frame that aren't sent to everyone
+#define	SVDEMO_VIS_SINGLE		1		// only singleClient
+#define	SVDEMO_VIS_NOTSINGLE	2		// everyone but singleClient
+#define	SVDEMO_VIS_MASK			3		// the clients in the singleClient bits
+
 
 //
 // client to server
@@ -545,7 +632,10 @@ fileHandle_t	FS_FOpenFileWrite( const char *qpath );
 int		FS_filelength( fileHandle_t f );
 fileHandle_t FS_SV_FOpenFileWrite( const char *filename );
 int		FS_SV_FOpenFileRead( const char *filename, fileHandle_t *fp );
+const byte	*FS_SV_MapFile( const char *filename, int *length );
+// maps a file outside of the pk3s read only, NULL if it can't, release with Sys_UnmapFile
 void	FS_SV_Rename( const char *from, const char *to );
+void	FS_SV_Remove( const char *filename );
 int		FS_FOpenFileRead( const char *qpath, fileHandle_t *file, qboolean uniqueFILE );
 // if uniqueFILE is true, then a new FILE will be fopened even if the file
 // is found in an already open pak file.  If uniqueFILE is false, you must call
@@ -576,6 +666,13 @@ int		FS_ReadFile( const char *qpath, void **buffer );
 void	FS_ForceFlush( fileHandle_t f );
 // forces flush on files we're writing to.
 
+void	FS_WriteAsync( fileHandle_t f );
+// hands the writes to a file opened for writing to the writer thread, call
+// it right after opening.  Does nothing with fs_asyncWrites 0.
+
+void	FS_ShutdownAsyncWrites( void );
+// writes out everything queued and stops the writer thread
+
 void	FS_FreeFile( void *buffer );
 // frees the memory returned by FS_ReadFile
 
@@ -675,6 +772,8 @@ extern char cl_cdkey[34];
 
 // returnbed by Sys_GetProcessorId
 #define CPUID_GENERIC			0			// any unrecognized processor
+#define CPUID_SSE2				1
+#define CPUID_AVX2				2			// with the OS saving the ymm registers
 
 // TTimo
 // centralized and cleaned, that's the max string you can send to a Com_Printf / Com_DPrintf (above gets truncated)
@@ -802,6 +901,64 @@ void Com_Init( char *commandLine );
 void Com_Frame( void );
 void Com_Shutdown( void );
 
+//
+// jobs.c
+//
+#define	MAX_JOB_THREADS		16		// including the main thread
+
+// thread is 0 for the main thread and 1..Com_JobThreadCount()-1 for workers,
+// so callers can keep per-thread scratch memory
+typedef void (*jobFunc_t)( void *data, int index, int thread );
+
+// counts jobs that haven't finished yet, start it at zero
+typedef struct {
+	volatile int	count;
+} jobCounter_t;
+
+void	Com_InitJobs( void );
+void	Com_ShutdownJobs( void );
+int		Com_JobThreadCount( void );
+
+void	Com_AddJob( jobFunc_t func, void *data, int index, jobCounter_t *counter );
+void	Com_WaitJobs( jobCounter_t *counter );
+// queues func( data, index, thread ) and counts it against counter, which
+// may be NULL.  Com_WaitJobs runs queued jobs itself until the counter is
+// back at zero, so jobs can add jobs and wait for them.
+
+void	Com_ParallelFor( jobFunc_t func, void *data, int count );
+// runs func for every index in [0, count) on the worker threads and the
+// calling thread, returns when all of them are done.
+
+// Jobs must only be added and waited on from the main thread and from
+// other jobs, the thread numbers mean nothing anywhere else.  Job functions
+// must not use the zone, hunk, console or Com_Error, all of which are main
+// thread only.
+
+//
+// profile.c
+//
+// build with PROFILE_ZONES 0 to compile all of the zones out
+#ifndef PROFILE_ZONES
+#define	PROFILE_ZONES		1
+#endif
+
+#if PROFILE_ZONES
+#define	PROFILE_BEGIN( name )	do { if ( com_profiling ) Com_ProfileBegin( name ); } while ( 0 )
+#define	PROFILE_END()			do { if ( com_profiling ) Com_ProfileEnd(); } while ( 0 )
+#else
+#define	PROFILE_BEGIN( name )
+#define	PROFILE_END()
+#endif
+
+extern	int		com_profiling;
+
+void	Com_InitProfile( void );
+void	Com_ProfileFrame( void );
+void	Com_ProfileBegin( const char *name );	// name is kept, not copied
+void	Com_ProfileEnd( void );
+void	Com_ProfileUnwind( void );
+void	Com_ProfileThreadName( const char *name );
+
 
 /*
 ==============================================================
@@ -955,6 +1112,7 @@ void	Sys_Print( const char *msg );
 // Sys_Milliseconds should only be used for profiling purposes,
 // any game related timing information should come from event timestamps
 int		Sys_Milliseconds (void);
+int		Sys_Microseconds( void );	// wraps, only use differences
 
 void	Sys_SnapVector( float *v );
 
@@ -999,6 +1157,36 @@ void	Sys_EndProfiling( void );
 qboolean Sys_LowPhysicalMemory();
 unsigned int Sys_ProcessorCount();
 
+// threads and synchronization, handles are opaque to the caller
+void	*Sys_CreateThread( void (*func)( void *arg ), void *arg );
+void	Sys_JoinThread( void *thread );
+void	Sys_Yield( void );
+void	Sys_Sleep( int msec );
+
+void	*Sys_CreateMutex( void );
+void	Sys_DestroyMutex( void *mutex );
+void	Sys_LockMutex( void *mutex );
+void	Sys_UnlockMutex( void *mutex );
+
+void	*Sys_CreateSemaphore( int initialCount );
+void	Sys_DestroySemaphore( void *sem );
+void	Sys_PostSemaphore( void *sem, int count );
+void	Sys_WaitSemaphore( void *sem );
+
+int		Sys_AtomicAdd( volatile int *value, int add );	// returns the new value
+int		Sys_AtomicCompareExchange( volatile int *value, int exchange, int comparand );	// returns the old value
+
+// named memory shared with other processes on the same machine
+void	*Sys_OpenSharedMemory( const char *name, int size, qboolean *created );
+void	Sys_CloseSharedMemory( void *shm );
+void	*Sys_FindSharedMemory( const char *name );	// NULL if nobody has created it
+void	*Sys_MapSharedMemory( void *shm, qboolean writable );
+void	Sys_UnmapSharedMemory( void *view );
+
+// read only views of whole files
+const void	*Sys_MapFile( const char *ospath, int *length );	// NULL if missing or empty
+void	Sys_UnmapFile( const void *data );
+
 int Sys_MonkeyShouldBeSpanked( void );
 
 /* This is based on the Adaptive Huffman algorithm described in Sayood's Data
@@ -4291,15 +4291,17 @@ int inflateSyncPoint(z_streamp z)
 }
 #endif
 
+// inflate state comes from the C heap, not the zone, because the music
+// streamer reads from pk3 files on its own thread
 voidp zcalloc (voidp opaque, unsigned items, unsigned size)
 {
     if (opaque) items += size - size; /* make compiler happy */
-    return (voidp)Z_Malloc(items*size);
+    return (voidp)calloc(items, size);
 }
 
 void  zcfree (voidp opaque, voidp ptr)
 {
-    Z_Free(ptr);
+    free(ptr);
     if (opaque) return; /* make compiler happy */
 }
 
@@ -598,6 +598,9 @@ intptr_t	QDECL VM_Call( vm_t *vm, int callnum, ... ) {
 	  Com_Printf( "VM_Call( %i )\n", callnum );
 	}
 
+	// vm_t lives in a static table, so its name can be kept
+	PROFILE_BEGIN( vm->name );
+
 	// if we have a dll loaded, call it directly
 	if ( vm->entryPoint ) {
 		//rcg010207 -  see dissertation at top of VM_DllSyscall() in this file.
@@ -628,6 +631,8 @@ intptr_t	QDECL VM_Call( vm_t *vm, int callnum, ... ) {
 		r = VM_CallInterpreted( vm, &a.callnum );
 	}
 
+	PROFILE_END();
+
 	if ( oldVM != NULL ) // bk001220 - assert(currentVM!=NULL) for oldVM==NULL
 	  currentVM = oldVM;
 	return r;
@@ -1116,7 +1116,8 @@ smp extensions, or asynchronously by another thread.
 void RB_ExecuteRenderCommands( const void *data ) {
 	int		t1, t2;
 
-	t1 = ri.Milliseconds ();
+	PROFILE_BEGIN( "RB_ExecuteRenderCommands" );
+	t1 = ri.Microseconds ();
 
 	if ( !r_smp->integer || data == backEndData[0]->commands.cmds ) {
 		backEnd.smpFrame = 0;
@@ -1153,8 +1154,8 @@ void RB_ExecuteRenderCommands( const void *data ) {
 		case RC_END_OF_LIST:
 		default:
 			// stop rendering on this thread
-			t2 = ri.Milliseconds ();
-			backEnd.pc.msec = t2 - t1;
+			t2 = ri.Microseconds ();
+			backEnd.pc.usec = t2 - t1;
 
 			// VULKAN
 			// DX12
@@ -1163,6 +1164,7 @@ void RB_ExecuteRenderCommands( const void *data ) {
 				dx_end_frame();
 			}
 
+			PROFILE_END();
 			return;
 		}
 	}
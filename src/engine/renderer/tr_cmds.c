@@ -370,10 +370,10 @@ void RE_BeginFrame( stereoFrame_t stereoFrame ) {
 =============
 RE_EndFrame
 
-Returns the number of msec spent in the back end
+Returns the number of usec spent in the front and back end
 =============
 */
-void RE_EndFrame( int *frontEndMsec, int *backEndMsec ) {
+void RE_EndFrame( int *frontEndUsec, int *backEndUsec ) {
 	swapBuffersCommand_t	*cmd;
 
 	if ( !tr.registered ) {
@@ -391,13 +391,13 @@ void RE_EndFrame( int *frontEndMsec, int *backEndMsec ) {
 	// may still be rendering into the current ones
 	R_ToggleSmpFrame();
 
-	if ( frontEndMsec ) {
-		*frontEndMsec = tr.frontEndMsec;
+	if ( frontEndUsec ) {
+		*frontEndUsec = tr.frontEndUsec;
 	}
-	tr.frontEndMsec = 0;
-	if ( backEndMsec ) {
-		*backEndMsec = backEnd.pc.msec;
+	tr.frontEndUsec = 0;
+	if ( backEndUsec ) {
+		*backEndUsec = backEnd.pc.usec;
 	}
-	backEnd.pc.msec = 0;
+	backEnd.pc.usec = 0;
 }
 
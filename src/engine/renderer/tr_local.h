@@ -822,7 +822,7 @@ typedef struct {
 	int		c_dlightVertexes;
 	int		c_dlightIndexes;
 
-	int		msec;			// total msec for backend run
+	int		usec;			// total usec for backend run
 } backEndCounters_t;
 
 // all state modified by the back end is seperated
@@ -901,7 +901,7 @@ typedef struct {
 	vec3_t					sunDirection;
 
 	frontEndCounters_t		pc;
-	int						frontEndMsec;		// not in pc due to clearing issue
+	int						frontEndUsec;		// not in pc due to clearing issue
 
 	//
 	// put large tables at the end, so most elements will be
@@ -1546,7 +1546,7 @@ void RE_SetColor( const float *rgba );
 void RE_StretchPic ( float x, float y, float w, float h, 
 					  float s1, float t1, float s2, float t2, qhandle_t hShader );
 void RE_BeginFrame( stereoFrame_t stereoFrame );
-void RE_EndFrame( int *frontEndMsec, int *backEndMsec );
+void RE_EndFrame( int *frontEndUsec, int *backEndUsec );
 void SaveJPG(char * filename, int quality, int image_width, int image_height, unsigned char *image_buffer);
 
 // font stuff
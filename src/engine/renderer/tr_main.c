@@ -1530,6 +1530,8 @@ void R_RenderView (viewParms_t *parms) {
 		return;
 	}
 
+	PROFILE_BEGIN( "R_RenderView" );
+
 	tr.viewCount++;
 
 	tr.viewParms = *parms;
@@ -1550,6 +1552,8 @@ void R_RenderView (viewParms_t *parms) {
 
 	// draw main system development information (surface outlines, etc)
 	R_DebugGraphics();
+
+	PROFILE_END();
 }
 
 
@@ -80,7 +80,7 @@ typedef struct {
 	void	(*BeginFrame)( stereoFrame_t stereoFrame );
 
 	// if the pointers are not NULL, timing info will be returned
-	void	(*EndFrame)( int *frontEndMsec, int *backEndMsec );
+	void	(*EndFrame)( int *frontEndUsec, int *backEndUsec );
 
 
 	int		(*MarkFragments)( int numPoints, const vec3_t *points, const vec3_t projection,
@@ -113,6 +113,9 @@ typedef struct {
 	// for anything game related.  Get time from the refdef
 	int		(*Milliseconds)( void );
 
+	// unscaled, wraps, only use differences
+	int		(*Microseconds)( void );
+
 	// stack based memory allocation for per-level things that
 	// won't be freed
 #ifdef HUNK_DEBUG
@@ -134,16 +134,17 @@ typedef struct client_s {
 
 	// downloading
 	char			downloadName[MAX_QPATH]; // if not empty string, we are downloading
-	fileHandle_t	download;			// file being downloaded
+	const byte		*download;			// file being downloaded, mapped read only
  	int				downloadSize;		// total bytes (can't use EOF because of paks)
- 	int				downloadCount;		// bytes sent
 	int				downloadClientBlock;	// last block we sent to the client, awaiting ack
-	int				downloadCurrentBlock;	// current block number
 	int				downloadXmitBlock;	// last block we xmited
-	unsigned char	*downloadBlocks[MAX_DOWNLOAD_WINDOW];	// the buffers for the download blocks
-	int				downloadBlockSize[MAX_DOWNLOAD_WINDOW];
-	qboolean		downloadEOF;		// We have sent the EOF block
 	int				downloadSendTime;	// time we last got an ack from the client
+	int				downloadWindow;		// blocks allowed in flight, grows with acks
+	int				downloadThreshold;	// window size where slow start ends
+	int				downloadAcks;		// acks counted toward growing the window
+	int				downloadTokens;		// bytes the download rate allows right now
+	int				downloadTokenTime;	// svs.time downloadTokens was last filled
+	int				downloadMsgBytes;	// download bytes in the message being built
 
 	int				deltaMessage;		// frame last client usercmd message
 	int				nextReliableTime;	// svs.time when another reliable command will be allowed
@@ -151,11 +152,18 @@ typedef struct client_s {
 	int				lastConnectTime;	// svs.time when connection started
 	int				nextSnapshotTime;	// send another snapshot when svs.time >= nextSnapshotTime
 	qboolean		rateDelayed;		// true if nextSnapshotTime was set based on rate instead of snapshotMsec
+	qboolean		localSnapshots;		// the last snapshot went through NET_AllocLocalSnapshot
 	int				timeoutCount;		// must timeout a few frames in a row so debugging doesn't break
 	clientSnapshot_t	frames[PACKET_BACKUP];	// updates can be delta'd from here
 	int				ping;
 	int				rate;				// bytes / second
+	int				rateBytes;			// bytes the rate allows right now, negative when behind
+	int				rateTime;			// svs.time rateBytes was last filled
+	int				rateSentBytes;		// netchan totals rateBytes has been charged for
+	int				rateSentPackets;
 	int				snapshotMsec;		// requests a snapshot every snapshotMsec unless rate choked
+	netTraffic_t	traffic;			// what the snapshots carried while sv_traffic was set
+	float			entityPriority[MAX_GENTITIES];	// builds up while a changed entity is left out of snapshots
 	int				pureAuthentic;
 	qboolean  gotCP; // TTimo - additional flag to distinguish between a bad pure checksum, and no cp command at all
 	netchan_t		netchan;
@@ -187,6 +195,18 @@ typedef struct {
 } challenge_t;
 
 
+// getstatus and getinfo are rate limited per address, a flood from
+// more addresses than this just makes them share buckets
+#define	MAX_QUERY_BUCKETS	1024
+#define	QUERY_BUCKET_PROBES	4
+
+typedef struct {
+	netadr_t	adr;
+	int			tokens;				// thousandths of a query
+	int			time;				// Sys_Milliseconds of the last fill
+} queryBucket_t;
+
+
 #define	MAX_MASTERS	8				// max recipients for heartbeat packets
 
 
@@ -204,6 +224,8 @@ typedef struct {
 	entityState_t	*snapshotEntities;		// [numSnapshotEntities]
 	int			nextHeartbeatTime;
 	challenge_t	challenges[MAX_CHALLENGES];	// to prevent invalid IPs from connecting
+	queryBucket_t	queryBuckets[MAX_QUERY_BUCKETS];	// to keep status floods cheap
+	netTraffic_t	trafficDropped;			// traffic of clients that have left
 	netadr_t	redirectAddress;			// for rcon return messages
 
 	netadr_t	authorizeAddress;			// for rcon return messages
@@ -223,6 +245,13 @@ extern	cvar_t	*sv_zombietime;
 extern	cvar_t	*sv_rconPassword;
 extern	cvar_t	*sv_privatePassword;
 extern	cvar_t	*sv_allowDownload;
+extern	cvar_t	*sv_dlRate;
+extern	cvar_t	*sv_dlWindow;
+extern	cvar_t	*sv_queryRate;
+extern	cvar_t	*sv_queryBurst;
+extern	cvar_t	*sv_localSnapshots;
+extern	cvar_t	*sv_snapshotBudget;
+extern	cvar_t	*sv_traffic;
 extern	cvar_t	*sv_maxclients;
 
 extern	cvar_t	*sv_privateClients;
@@ -341,6 +370,39 @@ int			SV_BotGetConsoleMessage( int client, char *buf, int size );
 int BotImport_DebugPolygonCreate(int color, int numPoints, vec3_t *points);
 void BotImport_DebugPolygonDelete(int id);
 
+//
+// sv_demo.c
+//
+void		SV_DemoRecord_f( void );
+void		SV_DemoStopRecord_f( void );
+void		SV_DemoStop( void );
+void		SV_DemoConfigstring( int index );
+void		SV_DemoServerCommand( int clientNum, const char *cmd );
+void		SV_DemoFrame( void );
+
+//
+// sv_profile.c
+//
+typedef enum {
+	SVP_BOTS,
+	SVP_PINGS,
+	SVP_GAME,
+	SVP_TIMEOUTS,
+	SVP_BUILD,			// SV_BuildClientSnapshot
+	SVP_WRITE,			// encoding the rest of the snapshot message
+	SVP_SEND,			// netchan and fragments
+	SVP_DEMO,			// SV_DemoFrame
+	SVP_HEARTBEAT,
+	SVP_FRAME,			// the whole of SV_Frame
+	SVP_NUM_PHASES
+} svPhase_t;
+
+void		SV_ProfileInit( void );
+int			SV_ProfileBegin( void );
+void		SV_ProfileEnd( svPhase_t phase, int start );
+void		SV_ProfileEndFrame( void );
+void		SV_Profile_f( void );
+
 //============================================================
 //
 // high level object sorting to reduce interaction tests
@@ -557,6 +557,14 @@ void SV_BotInitBotLib(void) {
 	botlib_import.DebugPolygonCreate = BotImport_DebugPolygonCreate;
 	botlib_import.DebugPolygonDelete = BotImport_DebugPolygonDelete;
 
+#if PROFILE_ZONES
+	botlib_import.ProfileBegin = Com_ProfileBegin;
+	botlib_import.ProfileEnd = Com_ProfileEnd;
+#else
+	botlib_import.ProfileBegin = NULL;
+	botlib_import.ProfileEnd = NULL;
+#endif
+
 	botlib_export = (botlib_export_t *)GetBotLibAPI( BOTLIB_API_VERSION, &botlib_import );
 	assert(botlib_export); 	// bk001129 - somehow we end up with a zero import.
 }
@@ -691,6 +691,90 @@ static void SV_DumpUser_f( void ) {
 }
 
 
+/*
+==================
+SV_TrafficReport_f
+
+trafficreport [client|all] [file]
+==================
+*/
+static void SV_TrafficReport_f( void ) {
+	netTraffic_t	total;
+	client_t		*cl;
+	fileHandle_t	f;
+	char			filename[MAX_QPATH];
+	int				i;
+
+	// make sure server is running
+	if ( !com_sv_running->integer ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	if ( Cmd_Argc() > 3 ) {
+		Com_Printf( "Usage: trafficreport [client|all] [file]\n" );
+		return;
+	}
+
+	if ( !sv_traffic->integer ) {
+		Com_Printf( "sv_traffic is off\n" );
+	}
+
+	f = 0;
+	if ( Cmd_Argc() > 2 ) {
+		Q_strncpyz( filename, Cmd_Argv( 2 ), sizeof( filename ) );
+		COM_DefaultExtension( filename, sizeof( filename ), ".csv" );
+		f = FS_FOpenFileWrite( filename );
+		if ( !f ) {
+			Com_Printf( "couldn't open %s\n", filename );
+			return;
+		}
+		FS_Printf( f, "client,section,name,count,bytes\n" );
+	}
+
+	if ( Cmd_Argc() > 1 && Q_stricmp( Cmd_Argv( 1 ), "all" ) ) {
+		cl = SV_GetPlayerByNum();
+		if ( cl ) {
+			MSG_ReportTraffic( &cl->traffic, va( "%i", (int)( cl - svs.clients ) ), f );
+		}
+	} else {
+		total = svs.trafficDropped;
+		for ( i = 0, cl = svs.clients ; i < sv_maxclients->integer ; i++, cl++ ) {
+			if ( !cl->state ) {
+				continue;
+			}
+			if ( f ) {
+				MSG_ReportTraffic( &cl->traffic, va( "%i", i ), f );
+			}
+			MSG_AddTraffic( &total, &cl->traffic );
+		}
+		MSG_ReportTraffic( &total, "all", f );
+	}
+
+	if ( f ) {
+		FS_FCloseFile( f );
+		Com_Printf( "wrote %s\n", filename );
+	}
+}
+
+/*
+==================
+SV_TrafficReset_f
+==================
+*/
+static void SV_TrafficReset_f( void ) {
+	int		i;
+
+	if ( !com_sv_running->integer ) {
+		return;
+	}
+
+	Com_Memset( &svs.trafficDropped, 0, sizeof( svs.trafficDropped ) );
+	for ( i = 0 ; i < sv_maxclients->integer ; i++ ) {
+		Com_Memset( &svs.clients[i].traffic, 0, sizeof( svs.clients[i].traffic ) );
+	}
+}
+
 /*
 =================
 SV_KillServer
@@ -733,6 +817,11 @@ void SV_AddOperatorCommands( void ) {
 	Cmd_AddCommand ("spdevmap", SV_Map_f);
 #endif
 	Cmd_AddCommand ("killserver", SV_KillServer_f);
+	Cmd_AddCommand ("svprofile", SV_Profile_f);
+	Cmd_AddCommand ("trafficreport", SV_TrafficReport_f);
+	Cmd_AddCommand ("trafficreset", SV_TrafficReset_f);
+	Cmd_AddCommand ("svrecord", SV_DemoRecord_f);
+	Cmd_AddCommand ("svstoprecord", SV_DemoStopRecord_f);
 	if( com_dedicated->integer ) {
 		Cmd_AddCommand ("say", SV_ConSay_f);
 	}
@@ -492,17 +492,16 @@ void SV_DropClient( client_t *drop, const char *reason ) {
 	// Kill any download
 	SV_CloseDownload( drop );
 
+	// keep the traffic for the server totals
+	MSG_AddTraffic( &svs.trafficDropped, &drop->traffic );
+	Com_Memset( &drop->traffic, 0, sizeof( drop->traffic ) );
+
 	// tell everyone why they got dropped
 	SV_SendServerCommand( NULL, "print \"%s" S_COLOR_WHITE " %s\n\"", drop->name, reason );
 
 	Com_DPrintf( "Going to CS_ZOMBIE for %s\n", drop->name );
 	drop->state = CS_ZOMBIE;		// become free in a few seconds
 
-	if (drop->download)	{
-		FS_FCloseFile( drop->download );
-		drop->download = 0;
-	}
-
 	// call the prog function for removing a client
 	// this will remove the body, among other things
 	VM_Call( gvm, GAME_CLIENT_DISCONNECT, drop - svs.clients );
@@ -649,23 +648,88 @@ clear/free any download vars
 ==================
 */
 static void SV_CloseDownload( client_t *cl ) {
-	int i;
-
 	// EOF
 	if (cl->download) {
-		FS_FCloseFile( cl->download );
+		Sys_UnmapFile( cl->download );
 	}
-	cl->download = 0;
+	cl->download = NULL;
 	*cl->downloadName = 0;
+}
 
-	// Free the temporary buffer space
-	for (i = 0; i < MAX_DOWNLOAD_WINDOW; i++) {
-		if (cl->downloadBlocks[i]) {
-			Z_Free( cl->downloadBlocks[i] );
-			cl->downloadBlocks[i] = NULL;
-		}
+/*
+==================
+SV_DownloadEOFBlock
+
+The number of the zero length block that ends the download
+==================
+*/
+static int SV_DownloadEOFBlock( client_t *cl ) {
+	return ( cl->downloadSize + MAX_DOWNLOAD_BLKSIZE - 1 ) / MAX_DOWNLOAD_BLKSIZE;
+}
+
+/*
+==================
+SV_DownloadMaxWindow
+==================
+*/
+static int SV_DownloadMaxWindow( void ) {
+	return (int)Com_Clamp( 1, MAX_DOWNLOAD_WINDOW, sv_dlWindow->integer );
+}
+
+/*
+==================
+SV_DownloadRate
+
+Bytes per second the download gets from sv_dlRate, or 0 when it is
+uncapped.  Neither the client rate nor sv_maxRate come into it, those
+are for the game traffic.
+==================
+*/
+static int SV_DownloadRate( void ) {
+	if ( sv_dlRate->integer > 0 ) {
+		return (int)Com_Clamp( 1, 1000000, sv_dlRate->integer ) * 1024;
+	}
+	return 0;
+}
+
+/*
+==================
+SV_DownloadFillTokens
+
+Tops up the token bucket for the time since the last message.  The bucket
+holds a tenth of a second worth of bytes, but at least a whole block so
+slow rates still make progress.
+==================
+*/
+static void SV_DownloadFillTokens( client_t *cl ) {
+	int		rate, depth, msec;
+
+	rate = SV_DownloadRate();
+	if ( !rate ) {
+		// only the window and the room in the message hold it back
+		cl->downloadTokens = MAX_MSGLEN;
+		cl->downloadTokenTime = svs.time;
+		return;
+	}
+
+	depth = rate / 10;
+	if ( depth < MAX_DOWNLOAD_BLKSIZE ) {
+		depth = MAX_DOWNLOAD_BLKSIZE;
+	}
+
+	msec = svs.time - cl->downloadTokenTime;
+	cl->downloadTokenTime = svs.time;
+	if ( msec <= 0 ) {
+		return;
+	}
+	if ( msec > 1000 ) {
+		msec = 1000;
 	}
 
+	cl->downloadTokens += (int)( (float)rate * msec / 1000 );
+	if ( cl->downloadTokens > depth ) {
+		cl->downloadTokens = depth;
+	}
 }
 
 /*
@@ -711,7 +775,7 @@ void SV_NextDownload_f( client_t *cl )
 		Com_DPrintf( "clientDownload: %d : client acknowledge of block %d\n", cl - svs.clients, block );
 
 		// Find out if we are done.  A zero-length block indicates EOF
-		if (cl->downloadBlockSize[cl->downloadClientBlock % MAX_DOWNLOAD_WINDOW] == 0) {
+		if ( block == SV_DownloadEOFBlock( cl ) ) {
 			Com_Printf( "clientDownload: %d : file \"%s\" completed\n", cl - svs.clients, cl->downloadName );
 			SV_CloseDownload( cl );
 			return;
@@ -719,6 +783,18 @@ void SV_NextDownload_f( client_t *cl )
 
 		cl->downloadSendTime = svs.time;
 		cl->downloadClientBlock++;
+
+		// open the window a block per ack until the first loss, then a
+		// block per window worth of acks
+		if ( cl->downloadWindow < cl->downloadThreshold ) {
+			cl->downloadWindow++;
+		} else if ( ++cl->downloadAcks >= cl->downloadWindow ) {
+			cl->downloadAcks = 0;
+			cl->downloadWindow++;
+		}
+		if ( cl->downloadWindow > SV_DownloadMaxWindow() ) {
+			cl->downloadWindow = SV_DownloadMaxWindow();
+		}
 		return;
 	}
 	// We aren't getting an acknowledge for the correct block, drop the client
@@ -748,13 +824,18 @@ SV_WriteDownloadToClient
 
 Check to see if the client wants a file, open it if needed and start pumping the client
 Fill up msg with data 
+
+The file is mapped and blocks are written straight out of the mapping.
+How many blocks are in flight is limited by a window that grows as the
+client acknowledges them and halves when blocks time out, and how fast
+they go out by a token bucket filled at SV_DownloadRate.
 ==================
 */
 void SV_WriteDownloadToClient( client_t *cl , msg_t *msg )
 {
-	int curindex;
-	int rate;
-	int blockspersnap;
+	int blockSize;
+	int eofBlock;
+	int start;
 	int idPack, missionPack;
 	char errorMessage[1024];
 
@@ -770,7 +851,7 @@ void SV_WriteDownloadToClient( client_t *cl , msg_t *msg )
 		idPack = missionPack || FS_idPak(cl->downloadName, "baseq3");
 
 		if ( !sv_allowDownload->integer || idPack ||
-			( cl->downloadSize = FS_SV_FOpenFileRead( cl->downloadName, &cl->download ) ) <= 0 ) {
+			!( cl->download = FS_SV_MapFile( cl->downloadName, &cl->downloadSize ) ) ) {
 			// cannot auto-download file
 			if (idPack) {
 				Com_Printf("clientDownload: %d : \"%s\" cannot download id pk3 files\n", cl - svs.clients, cl->downloadName);
@@ -809,91 +890,67 @@ void SV_WriteDownloadToClient( client_t *cl , msg_t *msg )
 		}
  
 		// Init
-		cl->downloadCurrentBlock = cl->downloadClientBlock = cl->downloadXmitBlock = 0;
-		cl->downloadCount = 0;
-		cl->downloadEOF = qfalse;
-	}
-
-	// Perform any reads that we need to
-	while (cl->downloadCurrentBlock - cl->downloadClientBlock < MAX_DOWNLOAD_WINDOW &&
-		cl->downloadSize != cl->downloadCount) {
-
-		curindex = (cl->downloadCurrentBlock % MAX_DOWNLOAD_WINDOW);
-
-		if (!cl->downloadBlocks[curindex])
-			cl->downloadBlocks[curindex] = (unsigned char*) Z_Malloc( MAX_DOWNLOAD_BLKSIZE );
-
-		cl->downloadBlockSize[curindex] = FS_Read( cl->downloadBlocks[curindex], MAX_DOWNLOAD_BLKSIZE, cl->download );
-
-		if (cl->downloadBlockSize[curindex] < 0) {
-			// EOF right now
-			cl->downloadCount = cl->downloadSize;
-			break;
-		}
-
-		cl->downloadCount += cl->downloadBlockSize[curindex];
-
-		// Load in next block
-		cl->downloadCurrentBlock++;
-	}
-
-	// Check to see if we have eof condition and add the EOF block
-	if (cl->downloadCount == cl->downloadSize &&
-		!cl->downloadEOF &&
-		cl->downloadCurrentBlock - cl->downloadClientBlock < MAX_DOWNLOAD_WINDOW) {
-
-		cl->downloadBlockSize[cl->downloadCurrentBlock % MAX_DOWNLOAD_WINDOW] = 0;
-		cl->downloadCurrentBlock++;
-
-		cl->downloadEOF = qtrue;  // We have added the EOF block
-	}
-
-	// Loop up to window size times based on how many blocks we can fit in the
-	// client snapMsec and rate
-
-	// based on the rate, how many bytes can we fit in the snapMsec time of the client
-	// normal rate / snapshotMsec calculation
-	rate = cl->rate;
-	if ( sv_maxRate->integer ) {
-		if ( sv_maxRate->integer < 1000 ) {
-			Cvar_Set( "sv_MaxRate", "1000" );
-		}
-		if ( sv_maxRate->integer < rate ) {
-			rate = sv_maxRate->integer;
+		cl->downloadClientBlock = cl->downloadXmitBlock = 0;
+		cl->downloadSendTime = svs.time;
+		cl->downloadWindow = 4;
+		if ( cl->downloadWindow > SV_DownloadMaxWindow() ) {
+			cl->downloadWindow = SV_DownloadMaxWindow();
 		}
+		cl->downloadThreshold = SV_DownloadMaxWindow();
+		cl->downloadAcks = 0;
+		cl->downloadTokens = MAX_DOWNLOAD_BLKSIZE;
+		cl->downloadTokenTime = svs.time;
 	}
 
-	if (!rate) {
-		blockspersnap = 1;
-	} else {
-		blockspersnap = ( (rate * cl->snapshotMsec) / 1000 + MAX_DOWNLOAD_BLKSIZE ) /
-			MAX_DOWNLOAD_BLKSIZE;
-	}
+	SV_DownloadFillTokens( cl );
 
-	if (blockspersnap < 0)
-		blockspersnap = 1;
+	eofBlock = SV_DownloadEOFBlock( cl );
 
-	while (blockspersnap--) {
+	// the bucket may go into debt by the last block, which the next
+	// messages pay back before anything else is sent
+	while ( cl->downloadTokens > 0 ) {
 
 		// Write out the next section of the file, if we have already reached our window,
 		// automatically start retransmitting
 
-		if (cl->downloadClientBlock == cl->downloadCurrentBlock)
-			return; // Nothing to transmit
-
-		if (cl->downloadXmitBlock == cl->downloadCurrentBlock) {
+		if ( cl->downloadXmitBlock > eofBlock ||
+			cl->downloadXmitBlock - cl->downloadClientBlock >= cl->downloadWindow ) {
 			// We have transmitted the complete window, should we start resending?
 
 			//FIXME:  This uses a hardcoded one second timeout for lost blocks
 			//the timeout should be based on client rate somehow
-			if (svs.time - cl->downloadSendTime > 1000)
+			if (svs.time - cl->downloadSendTime > 1000) {
 				cl->downloadXmitBlock = cl->downloadClientBlock;
-			else
+
+				// back off, the client or the path can't take this much
+				cl->downloadThreshold = cl->downloadWindow / 2;
+				if ( cl->downloadThreshold < 2 ) {
+					cl->downloadThreshold = 2;
+				}
+				cl->downloadWindow = cl->downloadThreshold;
+				cl->downloadAcks = 0;
+			} else {
 				return;
+			}
+		}
+
+		if ( cl->downloadXmitBlock == eofBlock ) {
+			blockSize = 0;
+		} else {
+			blockSize = cl->downloadSize - cl->downloadXmitBlock * MAX_DOWNLOAD_BLKSIZE;
+			if ( blockSize > MAX_DOWNLOAD_BLKSIZE ) {
+				blockSize = MAX_DOWNLOAD_BLKSIZE;
+			}
+		}
+
+		// the data goes through the huffman coder and can come out larger,
+		// leave it room rather than overflow the message
+		if ( msg->cursize + blockSize + blockSize / 2 + 32 > msg->maxsize ) {
+			return;
 		}
 
 		// Send current block
-		curindex = (cl->downloadXmitBlock % MAX_DOWNLOAD_WINDOW);
+		start = msg->cursize;
 
 		MSG_WriteByte( msg, svc_download );
 		MSG_WriteShort( msg, cl->downloadXmitBlock );
@@ -902,15 +959,18 @@ void SV_WriteDownloadToClient( client_t *cl , msg_t *msg )
 		if ( cl->downloadXmitBlock == 0 )
 			MSG_WriteLong( msg, cl->downloadSize );
  
-		MSG_WriteShort( msg, cl->downloadBlockSize[curindex] );
+		MSG_WriteShort( msg, blockSize );
 
 		// Write the block
-		if ( cl->downloadBlockSize[curindex] ) {
-			MSG_WriteData( msg, cl->downloadBlocks[curindex], cl->downloadBlockSize[curindex] );
+		if ( blockSize ) {
+			MSG_WriteData( msg, cl->download + cl->downloadXmitBlock * MAX_DOWNLOAD_BLKSIZE, blockSize );
 		}
 
 		Com_DPrintf( "clientDownload: %d : writing block %d\n", cl - svs.clients, cl->downloadXmitBlock );
 
+		cl->downloadTokens -= msg->cursize - start;
+		cl->downloadMsgBytes += msg->cursize - start;
+
 		// Move on to the next block
 		// It will get sent with next snap shot.  The rate will keep us in line.
 		cl->downloadXmitBlock++;
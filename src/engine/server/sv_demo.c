@@ -0,0 +1,371 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// sv_demo.c -- server side demos of every client at once
+
+#include "server.h"
+
+/*
+===============================================================================
+
+svrecord writes what all of the clients could be sent to
+demos/<name>.svdm_<protocol>.  The file is made of the same records as a
+client demo, a sequence number and a length followed by a message, and
+ends with -1 -1, but the messages hold svd_ ops instead of svc_ ones.
+
+The first message is the gamestate.  After that there is one message per
+server frame, with the server commands and configstring changes since the
+last frame and an svd_frame: the playerstate of every active client,
+delta compressed against that client's previous one, then every entity
+that could be sent to anyone, delta compressed against the previous frame
+the same way snapshots are, then who may see the entities that only some
+clients are sent.
+
+The file is written by the FS_WriteAsync thread, so the only cost on the
+server thread is the encoding, which svprofile shows as "demo".
+
+cl_svdemo.c plays them back from any client's point of view.
+
+===============================================================================
+*/
+
+typedef struct {
+	qboolean		recording;
+	fileHandle_t	file;
+	char			name[MAX_QPATH];
+	int				sequence;			// messages written
+	int				lastTime;			// svs.time of the last frame
+	int				bytes;
+
+	msg_t			msg;				// commands collect here until the frame
+	byte			*msgData;
+
+	entityState_t	*baselines;			// as written in the gamestate
+	entityState_t	*entities[2];		// this frame and the last, sorted by number
+	int				numEntities[2];
+	int				current;
+
+	playerState_t	*ps;				// each client's last playerstate
+	byte			active[MAX_CLIENTS];	// was in the last frame
+} svDemo_t;
+
+static svDemo_t	svd;
+
+/*
+==================
+SV_DemoBeginMessage
+==================
+*/
+static void SV_DemoBeginMessage( void ) {
+	MSG_Init( &svd.msg, svd.msgData, SVDEMO_MSGLEN );
+	MSG_Bitstream( &svd.msg );
+	svd.msg.allowoverflow = qtrue;
+}
+
+/*
+==================
+SV_DemoWriteMessage
+
+Returns qfalse if the message overflowed
+==================
+*/
+static qboolean SV_DemoWriteMessage( void ) {
+	int		header[2];
+
+	if ( svd.msg.overflowed ) {
+		return qfalse;
+	}
+
+	header[0] = LittleLong( svd.sequence );
+	header[1] = LittleLong( svd.msg.cursize );
+	FS_Write( header, sizeof( header ), svd.file );
+	FS_Write( svd.msg.data, svd.msg.cursize, svd.file );
+
+	svd.sequence++;
+	svd.bytes += (int)sizeof( header ) + svd.msg.cursize;
+
+	SV_DemoBeginMessage();
+	return qtrue;
+}
+
+/*
+==================
+SV_DemoWriteGamestate
+==================
+*/
+static void SV_DemoWriteGamestate( void ) {
+	entityState_t	nullstate;
+	int				i;
+
+	MSG_WriteByte( &svd.msg, svd_gamestate );
+	MSG_WriteLong( &svd.msg, sv_maxclients->integer );
+	MSG_WriteLong( &svd.msg, sv.checksumFeed );
+
+	for ( i = 0 ; i < MAX_CONFIGSTRINGS ; i++ ) {
+		if ( sv.configstrings[i][0] ) {
+			MSG_WriteByte( &svd.msg, svd_configstring );
+			MSG_WriteShort( &svd.msg, i );
+			MSG_WriteBigString( &svd.msg, sv.configstrings[i] );
+		}
+	}
+
+	// the baselines can change under a map_restart, keep the ones written
+	Com_Memset( &nullstate, 0, sizeof( nullstate ) );
+	for ( i = 0 ; i < MAX_GENTITIES ; i++ ) {
+		svd.baselines[i] = sv.svEntities[i].baseline;
+		if ( !svd.baselines[i].number ) {
+			continue;
+		}
+		MSG_WriteByte( &svd.msg, svd_baseline );
+		MSG_WriteDeltaEntity( &svd.msg, &nullstate, &svd.baselines[i], qtrue );
+	}
+
+	MSG_WriteByte( &svd.msg, svd_EOF );
+	MSG_WriteByte( &svd.msg, svd_EOF );
+}
+
+/*
+==================
+SV_DemoStop
+==================
+*/
+void SV_DemoStop( void ) {
+	int		end;
+
+	if ( !svd.recording ) {
+		return;
+	}
+
+	// whatever came in since the last frame
+	if ( svd.msg.cursize ) {
+		MSG_WriteByte( &svd.msg, svd_EOF );
+		SV_DemoWriteMessage();
+	}
+
+	end = -1;
+	FS_Write( &end, 4, svd.file );
+	FS_Write( &end, 4, svd.file );
+	FS_FCloseFile( svd.file );
+
+	Com_Printf( "Stopped server demo %s, %i frames, %ik.\n", svd.name, svd.sequence, svd.bytes / 1024 );
+
+	Z_Free( svd.msgData );
+	Z_Free( svd.baselines );
+	Z_Free( svd.entities[0] );
+	Z_Free( svd.entities[1] );
+	Z_Free( svd.ps );
+	Com_Memset( &svd, 0, sizeof( svd ) );
+}
+
+/*
+==================
+SV_DemoRecord_f
+
+svrecord [name]
+==================
+*/
+void SV_DemoRecord_f( void ) {
+	char		demoName[MAX_QPATH];
+	char		name[MAX_OSPATH];
+	qtime_t		now;
+
+	if ( !com_sv_running->integer || sv.state != SS_GAME ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+	if ( svd.recording ) {
+		Com_Printf( "Already recording %s.\n", svd.name );
+		return;
+	}
+	if ( Cmd_Argc() > 2 ) {
+		Com_Printf( "svrecord [name]\n" );
+		return;
+	}
+
+	if ( Cmd_Argc() == 2 ) {
+		Q_strncpyz( demoName, Cmd_Argv( 1 ), sizeof( demoName ) );
+	} else {
+		Com_RealTime( &now );
+		Com_sprintf( demoName, sizeof( demoName ), "%04i%02i%02i-%02i%02i%02i-%s",
+			1900 + now.tm_year, now.tm_mon + 1, now.tm_mday, now.tm_hour, now.tm_min, now.tm_sec,
+			sv_mapname->string );
+	}
+	Com_sprintf( name, sizeof( name ), "demos/%s.%s%d", demoName, SVDEMO_EXTENSION, PROTOCOL_VERSION );
+
+	svd.file = FS_FOpenFileWrite( name );
+	if ( !svd.file ) {
+		Com_Printf( "ERROR: couldn't open %s.\n", name );
+		return;
+	}
+	FS_WriteAsync( svd.file );
+	Com_Printf( "recording server demo to %s.\n", name );
+
+	Q_strncpyz( svd.name, demoName, sizeof( svd.name ) );
+	svd.msgData = (byte *)Z_Malloc( SVDEMO_MSGLEN );
+	svd.baselines = (entityState_t *)Z_Malloc( MAX_GENTITIES * sizeof( entityState_t ) );
+	svd.entities[0] = (entityState_t *)Z_Malloc( MAX_GENTITIES * sizeof( entityState_t ) );
+	svd.entities[1] = (entityState_t *)Z_Malloc( MAX_GENTITIES * sizeof( entityState_t ) );
+	svd.ps = (playerState_t *)Z_Malloc( MAX_CLIENTS * sizeof( playerState_t ) );
+	svd.numEntities[0] = 0;
+	svd.numEntities[1] = 0;
+	svd.current = 0;
+	svd.sequence = 0;
+	svd.bytes = 0;
+	svd.lastTime = svs.time;
+	Com_Memset( svd.active, 0, sizeof( svd.active ) );
+	svd.recording = qtrue;
+
+	SV_DemoBeginMessage();
+	SV_DemoWriteGamestate();
+	SV_DemoWriteMessage();
+}
+
+/*
+==================
+SV_DemoStopRecord_f
+==================
+*/
+void SV_DemoStopRecord_f( void ) {
+	if ( !svd.recording ) {
+		Com_Printf( "Not recording a server demo.\n" );
+		return;
+	}
+	SV_DemoStop();
+}
+
+/*
+==================
+SV_DemoConfigstring
+
+Called when a configstring changes in game
+==================
+*/
+void SV_DemoConfigstring( int index ) {
+	if ( !svd.recording ) {
+		return;
+	}
+	MSG_WriteByte( &svd.msg, svd_configstring );
+	MSG_WriteShort( &svd.msg, index );
+	MSG_WriteBigString( &svd.msg, sv.configstrings[index] );
+}
+
+/*
+==================
+SV_DemoServerCommand
+
+clientNum is -1 for a command to everyone
+==================
+*/
+void SV_DemoServerCommand( int clientNum, const char *cmd ) {
+	if ( !svd.recording ) {
+		return;
+	}
+	MSG_WriteByte( &svd.msg, svd_serverCommand );
+	MSG_WriteByte( &svd.msg, clientNum < 0 ? 255 : clientNum );
+	MSG_WriteString( &svd.msg, cmd );
+}
+
+/*
+==================
+SV_DemoFrame
+
+Called at the end of SV_Frame
+==================
+*/
+void SV_DemoFrame( void ) {
+	static int		visNumbers[MAX_GENTITIES];
+	sharedEntity_t	*ent;
+	entityState_t	*to;
+	playerState_t	*ps;
+	client_t		*cl;
+	int				numTo, numVis;
+	int				e, i, mode;
+
+	if ( !svd.recording || svs.time == svd.lastTime ) {
+		return;
+	}
+	svd.lastTime = svs.time;
+
+	MSG_WriteByte( &svd.msg, svd_frame );
+	MSG_WriteLong( &svd.msg, svs.time );
+	MSG_WriteByte( &svd.msg, svs.snapFlagServerBit );
+
+	// the playerstates, against each client's last one
+	for ( i = 0, cl = svs.clients ; i < sv_maxclients->integer ; i++, cl++ ) {
+		if ( cl->state != CS_ACTIVE || !cl->gentity ) {
+			svd.active[i] = qfalse;
+			continue;
+		}
+		ps = SV_GameClientNum( i );
+		MSG_WriteByte( &svd.msg, i );
+		MSG_WriteDeltaPlayerstate( &svd.msg, svd.active[i] ? &svd.ps[i] : NULL, ps );
+		svd.ps[i] = *ps;
+		svd.active[i] = qtrue;
+	}
+	MSG_WriteByte( &svd.msg, MAX_CLIENTS );
+
+	// everything that can be sent to anyone, the way SV_AddEntitiesVisibleFromPoint picks
+	to = svd.entities[svd.current ^ 1];
+	numTo = 0;
+	numVis = 0;
+	for ( e = 0 ; e < sv.num_entities ; e++ ) {
+		ent = SV_GentityNum( e );
+		if ( !ent->r.linked || ( ent->r.svFlags & SVF_NOCLIENT ) ) {
+			continue;
+		}
+		if ( ent->s.number != e ) {
+			Com_DPrintf( "FIXING ENT->S.NUMBER!!!\n" );
+			ent->s.number = e;
+		}
+		if ( ent->r.svFlags & ( SVF_SINGLECLIENT | SVF_NOTSINGLECLIENT | SVF_CLIENTMASK ) ) {
+			visNumbers[numVis++] = e;
+		}
+		to[numTo++] = ent->s;
+	}
+	MSG_WriteEntityList( &svd.msg, svd.entities[svd.current], svd.numEntities[svd.current],
+		to, numTo, svd.baselines );
+
+	for ( i = 0 ; i < numVis ; i++ ) {
+		ent = SV_GentityNum( visNumbers[i] );
+		if ( ent->r.svFlags & SVF_SINGLECLIENT ) {
+			mode = SVDEMO_VIS_SINGLE;
+		} else if ( ent->r.svFlags & SVF_NOTSINGLECLIENT ) {
+			mode = SVDEMO_VIS_NOTSINGLE;
+		} else {
+			mode = SVDEMO_VIS_MASK;
+		}
+		MSG_WriteBits( &svd.msg, visNumbers[i], GENTITYNUM_BITS );
+		MSG_WriteBits( &svd.msg, mode, 2 );
+		MSG_WriteLong( &svd.msg, ent->r.singleClient );
+	}
+	MSG_WriteBits( &svd.msg, (MAX_GENTITIES-1), GENTITYNUM_BITS );
+
+	MSG_WriteByte( &svd.msg, svd_EOF );
+
+	svd.current ^= 1;
+	svd.numEntities[svd.current] = numTo;
+
+	if ( !SV_DemoWriteMessage() ) {
+		Com_Printf( "WARNING: server demo frame overflowed, stopping %s\n", svd.name );
+		svd.msg.cursize = 0;
+		SV_DemoStop();
+	}
+}
@@ -89,6 +89,7 @@ void SV_GameSendServerCommand( int clientNum, const char *text ) {
 		if ( clientNum < 0 || clientNum >= sv_maxclients->integer ) {
 			return;
 		}
+		SV_DemoServerCommand( clientNum, text );
 		SV_SendServerCommand( svs.clients + clientNum, "%s", text );	
 	}
 }
@@ -53,6 +53,7 @@ void SV_SetConfigstring (int index, const char *val) {
 	// send it to all the clients if we aren't
 	// spawning a new server
 	if ( sv.state == SS_GAME || sv.restarting ) {
+		SV_DemoConfigstring( index );
 
 		// send the data to all relevent clients
 		for (i = 0, client = svs.clients; i < sv_maxclients->integer ; i++, client++) {
@@ -351,6 +352,9 @@ void SV_SpawnServer( char *server, qboolean killBots ) {
 	char		systemInfo[16384];
 	const char	*p;
 
+	// a server demo is of one map
+	SV_DemoStop();
+
 	// shut down the existing game if it is running
 	SV_ShutdownGameProgs();
 
@@ -599,6 +603,13 @@ void SV_Init (void) {
 	Cvar_Get ("nextmap", "", CVAR_TEMP );
 
 	sv_allowDownload = Cvar_Get ("sv_allowDownload", "0", CVAR_SERVERINFO);
+	sv_dlRate = Cvar_Get ("sv_dlRate", "0", CVAR_ARCHIVE );
+	sv_dlWindow = Cvar_Get ("sv_dlWindow", "32", CVAR_ARCHIVE );
+	sv_queryRate = Cvar_Get ("sv_queryRate", "4", CVAR_ARCHIVE );
+	sv_queryBurst = Cvar_Get ("sv_queryBurst", "8", CVAR_ARCHIVE );
+	sv_localSnapshots = Cvar_Get ("sv_localSnapshots", "1", 0 );
+	sv_snapshotBudget = Cvar_Get ("sv_snapshotBudget", "1", CVAR_ARCHIVE );
+	sv_traffic = Cvar_Get ("sv_traffic", "0", 0 );
 	sv_master[0] = Cvar_Get ("sv_master1", MASTER_SERVER_NAME, 0 );
 	sv_master[1] = Cvar_Get ("sv_master2", "", CVAR_ARCHIVE );
 	sv_master[2] = Cvar_Get ("sv_master3", "", CVAR_ARCHIVE );
@@ -612,6 +623,8 @@ void SV_Init (void) {
 	sv_lanForceRate = Cvar_Get ("sv_lanForceRate", "1", CVAR_ARCHIVE );
 	sv_strictAuth = Cvar_Get ("sv_strictAuth", "1", CVAR_ARCHIVE );
 
+	SV_ProfileInit();
+
 	// initialize bot cvars so they are listed and can be set before loading the botlib
 	SV_BotInitCvars();
 
@@ -661,6 +674,8 @@ before Sys_Quit or Sys_Error
 ================
 */
 void SV_Shutdown( char *finalmsg ) {
+	int		i;
+
 	if ( !com_sv_running || !com_sv_running->integer ) {
 		return;
 	}
@@ -671,6 +686,7 @@ void SV_Shutdown( char *finalmsg ) {
 		SV_FinalMessage( finalmsg );
 	}
 
+	SV_DemoStop();
 	SV_RemoveOperatorCommands();
 	SV_MasterShutdown();
 	SV_ShutdownGameProgs();
@@ -679,7 +695,14 @@ void SV_Shutdown( char *finalmsg ) {
 	SV_ClearServer();
 
 	// free server static data
+	MSG_SetTraffic( NULL );		// in case an error left it pointing at a client
 	if ( svs.clients ) {
+		// downloads keep their files mapped
+		for ( i = 0 ; i < sv_maxclients->integer ; i++ ) {
+			if ( svs.clients[i].download ) {
+				Sys_UnmapFile( svs.clients[i].download );
+			}
+		}
 		Z_Free( svs.clients );
 	}
 	Com_Memset( &svs, 0, sizeof( svs ) );
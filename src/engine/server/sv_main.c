@@ -32,6 +32,13 @@ cvar_t	*sv_zombietime;			// seconds to sink messages after disconnect
 cvar_t	*sv_rconPassword;		// password for remote server commands
 cvar_t	*sv_privatePassword;	// password for the privateClient slots
 cvar_t	*sv_allowDownload;
+cvar_t	*sv_dlRate;			// KB/s per downloading client, 0 for no cap
+cvar_t	*sv_dlWindow;			// download blocks in flight
+cvar_t	*sv_queryRate;			// getstatus/getinfo per second from one address, 0 for no limit
+cvar_t	*sv_queryBurst;			// queries one address can send at once
+cvar_t	*sv_localSnapshots;		// loopback clients get snapshots without the bitstream
+cvar_t	*sv_snapshotBudget;		// cut snapshots down to what the rate allows instead of delaying them
+cvar_t	*sv_traffic;			// count snapshot bytes per client, field and entity type
 cvar_t	*sv_maxclients;
 
 cvar_t	*sv_privateClients;		// number of clients reserved for password
@@ -182,6 +189,8 @@ void QDECL SV_SendServerCommand(client_t *cl, const char *fmt, ...) {
 		Com_Printf ("broadcast: %s\n", SV_ExpandNewlines((char *)message) );
 	}
 
+	SV_DemoServerCommand( -1, (char *)message );
+
 	// send the data to all relevent clients
 	for (j = 0, client = svs.clients; j < sv_maxclients->integer ; j++, client++) {
 		if ( client->state < CS_PRIMED ) {
@@ -297,44 +306,129 @@ CONNECTIONLESS COMMANDS
 
 /*
 ================
-SVC_Status
+SVC_RateLimit
 
-Responds with all the info that qplug or qspy can see about the server
-and all connected players.  Used for getting detailed information after
-the simple info query.
+Token bucket for the address the query came from.  Buckets are found by
+hashing the IP, ignoring the port so a flood can't dodge the limit by
+changing it.  When all the probed slots belong to other addresses the
+one that has been quiet the longest is taken over.
 ================
 */
-void SVC_Status( netadr_t from ) {
+static qboolean SVC_RateLimit( netadr_t from ) {
+	queryBucket_t	*bucket, *oldest;
+	unsigned int	hash;
+	int				i, now, rate, burst, msec;
+
+	if ( sv_queryRate->integer <= 0 || from.type == NA_LOOPBACK ) {
+		return qfalse;
+	}
+
+	hash = ( (unsigned)from.ip[0] << 24 | from.ip[1] << 16 | from.ip[2] << 8 | from.ip[3] ) * 2654435761u;
+	hash = ( hash >> 16 ) ^ hash;
+
+	now = Sys_Milliseconds();
+	rate = (int)Com_Clamp( 1, 1000, sv_queryRate->integer );
+	burst = (int)Com_Clamp( 1, 1000, sv_queryBurst->integer ) * 1000;
+
+	oldest = NULL;
+	for ( i = 0 ; i < QUERY_BUCKET_PROBES ; i++ ) {
+		bucket = &svs.queryBuckets[( hash + i ) & ( MAX_QUERY_BUCKETS - 1 )];
+		if ( NET_CompareBaseAdr( bucket->adr, from ) ) {
+			break;
+		}
+		if ( !oldest || bucket->time - oldest->time < 0 ) {
+			oldest = bucket;
+		}
+	}
+
+	if ( i == QUERY_BUCKET_PROBES ) {
+		bucket = oldest;
+		bucket->adr = from;
+		bucket->tokens = burst;
+		bucket->time = now;
+	}
+
+	msec = now - bucket->time;
+	bucket->time = now;
+	if ( msec > 0 ) {
+		// an empty bucket is full again after burst / rate seconds
+		if ( msec > burst ) {
+			msec = burst;
+		}
+		bucket->tokens += msec * rate;
+		if ( bucket->tokens > burst ) {
+			bucket->tokens = burst;
+		}
+	}
+
+	if ( bucket->tokens < 1000 ) {
+		return qtrue;
+	}
+	bucket->tokens -= 1000;
+	return qfalse;
+}
+
+/*
+===============================================================================
+
+The status and info responses are built at most once a server frame, and
+again if a serverinfo cvar changes in between.  Each query only adds its
+challenge in front, which is where Info_SetValueForKey would have put it.
+
+===============================================================================
+*/
+
+typedef struct {
+	int			time;						// svs.time it was built for
+	qboolean	valid;
+	qboolean	noStatus;					// single player
+	qboolean	noInfo;
+	char		statusInfo[MAX_INFO_STRING];
+	char		statusPlayers[MAX_MSGLEN];
+	char		info[MAX_INFO_STRING];
+} queryCache_t;
+
+static queryCache_t	sv_queryCache;
+
+/*
+================
+SVC_BuildQueryCache
+================
+*/
+static void SVC_BuildQueryCache( void ) {
+	queryCache_t	*qc;
 	char	player[1024];
-	char	status[MAX_MSGLEN];
-	int		i;
+	int		i, count;
 	client_t	*cl;
 	playerState_t	*ps;
 	int		statusLength;
 	int		playerLength;
-	char	infostring[MAX_INFO_STRING];
+	char	*gamedir;
 
-	// ignore if we are in single player
-	if ( Cvar_VariableValue( "g_gametype" ) == GT_SINGLE_PLAYER ) {
+	qc = &sv_queryCache;
+	if ( qc->valid && qc->time == svs.time && !( cvar_modifiedFlags & CVAR_SERVERINFO ) ) {
 		return;
 	}
+	qc->valid = qtrue;
+	qc->time = svs.time;
 
-	strcpy( infostring, Cvar_InfoString( CVAR_SERVERINFO ) );
+	// ignore if we are in single player
+	qc->noStatus = ( Cvar_VariableValue( "g_gametype" ) == GT_SINGLE_PLAYER ) ? qtrue : qfalse;
+	qc->noInfo = ( qc->noStatus || Cvar_VariableValue( "ui_singlePlayerActive" ) ) ? qtrue : qfalse;
 
-	// echo back the parameter to status. so master servers can use it as a challenge
-	// to prevent timed spoofed reply packets that add ghost servers
-	Info_SetValueForKey( infostring, "challenge", Cmd_Argv(1) );
+	// status
+	Q_strncpyz( qc->statusInfo, Cvar_InfoString( CVAR_SERVERINFO ), sizeof( qc->statusInfo ) );
 
 	// add "demo" to the sv_keywords if restricted
 	if ( Cvar_VariableValue( "fs_restrict" ) ) {
 		char	keywords[MAX_INFO_STRING];
 
 		Com_sprintf( keywords, sizeof( keywords ), "demo %s",
-			Info_ValueForKey( infostring, "sv_keywords" ) );
-		Info_SetValueForKey( infostring, "sv_keywords", keywords );
+			Info_ValueForKey( qc->statusInfo, "sv_keywords" ) );
+		Info_SetValueForKey( qc->statusInfo, "sv_keywords", keywords );
 	}
 
-	status[0] = 0;
+	qc->statusPlayers[0] = 0;
 	statusLength = 0;
 
 	for (i=0 ; i < sv_maxclients->integer ; i++) {
@@ -344,70 +438,118 @@ void SVC_Status( netadr_t from ) {
 			Com_sprintf (player, sizeof(player), "%i %i \"%s\"\n", 
 				ps->persistant[PERS_SCORE], cl->ping, cl->name);
 			playerLength = (int)strlen(player);
-			if (statusLength + playerLength >= sizeof(status) ) {
+			// leave room for the header and the challenge
+			if (statusLength + playerLength >= sizeof(qc->statusPlayers) - MAX_INFO_STRING - 64 ) {
 				break;		// can't hold any more
 			}
-			strcpy (status + statusLength, player);
+			strcpy (qc->statusPlayers + statusLength, player);
 			statusLength += playerLength;
 		}
 	}
 
-	NET_OutOfBandPrint( NS_SERVER, from, "statusResponse\n%s\n%s", infostring, status );
+	// info, don't count privateclients
+	count = 0;
+	for ( i = sv_privateClients->integer ; i < sv_maxclients->integer ; i++ ) {
+		if ( svs.clients[i].state >= CS_CONNECTED ) {
+			count++;
+		}
+	}
+
+	qc->info[0] = 0;
+
+	Info_SetValueForKey( qc->info, "protocol", va("%i", PROTOCOL_VERSION) );
+	Info_SetValueForKey( qc->info, "hostname", sv_hostname->string );
+	Info_SetValueForKey( qc->info, "mapname", sv_mapname->string );
+	Info_SetValueForKey( qc->info, "clients", va("%i", count) );
+	Info_SetValueForKey( qc->info, "sv_maxclients", 
+		va("%i", sv_maxclients->integer - sv_privateClients->integer ) );
+	Info_SetValueForKey( qc->info, "gametype", va("%i", sv_gametype->integer ) );
+	Info_SetValueForKey( qc->info, "pure", va("%i", sv_pure->integer ) );
+
+	if( sv_minPing->integer ) {
+		Info_SetValueForKey( qc->info, "minPing", va("%i", sv_minPing->integer) );
+	}
+	if( sv_maxPing->integer ) {
+		Info_SetValueForKey( qc->info, "maxPing", va("%i", sv_maxPing->integer) );
+	}
+	gamedir = Cvar_VariableString( "fs_game" );
+	if( *gamedir ) {
+		Info_SetValueForKey( qc->info, "game", gamedir );
+	}
 }
 
 /*
 ================
-SVC_Info
+SVC_Challenge
 
-Responds with a short info message that should be enough to determine
-if a user is interested in a server to do a full status
+The challenge key to put in front of a cached info string, or an empty
+string where Info_SetValueForKey would have refused to add it
 ================
 */
-void SVC_Info( netadr_t from ) {
-	int		i, count;
-	char	*gamedir;
-	char	infostring[MAX_INFO_STRING];
+static const char *SVC_Challenge( const char *info ) {
+	const char	*challenge;
 
-	// ignore if we are in single player
-	if ( Cvar_VariableValue( "g_gametype" ) == GT_SINGLE_PLAYER || Cvar_VariableValue("ui_singlePlayerActive")) {
-		return;
+	challenge = Cmd_Argv(1);
+	if ( !challenge[0] || strchr( challenge, '\\' ) || strchr( challenge, ';' ) || strchr( challenge, '"' ) ) {
+		return "";
 	}
+	if ( strlen( challenge ) + 11 + strlen( info ) > MAX_INFO_STRING ) {
+		return "";
+	}
+	return va( "\\challenge\\%s", challenge );
+}
 
-	// don't count privateclients
-	count = 0;
-	for ( i = sv_privateClients->integer ; i < sv_maxclients->integer ; i++ ) {
-		if ( svs.clients[i].state >= CS_CONNECTED ) {
-			count++;
-		}
+/*
+================
+SVC_Status
+
+Responds with all the info that qplug or qspy can see about the server
+and all connected players.  Used for getting detailed information after
+the simple info query.
+================
+*/
+void SVC_Status( netadr_t from ) {
+	if ( SVC_RateLimit( from ) ) {
+		return;
 	}
 
-	infostring[0] = 0;
+	SVC_BuildQueryCache();
 
-	// echo back the parameter to status. so servers can use it as a challenge
+	// ignore if we are in single player
+	if ( sv_queryCache.noStatus ) {
+		return;
+	}
+
+	// echo back the parameter to status. so master servers can use it as a challenge
 	// to prevent timed spoofed reply packets that add ghost servers
-	Info_SetValueForKey( infostring, "challenge", Cmd_Argv(1) );
+	NET_OutOfBandPrint( NS_SERVER, from, "statusResponse\n%s%s\n%s",
+		SVC_Challenge( sv_queryCache.statusInfo ), sv_queryCache.statusInfo, sv_queryCache.statusPlayers );
+}
 
-	Info_SetValueForKey( infostring, "protocol", va("%i", PROTOCOL_VERSION) );
-	Info_SetValueForKey( infostring, "hostname", sv_hostname->string );
-	Info_SetValueForKey( infostring, "mapname", sv_mapname->string );
-	Info_SetValueForKey( infostring, "clients", va("%i", count) );
-	Info_SetValueForKey( infostring, "sv_maxclients", 
-		va("%i", sv_maxclients->integer - sv_privateClients->integer ) );
-	Info_SetValueForKey( infostring, "gametype", va("%i", sv_gametype->integer ) );
-	Info_SetValueForKey( infostring, "pure", va("%i", sv_pure->integer ) );
+/*
+================
+SVC_Info
 
-	if( sv_minPing->integer ) {
-		Info_SetValueForKey( infostring, "minPing", va("%i", sv_minPing->integer) );
-	}
-	if( sv_maxPing->integer ) {
-		Info_SetValueForKey( infostring, "maxPing", va("%i", sv_maxPing->integer) );
+Responds with a short info message that should be enough to determine
+if a user is interested in a server to do a full status
+================
+*/
+void SVC_Info( netadr_t from ) {
+	if ( SVC_RateLimit( from ) ) {
+		return;
 	}
-	gamedir = Cvar_VariableString( "fs_game" );
-	if( *gamedir ) {
-		Info_SetValueForKey( infostring, "game", gamedir );
+
+	SVC_BuildQueryCache();
+
+	// ignore if we are in single player
+	if ( sv_queryCache.noInfo ) {
+		return;
 	}
 
-	NET_OutOfBandPrint( NS_SERVER, from, "infoResponse\n%s", infostring );
+	// echo back the parameter to status. so servers can use it as a challenge
+	// to prevent timed spoofed reply packets that add ghost servers
+	NET_OutOfBandPrint( NS_SERVER, from, "infoResponse\n%s%s",
+		SVC_Challenge( sv_queryCache.info ), sv_queryCache.info );
 }
 
 /*
@@ -751,6 +893,7 @@ happen before SV_Frame is called
 void SV_Frame( int msec ) {
 	int		frameMsec;
 	int		startTime;
+	int		frameStart, phaseStart;
 
 	// the menu kills the server with this cvar
 	if ( sv_killserver->integer ) {
@@ -776,7 +919,11 @@ void SV_Frame( int msec ) {
 
 	sv.timeResidual += msec;
 
-	if (!com_dedicated->integer) SV_BotFrame( svs.time + sv.timeResidual );
+	if (!com_dedicated->integer) {
+		phaseStart = SV_ProfileBegin();
+		SV_BotFrame( svs.time + sv.timeResidual );
+		SV_ProfileEnd( SVP_BOTS, phaseStart );
+	}
 
 	if ( com_dedicated->integer && sv.timeResidual < frameMsec ) {
 		// NET_Sleep will give the OS time slices until either get a packet
@@ -822,13 +969,21 @@ void SV_Frame( int msec ) {
 	} else {
 		startTime = 0;	// quite a compiler warning
 	}
+	frameStart = SV_ProfileBegin();
 
 	// update ping based on the all received frames
+	phaseStart = SV_ProfileBegin();
 	SV_CalcPings();
+	SV_ProfileEnd( SVP_PINGS, phaseStart );
 
-	if (com_dedicated->integer) SV_BotFrame( svs.time );
+	if (com_dedicated->integer) {
+		phaseStart = SV_ProfileBegin();
+		SV_BotFrame( svs.time );
+		SV_ProfileEnd( SVP_BOTS, phaseStart );
+	}
 
 	// run the game simulation in chunks
+	phaseStart = SV_ProfileBegin();
 	while ( sv.timeResidual >= frameMsec ) {
 		sv.timeResidual -= frameMsec;
 		svs.time += frameMsec;
@@ -836,19 +991,31 @@ void SV_Frame( int msec ) {
 		// let everything in the world think and move
 		VM_Call( gvm, GAME_RUN_FRAME, svs.time );
 	}
+	SV_ProfileEnd( SVP_GAME, phaseStart );
 
 	if ( com_speeds->integer ) {
 		time_game = Sys_Milliseconds () - startTime;
 	}
 
 	// check timeouts
+	phaseStart = SV_ProfileBegin();
 	SV_CheckTimeouts();
+	SV_ProfileEnd( SVP_TIMEOUTS, phaseStart );
 
-	// send messages back to the clients
+	// send messages back to the clients, this times its own phases
 	SV_SendClientMessages();
 
+	phaseStart = SV_ProfileBegin();
+	SV_DemoFrame();
+	SV_ProfileEnd( SVP_DEMO, phaseStart );
+
 	// send a heartbeat to the master if needed
+	phaseStart = SV_ProfileBegin();
 	SV_MasterHeartbeat();
+	SV_ProfileEnd( SVP_HEARTBEAT, phaseStart );
+
+	SV_ProfileEnd( SVP_FRAME, frameStart );
+	SV_ProfileEndFrame();
 }
 
 //============================================================================
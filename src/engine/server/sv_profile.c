@@ -0,0 +1,361 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// sv_profile.c -- per phase timing of server frames
+
+#include "server.h"
+
+/*
+===============================================================================
+
+Every phase of SV_Frame is timed with Sys_Microseconds and summed over
+the frame, then the frame totals go into log scale histograms with eight
+buckets per power of two, so percentiles are good to about 12%.  The
+histograms cover one minute of real time.  When the minute is up the
+window is kept as the last one, optionally appended to sv_profileLog,
+and a new one is started.
+
+===============================================================================
+*/
+
+#define	SVP_WINDOW_MSEC		60000
+
+#define	SVP_SUB_BITS		3
+#define	SVP_SUB_BUCKETS		( 1 << SVP_SUB_BITS )
+#define	SVP_BUCKETS			( 29 * SVP_SUB_BUCKETS )	// covers all positive ints
+
+typedef struct {
+	int		count;
+	int		max;
+	double	total;
+	int		buckets[SVP_BUCKETS];
+} svHistogram_t;
+
+typedef struct {
+	int				startTime;		// Sys_Milliseconds
+	int				realTime;		// Com_RealTime, for the log
+	svHistogram_t	phases[SVP_NUM_PHASES];
+} svProfileWindow_t;
+
+typedef struct {
+	int					frameTime[SVP_NUM_PHASES];
+	svProfileWindow_t	current;
+	svProfileWindow_t	last;
+	qboolean			haveLast;
+	fileHandle_t		log;
+	qboolean			logJson;
+} svProfile_t;
+
+static svProfile_t	svp;
+
+static const char *svp_phaseNames[SVP_NUM_PHASES] = {
+	"bots",
+	"pings",
+	"game",
+	"timeouts",
+	"build",
+	"write",
+	"send",
+	"demo",
+	"heartbeat",
+	"frame"
+};
+
+cvar_t	*sv_profile;
+cvar_t	*sv_profileLog;
+
+/*
+==================
+SV_ProfileBucket
+==================
+*/
+static int SV_ProfileBucket( int usec ) {
+	int		exponent;
+
+	if ( usec < SVP_SUB_BUCKETS ) {
+		return usec < 0 ? 0 : usec;
+	}
+
+	for ( exponent = SVP_SUB_BITS ; ( usec >> ( exponent + 1 ) ) != 0 ; exponent++ ) {
+	}
+
+	return ( exponent - SVP_SUB_BITS + 1 ) * SVP_SUB_BUCKETS
+		+ ( ( usec >> ( exponent - SVP_SUB_BITS ) ) & ( SVP_SUB_BUCKETS - 1 ) );
+}
+
+/*
+==================
+SV_ProfileBucketTop
+
+The largest value that falls into the bucket
+==================
+*/
+static int SV_ProfileBucketTop( int bucket ) {
+	int		exponent, mantissa;
+
+	if ( bucket < SVP_SUB_BUCKETS ) {
+		return bucket;
+	}
+
+	exponent = bucket / SVP_SUB_BUCKETS + SVP_SUB_BITS - 1;
+	mantissa = bucket & ( SVP_SUB_BUCKETS - 1 );
+
+	return (int)( ( (unsigned)( SVP_SUB_BUCKETS + mantissa + 1 ) << ( exponent - SVP_SUB_BITS ) ) - 1 );
+}
+
+/*
+==================
+SV_ProfilePercentile
+==================
+*/
+static int SV_ProfilePercentile( const svHistogram_t *hist, float fraction ) {
+	int		i, wanted, seen;
+
+	if ( !hist->count ) {
+		return 0;
+	}
+
+	wanted = (int)ceil( hist->count * fraction );
+	if ( wanted < 1 ) {
+		wanted = 1;
+	}
+
+	seen = 0;
+	for ( i = 0 ; i < SVP_BUCKETS ; i++ ) {
+		seen += hist->buckets[i];
+		if ( seen >= wanted ) {
+			break;
+		}
+	}
+
+	// the bucket is wider than anything that went into it at the top end
+	return SV_ProfileBucketTop( i ) < hist->max ? SV_ProfileBucketTop( i ) : hist->max;
+}
+
+/*
+==================
+SV_ProfileOpenLog
+==================
+*/
+static void SV_ProfileOpenLog( void ) {
+	const char	*ext;
+	qboolean	exists;
+
+	if ( svp.log ) {
+		FS_FCloseFile( svp.log );
+		svp.log = 0;
+	}
+	sv_profileLog->modified = qfalse;
+
+	if ( !sv_profileLog->string[0] ) {
+		return;
+	}
+
+	ext = strrchr( sv_profileLog->string, '.' );
+	svp.logJson = ( ext && !Q_stricmp( ext, ".json" ) ) ? qtrue : qfalse;
+
+	exists = FS_FileExists( sv_profileLog->string );
+	if ( FS_FOpenFileByMode( sv_profileLog->string, &svp.log, FS_APPEND ) < 0 ) {
+		svp.log = 0;
+		Com_Printf( "WARNING: couldn't open %s\n", sv_profileLog->string );
+		return;
+	}
+
+	if ( !exists && !svp.logJson ) {
+		FS_Printf( svp.log, "time,phase,frames,mean_us,p50_us,p99_us,max_us\n" );
+	}
+}
+
+/*
+==================
+SV_ProfileWriteLog
+
+CSV gets a row per phase, JSON a line per window
+==================
+*/
+static void SV_ProfileWriteLog( const svProfileWindow_t *window ) {
+	const svHistogram_t	*hist;
+	int					i;
+
+	if ( sv_profileLog->modified ) {
+		SV_ProfileOpenLog();
+	}
+	if ( !svp.log ) {
+		return;
+	}
+
+	if ( svp.logJson ) {
+		FS_Printf( svp.log, "{\"time\":%i,\"phases\":{", window->realTime );
+	}
+
+	for ( i = 0 ; i < SVP_NUM_PHASES ; i++ ) {
+		hist = &window->phases[i];
+		if ( svp.logJson ) {
+			FS_Printf( svp.log, "%s\"%s\":{\"frames\":%i,\"mean_us\":%i,\"p50_us\":%i,\"p99_us\":%i,\"max_us\":%i}",
+				i ? "," : "", svp_phaseNames[i], hist->count,
+				hist->count ? (int)( hist->total / hist->count ) : 0,
+				SV_ProfilePercentile( hist, 0.5f ), SV_ProfilePercentile( hist, 0.99f ), hist->max );
+		} else {
+			FS_Printf( svp.log, "%i,%s,%i,%i,%i,%i,%i\n",
+				window->realTime, svp_phaseNames[i], hist->count,
+				hist->count ? (int)( hist->total / hist->count ) : 0,
+				SV_ProfilePercentile( hist, 0.5f ), SV_ProfilePercentile( hist, 0.99f ), hist->max );
+		}
+	}
+
+	if ( svp.logJson ) {
+		FS_Printf( svp.log, "}}\n" );
+	}
+	FS_Flush( svp.log );
+}
+
+/*
+==================
+SV_ProfileStartWindow
+==================
+*/
+static void SV_ProfileStartWindow( void ) {
+	qtime_t		now;
+
+	Com_Memset( &svp.current, 0, sizeof( svp.current ) );
+	svp.current.startTime = Sys_Milliseconds();
+	svp.current.realTime = Com_RealTime( &now );
+}
+
+/*
+==================
+SV_ProfileInit
+==================
+*/
+void SV_ProfileInit( void ) {
+	sv_profile = Cvar_Get( "sv_profile", "0", 0 );
+	sv_profileLog = Cvar_Get( "sv_profileLog", "", CVAR_ARCHIVE );
+
+	Com_Memset( svp.frameTime, 0, sizeof( svp.frameTime ) );
+	SV_ProfileStartWindow();
+}
+
+/*
+==================
+SV_ProfileBegin
+==================
+*/
+int SV_ProfileBegin( void ) {
+	if ( !sv_profile->integer ) {
+		return 0;
+	}
+	return Sys_Microseconds();
+}
+
+/*
+==================
+SV_ProfileEnd
+
+Adds the time since start, as returned by SV_ProfileBegin, to the phase
+==================
+*/
+void SV_ProfileEnd( svPhase_t phase, int start ) {
+	// start is 0 if sv_profile was turned on in between
+	if ( !sv_profile->integer || !start ) {
+		return;
+	}
+	svp.frameTime[phase] += Sys_Microseconds() - start;
+}
+
+/*
+==================
+SV_ProfileEndFrame
+
+Moves the frame totals into the histograms
+==================
+*/
+void SV_ProfileEndFrame( void ) {
+	svHistogram_t	*hist;
+	int				i, usec;
+
+	if ( !sv_profile->integer ) {
+		return;
+	}
+
+	for ( i = 0 ; i < SVP_NUM_PHASES ; i++ ) {
+		usec = svp.frameTime[i];
+		svp.frameTime[i] = 0;
+
+		hist = &svp.current.phases[i];
+		hist->buckets[SV_ProfileBucket( usec )]++;
+		hist->count++;
+		hist->total += usec;
+		if ( usec > hist->max ) {
+			hist->max = usec;
+		}
+	}
+
+	if ( Sys_Milliseconds() - svp.current.startTime >= SVP_WINDOW_MSEC ) {
+		SV_ProfileWriteLog( &svp.current );
+		svp.last = svp.current;
+		svp.haveLast = qtrue;
+		SV_ProfileStartWindow();
+	}
+}
+
+/*
+==================
+SV_ProfilePrintWindow
+==================
+*/
+static void SV_ProfilePrintWindow( const svProfileWindow_t *window ) {
+	const svHistogram_t	*hist;
+	int					i;
+
+	Com_Printf( "phase       frames     mean      p50      p99      max (msec)\n" );
+	for ( i = 0 ; i < SVP_NUM_PHASES ; i++ ) {
+		hist = &window->phases[i];
+		Com_Printf( "%-10s %7i %8.3f %8.3f %8.3f %8.3f\n", svp_phaseNames[i], hist->count,
+			hist->count ? hist->total / hist->count * 0.001 : 0.0,
+			SV_ProfilePercentile( hist, 0.5f ) * 0.001, SV_ProfilePercentile( hist, 0.99f ) * 0.001,
+			hist->max * 0.001 );
+	}
+}
+
+/*
+==================
+SV_Profile_f
+==================
+*/
+void SV_Profile_f( void ) {
+	if ( !Q_stricmp( Cmd_Argv( 1 ), "reset" ) ) {
+		svp.haveLast = qfalse;
+		SV_ProfileStartWindow();
+		return;
+	}
+
+	if ( !sv_profile->integer ) {
+		Com_Printf( "sv_profile is off\n" );
+	}
+
+	Com_Printf( "current window, %i seconds:\n", ( Sys_Milliseconds() - svp.current.startTime ) / 1000 );
+	SV_ProfilePrintWindow( &svp.current );
+
+	if ( svp.haveLast ) {
+		Com_Printf( "\nlast full minute:\n" );
+		SV_ProfilePrintWindow( &svp.last );
+	}
+}
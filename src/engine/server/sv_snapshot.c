@@ -22,6 +22,11 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include "server.h"
 
+#define	MAX_SNAPSHOT_ENTITIES	1024
+
+#define	HEADER_RATE_BYTES	28		// IP and UDP headers, the netchan header is already counted
+
+static int SV_ClientRate( client_t *client );
 
 /*
 =============================================================================
@@ -113,6 +118,326 @@ static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to,
 }
 
 
+/*
+=============================================================================
+
+When the entities of a snapshot come out larger than the client rate
+allows for one snapshot interval, the snapshot is cut down to a budget
+instead of holding up the next one.  Every changed entity that misses a
+snapshot adds its priority to a per client total, and the largest totals
+go first, so nothing starves for long.  An entity that is left out keeps
+the state the client already has in the frame, or drops out of the frame
+if the client never had it, so later deltas still line up.
+
+=============================================================================
+*/
+
+#define	MAX_DELTA_BYTES		1024		// a full entityState_t from nothing fits easily
+#define	MIN_SNAPSHOT_BUDGET	128			// bytes, so something always gets through
+#define	PRIORITY_DISTANCE	1024.0f		// priority halves at this range
+
+typedef struct {
+	entityState_t	*oldent;		// NULL if the client doesn't have the entity
+	entityState_t	*newent;
+	int				bits;
+	float			priority;
+	qboolean		send;
+} snapshotCandidate_t;
+
+/*
+=============
+SV_SnapshotBudget
+
+Bits the entities of a snapshot can take without the rate having to
+delay the next one, 0 to send them all
+=============
+*/
+static int SV_SnapshotBudget( client_t *client, msg_t *msg ) {
+	int		bytes;
+
+	if ( !sv_snapshotBudget->integer || client->state != CS_ACTIVE ) {
+		return 0;
+	}
+	if ( client->netchan.remoteAddress.type == NA_LOOPBACK
+		|| ( sv_lanForceRate->integer && Sys_IsLANAddress( client->netchan.remoteAddress ) ) ) {
+		return 0;
+	}
+
+	bytes = SV_ClientRate( client ) * client->snapshotMsec / 1000;
+	if ( client->rateBytes < 0 ) {
+		bytes += client->rateBytes;
+	}
+	bytes -= msg->cursize + HEADER_RATE_BYTES;
+	if ( bytes < MIN_SNAPSHOT_BUDGET ) {
+		bytes = MIN_SNAPSHOT_BUDGET;
+	}
+
+	return bytes * 8;
+}
+
+/*
+=============
+SV_DeltaEntityBits
+=============
+*/
+static int SV_DeltaEntityBits( entityState_t *from, entityState_t *to, qboolean force ) {
+	byte			buf[MAX_DELTA_BYTES];
+	msg_t			msg;
+	netTraffic_t	*traffic;
+
+	// this doesn't go out, so it isn't traffic
+	traffic = MSG_SetTraffic( NULL );
+
+	MSG_Init( &msg, buf, sizeof( buf ) );
+	MSG_WriteDeltaEntity( &msg, from, to, force );
+
+	MSG_SetTraffic( traffic );
+	return msg.bit;
+}
+
+/*
+=============
+SV_EntityPriority
+
+How much it matters to the client that a changed entity makes it into
+this snapshot
+=============
+*/
+static float SV_EntityPriority( const vec3_t org, const vec3_t forward,
+							   const entityState_t *oldent, const entityState_t *newent ) {
+	sharedEntity_t	*ent;
+	vec3_t			dir;
+	float			dist, priority;
+
+	ent = SV_GentityNum( newent->number );
+	if ( ent->r.svFlags & SVF_BROADCAST ) {
+		dist = 0;
+	} else {
+		VectorSubtract( ent->r.currentOrigin, org, dir );
+		dist = VectorNormalize( dir );
+	}
+
+	priority = PRIORITY_DISTANCE / ( PRIORITY_DISTANCE + dist );
+
+	// in front of the view, or close enough to turn around to
+	if ( dist < 256 || DotProduct( dir, forward ) > 0.5f ) {
+		priority *= 2;
+	}
+
+	// new entities and events may only be around for a moment, a new
+	// trajectory is something the client can't extrapolate
+	if ( !oldent || oldent->event != newent->event ) {
+		priority *= 4;
+	} else if ( oldent->pos.trType != newent->pos.trType ) {
+		priority *= 2;
+	}
+
+	if ( newent->number < sv_maxclients->integer ) {
+		priority *= 2;
+	}
+
+	return priority;
+}
+
+/*
+=============
+SV_QsortCandidates
+
+Highest priority first
+=============
+*/
+static int QDECL SV_QsortCandidates( const void *a, const void *b ) {
+	float	pa, pb;
+
+	pa = (*(snapshotCandidate_t **)a)->priority;
+	pb = (*(snapshotCandidate_t **)b)->priority;
+
+	if ( pa > pb ) {
+		return -1;
+	}
+	if ( pa < pb ) {
+		return 1;
+	}
+	return 0;
+}
+
+/*
+=============
+SV_EmitBudgetedEntities
+
+Like SV_EmitPacketEntities, but only sends the changes that fit in budget
+bits, and rewrites the frame to what the client will actually have
+=============
+*/
+static void SV_EmitBudgetedEntities( client_t *client, clientSnapshot_t *from, clientSnapshot_t *to,
+									msg_t *msg, int budget ) {
+	static snapshotCandidate_t	candidates[MAX_SNAPSHOT_ENTITIES];
+	static snapshotCandidate_t	*order[MAX_SNAPSHOT_ENTITIES];
+	snapshotCandidate_t	*cand;
+	entityState_t		*oldent, *newent, *state;
+	vec3_t				org, forward;
+	int					oldindex, newindex;
+	int					oldnum, newnum;
+	int					from_num_entities;
+	int					numOrder, kept, i;
+
+	if ( !from ) {
+		from_num_entities = 0;
+	} else {
+		from_num_entities = from->num_entities;
+	}
+
+	VectorCopy( to->ps.origin, org );
+	org[2] += to->ps.viewheight;
+	AngleVectors( to->ps.viewangles, forward, NULL, NULL );
+
+	// size up every change, removals always go out
+	budget -= 32;		// end of packetentities
+	numOrder = 0;
+	newent = NULL;
+	oldent = NULL;
+	newindex = 0;
+	oldindex = 0;
+	while ( newindex < to->num_entities || oldindex < from_num_entities ) {
+		if ( newindex >= to->num_entities ) {
+			newnum = 9999;
+		} else {
+			newent = &svs.snapshotEntities[(to->first_entity+newindex) % svs.numSnapshotEntities];
+			newnum = newent->number;
+		}
+
+		if ( oldindex >= from_num_entities ) {
+			oldnum = 9999;
+		} else {
+			oldent = &svs.snapshotEntities[(from->first_entity+oldindex) % svs.numSnapshotEntities];
+			oldnum = oldent->number;
+		}
+
+		if ( newnum > oldnum ) {
+			budget -= SV_DeltaEntityBits( oldent, NULL, qtrue );
+			oldindex++;
+			continue;
+		}
+
+		cand = &candidates[newindex];
+		cand->newent = newent;
+		if ( newnum == oldnum ) {
+			cand->oldent = oldent;
+			cand->bits = SV_DeltaEntityBits( oldent, newent, qfalse );
+			oldindex++;
+		} else {
+			cand->oldent = NULL;
+			cand->bits = SV_DeltaEntityBits( &sv.svEntities[newnum].baseline, newent, qtrue );
+		}
+		newindex++;
+
+		if ( !cand->bits ) {
+			// unchanged, the client is up to date
+			cand->send = qtrue;
+			client->entityPriority[newnum] = 0;
+			continue;
+		}
+
+		client->entityPriority[newnum] += SV_EntityPriority( org, forward, cand->oldent, newent );
+		cand->priority = client->entityPriority[newnum];
+		order[numOrder++] = cand;
+	}
+
+	// take the most starved changes that fit, and always the first one
+	qsort( order, numOrder, sizeof( order[0] ), SV_QsortCandidates );
+	for ( i = 0 ; i < numOrder ; i++ ) {
+		cand = order[i];
+		if ( i && cand->bits > budget ) {
+			cand->send = qfalse;
+			continue;
+		}
+		cand->send = qtrue;
+		budget -= cand->bits;
+		client->entityPriority[cand->newent->number] = 0;
+	}
+
+	// write them in entity order, packing the frame down as entities drop out
+	kept = 0;
+	newindex = 0;
+	oldindex = 0;
+	while ( newindex < to->num_entities || oldindex < from_num_entities ) {
+		if ( newindex >= to->num_entities ) {
+			newnum = 9999;
+		} else {
+			newent = &svs.snapshotEntities[(to->first_entity+newindex) % svs.numSnapshotEntities];
+			newnum = newent->number;
+		}
+
+		if ( oldindex >= from_num_entities ) {
+			oldnum = 9999;
+		} else {
+			oldent = &svs.snapshotEntities[(from->first_entity+oldindex) % svs.numSnapshotEntities];
+			oldnum = oldent->number;
+		}
+
+		if ( newnum > oldnum ) {
+			MSG_WriteDeltaEntity( msg, oldent, NULL, qtrue );
+			oldindex++;
+			continue;
+		}
+
+		cand = &candidates[newindex];
+		state = &svs.snapshotEntities[(to->first_entity+kept) % svs.numSnapshotEntities];
+		newindex++;
+
+		if ( newnum == oldnum ) {
+			oldindex++;
+			if ( cand->send ) {
+				MSG_WriteDeltaEntity( msg, oldent, newent, qfalse );
+			} else {
+				newent = oldent;	// the client keeps what it has
+			}
+		} else if ( cand->send ) {
+			MSG_WriteDeltaEntity( msg, &sv.svEntities[newnum].baseline, newent, qtrue );
+		} else {
+			continue;			// the client doesn't get it yet
+		}
+
+		if ( state != newent ) {
+			*state = *newent;
+		}
+		kept++;
+	}
+	to->num_entities = kept;
+
+	MSG_WriteBits( msg, (MAX_GENTITIES-1), GENTITYNUM_BITS );	// end of packetentities
+}
+
+
+
+/*
+==================
+SV_WriteLocalSnapshot
+
+Hands the whole snapshot to a loopback client through the local snapshot
+ring, so nothing has to be delta encoded here or decoded on the other end
+==================
+*/
+static void SV_WriteLocalSnapshot( clientSnapshot_t *frame, int snapFlags, msg_t *msg ) {
+	localSnapshot_t	*snap;
+	entityState_t	*entities;
+	int				i;
+
+	snap = NET_AllocLocalSnapshot( frame->num_entities );
+	snap->serverTime = svs.time;
+	snap->snapFlags = snapFlags;
+	snap->areabytes = frame->areabytes;
+	Com_Memcpy( snap->areabits, frame->areabits, frame->areabytes );
+	snap->ps = frame->ps;
+
+	entities = NET_LocalSnapshotEntities( snap );
+	for ( i = 0 ; i < frame->num_entities ; i++ ) {
+		entities[i] = svs.snapshotEntities[( frame->first_entity + i ) % svs.numSnapshotEntities];
+	}
+
+	MSG_WriteByte( msg, svc_localSnapshot );
+	MSG_WriteLong( msg, snap->sequence );
+}
 
 /*
 ==================
@@ -124,12 +449,34 @@ static void SV_WriteSnapshotToClient( client_t *client, msg_t *msg ) {
 	int					lastframe;
 	int					i;
 	int					snapFlags;
+	qboolean			wasLocal;
+	int					budget;
+	msg_t				entityStart;
+	netTraffic_t		*traffic;
+	static netTraffic_t	trafficStart;
 
 	// this is the snapshot we are creating
 	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
 
+	snapFlags = svs.snapFlagServerBit;
+	if ( client->rateDelayed ) {
+		snapFlags |= SNAPFLAG_RATE_DELAYED;
+	}
+	if ( client->state != CS_ACTIVE ) {
+		snapFlags |= SNAPFLAG_NOT_ACTIVE;
+	}
+
+	wasLocal = client->localSnapshots;
+	client->localSnapshots = ( sv_localSnapshots->integer && client->netchan.remoteAddress.type == NA_LOOPBACK
+		&& NET_LocalSnapshotsWanted() ) ? qtrue : qfalse;
+
+	if ( client->localSnapshots ) {
+		SV_WriteLocalSnapshot( frame, snapFlags, msg );
+		return;
+	}
+
 	// try to use a previous frame as the source for delta compressing the snapshot
-	if ( client->deltaMessage <= 0 || client->state != CS_ACTIVE ) {
+	if ( client->deltaMessage <= 0 || client->state != CS_ACTIVE || wasLocal ) {
 		// client is asking for a retransmit
 		oldframe = NULL;
 		lastframe = 0;
@@ -165,14 +512,6 @@ static void SV_WriteSnapshotToClient( client_t *client, msg_t *msg ) {
 	// what we are delta'ing from
 	MSG_WriteByte (msg, lastframe);
 
-	snapFlags = svs.snapFlagServerBit;
-	if ( client->rateDelayed ) {
-		snapFlags |= SNAPFLAG_RATE_DELAYED;
-	}
-	if ( client->state != CS_ACTIVE ) {
-		snapFlags |= SNAPFLAG_NOT_ACTIVE;
-	}
-
 	MSG_WriteByte (msg, snapFlags);
 
 	// send over the areabits
@@ -186,8 +525,25 @@ static void SV_WriteSnapshotToClient( client_t *client, msg_t *msg ) {
 		MSG_WriteDeltaPlayerstate( msg, NULL, &frame->ps );
 	}
 
-	// delta encode the entities
+	// delta encode the entities, and if they come out larger than the rate
+	// allows for a snapshot, start over with the ones that matter most
+	budget = SV_SnapshotBudget( client, msg );
+	entityStart = *msg;
+	traffic = MSG_SetTraffic( NULL );
+	MSG_SetTraffic( traffic );
+	if ( budget && traffic ) {
+		trafficStart = *traffic;
+	}
 	SV_EmitPacketEntities (oldframe, frame, msg);
+	if ( budget && msg->bit - entityStart.bit > budget ) {
+		*msg = entityStart;
+		msg->data[msg->bit >> 3] &= ( 1 << ( msg->bit & 7 ) ) - 1;	// bits are or'd in
+		// the entities that were thrown away never went out
+		if ( traffic ) {
+			*traffic = trafficStart;
+		}
+		SV_EmitBudgetedEntities( client, oldframe, frame, msg, budget );
+	}
 
 	// padding for rate debugging
 	if ( sv_padPackets->integer ) {
@@ -207,6 +563,9 @@ SV_UpdateServerCommandsToClient
 */
 void SV_UpdateServerCommandsToClient( client_t *client, msg_t *msg ) {
 	int		i;
+	int		start;
+
+	start = msg->bit;
 
 	// write any unacknowledged serverCommands
 	for ( i = client->reliableAcknowledge + 1 ; i <= client->reliableSequence ; i++ ) {
@@ -215,6 +574,11 @@ void SV_UpdateServerCommandsToClient( client_t *client, msg_t *msg ) {
 		MSG_WriteString( msg, client->reliableCommands[ i & (MAX_RELIABLE_COMMANDS-1) ] );
 	}
 	client->reliableSent = client->reliableSequence;
+
+	if ( sv_traffic->integer ) {
+		client->traffic.commands += client->reliableSequence - client->reliableAcknowledge;
+		client->traffic.commandBits += msg->bit - start;
+	}
 }
 
 /*
@@ -225,7 +589,6 @@ Build a client snapshot structure
 =============================================================================
 */
 
-#define	MAX_SNAPSHOT_ENTITIES	1024
 typedef struct {
 	int		numSnapshotEntities;
 	int		snapshotEntities[MAX_SNAPSHOT_ENTITIES];	
@@ -517,21 +880,14 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 
 /*
 ====================
-SV_RateMsec
+SV_ClientRate
 
-Return the number of msec a given size message is supposed
-to take to clear, based on the current rate
+Bytes per second the client gets, after sv_maxRate
 ====================
 */
-#define	HEADER_RATE_BYTES	48		// include our header, IP header, and some overhead
-static int SV_RateMsec( client_t *client, int messageSize ) {
+static int SV_ClientRate( client_t *client ) {
 	int		rate;
-	int		rateMsec;
 
-	// individual messages will never be larger than fragment size
-	if ( messageSize > 1500 ) {
-		messageSize = 1500;
-	}
 	rate = client->rate;
 	if ( sv_maxRate->integer ) {
 		if ( sv_maxRate->integer < 1000 ) {
@@ -541,9 +897,99 @@ static int SV_RateMsec( client_t *client, int messageSize ) {
 			rate = sv_maxRate->integer;
 		}
 	}
-	rateMsec = ( messageSize + HEADER_RATE_BYTES ) * 1000 / rate;
+	if ( rate < 1000 ) {
+		rate = 1000;
+	}
+	return rate;
+}
 
-	return rateMsec;
+/*
+====================
+SV_RateCharge
+
+Takes whatever the netchan sent since the last charge out of the budget
+====================
+*/
+static void SV_RateCharge( client_t *client ) {
+	int		bytes, packets;
+
+	bytes = client->netchan.sentBytes - client->rateSentBytes;
+	packets = client->netchan.sentPackets - client->rateSentPackets;
+	client->rateSentBytes = client->netchan.sentBytes;
+	client->rateSentPackets = client->netchan.sentPackets;
+
+	// the netchan starts over on a new connection
+	if ( bytes < 0 || packets < 0 ) {
+		return;
+	}
+	client->rateBytes -= bytes + packets * HEADER_RATE_BYTES;
+}
+
+/*
+====================
+SV_RateFill
+
+Adds what the rate allows for the time since the last fill.  Saving up
+stops at a tenth of a second worth, but at least a full packet, so that
+is as large as a burst can get.
+====================
+*/
+static void SV_RateFill( client_t *client ) {
+	int		rate, depth, msec;
+
+	SV_RateCharge( client );
+
+	rate = SV_ClientRate( client );
+	depth = rate / 10;
+	if ( depth < MAX_PACKETLEN ) {
+		depth = MAX_PACKETLEN;
+	}
+
+	msec = svs.time - client->rateTime;
+	client->rateTime = svs.time;
+	if ( msec <= 0 ) {
+		return;
+	}
+	if ( msec > 1000 ) {
+		msec = 1000;
+	}
+
+	client->rateBytes += rate * msec / 1000;
+	if ( client->rateBytes > depth ) {
+		client->rateBytes = depth;
+	}
+}
+
+/*
+====================
+SV_RateMsec
+
+Return the number of msec until the budget is out of debt
+====================
+*/
+static int SV_RateMsec( client_t *client ) {
+	int		rate;
+
+	if ( client->rateBytes >= 0 ) {
+		return 0;
+	}
+	rate = SV_ClientRate( client );
+	return (int)( ( -(float)client->rateBytes * 1000 + rate - 1 ) / rate );
+}
+
+/*
+====================
+SV_SendFragments
+
+Sends the rest of a fragmented message back to back for as long as the
+budget lasts, and always at least one fragment
+====================
+*/
+static void SV_SendFragments( client_t *client ) {
+	do {
+		SV_Netchan_TransmitNextFragment( client );
+		SV_RateCharge( client );
+	} while ( client->netchan.unsentFragments && client->rateBytes > 0 );
 }
 
 /*
@@ -561,8 +1007,21 @@ void SV_SendMessageToClient( msg_t *msg, client_t *client ) {
 	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSent = svs.time;
 	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageAcked = -1;
 
+	SV_RateFill( client );
+
 	// send the datagram
 	SV_Netchan_Transmit( client, msg );	//msg->cursize, msg->data );
+	SV_RateCharge( client );
+
+	// download blocks are paced by their own bucket, so they don't count
+	// against the client rate
+	client->rateBytes += client->downloadMsgBytes;
+	client->downloadMsgBytes = 0;
+
+	// the rest of a large message follows right away if the rate allows
+	if ( client->netchan.unsentFragments && client->rateBytes > 0 ) {
+		SV_SendFragments( client );
+	}
 
 	// set nextSnapshotTime based on rate and requested number of updates
 
@@ -575,7 +1034,7 @@ void SV_SendMessageToClient( msg_t *msg, client_t *client ) {
 	}
 	
 	// normal rate / snapshotMsec calculation
-	rateMsec = SV_RateMsec( client, msg->cursize );
+	rateMsec = SV_RateMsec( client );
 
 	if ( rateMsec < client->snapshotMsec ) {
 		// never send more packets than this, no matter what the rate is at
@@ -610,9 +1069,12 @@ Also called by SV_FinalMessage
 void SV_SendClientSnapshot( client_t *client ) {
 	byte		msg_buf[MAX_MSGLEN];
 	msg_t		msg;
+	int			phaseStart;
 
 	// build the snapshot
+	phaseStart = SV_ProfileBegin();
 	SV_BuildClientSnapshot( client );
+	SV_ProfileEnd( SVP_BUILD, phaseStart );
 
 	// bots need to have their snapshots build, but
 	// the query them directly without needing to be sent
@@ -620,6 +1082,12 @@ void SV_SendClientSnapshot( client_t *client ) {
 		return;
 	}
 
+	phaseStart = SV_ProfileBegin();
+
+	if ( sv_traffic->integer ) {
+		MSG_SetTraffic( &client->traffic );
+	}
+
 	MSG_Init (&msg, msg_buf, sizeof(msg_buf));
 	msg.allowoverflow = qtrue;
 
@@ -643,7 +1111,17 @@ void SV_SendClientSnapshot( client_t *client ) {
 		MSG_Clear (&msg);
 	}
 
+	if ( sv_traffic->integer ) {
+		MSG_SetTraffic( NULL );
+		client->traffic.messages++;
+		client->traffic.messageBytes += msg.cursize;
+		client->traffic.downloadBytes += client->downloadMsgBytes;
+	}
+	SV_ProfileEnd( SVP_WRITE, phaseStart );
+
+	phaseStart = SV_ProfileBegin();
 	SV_SendMessageToClient( &msg, client );
+	SV_ProfileEnd( SVP_SEND, phaseStart );
 }
 
 
@@ -669,9 +1147,13 @@ void SV_SendClientMessages( void ) {
 		// send additional message fragments if the last message
 		// was too large to send at once
 		if ( c->netchan.unsentFragments ) {
-			c->nextSnapshotTime = svs.time + 
-				SV_RateMsec( c, c->netchan.unsentLength - c->netchan.unsentFragmentStart );
-			SV_Netchan_TransmitNextFragment( c );
+			int		phaseStart;
+
+			phaseStart = SV_ProfileBegin();
+			SV_RateFill( c );
+			SV_SendFragments( c );
+			c->nextSnapshotTime = svs.time + SV_RateMsec( c );
+			SV_ProfileEnd( SVP_SEND, phaseStart );
 			continue;
 		}
 
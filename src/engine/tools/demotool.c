@@ -0,0 +1,887 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// demotool.c -- reads demos without the client, for mining match stats
+
+#include "../../game/q_shared.h"
+#include "../qcommon/qcommon.h"
+#include "../../game/bg_public.h"
+#include <setjmp.h>
+#include <io.h>
+#include <direct.h>
+
+/*
+===============================================================================
+
+demotool [-threads <n>] [-out <dir>] [-nowrite] <demo|directory> ...
+
+Every demo is parsed with msg.c the same way CL_ParseServerMessage does,
+without the renderer, sound or any VM.  The demos are shared out to a
+pool of threads, each of which takes the next demo that nobody has
+started yet.  msg.c and huffman.c keep their bit position and string
+buffers per thread, so they can run side by side.
+
+Each valid snapshot adds a row to the "ps" table and a row per entity
+to the "ent" table.  The tables are written to <demo>.q3dc column by
+column, so a column can be read without touching the rest:
+
+int		magic				DEMOTOOL_MAGIC
+int		version				DEMOTOOL_VERSION
+int		numTables
+for each table:
+	char	name[16]
+	int		numRows
+	int		numColumns
+	for each column:
+		char	name[16]
+		int		type		COLUMN_INT or COLUMN_FLOAT
+	for each column:
+		numRows 32 bit little endian values
+
+The tool has no zone or hunk, so it uses malloc.
+
+===============================================================================
+*/
+
+#define	DEMOTOOL_MAGIC		(('C'<<24)+('D'<<16)+('3'<<8)+'Q')
+#define	DEMOTOOL_VERSION	1
+
+#define	MAX_DEMOS			65536
+#define	MAX_PARSE_ENTITIES	2048		// same as the client
+#define	MAX_TABLE_COLUMNS	24
+
+typedef enum {
+	COLUMN_INT,
+	COLUMN_FLOAT
+} columnType_t;
+
+typedef struct {
+	const char		*name;
+	columnType_t	type;
+} columnDef_t;
+
+typedef union {
+	int		i;
+	float	f;
+} columnValue_t;
+
+typedef struct {
+	const char			*name;
+	int					numColumns;
+	const columnDef_t	*columns;
+	int					numRows;
+	int					maxRows;
+	columnValue_t		*data[MAX_TABLE_COLUMNS];
+} table_t;
+
+static const columnDef_t	psColumns[] = {
+	{ "serverTime", COLUMN_INT },
+	{ "messageNum", COLUMN_INT },
+	{ "clientNum", COLUMN_INT },
+	{ "pm_type", COLUMN_INT },
+	{ "pm_flags", COLUMN_INT },
+	{ "origin_x", COLUMN_FLOAT },
+	{ "origin_y", COLUMN_FLOAT },
+	{ "origin_z", COLUMN_FLOAT },
+	{ "velocity_x", COLUMN_FLOAT },
+	{ "velocity_y", COLUMN_FLOAT },
+	{ "velocity_z", COLUMN_FLOAT },
+	{ "pitch", COLUMN_FLOAT },
+	{ "yaw", COLUMN_FLOAT },
+	{ "weapon", COLUMN_INT },
+	{ "weaponstate", COLUMN_INT },
+	{ "health", COLUMN_INT },
+	{ "armor", COLUMN_INT },
+	{ "score", COLUMN_INT },
+	{ "eFlags", COLUMN_INT },
+	{ "numEntities", COLUMN_INT }
+};
+
+static const columnDef_t	entColumns[] = {
+	{ "serverTime", COLUMN_INT },
+	{ "number", COLUMN_INT },
+	{ "eType", COLUMN_INT },
+	{ "eFlags", COLUMN_INT },
+	{ "trType", COLUMN_INT },
+	{ "origin_x", COLUMN_FLOAT },
+	{ "origin_y", COLUMN_FLOAT },
+	{ "origin_z", COLUMN_FLOAT },
+	{ "yaw", COLUMN_FLOAT },
+	{ "event", COLUMN_INT },
+	{ "eventParm", COLUMN_INT },
+	{ "weapon", COLUMN_INT },
+	{ "clientNum", COLUMN_INT },
+	{ "otherEntityNum", COLUMN_INT },
+	{ "modelindex", COLUMN_INT }
+};
+
+typedef struct {
+	qboolean		valid;
+	int				messageNum;
+	int				serverTime;
+	playerState_t	ps;
+	int				numEntities;
+	int				parseEntitiesNum;
+} demoSnapshot_t;
+
+// everything one thread needs to parse a demo
+typedef struct {
+	const char		*name;
+	int				serverMessageSequence;
+	int				clientNum;
+
+	entityState_t	entityBaselines[MAX_GENTITIES];
+	demoSnapshot_t	snapshots[PACKET_BACKUP];
+	entityState_t	parseEntities[MAX_PARSE_ENTITIES];
+	int				parseEntitiesNum;
+
+	int				numMessages;
+	int				numSnapshots;
+	int				numEntities;
+
+	table_t			ps;
+	table_t			ent;
+
+	byte			msgData[MAX_MSGLEN];
+} demoParse_t;
+
+typedef struct {
+	int				numDemos;
+	char			*demos[MAX_DEMOS];
+	volatile int	nextDemo;
+
+	int				numThreads;
+	char			outDir[MAX_OSPATH];
+	qboolean		noWrite;
+
+	volatile int	demosParsed;
+	volatile int	demosFailed;
+	volatile int	snapshotsParsed;
+	volatile int	kilobytesParsed;
+} demoTool_t;
+
+static demoTool_t	dt;
+
+// msg.c checks it for debug output
+static cvar_t		dt_shownet;
+cvar_t				*cl_shownet = &dt_shownet;
+
+// where Com_Error goes on this thread
+static __declspec( thread ) jmp_buf	*dt_abort;
+static __declspec( thread ) char	dt_error[MAX_STRING_CHARS];
+
+/*
+===============================================================================
+
+ENGINE GLUE
+
+===============================================================================
+*/
+
+void QDECL Com_Printf( const char *fmt, ... ) {
+	va_list		argptr;
+
+	va_start( argptr, fmt );
+	vprintf( fmt, argptr );
+	va_end( argptr );
+}
+
+/*
+==================
+Com_Error
+
+Abandons the demo being parsed on this thread
+==================
+*/
+void QDECL Com_Error( int code, const char *fmt, ... ) {
+	va_list		argptr;
+
+	va_start( argptr, fmt );
+	vsnprintf( dt_error, sizeof( dt_error ), fmt, argptr );
+	va_end( argptr );
+
+	if ( dt_abort ) {
+		longjmp( *dt_abort, 1 );
+	}
+
+	printf( "ERROR: %s\n", dt_error );
+	exit( 1 );
+}
+
+// common.c has the real ones, it isn't linked in
+void Com_Memcpy( void *dest, const void *src, const size_t count ) {
+	memcpy( dest, src, count );
+}
+
+void Com_Memset( void *dest, const int val, const size_t count ) {
+	memset( dest, val, count );
+}
+
+// only MSG_ReportTraffic writes to files, which is never called here
+void QDECL FS_Printf( fileHandle_t f, const char *fmt, ... ) {
+}
+
+// win_shared.c wants it for Sys_DefaultInstallPath
+char *Sys_Cwd( void ) {
+	static char	cwd[MAX_OSPATH];
+
+	_getcwd( cwd, sizeof( cwd ) - 1 );
+	cwd[MAX_OSPATH-1] = 0;
+	return cwd;
+}
+
+/*
+===============================================================================
+
+TABLES
+
+===============================================================================
+*/
+
+/*
+==================
+DT_InitTable
+==================
+*/
+static void DT_InitTable( table_t *table, const char *name, const columnDef_t *columns, int numColumns ) {
+	Com_Memset( table, 0, sizeof( *table ) );
+	table->name = name;
+	table->columns = columns;
+	table->numColumns = numColumns;
+}
+
+/*
+==================
+DT_ClearTable
+==================
+*/
+static void DT_ClearTable( table_t *table ) {
+	table->numRows = 0;
+}
+
+/*
+==================
+DT_AddRow
+
+Returns the new row, the columns grow together
+==================
+*/
+static int DT_AddRow( table_t *table ) {
+	columnValue_t	*data;
+	int				i, maxRows;
+
+	if ( table->numRows == table->maxRows ) {
+		maxRows = table->maxRows ? table->maxRows * 2 : 4096;
+		for ( i = 0 ; i < table->numColumns ; i++ ) {
+			data = (columnValue_t *)realloc( table->data[i], maxRows * sizeof( *data ) );
+			if ( !data ) {
+				Com_Error( ERR_FATAL, "DT_AddRow: out of memory for %i rows", maxRows );
+			}
+			table->data[i] = data;
+		}
+		table->maxRows = maxRows;
+	}
+
+	return table->numRows++;
+}
+
+/*
+==================
+DT_WriteTable
+==================
+*/
+static void DT_WriteTable( FILE *f, const table_t *table ) {
+	char	name[16];
+	int		header[2];
+	int		i;
+
+	Com_Memset( name, 0, sizeof( name ) );
+	Q_strncpyz( name, table->name, sizeof( name ) );
+	fwrite( name, sizeof( name ), 1, f );
+
+	header[0] = LittleLong( table->numRows );
+	header[1] = LittleLong( table->numColumns );
+	fwrite( header, sizeof( header ), 1, f );
+
+	for ( i = 0 ; i < table->numColumns ; i++ ) {
+		Com_Memset( name, 0, sizeof( name ) );
+		Q_strncpyz( name, table->columns[i].name, sizeof( name ) );
+		fwrite( name, sizeof( name ), 1, f );
+		header[0] = LittleLong( table->columns[i].type );
+		fwrite( header, sizeof( header[0] ), 1, f );
+	}
+
+	// x64 windows is little endian, the columns go out as they are
+	for ( i = 0 ; i < table->numColumns ; i++ ) {
+		fwrite( table->data[i], sizeof( columnValue_t ), table->numRows, f );
+	}
+}
+
+/*
+==================
+DT_WriteOutput
+==================
+*/
+static void DT_WriteOutput( demoParse_t *dp ) {
+	char		name[MAX_OSPATH];
+	const char	*base;
+	FILE		*f;
+	int			header[3];
+
+	if ( dt.outDir[0] ) {
+		base = strrchr( dp->name, '/' );
+		if ( !base || strrchr( dp->name, '\\' ) > base ) {
+			base = strrchr( dp->name, '\\' );
+		}
+		base = base ? base + 1 : dp->name;
+		Com_sprintf( name, sizeof( name ), "%s/%s.q3dc", dt.outDir, base );
+	} else {
+		Com_sprintf( name, sizeof( name ), "%s.q3dc", dp->name );
+	}
+
+	f = fopen( name, "wb" );
+	if ( !f ) {
+		Com_Error( ERR_DROP, "couldn't write %s", name );
+	}
+
+	header[0] = LittleLong( DEMOTOOL_MAGIC );
+	header[1] = LittleLong( DEMOTOOL_VERSION );
+	header[2] = LittleLong( 2 );
+	fwrite( header, sizeof( header ), 1, f );
+
+	DT_WriteTable( f, &dp->ps );
+	DT_WriteTable( f, &dp->ent );
+
+	fclose( f );
+}
+
+/*
+===============================================================================
+
+PARSING
+
+The same steps as cl_parse.c, on a demoParse_t instead of cl and clc
+
+===============================================================================
+*/
+
+/*
+==================
+DT_ParseGamestate
+==================
+*/
+static void DT_ParseGamestate( demoParse_t *dp, msg_t *msg ) {
+	entityState_t	nullstate;
+	int				cmd, newnum;
+
+	Com_Memset( dp->entityBaselines, 0, sizeof( dp->entityBaselines ) );
+	Com_Memset( dp->snapshots, 0, sizeof( dp->snapshots ) );
+	dp->parseEntitiesNum = 0;
+
+	MSG_ReadLong( msg );	// server command sequence
+
+	while ( 1 ) {
+		cmd = MSG_ReadByte( msg );
+
+		if ( cmd == svc_EOF ) {
+			break;
+		}
+
+		if ( cmd == svc_configstring ) {
+			MSG_ReadShort( msg );
+			MSG_ReadBigString( msg );
+		} else if ( cmd == svc_baseline ) {
+			newnum = MSG_ReadBits( msg, GENTITYNUM_BITS );
+			if ( newnum < 0 || newnum >= MAX_GENTITIES ) {
+				Com_Error( ERR_DROP, "Baseline number out of range: %i", newnum );
+			}
+			Com_Memset( &nullstate, 0, sizeof( nullstate ) );
+			MSG_ReadDeltaEntity( msg, &nullstate, &dp->entityBaselines[newnum], newnum );
+		} else {
+			Com_Error( ERR_DROP, "DT_ParseGamestate: bad command byte" );
+		}
+	}
+
+	dp->clientNum = MSG_ReadLong( msg );
+	MSG_ReadLong( msg );	// checksum feed
+}
+
+/*
+==================
+DT_DeltaEntity
+==================
+*/
+static void DT_DeltaEntity( demoParse_t *dp, msg_t *msg, demoSnapshot_t *frame, int newnum,
+						   entityState_t *old, qboolean unchanged ) {
+	entityState_t	*state;
+
+	state = &dp->parseEntities[dp->parseEntitiesNum & (MAX_PARSE_ENTITIES-1)];
+
+	if ( unchanged ) {
+		*state = *old;
+	} else {
+		MSG_ReadDeltaEntity( msg, old, state, newnum );
+	}
+
+	if ( state->number == (MAX_GENTITIES-1) ) {
+		return;		// entity was delta removed
+	}
+	dp->parseEntitiesNum++;
+	frame->numEntities++;
+}
+
+/*
+==================
+DT_ParsePacketEntities
+==================
+*/
+static void DT_ParsePacketEntities( demoParse_t *dp, msg_t *msg, demoSnapshot_t *oldframe, demoSnapshot_t *newframe ) {
+	entityState_t	*oldstate;
+	int				oldindex, oldnum, newnum;
+
+	newframe->parseEntitiesNum = dp->parseEntitiesNum;
+	newframe->numEntities = 0;
+
+	oldindex = 0;
+	oldstate = NULL;
+	if ( !oldframe || !oldframe->numEntities ) {
+		oldnum = 99999;
+	} else {
+		oldstate = &dp->parseEntities[oldframe->parseEntitiesNum & (MAX_PARSE_ENTITIES-1)];
+		oldnum = oldstate->number;
+	}
+
+	while ( 1 ) {
+		newnum = MSG_ReadBits( msg, GENTITYNUM_BITS );
+		if ( newnum == (MAX_GENTITIES-1) ) {
+			break;
+		}
+		if ( msg->readcount > msg->cursize ) {
+			Com_Error( ERR_DROP, "DT_ParsePacketEntities: end of message" );
+		}
+
+		while ( oldnum <= newnum ) {
+			// unchanged ones first, then the delta from the old state
+			DT_DeltaEntity( dp, msg, newframe, oldnum, oldstate, oldnum < newnum ? qtrue : qfalse );
+			if ( oldnum == newnum ) {
+				newnum = -1;
+			}
+
+			oldindex++;
+			if ( oldindex >= oldframe->numEntities ) {
+				oldnum = 99999;
+			} else {
+				oldstate = &dp->parseEntities[(oldframe->parseEntitiesNum + oldindex) & (MAX_PARSE_ENTITIES-1)];
+				oldnum = oldstate->number;
+			}
+		}
+
+		if ( newnum >= 0 ) {
+			// new from the baseline
+			DT_DeltaEntity( dp, msg, newframe, newnum, &dp->entityBaselines[newnum], qfalse );
+		}
+	}
+
+	// any remaining entities in the old frame are copied over
+	while ( oldnum != 99999 ) {
+		DT_DeltaEntity( dp, msg, newframe, oldnum, oldstate, qtrue );
+
+		oldindex++;
+		if ( oldindex >= oldframe->numEntities ) {
+			oldnum = 99999;
+		} else {
+			oldstate = &dp->parseEntities[(oldframe->parseEntitiesNum + oldindex) & (MAX_PARSE_ENTITIES-1)];
+			oldnum = oldstate->number;
+		}
+	}
+}
+
+/*
+==================
+DT_AddSnapshotRows
+==================
+*/
+static void DT_AddSnapshotRows( demoParse_t *dp, const demoSnapshot_t *snap ) {
+	const playerState_t	*ps;
+	const entityState_t	*es;
+	columnValue_t		**c;
+	int					row, i;
+
+	ps = &snap->ps;
+	row = DT_AddRow( &dp->ps );
+	c = dp->ps.data;
+	c[0][row].i = snap->serverTime;
+	c[1][row].i = snap->messageNum;
+	c[2][row].i = ps->clientNum;
+	c[3][row].i = ps->pm_type;
+	c[4][row].i = ps->pm_flags;
+	c[5][row].f = ps->origin[0];
+	c[6][row].f = ps->origin[1];
+	c[7][row].f = ps->origin[2];
+	c[8][row].f = ps->velocity[0];
+	c[9][row].f = ps->velocity[1];
+	c[10][row].f = ps->velocity[2];
+	c[11][row].f = ps->viewangles[PITCH];
+	c[12][row].f = ps->viewangles[YAW];
+	c[13][row].i = ps->weapon;
+	c[14][row].i = ps->weaponstate;
+	c[15][row].i = ps->stats[STAT_HEALTH];
+	c[16][row].i = ps->stats[STAT_ARMOR];
+	c[17][row].i = ps->persistant[PERS_SCORE];
+	c[18][row].i = ps->eFlags;
+	c[19][row].i = snap->numEntities;
+
+	c = dp->ent.data;
+	for ( i = 0 ; i < snap->numEntities ; i++ ) {
+		es = &dp->parseEntities[(snap->parseEntitiesNum + i) & (MAX_PARSE_ENTITIES-1)];
+		row = DT_AddRow( &dp->ent );
+		c[0][row].i = snap->serverTime;
+		c[1][row].i = es->number;
+		c[2][row].i = es->eType;
+		c[3][row].i = es->eFlags;
+		c[4][row].i = es->pos.trType;
+		c[5][row].f = es->pos.trBase[0];
+		c[6][row].f = es->pos.trBase[1];
+		c[7][row].f = es->pos.trBase[2];
+		c[8][row].f = es->apos.trBase[YAW];
+		c[9][row].i = es->event & ~EV_EVENT_BITS;
+		c[10][row].i = es->eventParm;
+		c[11][row].i = es->weapon;
+		c[12][row].i = es->clientNum;
+		c[13][row].i = es->otherEntityNum;
+		c[14][row].i = es->modelindex;
+	}
+
+	dp->numEntities += snap->numEntities;
+}
+
+/*
+==================
+DT_ParseSnapshot
+==================
+*/
+static void DT_ParseSnapshot( demoParse_t *dp, msg_t *msg ) {
+	demoSnapshot_t	newSnap;
+	demoSnapshot_t	*old;
+	byte			areamask[MAX_MAP_AREA_BYTES];
+	int				deltaNum, len;
+
+	Com_Memset( &newSnap, 0, sizeof( newSnap ) );
+
+	newSnap.serverTime = MSG_ReadLong( msg );
+	newSnap.messageNum = dp->serverMessageSequence;
+
+	deltaNum = MSG_ReadByte( msg );
+	MSG_ReadByte( msg );	// snapFlags
+
+	old = NULL;
+	if ( !deltaNum ) {
+		newSnap.valid = qtrue;
+	} else {
+		deltaNum = newSnap.messageNum - deltaNum;
+		old = &dp->snapshots[deltaNum & PACKET_MASK];
+		if ( old->valid && old->messageNum == deltaNum
+			&& dp->parseEntitiesNum - old->parseEntitiesNum <= MAX_PARSE_ENTITIES-128 ) {
+			newSnap.valid = qtrue;
+		}
+	}
+
+	len = MSG_ReadByte( msg );
+	if ( len > (int)sizeof( areamask ) ) {
+		Com_Error( ERR_DROP, "DT_ParseSnapshot: Invalid size %d for areamask", len );
+	}
+	MSG_ReadData( msg, areamask, len );
+
+	MSG_ReadDeltaPlayerstate( msg, old ? &old->ps : NULL, &newSnap.ps );
+	DT_ParsePacketEntities( dp, msg, old, &newSnap );
+
+	if ( !newSnap.valid ) {
+		return;
+	}
+
+	dp->snapshots[newSnap.messageNum & PACKET_MASK] = newSnap;
+	dp->numSnapshots++;
+
+	DT_AddSnapshotRows( dp, &newSnap );
+}
+
+/*
+==================
+DT_ParseServerMessage
+==================
+*/
+static void DT_ParseServerMessage( demoParse_t *dp, msg_t *msg ) {
+	int		cmd;
+
+	MSG_Bitstream( msg );
+	MSG_ReadLong( msg );	// reliable acknowledge
+
+	while ( 1 ) {
+		if ( msg->readcount > msg->cursize ) {
+			Com_Error( ERR_DROP, "DT_ParseServerMessage: read past end of server message" );
+		}
+
+		cmd = MSG_ReadByte( msg );
+		if ( cmd == svc_EOF ) {
+			break;
+		}
+
+		switch ( cmd ) {
+		default:
+			Com_Error( ERR_DROP, "DT_ParseServerMessage: Illegible server message %i", cmd );
+			break;
+		case svc_nop:
+			break;
+		case svc_serverCommand:
+			MSG_ReadLong( msg );
+			MSG_ReadString( msg );
+			break;
+		case svc_gamestate:
+			DT_ParseGamestate( dp, msg );
+			break;
+		case svc_snapshot:
+			DT_ParseSnapshot( dp, msg );
+			break;
+		}
+	}
+}
+
+/*
+==================
+DT_ParseDemo
+
+Reads messages up to the end marker, anything after it is keyframes
+==================
+*/
+static void DT_ParseDemo( demoParse_t *dp, const byte *data, int length ) {
+	msg_t	buf;
+	int		pos, len;
+
+	pos = 0;
+	while ( pos + 8 <= length ) {
+		dp->serverMessageSequence = LittleLong( *(const int *)( data + pos ) );
+		len = LittleLong( *(const int *)( data + pos + 4 ) );
+		pos += 8;
+
+		if ( len == -1 ) {
+			return;
+		}
+		if ( len < 0 || len > MAX_MSGLEN ) {
+			Com_Error( ERR_DROP, "demoMsglen %i > MAX_MSGLEN", len );
+		}
+		if ( pos + len > length ) {
+			Com_Printf( "%s: demo file was truncated.\n", dp->name );
+			return;
+		}
+
+		// the huffman reader may look a byte past the end
+		MSG_Init( &buf, dp->msgData, sizeof( dp->msgData ) );
+		Com_Memcpy( dp->msgData, data + pos, len );
+		buf.cursize = len;
+		pos += len;
+
+		DT_ParseServerMessage( dp, &buf );
+		dp->numMessages++;
+	}
+}
+
+/*
+===============================================================================
+
+THREADS
+
+===============================================================================
+*/
+
+/*
+==================
+DT_Worker
+
+Takes demos until there are none left
+==================
+*/
+static void DT_Worker( void *arg ) {
+	demoParse_t		*dp;
+	jmp_buf			jump;
+	const byte		*data;
+	int				index, length;
+
+	dp = (demoParse_t *)malloc( sizeof( *dp ) );
+	if ( !dp ) {
+		printf( "ERROR: couldn't allocate a demo parser\n" );
+		return;
+	}
+	DT_InitTable( &dp->ps, "ps", psColumns, (int)ARRAY_LEN( psColumns ) );
+	DT_InitTable( &dp->ent, "ent", entColumns, (int)ARRAY_LEN( entColumns ) );
+
+	while ( 1 ) {
+		index = Sys_AtomicAdd( &dt.nextDemo, 1 ) - 1;
+		if ( index >= dt.numDemos ) {
+			break;
+		}
+
+		dp->name = dt.demos[index];
+		dp->serverMessageSequence = 0;
+		dp->numMessages = 0;
+		dp->numSnapshots = 0;
+		dp->numEntities = 0;
+		DT_ClearTable( &dp->ps );
+		DT_ClearTable( &dp->ent );
+
+		data = (const byte *)Sys_MapFile( dp->name, &length );
+		if ( !data ) {
+			printf( "%s: couldn't open\n", dp->name );
+			Sys_AtomicAdd( &dt.demosFailed, 1 );
+			continue;
+		}
+
+		dt_abort = &jump;
+		if ( setjmp( jump ) ) {
+			printf( "%s: %s\n", dp->name, dt_error );
+			Sys_AtomicAdd( &dt.demosFailed, 1 );
+		} else {
+			DT_ParseDemo( dp, data, length );
+			if ( !dt.noWrite ) {
+				DT_WriteOutput( dp );
+			}
+			Sys_AtomicAdd( &dt.demosParsed, 1 );
+			Sys_AtomicAdd( &dt.snapshotsParsed, dp->numSnapshots );
+		}
+		dt_abort = NULL;
+
+		Sys_AtomicAdd( &dt.kilobytesParsed, length >> 10 );
+		Sys_UnmapFile( data );
+	}
+
+	// the tables' columns are freed with the process
+	free( dp );
+}
+
+/*
+==================
+DT_AddDemo
+
+A directory adds every demo in it
+==================
+*/
+static void DT_AddDemo( const char *path ) {
+	struct _finddata_t	find;
+	intptr_t			handle;
+	char				pattern[MAX_OSPATH];
+	char				name[MAX_OSPATH];
+	int					len;
+
+	handle = -1;
+	if ( !strstr( path, ".dm_" ) ) {
+		Com_sprintf( pattern, sizeof( pattern ), "%s/*.dm_*", path );
+		handle = _findfirst( pattern, &find );
+	}
+
+	if ( handle == -1 ) {
+		if ( dt.numDemos == MAX_DEMOS ) {
+			Com_Error( ERR_FATAL, "more than %i demos", MAX_DEMOS );
+		}
+		dt.demos[dt.numDemos++] = _strdup( path );
+		return;
+	}
+
+	do {
+		// skip our own output
+		len = (int)strlen( find.name );
+		if ( len > 5 && !Q_stricmp( find.name + len - 5, ".q3dc" ) ) {
+			continue;
+		}
+		if ( dt.numDemos == MAX_DEMOS ) {
+			Com_Error( ERR_FATAL, "more than %i demos", MAX_DEMOS );
+		}
+		Com_sprintf( name, sizeof( name ), "%s/%s", path, find.name );
+		dt.demos[dt.numDemos++] = _strdup( name );
+	} while ( _findnext( handle, &find ) == 0 );
+
+	_findclose( handle );
+}
+
+/*
+==================
+main
+==================
+*/
+int main( int argc, char **argv ) {
+	void	*threads[MAX_JOB_THREADS];
+	msg_t	dummy;
+	byte	dummyData[1];
+	int		i, start, msec;
+	float	seconds;
+
+	dt.numThreads = (int)Sys_ProcessorCount();
+
+	for ( i = 1 ; i < argc ; i++ ) {
+		if ( !Q_stricmp( argv[i], "-threads" ) && i + 1 < argc ) {
+			dt.numThreads = atoi( argv[++i] );
+		} else if ( !Q_stricmp( argv[i], "-out" ) && i + 1 < argc ) {
+			Q_strncpyz( dt.outDir, argv[++i], sizeof( dt.outDir ) );
+		} else if ( !Q_stricmp( argv[i], "-nowrite" ) ) {
+			dt.noWrite = qtrue;
+		} else {
+			DT_AddDemo( argv[i] );
+		}
+	}
+
+	if ( !dt.numDemos ) {
+		printf( "demotool [-threads <n>] [-out <dir>] [-nowrite] <demo|directory> ...\n" );
+		return 1;
+	}
+	dt.numThreads = (int)Com_Clamp( 1, MAX_JOB_THREADS, dt.numThreads );
+	if ( dt.numThreads > dt.numDemos ) {
+		dt.numThreads = dt.numDemos;
+	}
+
+	// build the huffman tree before anyone reads with it
+	MSG_Init( &dummy, dummyData, sizeof( dummyData ) );
+
+	start = Sys_Milliseconds();
+
+	// the main thread is one of the workers
+	for ( i = 1 ; i < dt.numThreads ; i++ ) {
+		threads[i] = Sys_CreateThread( DT_Worker, NULL );
+		if ( !threads[i] ) {
+			printf( "WARNING: couldn't create thread %i\n", i );
+		}
+	}
+	DT_Worker( NULL );
+	for ( i = 1 ; i < dt.numThreads ; i++ ) {
+		if ( threads[i] ) {
+			Sys_JoinThread( threads[i] );
+		}
+	}
+
+	msec = Sys_Milliseconds() - start;
+	seconds = ( msec > 0 ? msec : 1 ) * 0.001f;
+
+	printf( "%i demos, %i failed, %i snapshots, %.1f MB on %i threads in %.3f seconds\n",
+		dt.demosParsed + dt.demosFailed, dt.demosFailed, dt.snapshotsParsed,
+		dt.kilobytesParsed / 1024.0f, dt.numThreads, seconds );
+	printf( "%.1f demos/s, %.1f MB/s, %.0f snapshots/s\n",
+		( dt.demosParsed + dt.demosFailed ) / seconds, dt.kilobytesParsed / 1024.0f / seconds,
+		dt.snapshotsParsed / seconds );
+
+	return dt.demosFailed ? 1 : 0;
+}
@@ -202,6 +202,9 @@ typedef struct botlib_import_s
 	//
 	int			(*DebugPolygonCreate)(int color, int numPoints, vec3_t *points);
 	void		(*DebugPolygonDelete)(int id);
+	//instrumentation zones, NULL when the engine is built without them
+	void		(*ProfileBegin)(const char *name);
+	void		(*ProfileEnd)(void);
 } botlib_import_t;
 
 typedef struct aas_export_s
@@ -568,6 +568,14 @@ qboolean G_FilterPacket (char *from);
 //
 void FireWeapon( gentity_t *ent );
 
+//
+// g_unlagged.c
+//
+void G_ResetHistory( void );
+void G_StoreHistory( void );
+void G_RewindClients( gentity_t *shooter );
+void G_RestoreClients( void );
+
 //
 // p_hud.c
 //
@@ -725,6 +733,8 @@ extern	vmCvar_t	g_cubeTimeout;
 extern	vmCvar_t	g_redteam;
 extern	vmCvar_t	g_blueteam;
 extern	vmCvar_t	g_smoothClients;
+extern	vmCvar_t	g_unlagged;
+extern	vmCvar_t	g_unlaggedMaxMsec;
 extern	vmCvar_t	pmove_fixed;
 extern	vmCvar_t	pmove_msec;
 extern	vmCvar_t	g_rankings;
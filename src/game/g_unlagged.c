@@ -0,0 +1,251 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// g_unlagged.c -- hitscan lag compensation
+
+#include "g_local.h"
+
+/*
+===============================================================================
+
+At the end of every G_RunFrame the position and bounds of every client
+are stored in a ring of frames.  The frames all share one time, so the
+arrays are laid out by frame and then by client, and a rewind only has
+to find its place in time once for everyone.
+
+Before a hitscan weapon traces, everyone but the shooter is moved back
+to where they were at the shooter's command time, which is what the
+shooter was looking at, and put back afterwards.
+
+===============================================================================
+*/
+
+#define	MAX_HISTORY_FRAMES	32		// must be a power of two
+#define	HISTORY_MASK		( MAX_HISTORY_FRAMES - 1 )
+
+typedef struct {
+	int			numFrames;
+	int			head;				// next frame to be written
+	int			time[MAX_HISTORY_FRAMES];
+	byte		valid[MAX_HISTORY_FRAMES][MAX_CLIENTS];
+	byte		teleport[MAX_HISTORY_FRAMES][MAX_CLIENTS];	// EF_TELEPORT_BIT when stored
+	vec3_t		origin[MAX_HISTORY_FRAMES][MAX_CLIENTS];
+	vec3_t		mins[MAX_HISTORY_FRAMES][MAX_CLIENTS];
+	vec3_t		maxs[MAX_HISTORY_FRAMES][MAX_CLIENTS];
+} clientHistory_t;
+
+// what the rewound clients have to be put back to
+typedef struct {
+	qboolean	active;
+	byte		moved[MAX_CLIENTS];
+	vec3_t		origin[MAX_CLIENTS];
+	vec3_t		mins[MAX_CLIENTS];
+	vec3_t		maxs[MAX_CLIENTS];
+	vec3_t		rewoundOrigin[MAX_CLIENTS];
+	vec3_t		rewoundMins[MAX_CLIENTS];
+	vec3_t		rewoundMaxs[MAX_CLIENTS];
+} clientRewind_t;
+
+static clientHistory_t	history;
+static clientRewind_t	unlag;
+
+/*
+================
+G_ResetHistory
+
+Called when the level starts
+================
+*/
+void G_ResetHistory( void ) {
+	history.numFrames = 0;
+	history.head = 0;
+	unlag.active = qfalse;
+}
+
+/*
+================
+G_StoreHistory
+
+Called at the end of every G_RunFrame
+================
+*/
+void G_StoreHistory( void ) {
+	gentity_t	*ent;
+	int			frame, i;
+
+	frame = history.head;
+	history.head = ( history.head + 1 ) & HISTORY_MASK;
+	if ( history.numFrames < MAX_HISTORY_FRAMES ) {
+		history.numFrames++;
+	}
+
+	history.time[frame] = level.time;
+
+	for ( i = 0, ent = g_entities ; i < level.maxclients ; i++, ent++ ) {
+		if ( !ent->inuse || !ent->client || !ent->r.linked
+			|| ent->client->pers.connected != CON_CONNECTED
+			|| ent->client->sess.sessionTeam == TEAM_SPECTATOR ) {
+			history.valid[frame][i] = qfalse;
+			continue;
+		}
+
+		history.valid[frame][i] = qtrue;
+		history.teleport[frame][i] = ( ent->client->ps.eFlags & EF_TELEPORT_BIT ) ? 1 : 0;
+		VectorCopy( ent->r.currentOrigin, history.origin[frame][i] );
+		VectorCopy( ent->r.mins, history.mins[frame][i] );
+		VectorCopy( ent->r.maxs, history.maxs[frame][i] );
+	}
+}
+
+/*
+================
+G_RewindClients
+
+Moves everyone but the shooter back to the shooter's command time
+================
+*/
+void G_RewindClients( gentity_t *shooter ) {
+	gentity_t	*ent;
+	int			time, olderTime;
+	int			newest, newer, older, n, i;
+	float		frac;
+	vec3_t		delta;
+
+	unlag.active = qfalse;
+
+	if ( !g_unlagged.integer || !shooter->client || history.numFrames < 2 ) {
+		return;
+	}
+	if ( shooter->r.svFlags & SVF_BOT ) {
+		return;		// bots aim at where things are
+	}
+
+	time = shooter->client->pers.cmd.serverTime;
+	if ( time >= level.time ) {
+		return;
+	}
+	if ( time < level.time - g_unlaggedMaxMsec.integer ) {
+		time = level.time - g_unlaggedMaxMsec.integer;
+	}
+
+	// walk back from the latest frame to the pair around the time
+	newest = newer = ( history.head - 1 ) & HISTORY_MASK;
+	if ( time >= history.time[newer] ) {
+		return;		// newer than anything stored, nothing to rewind
+	}
+	older = newer;
+	for ( n = 1 ; n < history.numFrames ; n++ ) {
+		older = ( newer - 1 ) & HISTORY_MASK;
+		if ( history.time[older] <= time ) {
+			break;
+		}
+		newer = older;
+	}
+	olderTime = history.time[older];
+	if ( time < olderTime ) {
+		time = olderTime;		// not kept that far back
+	}
+
+	if ( history.time[newer] > olderTime ) {
+		frac = (float)( time - olderTime ) / ( history.time[newer] - olderTime );
+	} else {
+		frac = 0;
+	}
+
+	for ( i = 0, ent = g_entities ; i < level.maxclients ; i++, ent++ ) {
+		unlag.moved[i] = qfalse;
+
+		if ( ent == shooter || !ent->inuse || !ent->client || !ent->r.linked ) {
+			continue;
+		}
+		if ( !history.valid[older][i] || !history.valid[newer][i] ) {
+			continue;
+		}
+		if ( history.teleport[newest][i] != ( ( ent->client->ps.eFlags & EF_TELEPORT_BIT ) ? 1 : 0 ) ) {
+			continue;	// teleported since the last frame was stored, the history is all on the other side
+		}
+
+		VectorCopy( ent->r.currentOrigin, unlag.origin[i] );
+		VectorCopy( ent->r.mins, unlag.mins[i] );
+		VectorCopy( ent->r.maxs, unlag.maxs[i] );
+
+		if ( history.teleport[older][i] != history.teleport[newer][i] ) {
+			// don't drag them along the teleport, take the closer side
+			n = frac < 0.5f ? older : newer;
+			VectorCopy( history.origin[n][i], ent->r.currentOrigin );
+			VectorCopy( history.mins[n][i], ent->r.mins );
+			VectorCopy( history.maxs[n][i], ent->r.maxs );
+		} else {
+			VectorSubtract( history.origin[newer][i], history.origin[older][i], delta );
+			VectorMA( history.origin[older][i], frac, delta, ent->r.currentOrigin );
+			// bounds only change with crouching and dying, no use blending them
+			VectorCopy( history.mins[newer][i], ent->r.mins );
+			VectorCopy( history.maxs[newer][i], ent->r.maxs );
+		}
+
+		VectorCopy( ent->r.currentOrigin, unlag.rewoundOrigin[i] );
+		VectorCopy( ent->r.mins, unlag.rewoundMins[i] );
+		VectorCopy( ent->r.maxs, unlag.rewoundMaxs[i] );
+		unlag.moved[i] = qtrue;
+
+		trap_LinkEntity( ent );
+	}
+
+	unlag.active = qtrue;
+}
+
+/*
+================
+G_RestoreClients
+
+Puts back everyone G_RewindClients moved.  Anything the shot itself
+changed, like the bounds of someone it killed, is left alone.
+================
+*/
+void G_RestoreClients( void ) {
+	gentity_t	*ent;
+	int			i;
+
+	if ( !unlag.active ) {
+		return;
+	}
+	unlag.active = qfalse;
+
+	for ( i = 0, ent = g_entities ; i < level.maxclients ; i++, ent++ ) {
+		if ( !unlag.moved[i] ) {
+			continue;
+		}
+
+		if ( VectorCompare( ent->r.currentOrigin, unlag.rewoundOrigin[i] ) ) {
+			VectorCopy( unlag.origin[i], ent->r.currentOrigin );
+		}
+		if ( VectorCompare( ent->r.mins, unlag.rewoundMins[i] ) ) {
+			VectorCopy( unlag.mins[i], ent->r.mins );
+		}
+		if ( VectorCompare( ent->r.maxs, unlag.rewoundMaxs[i] ) ) {
+			VectorCopy( unlag.maxs[i], ent->r.maxs );
+		}
+
+		if ( ent->r.linked ) {
+			trap_LinkEntity( ent );
+		}
+	}
+}
@@ -654,6 +654,18 @@ void FireWeapon( gentity_t *ent ) {
 
 	CalcMuzzlePointOrigin ( ent, ent->client->oldOrigin, forward, right, up, muzzle );
 
+	// instant hit weapons trace against where the shooter saw everyone
+	switch( ent->s.weapon ) {
+	case WP_LIGHTNING:
+	case WP_SHOTGUN:
+	case WP_MACHINEGUN:
+	case WP_RAILGUN:
+		G_RewindClients( ent );
+		break;
+	default:
+		break;
+	}
+
 	// fire the specific weapon
 	switch( ent->s.weapon ) {
 	case WP_GAUNTLET:
@@ -694,4 +706,6 @@ void FireWeapon( gentity_t *ent ) {
 // FIXME		G_Error( "Bad ent->s.weapon" );
 		break;
 	}
+
+	G_RestoreClients();
 }
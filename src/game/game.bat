@@ -76,6 +76,8 @@ set cc=lcc -DQ3_VM -S -Wf-target=bytecode -Wf-g -I%src%\cgame -I%src%\game -I%sr
 @if errorlevel 1 goto quit
 %cc%  %src%/game/g_trigger.c
 @if errorlevel 1 goto quit
+%cc%  %src%/game/g_unlagged.c
+@if errorlevel 1 goto quit
 %cc%  %src%/game/g_utils.c
 @if errorlevel 1 goto quit
 %cc%  %src%/game/g_weapon.c